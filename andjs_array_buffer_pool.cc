@@ -0,0 +1,176 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_array_buffer_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/bits.h"
+
+#include "andjs/andjs_stats.h"
+
+namespace andjs {
+
+namespace {
+
+const int kMinPooledShift = 6;
+
+// Size class of a buffer of |length| bytes, -1 when it isn't pooled.
+int SizeClassOf(size_t length) {
+  if(length == 0 || length > ArrayBufferPool::kMaxPooledSize)
+    return -1;
+  int shift = base::bits::Log2Ceiling(static_cast<uint32_t>(length));
+  return shift > kMinPooledShift ? shift - kMinPooledShift : 0;
+}
+
+size_t BlockSizeOf(int size_class) {
+  return ArrayBufferPool::kMinPooledSize << size_class;
+}
+
+}
+
+const size_t ArrayBufferPool::kMinPooledSize = 1 << kMinPooledShift;
+const size_t ArrayBufferPool::kMaxPooledSize = 64 * 1024;
+const size_t ArrayBufferPool::kMaxCachedBytes = 128 * 1024;
+
+// static
+ArrayBufferPool* ArrayBufferPool::GetInstance() {
+  static base::NoDestructor<ArrayBufferPool> instance;
+  return instance.get();
+}
+
+ArrayBufferPool::ArrayBufferPool()
+    : free_lists_(SizeClassOf(kMaxPooledSize) + 1, nullptr),
+      free_list_bytes_(free_lists_.size(), 0),
+      live_bytes_(0),
+      cached_bytes_(0) {
+}
+
+ArrayBufferPool::~ArrayBufferPool() = default;
+
+void ArrayBufferPool::AddIsolate(v8::Isolate* isolate, AndJSStats* stats) {
+  base::AutoLock locker(lock_);
+  isolates_[isolate] = stats;
+}
+
+void ArrayBufferPool::RemoveIsolate(v8::Isolate* isolate) {
+  base::AutoLock locker(lock_);
+  isolates_.erase(isolate);
+}
+
+void ArrayBufferPool::Trim() {
+  base::AutoLock locker(lock_);
+  for(size_t i = 0; i < free_lists_.size(); i++) {
+    while(FreeBlock* block = free_lists_[i]) {
+      free_lists_[i] = block->next;
+      free(block);
+    }
+    free_list_bytes_[i] = 0;
+  }
+  cached_bytes_ = 0;
+}
+
+size_t ArrayBufferPool::live_bytes() {
+  base::AutoLock locker(lock_);
+  return live_bytes_;
+}
+
+size_t ArrayBufferPool::cached_bytes() {
+  base::AutoLock locker(lock_);
+  return cached_bytes_;
+}
+
+void* ArrayBufferPool::Allocate(size_t length) {
+  return AllocateBlock(length, true);
+}
+
+void* ArrayBufferPool::AllocateUninitialized(size_t length) {
+  return AllocateBlock(length, false);
+}
+
+// V8 passes the length it allocated with, that is the size class.
+void ArrayBufferPool::Free(void* data, size_t length) {
+  if(!data)
+    return;
+  int size_class = SizeClassOf(length);
+  base::AutoLock locker(lock_);
+  if(size_class < 0) {
+    live_bytes_ -= length;
+    free(data);
+    return;
+  }
+  size_t size = BlockSizeOf(size_class);
+  live_bytes_ -= size;
+  if(free_list_bytes_[size_class] + size > kMaxCachedBytes) {
+    free(data);
+    return;
+  }
+  FreeBlock* block = static_cast<FreeBlock*>(data);
+  block->next = free_lists_[size_class];
+  free_lists_[size_class] = block;
+  free_list_bytes_[size_class] += size;
+  cached_bytes_ += size;
+}
+
+// Allocations run while the isolate asking for them is entered, that is
+// how they are counted per instance.
+void* ArrayBufferPool::AllocateBlock(size_t length, bool zero) {
+  int size_class = SizeClassOf(length);
+  size_t size = size_class < 0 ? length : BlockSizeOf(size_class);
+  void* data = nullptr;
+  AndJSStats* stats = nullptr;
+  {
+    base::AutoLock locker(lock_);
+    if(size_class >= 0 && free_lists_[size_class]) {
+      FreeBlock* block = free_lists_[size_class];
+      free_lists_[size_class] = block->next;
+      free_list_bytes_[size_class] -= size;
+      cached_bytes_ -= size;
+      data = block;
+    }
+    live_bytes_ += size;
+    auto it = isolates_.find(v8::Isolate::GetCurrent());
+    if(it != isolates_.end())
+      stats = it->second;
+  }
+
+  bool pooled = data != nullptr;
+  if(pooled) {
+    if(zero)
+      memset(data, 0, length);
+  } else {
+    data = zero ? calloc(1, size) : malloc(size);
+    if(!data) {
+      base::AutoLock locker(lock_);
+      live_bytes_ -= size;
+      return nullptr;
+    }
+  }
+  if(stats) {
+    AndJSStats::Add(&stats->array_buffer_allocs, 1);
+    AndJSStats::Add(&stats->array_buffer_bytes, length);
+    if(pooled)
+      AndJSStats::Add(&stats->array_buffer_pool_hits, 1);
+  }
+  return data;
+}
+
+}
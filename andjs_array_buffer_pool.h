@@ -0,0 +1,97 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_ARRAY_BUFFER_POOL_H__
+#define __ANDJS_ARRAY_BUFFER_POOL_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/no_destructor.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+#include "v8/include/v8.h"
+
+namespace andjs {
+
+struct AndJSStats;
+
+// The v8::ArrayBuffer::Allocator of every isolate, in place of
+// gin::ArrayBufferAllocator. gin takes one allocator for the process, so
+// the pool is shared by all instances and workers.
+//
+// Buffers of up to kMaxPooledSize get a block of the next power of two
+// from kMinPooledSize up. A freed block is kept for the next buffer of its
+// size class, up to kMaxCachedBytes per class, instead of going back to
+// malloc(). Blocks are plain malloc() memory, but they must go back
+// through Free() with their length, memory that did not come from here
+// must not. Any thread, V8 frees buffers on its background threads.
+class ArrayBufferPool : public v8::ArrayBuffer::Allocator {
+  public:
+    static const size_t kMinPooledSize;
+    static const size_t kMaxPooledSize;
+    static const size_t kMaxCachedBytes;
+
+    static ArrayBufferPool* GetInstance();
+
+    // Buffers allocated while |isolate| is entered are counted in |stats|.
+    void AddIsolate(v8::Isolate* isolate, AndJSStats* stats);
+    void RemoveIsolate(v8::Isolate* isolate);
+
+    // Gives the cached blocks back, on memory pressure.
+    void Trim();
+
+    // Bytes of the buffers alive right now, and of the blocks kept for
+    // reuse. Process wide.
+    size_t live_bytes();
+    size_t cached_bytes();
+
+    // v8::ArrayBuffer::Allocator:
+    void* Allocate(size_t length) override;
+    void* AllocateUninitialized(size_t length) override;
+    void Free(void* data, size_t length) override;
+
+  private:
+    friend class base::NoDestructor<ArrayBufferPool>;
+
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+
+    ArrayBufferPool();
+    ~ArrayBufferPool() override;
+
+    void* AllocateBlock(size_t length, bool zero);
+
+    base::Lock lock_;
+    std::map<v8::Isolate*, AndJSStats*> isolates_ GUARDED_BY(lock_);
+    std::vector<FreeBlock*> free_lists_ GUARDED_BY(lock_);
+    std::vector<size_t> free_list_bytes_ GUARDED_BY(lock_);
+    size_t live_bytes_ GUARDED_BY(lock_);
+    size_t cached_bytes_ GUARDED_BY(lock_);
+
+    DISALLOW_COPY_AND_ASSIGN(ArrayBufferPool);
+};
+
+}
+#endif
@@ -0,0 +1,261 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_bindings.h"
+
+#include "base/android/jni_array.h"
+#include "base/android/jni_string.h"
+#include "base/logging.h"
+#include "base/trace_event/trace_event.h"
+#include "content/browser/android/java/jni_reflect.h"
+
+#include "andjs/andjs_logger.h"
+#include "andjs/andjs_stats.h"
+#include "jni/AndJSBindings_jni.h"
+
+using base::android::JavaParamRef;
+using base::android::ScopedJavaLocalRef;
+
+namespace andjs {
+
+const char kJavaExceptionRaised[] = "Java exception was raised during method invocation";
+const char kJavaObjectGone[] = "Java object is gone";
+
+namespace {
+
+// Keep in sync with AndJSBindings.FLAG_BATCHED.
+const int kFlagBatched = 1 << 0;
+
+// One type of a JNI method descriptor starting at |*pos|, moves |*pos| past it.
+BindingType ParseType(const std::string& signature, size_t* pos) {
+  char c = signature[(*pos)++];
+  switch(c) {
+    case 'V': return BindingType::kVoid;
+    case 'Z': return BindingType::kBoolean;
+    case 'I': return BindingType::kInt;
+    case 'J': return BindingType::kLong;
+    case 'F': return BindingType::kFloat;
+    case 'D': return BindingType::kDouble;
+    case 'L': {
+      size_t end = signature.find(';', *pos);
+      if(end == std::string::npos) {
+        *pos = signature.size();
+        return BindingType::kUnsupported;
+      }
+      std::string class_name = signature.substr(*pos, end - *pos);
+      *pos = end + 1;
+      return class_name == "java/lang/String" ? BindingType::kString : BindingType::kObject;
+    }
+    case '[':
+      // Arrays go through the reflective path, skip the element type.
+      ParseType(signature, pos);
+      return BindingType::kUnsupported;
+    default:
+      // byte, char and short keep the coercion rules of the reflective path.
+      return BindingType::kUnsupported;
+  }
+}
+
+bool ParseSignature(const std::string& signature, MethodBinding* method) {
+  if(signature.empty() || signature[0] != '(')
+    return false;
+  size_t pos = 1;
+  while(pos < signature.size() && signature[pos] != ')')
+    method->parameter_types.push_back(ParseType(signature, &pos));
+  if(pos >= signature.size())
+    return false;
+  pos++;
+  method->return_type = ParseType(signature, &pos);
+  return pos == signature.size();
+}
+
+}  // namespace
+
+ClassBinding::ClassBinding(JNIEnv* env,
+                           const base::android::JavaRef<jclass>& clazz,
+                           const base::android::JavaRef<jclass>& annotation_clazz,
+                           const std::vector<std::string>& names,
+                           const std::vector<std::string>& signatures,
+                           const std::vector<int>& flags,
+                           int32_t replayer_id)
+    : annotation_clazz_(annotation_clazz),
+      replayer_id_(replayer_id) {
+  for(size_t i = 0; i < names.size() && i < signatures.size(); i++) {
+    MethodBinding method;
+    method.name = names[i];
+    method.index = static_cast<int32_t>(i);
+    method.method_id = env->GetMethodID(clazz.obj(), names[i].c_str(), signatures[i].c_str());
+    if(!method.method_id || !ParseSignature(signatures[i], &method)) {
+      base::android::ClearException(env);
+      LOG(ERROR) << " ClassBinding unknown method " << names[i] << signatures[i];
+      continue;
+    }
+    method.direct = method.return_type != BindingType::kUnsupported;
+    for(BindingType type : method.parameter_types) {
+      if(type == BindingType::kUnsupported || type == BindingType::kObject)
+        method.direct = false;
+    }
+    method.batched = i < flags.size() && (flags[i] & kFlagBatched);
+    if(method.batched && (!method.direct || method.return_type != BindingType::kVoid)) {
+      // The processor rejects these, an out of date binding is called directly.
+      LOG(ERROR) << " ClassBinding can't batch " << names[i] << signatures[i];
+      method.batched = false;
+    }
+    methods_.push_back(std::move(method));
+  }
+}
+
+ClassBinding::~ClassBinding() = default;
+
+const MethodBinding* ClassBinding::Find(const std::string& name, size_t arity) const {
+  const MethodBinding* found = nullptr;
+  for(const MethodBinding& method : methods_) {
+    if(method.name != name || method.parameter_types.size() != arity)
+      continue;
+    if(found)
+      return nullptr;
+    found = &method;
+  }
+  return found;
+}
+
+bool ClassBinding::HasMethod(const std::string& name) const {
+  for(const MethodBinding& method : methods_) {
+    if(method.name == name)
+      return true;
+  }
+  return false;
+}
+
+std::set<std::string> ClassBinding::GetMethodNames() const {
+  std::set<std::string> names;
+  for(const MethodBinding& method : methods_)
+    names.insert(method.name);
+  return names;
+}
+
+// static
+BindingRegistry* BindingRegistry::GetInstance() {
+  static base::NoDestructor<BindingRegistry> instance;
+  return instance.get();
+}
+
+BindingRegistry::BindingRegistry() = default;
+
+BindingRegistry::~BindingRegistry() = default;
+
+void BindingRegistry::Register(const std::string& class_name, std::unique_ptr<ClassBinding> binding) {
+  base::AutoLock locker(lock_);
+  // A class is registered once per class loader, the first one is kept.
+  if(!bindings_.count(class_name))
+    bindings_[class_name] = std::move(binding);
+}
+
+const ClassBinding* BindingRegistry::Find(const std::string& class_name) {
+  base::AutoLock locker(lock_);
+  auto it = bindings_.find(class_name);
+  return it == bindings_.end() ? nullptr : it->second.get();
+}
+
+BatchedCalls::BatchedCalls(AndJSStats* stats)
+    : stats_(stats),
+      call_start_(0),
+      calls_(0) {
+}
+
+BatchedCalls::~BatchedCalls() = default;
+
+void BatchedCalls::BeginCall(const ClassBinding& binding, const MethodBinding& method,
+                             int32_t object_id, const base::android::JavaRef<jobject>& object) {
+  DCHECK(method.batched);
+  if(buffer_.capacity() == 0)
+    buffer_.reserve(kFlushThreshold + kFlushThreshold / 4);
+  auto it = target_indices_.find(object_id);
+  if(it == target_indices_.end()) {
+    it = target_indices_.emplace(object_id, static_cast<int32_t>(targets_.size())).first;
+    targets_.emplace_back(object);
+  }
+  call_start_ = buffer_.size();
+  Write(binding.replayer_id());
+  Write(method.index);
+  Write(it->second);
+}
+
+uint16_t* BatchedCalls::WriteString(size_t length) {
+  Write(static_cast<int32_t>(length));
+  size_t size = buffer_.size();
+  buffer_.resize(size + length * sizeof(uint16_t));
+  return reinterpret_cast<uint16_t*>(&buffer_[size]);
+}
+
+void BatchedCalls::EndCall() {
+  calls_++;
+  AndJSStats::Add(&stats_->bridge_batched_calls, 1);
+  if(buffer_.size() >= kFlushThreshold)
+    Flush();
+}
+
+void BatchedCalls::CancelCall() {
+  buffer_.resize(call_start_);
+}
+
+void BatchedCalls::Flush() {
+  if(!calls_)
+    return;
+  TRACE_EVENT2("andjs", "BatchedCalls::Flush", "calls", calls_, "bytes", buffer_.size());
+  JNIEnv* env = base::android::AttachCurrentThread();
+  ScopedJavaLocalRef<jclass> object_clazz = base::android::GetClass(env, "java/lang/Object");
+  ScopedJavaLocalRef<jobjectArray> targets(env,
+    env->NewObjectArray(static_cast<jsize>(targets_.size()), object_clazz.obj(), nullptr));
+  for(size_t i = 0; i < targets_.size(); i++)
+    env->SetObjectArrayElement(targets.obj(), static_cast<jsize>(i), targets_[i].obj());
+  // Only read during the upcall, java doesn't keep the buffer.
+  ScopedJavaLocalRef<jobject> calls(env, env->NewDirectByteBuffer(buffer_.data(), buffer_.size()));
+  Java_AndJSBindings_replay(env, targets, calls);
+  AndJSStats::Add(&stats_->bridge_batch_flushes, 1);
+
+  buffer_.clear();
+  call_start_ = 0;
+  calls_ = 0;
+  target_indices_.clear();
+  targets_.clear();
+}
+
+static void JNI_AndJSBindings_RegisterClass(JNIEnv* env,
+                                            const JavaParamRef<jclass>& clazz,
+                                            const JavaParamRef<jobjectArray>& jnames,
+                                            const JavaParamRef<jobjectArray>& jsignatures,
+                                            const JavaParamRef<jintArray>& jflags,
+                                            jint replayer_id,
+                                            const JavaParamRef<jclass>& annotation_clazz) {
+  std::string class_name = content::GetClassName(env, clazz);
+  TRACE_EVENT1("andjs", "AndJSBindings::RegisterClass", "class", class_name);
+  std::vector<std::string> names;
+  std::vector<std::string> signatures;
+  std::vector<int> flags;
+  base::android::AppendJavaStringArrayToStringVector(env, jnames, &names);
+  base::android::AppendJavaStringArrayToStringVector(env, jsignatures, &signatures);
+  base::android::JavaIntArrayToIntVector(env, jflags, &flags);
+  ANDJS_LOG(Debug) << " RegisterClass " << class_name << " methods " << names.size();
+  BindingRegistry::GetInstance()->Register(class_name,
+    std::make_unique<ClassBinding>(env, clazz, annotation_clazz, names, signatures, flags, replayer_id));
+}
+
+}
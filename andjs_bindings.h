@@ -0,0 +1,259 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_BINDINGS_H__
+#define __ANDJS_BINDINGS_H__
+#include <jni.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/android/scoped_java_ref.h"
+#include "base/macros.h"
+#include "base/no_destructor.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+
+namespace andjs {
+
+struct AndJSStats;
+
+// JNI types a generated binding converts straight from and to script values.
+enum class BindingType {
+  kUnsupported,
+  kVoid,
+  kBoolean,
+  kInt,
+  kLong,
+  kFloat,
+  kDouble,
+  kString,
+  kObject,
+};
+
+// One @CalledByJavascript method listed by a generated binding.
+struct MethodBinding {
+  std::string name;
+  jmethodID method_id;
+  BindingType return_type;
+  std::vector<BindingType> parameter_types;
+  // False when a parameter or the return type needs the reflective path,
+  // GinJavaMethodInvocationHelper handles those calls.
+  bool direct;
+  // @CalledByJavascript(batched = true): the call goes to BatchedCalls and
+  // returns undefined right away. Only direct void methods are batched.
+  bool batched;
+  // Position in the table of the generated binding, what its replayer
+  // switches on.
+  int32_t index;
+};
+
+// The @CalledByJavascript methods of a class as listed at compile time by
+// its <Class>_AndJSBindings, see CalledByJavascriptProcessor. Method ids are
+// resolved once when the class is registered.
+class ClassBinding {
+  public:
+    ClassBinding(JNIEnv* env,
+                 const base::android::JavaRef<jclass>& clazz,
+                 const base::android::JavaRef<jclass>& annotation_clazz,
+                 const std::vector<std::string>& names,
+                 const std::vector<std::string>& signatures,
+                 const std::vector<int>& flags,
+                 int32_t replayer_id);
+    ~ClassBinding();
+
+    // The overload of |name| that takes |arity| arguments, nullptr when
+    // there is none or more than one and reflection has to pick.
+    const MethodBinding* Find(const std::string& name, size_t arity) const;
+    bool HasMethod(const std::string& name) const;
+    std::set<std::string> GetMethodNames() const;
+    const std::vector<MethodBinding>& methods() const { return methods_; }
+    // What objects returned by the methods are checked against.
+    const base::android::JavaRef<jclass>& annotation_clazz() const { return annotation_clazz_; }
+    // Index of the generated class among the replayers of AndJSBindings.
+    int32_t replayer_id() const { return replayer_id_; }
+
+  private:
+    std::vector<MethodBinding> methods_;
+    base::android::ScopedJavaGlobalRef<jclass> annotation_clazz_;
+    int32_t replayer_id_;
+
+    DISALLOW_COPY_AND_ASSIGN(ClassBinding);
+};
+
+// Process wide, registered from java when a generated binding class is
+// loaded. Bindings are never removed, so the pointers stay valid.
+class BindingRegistry {
+  public:
+    static BindingRegistry* GetInstance();
+
+    void Register(const std::string& class_name, std::unique_ptr<ClassBinding> binding);
+    // Any thread. nullptr for classes without a generated binding.
+    const ClassBinding* Find(const std::string& class_name);
+
+  private:
+    friend class base::NoDestructor<BindingRegistry>;
+    BindingRegistry();
+    ~BindingRegistry();
+
+    std::map<std::string, std::unique_ptr<ClassBinding>> bindings_ GUARDED_BY(lock_);
+    base::Lock lock_;
+
+    DISALLOW_COPY_AND_ASSIGN(BindingRegistry);
+};
+
+// Calls of batched methods made by the scripts of one engine. They are
+// packed here instead of invoked and AndJSBindings.replay() runs them in
+// order in a single upcall. A call is the replayer id, the method index and
+// the target index as int32, then the arguments in native byte order:
+// boolean as one byte, int, long, float and double as is, String as an
+// int32 length, -1 for null, and that many UTF-16 units. JSTask thread only.
+class BatchedCalls {
+  public:
+    // A task that batches more bytes than this flushes before it ends.
+    static const size_t kFlushThreshold = 64 * 1024;
+
+    explicit BatchedCalls(AndJSStats* stats);
+    ~BatchedCalls();
+
+    bool empty() const { return calls_ == 0; }
+
+    // The engine writes the arguments of |method| in order between
+    // BeginCall() and EndCall(), or drops them with CancelCall() when a
+    // conversion throws.
+    void BeginCall(const ClassBinding& binding, const MethodBinding& method,
+                   int32_t object_id, const base::android::JavaRef<jobject>& object);
+    void WriteBoolean(bool value) { Write<int8_t>(value ? 1 : 0); }
+    void WriteInt(int32_t value) { Write(value); }
+    void WriteLong(int64_t value) { Write(value); }
+    void WriteFloat(float value) { Write(value); }
+    void WriteDouble(double value) { Write(value); }
+    void WriteNullString() { Write<int32_t>(-1); }
+    // Room for a String argument of |length| UTF-16 units, valid until the
+    // next write.
+    uint16_t* WriteString(size_t length);
+    void EndCall();
+    void CancelCall();
+
+    // Replays the calls so far. What the java methods throw is logged, the
+    // scripts that made the calls have moved on.
+    void Flush();
+
+  private:
+    template <typename T>
+    void Write(T value) {
+      size_t size = buffer_.size();
+      buffer_.resize(size + sizeof(T));
+      memcpy(&buffer_[size], &value, sizeof(T));
+    }
+
+    AndJSStats* stats_;
+    std::vector<uint8_t> buffer_;
+    size_t call_start_;
+    size_t calls_;
+    // The objects called since the last flush, each once.
+    std::map<int32_t, int32_t> target_indices_;
+    std::vector<base::android::ScopedJavaGlobalRef<jobject>> targets_;
+
+    DISALLOW_COPY_AND_ASSIGN(BatchedCalls);
+};
+
+// The Call<Type>MethodA() of each return type. Engines build their thunks
+// on top, one instantiation per return type converts the result directly.
+template <BindingType R>
+struct JavaMethod;
+
+template <>
+struct JavaMethod<BindingType::kVoid> {
+  typedef void Type;
+  static void Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    env->CallVoidMethodA(object, method_id, args);
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kBoolean> {
+  typedef jboolean Type;
+  static jboolean Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return env->CallBooleanMethodA(object, method_id, args);
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kInt> {
+  typedef jint Type;
+  static jint Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return env->CallIntMethodA(object, method_id, args);
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kLong> {
+  typedef jlong Type;
+  static jlong Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return env->CallLongMethodA(object, method_id, args);
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kFloat> {
+  typedef jfloat Type;
+  static jfloat Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return env->CallFloatMethodA(object, method_id, args);
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kDouble> {
+  typedef jdouble Type;
+  static jdouble Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return env->CallDoubleMethodA(object, method_id, args);
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kString> {
+  typedef base::android::ScopedJavaLocalRef<jstring> Type;
+  static Type Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return Type(env, static_cast<jstring>(env->CallObjectMethodA(object, method_id, args)));
+  }
+};
+
+template <>
+struct JavaMethod<BindingType::kObject> {
+  typedef base::android::ScopedJavaLocalRef<jobject> Type;
+  static Type Call(JNIEnv* env, jobject object, jmethodID method_id, const jvalue* args) {
+    return Type(env, env->CallObjectMethodA(object, method_id, args));
+  }
+};
+
+// Message of the script exception thrown when the java method threw.
+extern const char kJavaExceptionRaised[];
+// Message of the TypeError thrown when the java object of a call was
+// removed or garbage collected.
+extern const char kJavaObjectGone[];
+
+}
+#endif
@@ -20,401 +20,1165 @@
  */
 #include "andjs/andjs_core.h"
 
-#include "base/threading/thread_task_runner_handle.h"
-#include "base/strings/string_util.h"
-#include "base/android/jni_weak_ref.h"
+#include <algorithm>
+
 #include "base/android/jni_string.h"
-#include "base/feature_list.h"
+#include "base/android/path_utils.h"
+#include "base/bind.h"
+#include "base/bind_helpers.h"
+#include "base/files/file_path.h"
 #include "base/files/file_util.h"
-#include "base/threading/thread.h"
-#include "base/i18n/icu_util.h"
-#include "gin/array_buffer.h"
-#include "gin/try_catch.h"
-#include "gin/v8_initializer.h"
-#include "gin/arguments.h"
-#include "gin/converter.h"
-#include "gin/object_template_builder.h"
-#include "gin/handle.h"
-#include "gin/wrappable.h"
-#include "gin/per_context_data.h"
-#include "crypto/aead.h"
-#include "crypto/sha2.h"
-#include "base/base64.h"
-#include "v8/include/libplatform/libplatform.h"
-
-#include "andjs/gin_java_bridge_object.h"
-
-using v8::Context;
-using v8::Local;
-using v8::HandleScope;
-using v8::Isolate;
-using v8::Locker;
+#include "base/json/json_reader.h"
+#include "base/json/json_writer.h"
+#include "base/no_destructor.h"
+#include "base/threading/platform_thread.h"
+#include "base/threading/thread_task_runner_handle.h"
+#include "base/trace_event/trace_event.h"
+#include "base/values.h"
+
+#include "andjs/andjs_array_buffer_pool.h"
+#include "andjs/andjs_core_quickjs.h"
+#include "andjs/andjs_cpu_profile.h"
+#include "andjs/andjs_core_v8.h"
+#include "andjs/andjs_logger.h"
 
 using base::android::JavaParamRef;
-using base::android::ScopedJavaLocalRef;
 using base::android::ConvertJavaStringToUTF8;
-using base::android::ConvertJavaStringToUTF16;
 using base::android::ConvertUTF8ToJavaString;
 
 namespace andjs {
 
-static std::unique_ptr<content::V8ValueConverter> g_converter_ = content::V8ValueConverter::Create();
+namespace {
 
-class AdbLog: public gin::Wrappable<AdbLog> {
-  public:
-    static gin::WrapperInfo kWrapperInfo;
+// JSTask counts as idle once its queue stayed empty this long, GC then goes
+// on in slices so a task posted meanwhile waits at most one slice.
+constexpr base::TimeDelta kIdleGCDelay = base::TimeDelta::FromMilliseconds(100);
+constexpr base::TimeDelta kIdleGCSlice = base::TimeDelta::FromMilliseconds(10);
 
-    static gin::Handle<AdbLog> Create(v8::Isolate* isolate) {
-      return CreateHandle(isolate, new AdbLog());
-    }
+// Tasks one drain runs before it lets the ones posted to JSTask directly,
+// timers and replies, have their turn.
+constexpr size_t kMaxTasksPerDrain = 64;
 
-    void Info(v8::Isolate* isolate, const std::string info) {
-      LOG(INFO) << info;
+// Time a java caller spends in a call that hands work to JSTask, waiting
+// for |engine_lock_| or for a result.
+class ScopedCallerTimer {
+  public:
+    explicit ScopedCallerTimer(AndJSStats* stats)
+        : stats_(stats), start_(base::TimeTicks::Now()) {}
+    ~ScopedCallerTimer() {
+      int64_t blocked_us = (base::TimeTicks::Now() - start_).InMicroseconds();
+      AndJSStats::Add(&stats_->caller_calls, 1);
+      AndJSStats::Add(&stats_->caller_block_us, blocked_us);
+      AndJSStats::Max(&stats_->caller_max_block_us, blocked_us);
     }
 
-    void Error(v8::Isolate* isolate, const std::string error) {
-      LOG(ERROR) << error;
-    }
+  private:
+    AndJSStats* stats_;
+    base::TimeTicks start_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedCallerTimer);
+};
+
+}  // namespace
+
+AndJSCore::SyncResult::SyncResult()
+    : done_(base::WaitableEvent::ResetPolicy::MANUAL,
+            base::WaitableEvent::InitialState::NOT_SIGNALED),
+      value_(false) {
+}
+
+AndJSCore::SyncResult::~SyncResult() = default;
 
-  protected:
-    AdbLog() = default;
-    gin::ObjectTemplateBuilder GetObjectTemplateBuilder(v8::Isolate* isolate) final {
-      return gin::Wrappable<AdbLog>::GetObjectTemplateBuilder(isolate)
-             .SetMethod("error", &AdbLog::Error)
-             .SetMethod("info", &AdbLog::Info);
+bool AndJSCore::SyncResult::Wait(base::TimeDelta timeout, bool* value) {
+  if(!done_.TimedWait(timeout))
+    return false;
+  *value = value_;
+  return true;
+}
+
+void AndJSCore::SyncResult::Set(bool value) {
+  value_ = value;
+  done_.Signal();
+}
+
+// Counts the caller in before it looks at |running_|, whoever clears it
+// then waits for the caller to leave.
+class AndJSCore::ScopedCaller {
+  public:
+    explicit ScopedCaller(AndJSCore* core) : core_(core) {
+      core_->active_callers_.fetch_add(1);
+      running_ = core_->running_.load();
+    }
+    ~ScopedCaller() {
+      core_->active_callers_.fetch_sub(1);
     }
-    const char* GetTypeName() final { return "AdbLog"; }
-    ~AdbLog() override = default;
+
+    bool running() const { return running_; }
 
   private:
-    DISALLOW_COPY_AND_ASSIGN(AdbLog);
+    AndJSCore* core_;
+    bool running_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedCaller);
 };
-gin::WrapperInfo AdbLog::kWrapperInfo = { gin::kEmbedderNativeGin };
 
-class JSCrypto: public gin::Wrappable<JSCrypto> {
-  private:
-    std::string aead_nonce_;
-    std::string aead_key_;
-	std::unique_ptr<crypto::Aead> aead_;
+AndJSCore::AndJSCore(const Options& options)
+    : type_(options.engine),
+      run_budget_(options.run_budget),
+      fresh_context_per_run_(options.fresh_context_per_run),
+      idle_timeout_(options.idle_timeout),
+      expose_wasm_(options.expose_wasm),
+      wasm_cache_dir_(options.wasm_cache_dir),
+      quickjs_memory_limit_(options.quickjs_memory_limit),
+      streaming_min_script_size_(options.streaming_min_script_size),
+      events_(options.event_queue_capacity, options.event_backpressure, &stats_),
+      structured_receiver_(&stats_),
+      next_context_id_(ScriptEngine::kMainContextId + 1),
+      barriers_posted_(0),
+      idle_generation_(0),
+      queued_tasks_(0),
+      idle_gc_generation_(0),
+      streaming_(false),
+      streaming_id_(0),
+      barriers_run_(0),
+      deferred_scripts_(0),
+      engine_ready_(false),
+      hibernating_(false),
+      resume_requested_(false),
+      shutdown_(false),
+      hibernated_cv_(&engine_lock_),
+      running_(false),
+      active_callers_(0),
+      js_thread_id_(base::kInvalidThreadId),
+      next_script_id_(1),
+      message_loop_(new base::MessageLoopForIO()),
+      drain_scheduled_(false) {
+  // QuickJS has no WebAssembly.
+  if(type_ == ScriptEngine::kAuto && expose_wasm_)
+    type_ = ScriptEngine::kV8;
+  if(type_ == ScriptEngine::kAuto && options.script_size_hint > 0)
+    type_ = SelectEngine(options.script_size_hint);
+  if(expose_wasm_ && wasm_cache_dir_.empty()) {
+    base::FilePath cache_dir;
+    if(base::android::GetCacheDirectory(&cache_dir))
+      wasm_cache_dir_ = cache_dir.AppendASCII("andjs_wasm");
+  }
 
-  public:
-    static gin::WrapperInfo kWrapperInfo;
+  // The synchronous callback, the thread creating instances doesn't run
+  // its message loop. Notifications come from AndJS's onTrimMemory() or
+  // from embedders that forward Chromium's own MemoryPressureListener.
+  memory_pressure_listener_.reset(new base::MemoryPressureListener(
+    base::DoNothing(),
+    base::BindRepeating(&AndJSCore::OnMemoryPressure, base::Unretained(this))));
 
-    static gin::Handle<JSCrypto> Create(v8::Isolate* isolate) {
-      return CreateHandle(isolate, new JSCrypto());
-    }
+  base::AutoLock locker(engine_lock_);
+  StartThreadLocked();
+}
 
-    void SetKey(v8::Isolate* isolate, const std::string& key) {
-      std::string hash256_ = crypto::SHA256HashString(key);
-      aead_nonce_.assign(hash256_, 0, aead_->NonceLength());
-      aead_key_ = crypto::SHA256HashString(hash256_+aead_nonce_);
-      aead_key_.append(hash256_, 0, 16);
-      aead_->Init(&aead_key_);
-    }
+// static
+ScriptEngine::Type AndJSCore::SelectEngine(size_t script_size) {
+  return script_size <= kAutoQuickJSMaxScriptSize ? ScriptEngine::kQuickJS : ScriptEngine::kV8;
+}
 
-    v8::Local<v8::Value> Seal(v8::Isolate* isolate, const std::string& plaintext) {
-      std::string ciphertext, output;
-      if(aead_->Seal(plaintext, aead_nonce_, "jscrypto", &ciphertext)) {
-        base::Base64Encode(ciphertext, &output);
-        base::Value val(output);
-        return g_converter_->ToV8Value(&val, isolate->GetCurrentContext());
-      }
-      return v8::Undefined(isolate);
+std::unique_ptr<ScriptEngine> AndJSCore::CreateEngine(ScriptEngine::Type type) {
+  switch(type) {
+    case ScriptEngine::kQuickJS: {
+      std::unique_ptr<AndJSCoreQuickJS> engine = std::make_unique<AndJSCoreQuickJS>(&stats_, &structured_receiver_);
+      engine->SetCallbackBudget(run_budget_);
+      engine->SetMemoryLimit(quickjs_memory_limit_);
+      return engine;
     }
-
-    v8::Local<v8::Value> Open(v8::Isolate* isolate, const std::string& ciphertext) {
-      std::string plaintext, output;
-      base::Base64Decode(ciphertext, &output);
-      if(aead_->Open(output, aead_nonce_, "jscrypto", &plaintext)) {
-        base::Value val(plaintext);
-        return g_converter_->ToV8Value(&val, isolate->GetCurrentContext());
-      }
-      return v8::Undefined(isolate);
+    case ScriptEngine::kV8: {
+      std::unique_ptr<AndJSCoreV8> engine = std::make_unique<AndJSCoreV8>(&stats_, &structured_receiver_);
+      engine->SetCallbackBudget(run_budget_);
+      if(expose_wasm_)
+        engine->EnableWasm(wasm_cache_dir_);
+      return engine;
     }
+    default:
+      break;
+  }
+  NOTREACHED();
+  return nullptr;
+}
 
-  protected:
-    JSCrypto() {
-      aead_.reset(new crypto::Aead(crypto::Aead::AES_128_CTR_HMAC_SHA256));
-    }
+void AndJSCore::Init() {
+  TRACE_EVENT0("andjs", "AndJSCore::Init");
+  // AUTO without a size hint waits for the first script to pick the engine.
+  if(type_ != ScriptEngine::kAuto)
+    EnsureEngine(0);
+}
+
+void AndJSCore::EnsureEngine(size_t script_size) {
+  base::AutoLock locker(engine_lock_);
+  EnsureEngineLocked(script_size);
+}
+
+// The caller only creates the engine object. Init() and the objects
+// injected before it are the first task on JSTask. A hibernated instance
+// gets an engine of the same type back, its globals and injected objects
+// are restored by the task after that. One still hibernating gets it once
+// JSTask stopped, see Hibernate().
+void AndJSCore::EnsureEngineLocked(size_t script_size) {
+  if(hibernating_) {
+    resume_requested_ = true;
+    return;
+  }
+  if(engine_)
+    return;
 
-    gin::ObjectTemplateBuilder GetObjectTemplateBuilder(v8::Isolate* isolate) final {
-      return gin::Wrappable<JSCrypto>::GetObjectTemplateBuilder(isolate)
-             .SetMethod("setkey", &JSCrypto::SetKey)
-             .SetMethod("seal", &JSCrypto::Seal)
-             .SetMethod("open", &JSCrypto::Open);
+  base::TimeTicks start = base::TimeTicks::Now();
+  ScriptEngine::Type type = type_ == ScriptEngine::kAuto ? SelectEngine(script_size) : type_;
+  if(hibernation_)
+    type = hibernation_->type;
+  LOG(INFO) << " AndJSCore select engine " << type << " script_size " << script_size;
+  engine_ = CreateEngine(type);
+  PostTaskLocked(base::BindOnce(&AndJSCore::InitEngineTask, base::Unretained(this), std::move(pending_objects_)));
+  pending_objects_.clear();
+
+  if(hibernation_) {
+    std::vector<InjectedObject> objects;
+    {
+      base::AutoLock locker(injected_lock_);
+      objects = injected_objects_;
     }
-    const char* GetTypeName() final { return "JSCrypto"; }
-    ~JSCrypto() override = default;
+    PostTaskLocked(base::BindOnce(&AndJSCore::ResumeTask, base::Unretained(this),
+                                  std::move(hibernation_), std::move(objects), start));
+  }
+  // The tasks held while it hibernated go after the resume.
+  for(base::OnceClosure& task : held_tasks_)
+    PushTaskLocked(std::move(task));
+  held_tasks_.clear();
+  running_.store(true);
+}
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(JSCrypto);
-};
-gin::WrapperInfo JSCrypto::kWrapperInfo = { gin::kEmbedderNativeGin };
+void AndJSCore::InitEngineTask(const std::vector<PendingObject>& objects) {
+  {
+    ScopedStatsTimer timer(&stats_.init_time_us);
+    engine_->Init();
+  }
+  engine_ready_ = true;
+  for(const PendingObject& pending : objects)
+    engine_->InjectObject(ScriptEngine::kMainContextId, pending.name, pending.object, pending.annotation_clazz);
+}
+
+// While the engine runs nothing but JSTask changes, |task| is queued like
+// PostTaskLocked() does without the lock. False when the caller has to take
+// |engine_lock_|, |task| is left alone then.
+bool AndJSCore::PostTaskFast(base::OnceClosure* task) {
+  ScopedCaller caller(this);
+  if(!caller.running())
+    return false;
+  ++barriers_posted_;
+  QueueTask(std::move(*task), true);
+  return true;
+}
+
+// Scripts queued after |task| don't overtake it.
+void AndJSCore::PostTaskLocked(base::OnceClosure task) {
+  ++barriers_posted_;
+  QueueTaskLocked(std::move(task), true);
+}
+
+// JSTask is started again after a hibernation. Callers checked |shutdown_|,
+// nothing runs after ShutdownTask().
+void AndJSCore::QueueTaskLocked(base::OnceClosure task, bool barrier) {
+  DCHECK(!shutdown_);
+  if(hibernating_) {
+    ++queued_tasks_;
+    held_tasks_.push_back(base::BindOnce(&AndJSCore::RunQueuedTask, base::Unretained(this), barrier, std::move(task)));
+    return;
+  }
+  if(!thread_)
+    StartThreadLocked();
+  QueueTask(std::move(task), barrier);
+}
+
+// Both paths end here with a running JSTask. Every task restarts the idle
+// timer.
+void AndJSCore::QueueTask(base::OnceClosure task, bool barrier) {
+  ++queued_tasks_;
+  PushTask(base::BindOnce(&AndJSCore::RunQueuedTask, base::Unretained(this), barrier, std::move(task)));
+
+  if(idle_timeout_ > base::TimeDelta()) {
+    static base::NoDestructor<base::Thread> idle_thread("JSIdle");
+    static const bool idle_started = idle_thread->Start();
+    ALLOW_UNUSED_LOCAL(idle_started);
+    idle_thread->task_runner()->PostDelayedTask(FROM_HERE,
+      base::BindOnce(&AndJSCore::OnIdleTimeout, base::Unretained(this), ++idle_generation_), idle_timeout_);
+  }
+}
+
+// For hibernation, shutdown and memory pressure, not counted as queued.
+void AndJSCore::PushTaskLocked(base::OnceClosure task) {
+  if(!thread_)
+    StartThreadLocked();
+  PushTask(std::move(task));
+}
 
-AndJSCore::AndJSCore() : next_object_id_(1), message_loop_(new base::MessageLoopForIO()) {
+void AndJSCore::StartThreadLocked() {
   thread_.reset(new base::Thread("JSTask"));
   thread_->Start();
+  js_thread_id_.store(thread_->GetThreadId());
+}
 
-  g_converter_->SetDateAllowed(false);
-  g_converter_->SetRegExpAllowed(false);
-  g_converter_->SetFunctionAllowed(true);
-  //thread_->task_runner()->PostTask(FROM_HERE, base::BindRepeating(&AndJSCore::Init, base::Unretained(this)));
+// JSTask pops without any lock.
+void AndJSCore::PushTask(base::OnceClosure task) {
+  AndJSStats::Add(&stats_.engine_tasks, 1);
+  tasks_.Push(std::move(task));
+  if(!drain_scheduled_.exchange(true))
+    thread_->task_runner()->PostTask(FROM_HERE, base::BindOnce(&AndJSCore::DrainTasksTask, base::Unretained(this)));
 }
 
-v8::Local<v8::Value> AndJSCore::GetV8Version(gin::Arguments* args) {
-  base::Value version(v8::V8::GetVersion());
-  return g_converter_->ToV8Value(&version, args->isolate()->GetCurrentContext());
+// JSTask thread. A push that lands after the flag is cleared either shows
+// up in this drain or posts the next one.
+void AndJSCore::DrainTasksTask() {
+  AndJSStats::Add(&stats_.engine_task_drains, 1);
+  drain_scheduled_.store(false);
+  base::OnceClosure task;
+  size_t count = 0;
+  while(count < kMaxTasksPerDrain && tasks_.TryPop(&task)) {
+    std::move(task).Run();
+    count++;
+  }
+  if(count == kMaxTasksPerDrain && !drain_scheduled_.exchange(true))
+    base::ThreadTaskRunnerHandle::Get()->PostTask(FROM_HERE, base::BindOnce(&AndJSCore::DrainTasksTask, base::Unretained(this)));
 }
 
-void AndJSCore::Init() {
-  base::i18n::InitializeICU();
-#ifdef V8_USE_EXTERNAL_STARTUP_DATA
-  gin::V8Initializer::LoadV8Snapshot();
-  gin::V8Initializer::LoadV8Natives();
-#endif
-
-  static const char kOptimizeForSize[] = "--optimize_for_size";
-  v8::V8::SetFlagsFromString(kOptimizeForSize, strlen(kOptimizeForSize));
-  static const char kNoOpt[] = "--noopt";
-  v8::V8::SetFlagsFromString(kNoOpt, strlen(kNoOpt));
-
-  // WebAssembly isn't encountered during resolution, so reduce the
-  // potential attack surface.
-  static const char kNoExposeWasm[] = "--no-expose-wasm";
-  v8::V8::SetFlagsFromString(kNoExposeWasm, strlen(kNoExposeWasm));
-
-  gin::IsolateHolder::Initialize(gin::IsolateHolder::kStrictMode,
-                                 gin::ArrayBufferAllocator::SharedInstance());
-
-  instance_.reset(new gin::IsolateHolder(base::ThreadTaskRunnerHandle::Get(),
-    #if ENABLE_V8_LOCKER
-    gin::IsolateHolder::AccessMode::kUseLocker,
-    #endif
-    gin::IsolateHolder::IsolateType::kUtility));
-  LOG(INFO) << " CreateIsolateHolder instance " << instance_;
-  Isolate* isolate_ = instance_->isolate();
-
-#if ENABLE_V8_LOCKER
-  v8::Locker locked(isolate_);
-#endif
-  v8::Isolate::Scope isolate_scope(isolate_);
-  v8::HandleScope handle_scope(isolate_);
-
-  v8::Local<v8::FunctionTemplate> get_v8_version_templ =
-    gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCore::GetV8Version));
-  v8::Local<v8::ObjectTemplate> global_templ =
-    gin::ObjectTemplateBuilder(isolate_).Build();
-  global_templ->Set(gin::StringToSymbol(isolate_, "get_v8_version"), get_v8_version_templ);
-
-  context_holder_.reset(new gin::ContextHolder(isolate_));
-  context_holder_->SetContext(v8::Context::New(isolate_, nullptr, global_templ));
-
-  v8::Context::Scope scope(context_holder_->context());
-  isolate_->SetCaptureStackTraceForUncaughtExceptions(true);
-  InjectNativeObject();
-  LOG(INFO) << " InjectNativeObject DONE ";
-}
-
-void AndJSCore::doV8Test(const std::string& jsbuf) {
-  for(int i = 0; i < 1; i ++)
+// Sends the callers to |engine_lock_| and waits for the ones that queue
+// without it right now, their tasks come before the one pushed next.
+void AndJSCore::StopFastCallersLocked() {
+  running_.store(false);
+  while(active_callers_.load() > 0)
+    base::PlatformThread::YieldCurrentThread();
+}
+
+// A call from a script on JSTask would wait for itself.
+scoped_refptr<AndJSCore::SyncResult> AndJSCore::MakeSyncResult(jlong wait_ms) {
+  if(wait_ms <= 0 || base::PlatformThread::CurrentId() == js_thread_id_.load())
+    return nullptr;
+  return base::MakeRefCounted<SyncResult>();
+}
+
+// True without a |result| to wait for.
+bool AndJSCore::WaitForResult(scoped_refptr<SyncResult> result, jlong wait_ms, const char* what) {
+  bool value = true;
+  if(result && !result->Wait(base::TimeDelta::FromMilliseconds(wait_ms), &value)) {
+    LOG(WARNING) << " AndJSCore " << what << " not done after " << wait_ms << "ms";
+    return false;
+  }
+  return value;
+}
+
+// JSTask thread only, for the follow ups of a task. They stay on the
+// thread that runs now, a hibernation drains them before it stops.
+void AndJSCore::PostTaskOnJSTask(base::OnceClosure task) {
+  ++queued_tasks_;
+  base::ThreadTaskRunnerHandle::Get()->PostTask(FROM_HERE, base::BindOnce(&AndJSCore::RunQueuedTask, base::Unretained(this), false, std::move(task)));
+}
+
+// The engine is picked by the first script, its size decides in AUTO mode.
+jlong AndJSCore::QueueScript(JNIEnv* env,
+                             jint priority,
+                             const base::android::JavaRef<jstring>& jreplace_key,
+                             size_t script_size,
+                             base::OnceClosure task) {
+  std::string replace_key;
+  if(!jreplace_key.is_null())
+    replace_key = ConvertJavaStringToUTF8(env, jreplace_key);
   {
-    v8::Isolate* isolate_ = context_holder_->isolate();
-#if ENABLE_V8_LOCKER
-    LOG(INFO) << " AndJSCore.Run isolate.IsLocked = " << v8::Locker::IsLocked(isolate_) << " IsActive " << v8::Locker::IsActive();
-    v8::Locker locked(isolate_);
-#endif
-    //gin::Runner::Scope scope(this);
-    v8::ScriptOrigin origin(gin::StringToV8(isolate_, "v8test"));
-    gin::TryCatch try_catch(isolate_);
-
-    for(int j = 0; j < 30000; j++) {
-    LOG(INFO) << " JNI_AndJS_V8Test STEP 02 Loop " << j;
-    auto maybe_script = v8::Script::Compile(context_holder_->context(), gin::StringToV8(isolate_, jsbuf), &origin);
-    v8::Local<v8::Script> script;
-    if (!maybe_script.ToLocal(&script)) {
-      LOG(ERROR) << try_catch.GetStackTrace();
-      return;
+    ScopedCaller caller(this);
+    if(caller.running()) {
+      int64_t id = AddScript(priority, replace_key, std::move(task));
+      QueueTask(base::BindOnce(&AndJSCore::RunNextScriptTask, base::Unretained(this)), false);
+      return id;
     }
+  }
+  base::AutoLock locker(engine_lock_);
+  if(shutdown_)
+    return 0;
+  EnsureEngineLocked(script_size);
+  int64_t id = AddScript(priority, replace_key, std::move(task));
+  QueueTaskLocked(base::BindOnce(&AndJSCore::RunNextScriptTask, base::Unretained(this)), false);
+  return id;
+}
 
-    auto maybe = script->Run(context_holder_->context());
-    v8::Local<v8::Value> result;
-    if (!maybe.ToLocal(&result)) {
-      LOG(ERROR) << try_catch.GetStackTrace();
+// Its RunNextScriptTask() is queued right after.
+int64_t AndJSCore::AddScript(jint priority, const std::string& replace_key, base::OnceClosure task) {
+  QueuedScript script;
+  script.replace_key = replace_key;
+  script.queued = base::TimeTicks::Now();
+  script.barrier = barriers_posted_.load();
+  script.task = std::move(task);
+  int lane = std::min(std::max<int>(priority, kHighPriority), kIdlePriority);
+  int64_t id;
+  {
+    base::AutoLock locker(lanes_lock_);
+    if(!script.replace_key.empty()) {
+      for(std::deque<QueuedScript>& queued : lanes_) {
+        size_t size = queued.size();
+        queued.erase(std::remove_if(queued.begin(), queued.end(), [&](const QueuedScript& older) {
+                       return older.replace_key == script.replace_key;
+                     }), queued.end());
+        AndJSStats::Add(&stats_.scripts_replaced, size - queued.size());
+      }
     }
-    v8::String::Utf8Value utf8(isolate_, result);
-    LOG(INFO) << " JNI_AndJS_V8Test STEP 03 " << *utf8 << " Loop " << j;
+    id = script.id = next_script_id_++;
+    lanes_[lane].push_back(std::move(script));
+  }
+  return id;
+}
+
+// Nothing left when the scripts this task was posted for got cancelled or
+// replaced.
+void AndJSCore::RunNextScriptTask() {
+  bool waiting = false;
+  if(!RunNextScript(&waiting) && waiting)
+    deferred_scripts_++;
+}
+
+// After a barrier task, the scripts that waited for it.
+void AndJSCore::RunDeferredScripts() {
+  bool waiting;
+  while(deferred_scripts_ > 0 && !streaming_ && RunNextScript(&waiting))
+    deferred_scripts_--;
+}
+
+// Runs the first script of the highest lane whose barriers ran. Lanes are
+// oldest first, so only the front of each one needs a look. |waiting| is
+// set when the scripts left wait for a barrier.
+bool AndJSCore::RunNextScript(bool* waiting) {
+  QueuedScript script;
+  int lane = kHighPriority;
+  {
+    base::AutoLock locker(lanes_lock_);
+    *waiting = false;
+    while(lane < kPriorityCount &&
+          (lanes_[lane].empty() || lanes_[lane].front().barrier > barriers_run_)) {
+      *waiting |= !lanes_[lane].empty();
+      lane++;
+    }
+    if(lane == kPriorityCount) {
+      if(!*waiting)
+        deferred_scripts_ = 0;
+      return false;
     }
+    script = std::move(lanes_[lane].front());
+    lanes_[lane].pop_front();
   }
+  int64_t wait_us = (base::TimeTicks::Now() - script.queued).InMicroseconds();
+  switch(lane) {
+    case kHighPriority:
+      AndJSStats::Add(&stats_.high_scripts, 1);
+      AndJSStats::Add(&stats_.high_queue_wait_us, wait_us);
+      AndJSStats::Max(&stats_.high_max_queue_wait_us, wait_us);
+      break;
+    case kNormalPriority:
+      AndJSStats::Add(&stats_.normal_scripts, 1);
+      AndJSStats::Add(&stats_.normal_queue_wait_us, wait_us);
+      AndJSStats::Max(&stats_.normal_max_queue_wait_us, wait_us);
+      break;
+    default:
+      AndJSStats::Add(&stats_.idle_scripts, 1);
+      AndJSStats::Add(&stats_.idle_queue_wait_us, wait_us);
+      AndJSStats::Max(&stats_.idle_max_queue_wait_us, wait_us);
+      break;
+  }
+  std::move(script.task).Run();
+  return true;
 }
 
-void AndJSCore::Shutdown() {
-  LOG(INFO) << " AndJSCore Shutdown instance " << instance_;
-  instance_.reset();
+jboolean AndJSCore::CancelTask(JNIEnv* env,
+                               const base::android::JavaParamRef<jobject>& jcaller,
+                               jlong task_id) {
+  base::AutoLock locker(lanes_lock_);
+  for(std::deque<QueuedScript>& queued : lanes_) {
+    for(auto it = queued.begin(); it != queued.end(); ++it) {
+      if(it->id == task_id) {
+        queued.erase(it);
+        AndJSStats::Add(&stats_.scripts_cancelled, 1);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// JSTask thread. While a script streams the task waits for it, still
+// counted as queued.
+void AndJSCore::RunQueuedTask(bool barrier, base::OnceClosure task) {
+  if(streaming_) {
+    streaming_held_tasks_.push_back(
+      base::BindOnce(&AndJSCore::RunQueuedTask, base::Unretained(this), barrier, std::move(task)));
+    return;
+  }
+  std::move(task).Run();
+  if(barrier) {
+    barriers_run_++;
+    RunDeferredScripts();
+  }
+  FinishQueuedTask();
 }
 
-bool AndJSCore::InjectNativeObject() {
-  v8::Isolate* isolate_ = context_holder_->isolate();
-#if ENABLE_V8_LOCKER
-  LOG(INFO) << " InjectNativeObject IsLocked = " << v8::Locker::IsLocked(isolate_);
-  v8::Locker locked(isolate_);
-#endif
-  v8::HandleScope handle_scope(isolate_);
-  gin::Handle<AdbLog> adb = AdbLog::Create(isolate_);
-  v8::Maybe<bool> result = global()->Set(context_holder_->context(), gin::StringToV8(isolate_, "adb"), adb.ToV8());
+// The last task of a burst schedules idle GC.
+void AndJSCore::FinishQueuedTask() {
+  if(engine_ready_)
+    engine_->FlushBatchedCalls();
+  if(--queued_tasks_ == 0) {
+    base::ThreadTaskRunnerHandle::Get()->PostDelayedTask(FROM_HERE,
+      base::BindOnce(&AndJSCore::IdleGCTask, base::Unretained(this), ++idle_gc_generation_), kIdleGCDelay);
+  }
+}
+
+void AndJSCore::IdleGCTask(uint64_t generation) {
+  if(generation != idle_gc_generation_ || queued_tasks_.load() > 0 || !engine_ready_)
+    return;
+  bool done;
+  {
+    ScopedStatsTimer timer(&stats_.idle_gc_time_us);
+    done = engine_->CollectIdleGarbage(kIdleGCSlice);
+  }
+  if(!done) {
+    base::ThreadTaskRunnerHandle::Get()->PostTask(FROM_HERE,
+      base::BindOnce(&AndJSCore::IdleGCTask, base::Unretained(this), generation));
+  }
+}
+
+// Any thread. It doesn't count as a task for the idle timers, and a
+// hibernated instance has nothing to give back.
+void AndJSCore::OnMemoryPressure(base::MemoryPressureListener::MemoryPressureLevel level) {
+  if(level == base::MemoryPressureListener::MEMORY_PRESSURE_LEVEL_NONE)
+    return;
+  base::AutoLock locker(engine_lock_);
+  if(!engine_ || !thread_ || hibernating_ || shutdown_)
+    return;
+  PushTaskLocked(base::BindOnce(&AndJSCore::MemoryPressureTask, base::Unretained(this),
+                                level == base::MemoryPressureListener::MEMORY_PRESSURE_LEVEL_CRITICAL));
+}
+
+void AndJSCore::MemoryPressureTask(bool critical) {
+  if(engine_ready_)
+    engine_->OnMemoryPressure(critical);
+}
 
-  gin::Handle<JSCrypto> jscrypto = JSCrypto::Create(isolate_);
-  result = global()->Set(context_holder_->context(), gin::StringToV8(isolate_, "jscrypto"), jscrypto.ToV8());
-  return !result.IsNothing() && result.FromJust();
+void AndJSCore::OnIdleTimeout(uint64_t generation) {
+  if(generation == idle_generation_.load())
+    Hibernate();
+}
+
+jint AndJSCore::CreateContext(JNIEnv* env,
+                              const base::android::JavaParamRef<jobject>& jcaller,
+                              jlong wait_ms) {
+  ScopedCallerTimer timer(&stats_);
+  int context_id = next_context_id_++;
+  scoped_refptr<SyncResult> result = MakeSyncResult(wait_ms);
+  base::OnceClosure task = base::BindOnce(&AndJSCore::CreateContextTask, base::Unretained(this), context_id, result);
+  if(!PostTaskFast(&task)) {
+    base::AutoLock locker(engine_lock_);
+    if(shutdown_)
+      return 0;
+    EnsureEngineLocked(0);
+    PostTaskLocked(std::move(task));
+  }
+  // Without waiting the id is good either way, runs in a context the engine
+  // had no memory for fail like in a disposed one.
+  bool created = true;
+  if(result && !result->Wait(base::TimeDelta::FromMilliseconds(wait_ms), &created))
+    LOG(WARNING) << " AndJSCore CreateContext not done after " << wait_ms << "ms";
+  return created ? context_id : 0;
+}
+
+void AndJSCore::CreateContextTask(int context_id, scoped_refptr<SyncResult> result) {
+  bool created = engine_->CreateContext(context_id);
+  if(result)
+    result->Set(created);
+}
+
+jboolean AndJSCore::DisposeContext(JNIEnv* env,
+                                   const base::android::JavaParamRef<jobject>& jcaller,
+                                   jint context_id,
+                                   jlong wait_ms) {
+  ScopedCallerTimer timer(&stats_);
+  {
+    base::AutoLock locker(injected_lock_);
+    injected_objects_.erase(std::remove_if(injected_objects_.begin(), injected_objects_.end(),
+                                           [context_id](const InjectedObject& object) {
+                                             return object.context_id == context_id;
+                                           }),
+                            injected_objects_.end());
+  }
+  scoped_refptr<SyncResult> result = MakeSyncResult(wait_ms);
+  base::OnceClosure task = base::BindOnce(&AndJSCore::DisposeContextTask, base::Unretained(this), context_id, result);
+  if(!PostTaskFast(&task)) {
+    base::AutoLock locker(engine_lock_);
+    if(shutdown_)
+      return false;
+    if(hibernation_)
+      hibernation_->disposed_contexts.insert(context_id);
+    // A context created while hibernating only exists after the resume.
+    if(!engine_ || (hibernation_ && !resume_requested_))
+      return true;
+    PostTaskLocked(std::move(task));
+  }
+  return WaitForResult(std::move(result), wait_ms, "DisposeContext");
+}
+
+void AndJSCore::DisposeContextTask(int context_id, scoped_refptr<SyncResult> result) {
+  used_contexts_.erase(context_id);
+  engine_->DisposeContext(context_id);
+  if(result)
+    result->Set(true);
+}
+
+jboolean AndJSCore::ResetContext(JNIEnv* env,
+                                 const base::android::JavaParamRef<jobject>& jcaller,
+                                 jint context_id,
+                                 jlong wait_ms) {
+  ScopedCallerTimer timer(&stats_);
+  scoped_refptr<SyncResult> result = MakeSyncResult(wait_ms);
+  base::OnceClosure task = base::BindOnce(&AndJSCore::ResetContextTask, base::Unretained(this), context_id, result);
+  if(!PostTaskFast(&task)) {
+    base::AutoLock locker(engine_lock_);
+    if(shutdown_)
+      return false;
+    if(hibernation_) {
+      hibernation_->reset_contexts.insert(context_id);
+      return true;
+    }
+    if(!engine_)
+      return true;
+    PostTaskLocked(std::move(task));
+  }
+  return WaitForResult(std::move(result), wait_ms, "ResetContext");
+}
+
+void AndJSCore::ResetContextTask(int context_id, scoped_refptr<SyncResult> result) {
+  used_contexts_.erase(context_id);
+  engine_->ResetContext(context_id);
+  if(result)
+    result->Set(true);
+}
+
+void AndJSCore::InjectObjectTask(int context_id, const PendingObject& object, scoped_refptr<SyncResult> result) {
+  bool injected = engine_->InjectObject(context_id, object.name, object.object, object.annotation_clazz);
+  if(result)
+    result->Set(injected);
 }
 
 bool AndJSCore::InjectObject(JNIEnv* env,
                              const base::android::JavaParamRef<jobject>& jcaller,
+                             jint context_id,
                              const base::android::JavaParamRef<jobject>& jobject,
                              const base::android::JavaParamRef<jstring>& jname,
-                             const base::android::JavaParamRef<jclass>&  annotation_clazz) {
-  std::string name(ConvertJavaStringToUTF8(env, jname));
-  return InjectObject(name, jobject, annotation_clazz);
+                             const base::android::JavaParamRef<jclass>&  annotation_clazz,
+                             jlong wait_ms) {
+  ScopedCallerTimer timer(&stats_);
+  PendingObject pending;
+  pending.name = ConvertJavaStringToUTF8(env, jname);
+  pending.object.Reset(env, jobject);
+  pending.annotation_clazz.Reset(env, annotation_clazz);
+
+  InjectedObject injected;
+  injected.context_id = context_id;
+  injected.name = pending.name;
+  injected.object = JavaObjectWeakGlobalRef(env, jobject.obj());
+  injected.annotation_clazz = pending.annotation_clazz;
+
+  scoped_refptr<SyncResult> result = MakeSyncResult(wait_ms);
+  bool queued = false;
+  {
+    ScopedCaller caller(this);
+    if(caller.running()) {
+      {
+        base::AutoLock locker(injected_lock_);
+        injected_objects_.push_back(std::move(injected));
+      }
+      // Queued like scripts, so the engine is only ever touched on JSTask.
+      ++barriers_posted_;
+      QueueTask(base::BindOnce(&AndJSCore::InjectObjectTask, base::Unretained(this), context_id, std::move(pending), result), true);
+      queued = true;
+    }
+  }
+  if(!queued) {
+    base::AutoLock locker(engine_lock_);
+    if(shutdown_)
+      return false;
+    {
+      base::AutoLock injected_locker(injected_lock_);
+      injected_objects_.push_back(std::move(injected));
+    }
+    if(hibernation_) {
+      // Bound with the others on resume.
+      return true;
+    }
+    if(!engine_) {
+      // Only the main context exists before the engine.
+      pending_objects_.push_back(std::move(pending));
+      return true;
+    }
+    PostTaskLocked(base::BindOnce(&AndJSCore::InjectObjectTask, base::Unretained(this), context_id, std::move(pending), result));
+  }
+  return WaitForResult(std::move(result), wait_ms, "InjectObject");
 }
 
-void AndJSCore::LoadJSBuf(JNIEnv* env,
-                          const base::android::JavaParamRef<jobject>& jcaller,
-                          const base::android::JavaParamRef<jstring>& jsbuf) {
-  std::string buf(ConvertJavaStringToUTF8(env, jsbuf));
-  thread_->task_runner()->PostTask(FROM_HERE, base::BindRepeating(&AndJSCore::Run, base::Unretained(this), buf, "_membuf.js_"));
+base::TimeDelta AndJSCore::GetRunBudget(jlong timeout_ms) const {
+  if(timeout_ms < 0)
+    return run_budget_;
+  return base::TimeDelta::FromMilliseconds(timeout_ms);
 }
 
-void AndJSCore::loadJSFileTask(const std::string& jspath) {
-  std::string buf;
-  base::FilePath filepath(jspath);
+void AndJSCore::StartPendingProfile() {
+  if(!pending_profile_title_.empty()) {
+    engine_->StartProfiling(pending_profile_title_, pending_profile_interval_);
+    pending_profile_title_.clear();
+  }
+}
 
-  if(base::ReadFileToString(filepath, &buf)) {
-    Run(buf, filepath.BaseName().value());
+void AndJSCore::OnRunFinished(ScriptEngine::RunStatus status, const std::string& resource_name, base::TimeDelta budget) {
+  if(status == ScriptEngine::kException)
+    AndJSStats::Add(&stats_.exceptions, 1);
+  if(status == ScriptEngine::kTerminated) {
+    int64_t count = ++stats_.terminated_runs;
+    LOG(WARNING) << " AndJSCore " << resource_name << " terminated after " << budget.InMilliseconds()
+                 << "ms cpu time, terminated runs " << count;
   }
 }
 
-void AndJSCore::LoadJSFile(JNIEnv* env,
-                           const base::android::JavaParamRef<jobject>& jcaller,
-                           const base::android::JavaParamRef<jstring>& jsfile) {
-  std::string jspath (ConvertJavaStringToUTF8(env, jsfile));
-  thread_->task_runner()->PostTask(FROM_HERE, base::BindRepeating(&AndJSCore::loadJSFileTask, base::Unretained(this), jspath));
+// With Options.freshContextPerRun every run after the first one in a
+// context starts from a clean global scope.
+void AndJSCore::PrepareContext(int context_id) {
+  if(fresh_context_per_run_ && !used_contexts_.insert(context_id).second)
+    engine_->ResetContext(context_id);
 }
 
-void AndJSCore::Shutdown(JNIEnv* env,
-                          const base::android::JavaParamRef<jobject>& jcaller) {
-  Shutdown();
+void AndJSCore::RunTask(int context_id, const ScriptString& source, const std::string& resource_name, base::TimeDelta budget) {
+  TRACE_EVENT1("andjs", "AndJSCore::RunTask", "resource_name", resource_name);
+  AndJSStats::Add(&stats_.scripts_run, 1);
+  StartPendingProfile();
+  PrepareContext(context_id);
+  OnRunFinished(engine_->Run(context_id, source, resource_name, budget), resource_name, budget);
 }
 
-scoped_refptr<content::GinJavaBoundObject> AndJSCore::GetObject(content::GinJavaBoundObject::ObjectID object_id) {
-  // Can be called on any thread.
-  base::AutoLock locker(objects_lock_);
-  auto iter = objects_.find(object_id);
-  if (iter != objects_.end())
-    return iter->second;
-  LOG(ERROR) << "AndJSCore: Unknown object: " << object_id;
-  return nullptr;
+void AndJSCore::RunModuleTask(int context_id, scoped_refptr<ModuleBundle> bundle, const std::string& entry, base::TimeDelta budget) {
+  TRACE_EVENT1("andjs", "AndJSCore::RunModuleTask", "entry", entry);
+  AndJSStats::Add(&stats_.scripts_run, 1);
+  StartPendingProfile();
+  PrepareContext(context_id);
+  engine_->SetModuleBundle(std::move(bundle));
+  OnRunFinished(engine_->RunModule(context_id, entry, budget), entry, budget);
 }
 
-v8::Local<v8::Value> AndJSCore::InjectObject(const base::android::JavaRef<jobject>& jobject,
-                                             const base::android::JavaRef<jclass>&  annotation_clazz) {
+jlong AndJSCore::LoadJSBuf(JNIEnv* env,
+                           const base::android::JavaParamRef<jobject>& jcaller,
+                           jint context_id,
+                           const base::android::JavaParamRef<jstring>& jsbuf,
+                           jlong timeout_ms,
+                           jint priority,
+                           const base::android::JavaParamRef<jstring>& jreplace_key) {
+  ScopedCallerTimer timer(&stats_);
+  ScriptString source = ScriptString::FromJavaString(env, jsbuf.obj());
+  size_t script_size = source.length();
+  return QueueScript(env, priority, jreplace_key, script_size,
+    base::BindOnce(&AndJSCore::RunTask, base::Unretained(this), context_id, std::move(source), "_membuf.js_", GetRunBudget(timeout_ms)));
+}
 
-  JNIEnv* env = base::android::AttachCurrentThread();
-  JavaObjectWeakGlobalRef ref(env, jobject.obj());
+// Large files are read and compiled off JSTask when the engine can, only
+// the finalization and the run are left for FinishStreamingTask().
+void AndJSCore::loadJSFileTask(int context_id, const std::string& jspath, int64_t file_size, base::TimeDelta budget) {
+  base::FilePath filepath(jspath);
 
-  scoped_refptr<content::GinJavaBoundObject> bound_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
-  content::GinJavaBoundObject::ObjectID object_id;
+  if(streaming_min_script_size_ > 0 && file_size >= static_cast<int64_t>(streaming_min_script_size_)) {
+    TRACE_EVENT1("andjs", "AndJSCore::StartStreaming", "path", jspath);
+    // The reply comes straight back to JSTask, the held tasks are queued
+    // behind the streamed script. It counts as a queued task until it ran,
+    // idle GC stays off meanwhile.
+    base::OnceClosure done = base::BindOnce(&AndJSCore::FinishStreamingTask, base::Unretained(this), ++streaming_id_);
+    if(engine_->StartStreaming(context_id, filepath, filepath.BaseName().value(), std::move(done))) {
+      ++queued_tasks_;
+      streaming_ = true;
+      streaming_name_ = filepath.BaseName().value();
+      streaming_budget_ = budget;
+      StartPendingProfile();
+      PrepareContext(context_id);
+      return;
+    }
+  }
+
+  std::string buf;
+  bool read_ok;
   {
-    base::AutoLock locker(objects_lock_);
-    object_id = next_object_id_++;
-    objects_[object_id] = bound_object;
+    TRACE_EVENT1("andjs", "AndJSCore::ReadJSFile", "path", jspath);
+    read_ok = base::ReadFileToString(filepath, &buf);
   }
-  GinJavaBridgeObject* object = new GinJavaBridgeObject(this, object_id);
+  if(read_ok) {
+    RunTask(context_id, ScriptString(std::move(buf)), filepath.BaseName().value(), budget);
+  }
+}
 
-  v8::Isolate* isolate_ = context_holder_->isolate();
-#if ENABLE_V8_LOCKER
-  v8::Locker locked(isolate_);
-#endif
-  v8::EscapableHandleScope handle_scope(isolate_);
+void AndJSCore::FinishStreamingTask(uint64_t streaming_id) {
+  // Hibernation ran it already.
+  if(!streaming_ || streaming_id != streaming_id_)
+    return;
+  RunStreamedScript();
+}
 
-  LOG(INFO) << " Inject Anonymous Object " << object;
-  gin::Handle<GinJavaBridgeObject> bridge_object = gin::CreateHandle(isolate_, object);
-  LOG(INFO) << " Inject Anonymous Object " << "  bridge_object " << object;
-  if(!bridge_object.IsEmpty()) {
-    return handle_scope.Escape(bridge_object.ToV8());
+// Then the tasks held back meanwhile, in order, until one of them streams
+// the next file.
+void AndJSCore::RunStreamedScript() {
+  TRACE_EVENT1("andjs", "AndJSCore::RunStreamedScript", "resource_name", streaming_name_);
+  streaming_ = false;
+  AndJSStats::Add(&stats_.scripts_run, 1);
+  OnRunFinished(engine_->FinishStreaming(streaming_budget_), streaming_name_, streaming_budget_);
+  FinishQueuedTask();
+  while(!streaming_ && !streaming_held_tasks_.empty()) {
+    base::OnceClosure task = std::move(streaming_held_tasks_.front());
+    streaming_held_tasks_.pop_front();
+    std::move(task).Run();
   }
-  return handle_scope.Escape(v8::Undefined(isolate_));
 }
- 
-bool AndJSCore::InjectObject(std::string& name,
-                             const base::android::JavaRef<jobject>& jobject,
-                             const base::android::JavaRef<jclass>&  annotation_clazz) {
 
-  JNIEnv* env = base::android::AttachCurrentThread();
-  JavaObjectWeakGlobalRef ref(env, jobject.obj());
+jlong AndJSCore::LoadJSFile(JNIEnv* env,
+                            const base::android::JavaParamRef<jobject>& jcaller,
+                            jint context_id,
+                            const base::android::JavaParamRef<jstring>& jsfile,
+                            jlong timeout_ms,
+                            jint priority,
+                            const base::android::JavaParamRef<jstring>& jreplace_key) {
+  ScopedCallerTimer timer(&stats_);
+  std::string jspath (ConvertJavaStringToUTF8(env, jsfile));
+  int64_t file_size = 0;
+  if(!base::GetFileSize(base::FilePath(jspath), &file_size)) {
+    LOG(ERROR) << " LoadJSFile unable to stat " << jspath;
+    return 0;
+  }
+  return QueueScript(env, priority, jreplace_key, static_cast<size_t>(file_size),
+    base::BindOnce(&AndJSCore::loadJSFileTask, base::Unretained(this), context_id, jspath, file_size, GetRunBudget(timeout_ms)));
+}
 
-  scoped_refptr<content::GinJavaBoundObject> bound_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
-  content::GinJavaBoundObject::ObjectID object_id;
-  {
-    base::AutoLock locker(objects_lock_);
-    object_id = next_object_id_++;
-    objects_[object_id] = bound_object;
+jlong AndJSCore::LoadJSBundle(JNIEnv* env,
+                              const base::android::JavaParamRef<jobject>& jcaller,
+                              jint context_id,
+                              const base::android::JavaParamRef<jstring>& jbundle,
+                              const base::android::JavaParamRef<jstring>& jentry,
+                              jlong timeout_ms,
+                              jint priority,
+                              const base::android::JavaParamRef<jstring>& jreplace_key) {
+  ScopedCallerTimer timer(&stats_);
+  std::string bundle_path(ConvertJavaStringToUTF8(env, jbundle));
+  scoped_refptr<ModuleBundle> bundle = ModuleBundle::Open(base::FilePath(bundle_path));
+  if(!bundle)
+    return 0;
+  size_t script_size = bundle->length();
+  return QueueScript(env, priority, jreplace_key, script_size,
+    base::BindOnce(&AndJSCore::RunModuleTask, base::Unretained(this),
+                   context_id, std::move(bundle), ConvertJavaStringToUTF8(env, jentry), GetRunBudget(timeout_ms)));
+}
+
+void AndJSCore::StartProfilingTask(const std::string& title, base::TimeDelta interval) {
+  if(!engine_ready_) {
+    pending_profile_title_ = title;
+    pending_profile_interval_ = interval;
+    return;
   }
-  GinJavaBridgeObject* object = new GinJavaBridgeObject(this, object_id);
+  engine_->StartProfiling(title, interval);
+}
 
-  v8::Isolate* isolate_ = context_holder_->isolate();
-  #if ENABLE_V8_LOCKER
-  v8::Locker locked(isolate_);
-  #endif
-  gin::Runner::Scope scope(this);
+void AndJSCore::StopProfilingTask(const std::string& path) {
+  pending_profile_title_.clear();
+  std::unique_ptr<CpuProfile> profile = engine_ready_ ? engine_->StopProfiling() : nullptr;
+  if(!profile) {
+    LOG(ERROR) << " StopProfiling no profile running";
+    return;
+  }
+  profile->WriteToFile(base::FilePath(path));
+}
 
-  gin::Handle<GinJavaBridgeObject> bridge_object = gin::CreateHandle(isolate_, object);
-  LOG(INFO) << " InjectJavaObject " << name << "  bridge_object " << object;
-  if(!bridge_object.IsEmpty()) {
-    v8::Maybe<bool> result = global()->Set(context_holder_->context(), gin::StringToV8(isolate_, name), bridge_object.ToV8());
-    return !result.IsNothing() && result.FromJust();
+void AndJSCore::StartProfiling(JNIEnv* env,
+                               const base::android::JavaParamRef<jobject>& jcaller,
+                               const base::android::JavaParamRef<jstring>& jtitle,
+                               jint interval_us) {
+  std::string title(ConvertJavaStringToUTF8(env, jtitle));
+  base::TimeDelta interval = base::TimeDelta::FromMicroseconds(std::max(interval_us, 100));
+  ScopedCallerTimer timer(&stats_);
+  base::OnceClosure task = base::BindOnce(&AndJSCore::StartProfilingTask, base::Unretained(this), title, interval);
+  if(PostTaskFast(&task))
+    return;
+  base::AutoLock locker(engine_lock_);
+  if(shutdown_)
+    return;
+  PostTaskLocked(std::move(task));
+}
+
+void AndJSCore::StopProfiling(JNIEnv* env,
+                              const base::android::JavaParamRef<jobject>& jcaller,
+                              const base::android::JavaParamRef<jstring>& jpath) {
+  std::string path(ConvertJavaStringToUTF8(env, jpath));
+  ScopedCallerTimer timer(&stats_);
+  base::OnceClosure task = base::BindOnce(&AndJSCore::StopProfilingTask, base::Unretained(this), path);
+  if(PostTaskFast(&task))
+    return;
+  base::AutoLock locker(engine_lock_);
+  if(shutdown_)
+    return;
+  PostTaskLocked(std::move(task));
+}
+
+// The payload is parsed on the caller's thread, JSTask only converts it.
+jboolean AndJSCore::DispatchEvent(JNIEnv* env,
+                                  const base::android::JavaParamRef<jobject>& jcaller,
+                                  const base::android::JavaParamRef<jstring>& jtype,
+                                  const base::android::JavaParamRef<jstring>& jdata) {
+  base::Optional<base::Value> data = base::JSONReader::Read(ConvertJavaStringToUTF8(env, jdata));
+  if(!data) {
+    LOG(ERROR) << " AndJSCore invalid event payload";
+    return false;
   }
-  return false;
+  return QueueEvent(std::make_unique<ScriptEvent>(ConvertJavaStringToUTF8(env, jtype),
+                                                  std::make_unique<base::Value>(std::move(*data))));
 }
 
-void AndJSCore::Run(const std::string& jsbuf, const std::string& resource_name) {
-  v8::Isolate* isolate_ = context_holder_->isolate();
-#if ENABLE_V8_LOCKER
-    v8::Locker locked(isolate_);
-#endif
-  gin::Runner::Scope scope(this);
-  gin::TryCatch try_catch(isolate_);
-  v8::ScriptOrigin origin(gin::StringToV8(isolate_, resource_name));
+jboolean AndJSCore::DispatchStructuredEvent(JNIEnv* env,
+                                            const base::android::JavaParamRef<jobject>& jcaller,
+                                            const base::android::JavaParamRef<jstring>& jtype,
+                                            const base::android::JavaParamRef<jobject>& jdata,
+                                            jint length) {
+  const uint8_t* data = static_cast<const uint8_t*>(env->GetDirectBufferAddress(jdata.obj()));
+  if(!data || length < 0 || env->GetDirectBufferCapacity(jdata.obj()) < length) {
+    LOG(ERROR) << " AndJSCore invalid structured event buffer";
+    return false;
+  }
+  std::unique_ptr<ScriptEvent> event = std::make_unique<ScriptEvent>();
+  event->type = ConvertJavaStringToUTF8(env, jtype);
+  event->structured.assign(data, data + length);
+  AndJSStats::Add(&stats_.structured_messages, 1);
+  AndJSStats::Add(&stats_.structured_bytes, length);
+  return QueueEvent(std::move(event));
+}
+
+bool AndJSCore::QueueEvent(std::unique_ptr<ScriptEvent> event) {
+  bool schedule_drain = false;
+  if(!events_.Push(std::move(event), &schedule_drain))
+    return false;
+  if(schedule_drain) {
+    ScopedCallerTimer timer(&stats_);
+    base::OnceClosure task = base::BindOnce(&AndJSCore::DrainEventsTask, base::Unretained(this));
+    if(PostTaskFast(&task))
+      return true;
+    base::AutoLock locker(engine_lock_);
+    if(shutdown_)
+      return false;
+    // Before the first script there are no listeners, the drain just
+    // empties the queue. A hibernated instance wakes up for its listeners.
+    if(hibernation_)
+      EnsureEngineLocked(0);
+    PostTaskLocked(std::move(task));
+  }
+  return true;
+}
+
+void AndJSCore::SetStructuredReceiver(JNIEnv* env,
+                                      const base::android::JavaParamRef<jobject>& jcaller,
+                                      const base::android::JavaParamRef<jobject>& jreceiver) {
+  structured_receiver_.Set(env, jreceiver);
+}
 
-  auto maybe_script = v8::Script::Compile(context_holder_->context(), gin::StringToV8(isolate_, jsbuf), &origin);
-  v8::Local<v8::Script> script;
-  if (!maybe_script.ToLocal(&script)) {
-    LOG(ERROR) << try_catch.GetStackTrace();
+void AndJSCore::SetEventCoalesce(JNIEnv* env,
+                                 const base::android::JavaParamRef<jobject>& jcaller,
+                                 const base::android::JavaParamRef<jstring>& jtype,
+                                 jint coalesce) {
+  if(coalesce < EventChannel::kNone || coalesce > EventChannel::kAccumulate)
     return;
+  events_.SetCoalesce(ConvertJavaStringToUTF8(env, jtype), static_cast<EventChannel::Coalesce>(coalesce));
+}
+
+// One batch per task, so scripts queued meanwhile are not starved by a
+// steady stream of events.
+void AndJSCore::DrainEventsTask() {
+  TRACE_EVENT0("andjs", "AndJSCore::DrainEvents");
+  std::vector<std::unique_ptr<ScriptEvent>> events;
+  bool more = events_.Drain(&events);
+  if(engine_ready_) {
+    for(const auto& event : events)
+      engine_->DispatchEvent(*event);
+    AndJSStats::Add(&stats_.events_delivered, events.size());
+  }
+  if(more)
+    PostTaskOnJSTask(base::BindOnce(&AndJSCore::DrainEventsTask, base::Unretained(this)));
+}
+
+jint AndJSCore::GetEngineType(JNIEnv* env,
+                              const base::android::JavaParamRef<jobject>& jcaller) {
+  ScopedCallerTimer timer(&stats_);
+  {
+    ScopedCaller caller(this);
+    if(caller.running())
+      return engine_->GetType();
+  }
+  base::AutoLock locker(engine_lock_);
+  if(hibernation_)
+    return hibernation_->type;
+  return engine_ ? engine_->GetType() : type_;
+}
+
+jlong AndJSCore::GetTerminatedRunCount(JNIEnv* env,
+                                      const base::android::JavaParamRef<jobject>& jcaller) {
+  return stats_.terminated_runs.load();
+}
+
+base::android::ScopedJavaLocalRef<jstring> AndJSCore::GetStats(JNIEnv* env,
+                                                               const base::android::JavaParamRef<jobject>& jcaller) {
+  std::unique_ptr<base::DictionaryValue> stats = stats_.ToValue();
+  // Process wide, the logger and the ArrayBuffer pool are shared by all
+  // instances.
+  stats->SetDouble("logDropped", AsyncLogger::GetInstance()->dropped());
+  stats->SetDouble("arrayBufferLiveBytes", ArrayBufferPool::GetInstance()->live_bytes());
+  stats->SetDouble("arrayBufferCachedBytes", ArrayBufferPool::GetInstance()->cached_bytes());
+  std::string json;
+  base::JSONWriter::Write(*stats, &json);
+  return ConvertUTF8ToJavaString(env, json);
+}
+
+// Tears the engine and JSTask down once the queued tasks ran. Scripts on
+// JSTask call back into AndJS, so |engine_lock_| is not held while the
+// thread stops. Callers meanwhile see |hibernation_| and their tasks are
+// held until the thread is gone.
+void AndJSCore::Hibernate() {
+  TRACE_EVENT0("andjs", "AndJSCore::Hibernate");
+  std::unique_ptr<base::Thread> thread;
+  {
+    base::AutoLock locker(engine_lock_);
+    if(!engine_ || hibernating_ || shutdown_)
+      return;
+    StopFastCallersLocked();
+    hibernation_ = std::make_unique<Hibernation>();
+    hibernation_->type = engine_->GetType();
+    ++barriers_posted_;
+    PushTaskLocked(base::BindOnce(&AndJSCore::HibernateTask, base::Unretained(this), hibernation_.get()));
+    thread = std::move(thread_);
+    hibernating_ = true;
   }
+  thread->Stop();
+  thread.reset();
 
-  auto maybe = script->Run(context_holder_->context());
-  v8::Local<v8::Value> result;
-  if (!maybe.ToLocal(&result)) {
-    LOG(ERROR) << try_catch.GetStackTrace();
+  // Shutdown() waits for this, the engine is destroyed without the lock.
+  std::unique_ptr<ScriptEngine> engine;
+  {
+    base::AutoLock locker(engine_lock_);
+    engine = std::move(engine_);
+    hibernating_ = false;
+    // The held tasks go after the resume, or to a JSTask without engine.
+    if(resume_requested_)
+      EnsureEngineLocked(0);
+    resume_requested_ = false;
+    for(base::OnceClosure& task : held_tasks_)
+      PushTaskLocked(std::move(task));
+    held_tasks_.clear();
+    hibernated_cv_.Broadcast();
   }
+}
 
+void AndJSCore::Hibernate(JNIEnv* env,
+                          const base::android::JavaParamRef<jobject>& jcaller) {
+  ScopedCallerTimer timer(&stats_);
+  Hibernate();
+}
+
+void AndJSCore::HibernateTask(Hibernation* hibernation) {
+  // The scripts queued before the hibernation run first, a streamed one
+  // and the tasks it held back included. The later ones wait for this
+  // barrier and run on the resumed engine.
+  while(streaming_)
+    RunStreamedScript();
+  RunDeferredScripts();
+  barriers_run_++;
+  // Every script left has its own RunNextScriptTask() after the resume.
+  deferred_scripts_ = 0;
+  ScopedStatsTimer timer(&stats_.hibernate_time_us);
+  AndJSStats::Add(&stats_.hibernations, 1);
+  stats_.released_heap_bytes.store(engine_->GetHeapSize());
+  engine_->SaveGlobals(&hibernation->globals);
+  engine_->Shutdown();
+  engine_ready_ = false;
+
+  int64_t size = 0;
+  for(const auto& globals : hibernation->globals)
+    size += globals.second.size();
+  stats_.hibernated_bytes.store(size);
+  LOG(INFO) << " AndJSCore hibernated, released " << stats_.released_heap_bytes.load()
+            << " heap bytes, kept " << size;
+}
+
+void AndJSCore::ResumeTask(std::unique_ptr<Hibernation> hibernation,
+                           const std::vector<InjectedObject>& objects,
+                           base::TimeTicks start) {
+  TRACE_EVENT0("andjs", "AndJSCore::Resume");
+  for(int context_id : hibernation->reset_contexts) {
+    auto it = hibernation->globals.find(context_id);
+    if(it != hibernation->globals.end())
+      it->second.clear();
+    used_contexts_.erase(context_id);
+  }
+  for(int context_id : hibernation->disposed_contexts) {
+    hibernation->globals.erase(context_id);
+    used_contexts_.erase(context_id);
+  }
+  engine_->RestoreGlobals(hibernation->globals);
+  JNIEnv* env = base::android::AttachCurrentThread();
+  for(const InjectedObject& object : objects) {
+    base::android::ScopedJavaLocalRef<jobject> java_object = object.object.get(env);
+    if(!java_object.is_null())
+      engine_->InjectObject(object.context_id, object.name, java_object, object.annotation_clazz);
+  }
+  stats_.hibernated_bytes.store(0);
+  AndJSStats::Add(&stats_.resumes, 1);
+  AndJSStats::Add(&stats_.resume_time_us, (base::TimeTicks::Now() - start).InMicroseconds());
+}
+
+void AndJSCore::Shutdown() {
+  LOG(INFO) << " AndJSCore Shutdown instance " << this;
+  memory_pressure_listener_.reset();
+  events_.Close();
+  // On JSTask after the queued scripts, the workers of the engine are
+  // bound to that thread. Like Hibernate() the thread stops without the
+  // lock, a running hibernation finishes first.
+  std::unique_ptr<base::Thread> thread;
   {
-    gin::Runner::Scope scope(this);
-    v8::Local<v8::Function> func;
-    if(gin::ConvertFromV8(isolate_, result, &func)) {
-      LOG(INFO) << " result IsFunction() " << func->IsFunction();
-      if(func->IsFunction()) {
-        gin::TryCatch func_try_catch(isolate_);
-        v8::Local<v8::Value> ret;
-        if(!v8::Function::Cast(*func)->Call(context_holder_->context(), global(), 0, nullptr).ToLocal(&ret)) {
-          LOG(ERROR) << func_try_catch.GetStackTrace();
-        }
-      }
+    base::AutoLock locker(engine_lock_);
+    while(hibernating_)
+      hibernated_cv_.Wait();
+    if(shutdown_)
+      return;
+    StopFastCallersLocked();
+    shutdown_ = true;
+    if(engine_)
+      PushTaskLocked(base::BindOnce(&AndJSCore::ShutdownTask, base::Unretained(this)));
+    pending_objects_.clear();
+    hibernation_.reset();
+    {
+      base::AutoLock injected_locker(injected_lock_);
+      injected_objects_.clear();
     }
+    thread = std::move(thread_);
   }
+  if(thread)
+    thread->Stop();
 }
 
-gin::ContextHolder* AndJSCore::GetContextHolder() {
-  return context_holder_.get();
+// A streamed script and the tasks it held back are dropped, the engine
+// waits for the streaming thread.
+void AndJSCore::ShutdownTask() {
+  if(engine_ready_)
+    engine_->Shutdown();
+  engine_ready_ = false;
+  streaming_ = false;
+  streaming_held_tasks_.clear();
+  deferred_scripts_ = 0;
+}
+
+void AndJSCore::Shutdown(JNIEnv* env,
+                         const base::android::JavaParamRef<jobject>& jcaller) {
+  ScopedCallerTimer timer(&stats_);
+  Shutdown();
 }
 
 AndJSCore::~AndJSCore() = default;
@@ -21,76 +21,411 @@
 
 #ifndef __ANDJS_CORE_H__
 #define __ANDJS_CORE_H__
+#include <atomic>
+#include <deque>
+#include <map>
 #include <memory>
+#include <set>
+#include <vector>
 
 #include "base/compiler_specific.h"
 #include "base/macros.h"
-#include "base/android/jni_weak_ref.h"
 #include "base/android/jni_android.h"
-#include "base/message_loop/message_loop.h"
+#include "base/android/jni_weak_ref.h"
+#include "base/android/scoped_java_ref.h"
 #include "base/files/file_path.h"
+#include "base/memory/memory_pressure_listener.h"
+#include "base/memory/ref_counted.h"
+#include "base/message_loop/message_loop.h"
+#include "base/synchronization/condition_variable.h"
+#include "base/synchronization/lock.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/thread_annotations.h"
+#include "base/threading/platform_thread.h"
 #include "base/threading/thread.h"
-#include "gin/public/isolate_holder.h"
-#include "gin/arguments.h"
-#include "gin/runner.h"
-#include "content/public/renderer/v8_value_converter.h"
-#include "gin/public/context_holder.h"
 
-#include "content/browser/android/java/gin_java_bound_object_delegate.h"
-#include "content/browser/android/java/gin_java_bound_object.h"
+#include "andjs/andjs_events.h"
+#include "andjs/andjs_module_bundle.h"
+#include "andjs/andjs_stats.h"
+#include "andjs/andjs_structured.h"
+#include "andjs/mpsc_queue.h"
+#include "andjs/script_engine.h"
 
 namespace andjs {
 
-class AndJSCore : public gin::Runner {
+// Native peer of com.github.wuruxu.andjs.AndJS. Owns the JSTask thread and
+// the ScriptEngine selected by AndJS.Options.engine. The engine is only
+// ever touched on JSTask, Init() included: callers on other threads push
+// tasks into a lock-free MPSCQueue and a drain task on JSTask runs them in
+// order. While the engine runs they don't take |engine_lock_| either, it
+// is only needed to create, hibernate or shut down the engine.
+class AndJSCore {
   public:
-    AndJSCore();
-    ~AndJSCore() override;
+    // Scripts up to this size go to QuickJS in AUTO mode: QuickJS creates a
+    // runtime in well under a millisecond with a few hundred KB of heap while
+    // an isolate costs several ms and MBs, so V8 only pays off once there is
+    // enough code to run. data/local/tmp/engine-bench.js measures both sides.
+    static const size_t kAutoQuickJSMaxScriptSize = 16 * 1024;
+
+    // Lanes of the queued script loads, keep in sync with AndJS.Priority.
+    // The next script comes from the highest lane that has one, an idle
+    // script only runs while no other script waits.
+    enum Priority {
+      kHighPriority = 0,
+      kNormalPriority = 1,
+      kIdlePriority = 2,
+      kPriorityCount = 3,
+    };
+
+    // Mirrors AndJS.Options.
+    struct Options {
+      ScriptEngine::Type engine = ScriptEngine::kAuto;
+      size_t script_size_hint = 0;
+      base::TimeDelta run_budget;
+      bool fresh_context_per_run = false;
+      // Hibernate after this long without a task, zero never does.
+      base::TimeDelta idle_timeout;
+      size_t event_queue_capacity = 1024;
+      EventChannel::Backpressure event_backpressure = EventChannel::kDrop;
+      // V8 only, AUTO picks it. Empty keeps compiled modules in the app
+      // cache directory.
+      bool expose_wasm = false;
+      base::FilePath wasm_cache_dir;
+      // Caps the JSRuntime heap of a QuickJS instance and its workers, zero
+      // is unlimited.
+      size_t quickjs_memory_limit = 64 * 1024 * 1024;
+      // loadJSFile() hands V8 files of at least this size to a background
+      // thread to parse and compile, zero never does.
+      size_t streaming_min_script_size = 256 * 1024;
+    };
+
+    explicit AndJSCore(const Options& options);
+    ~AndJSCore();
 
     void Init();
 
+    // Returns the id of a new AndJSContext, see ScriptEngine::CreateContext().
+    // With a positive |wait_ms| the caller waits up to that long for it to
+    // exist, like InjectObject().
+    jint CreateContext(JNIEnv* env,
+                       const base::android::JavaParamRef<jobject>& jcaller,
+                       jlong wait_ms);
+
+    // False when |wait_ms| passed before it was disposed.
+    jboolean DisposeContext(JNIEnv* env,
+                            const base::android::JavaParamRef<jobject>& jcaller,
+                            jint context_id,
+                            jlong wait_ms);
+
+    // Gives |context_id| a clean global scope once the queued scripts ran.
+    jboolean ResetContext(JNIEnv* env,
+                          const base::android::JavaParamRef<jobject>& jcaller,
+                          jint context_id,
+                          jlong wait_ms);
+
+    // With a positive |wait_ms| the caller waits up to that long for the
+    // engine to bind the object and gets its result, false on timeout.
+    // Otherwise, before the engine is picked and while it hibernates, it
+    // returns at once.
     bool InjectObject(JNIEnv* env,
                       const base::android::JavaParamRef<jobject>& jcaller,
+                      jint context_id,
                       const base::android::JavaParamRef<jobject>& jobject,
                       const base::android::JavaParamRef<jstring>& jname,
-                      const base::android::JavaParamRef<jclass>&  annotation_clazz);
+                      const base::android::JavaParamRef<jclass>&  annotation_clazz,
+                      jlong wait_ms);
 
-    void LoadJSBuf(JNIEnv* env,
-                   const base::android::JavaParamRef<jobject>& jcaller,
-                   const base::android::JavaParamRef<jstring>& jsbuf);
-
-    void LoadJSFile(JNIEnv* env,
+    // The loads return the id of the queued script for CancelTask(), zero
+    // when nothing was queued. A non-null |jreplace_key| cancels the queued
+    // scripts loaded with the same key.
+    jlong LoadJSBuf(JNIEnv* env,
                     const base::android::JavaParamRef<jobject>& jcaller,
-                    const base::android::JavaParamRef<jstring>& jsfile);
+                    jint context_id,
+                    const base::android::JavaParamRef<jstring>& jsbuf,
+                    jlong timeout_ms,
+                    jint priority,
+                    const base::android::JavaParamRef<jstring>& jreplace_key);
+
+    jlong LoadJSFile(JNIEnv* env,
+                     const base::android::JavaParamRef<jobject>& jcaller,
+                     jint context_id,
+                     const base::android::JavaParamRef<jstring>& jsfile,
+                     jlong timeout_ms,
+                     jint priority,
+                     const base::android::JavaParamRef<jstring>& jreplace_key);
+
+    // Runs the module |jentry| of the bundle archive |jbundle|, its imports
+    // resolve inside the bundle.
+    jlong LoadJSBundle(JNIEnv* env,
+                       const base::android::JavaParamRef<jobject>& jcaller,
+                       jint context_id,
+                       const base::android::JavaParamRef<jstring>& jbundle,
+                       const base::android::JavaParamRef<jstring>& jentry,
+                       jlong timeout_ms,
+                       jint priority,
+                       const base::android::JavaParamRef<jstring>& jreplace_key);
+
+    // Drops the script |task_id| if it did not start yet.
+    jboolean CancelTask(JNIEnv* env,
+                        const base::android::JavaParamRef<jobject>& jcaller,
+                        jlong task_id);
+
+    // Queues the event |jtype| with the JSON |jdata| for the listeners of
+    // the main context. False when it was dropped.
+    jboolean DispatchEvent(JNIEnv* env,
+                           const base::android::JavaParamRef<jobject>& jcaller,
+                           const base::android::JavaParamRef<jstring>& jtype,
+                           const base::android::JavaParamRef<jstring>& jdata);
+
+    // The same with the first |length| bytes of the direct ByteBuffer
+    // |jdata| as data, in the StructuredWriter format.
+    jboolean DispatchStructuredEvent(JNIEnv* env,
+                                     const base::android::JavaParamRef<jobject>& jcaller,
+                                     const base::android::JavaParamRef<jstring>& jtype,
+                                     const base::android::JavaParamRef<jobject>& jdata,
+                                     jint length);
+
+    // Where postToJava() messages go, null drops them.
+    void SetStructuredReceiver(JNIEnv* env,
+                               const base::android::JavaParamRef<jobject>& jcaller,
+                               const base::android::JavaParamRef<jobject>& jreceiver);
+
+    void SetEventCoalesce(JNIEnv* env,
+                          const base::android::JavaParamRef<jobject>& jcaller,
+                          const base::android::JavaParamRef<jstring>& jtype,
+                          jint coalesce);
 
     void Shutdown(JNIEnv* env,
                   const base::android::JavaParamRef<jobject>& jcaller);
 
-    scoped_refptr<content::GinJavaBoundObject> GetObject(content::GinJavaBoundObject::ObjectID object_id);
-    gin::ContextHolder* GetContextHolder() override;
-    void Run(const std::string& jsbuf, const std::string& resource_name) override;
-    v8::Local<v8::Value> InjectObject(const base::android::JavaRef<jobject>& jobject,
-                                      const base::android::JavaRef<jclass>&  annotation_clazz);
+    // Saves the globals of all contexts, then releases the engine heap and
+    // the JSTask thread. The next call that needs the engine restores it.
+    void Hibernate(JNIEnv* env,
+                   const base::android::JavaParamRef<jobject>& jcaller);
+
+    jint GetEngineType(JNIEnv* env,
+                       const base::android::JavaParamRef<jobject>& jcaller);
+
+    jlong GetTerminatedRunCount(JNIEnv* env,
+                                const base::android::JavaParamRef<jobject>& jcaller);
+
+    void StartProfiling(JNIEnv* env,
+                        const base::android::JavaParamRef<jobject>& jcaller,
+                        const base::android::JavaParamRef<jstring>& jtitle,
+                        jint interval_us);
+
+    // Writes the profile as a .cpuprofile file once the queued tasks ran.
+    void StopProfiling(JNIEnv* env,
+                       const base::android::JavaParamRef<jobject>& jcaller,
+                       const base::android::JavaParamRef<jstring>& jpath);
+
+    // AndJSStats as a JSON object string.
+    base::android::ScopedJavaLocalRef<jstring> GetStats(JNIEnv* env,
+                                                        const base::android::JavaParamRef<jobject>& jcaller);
+
+    static ScriptEngine::Type SelectEngine(size_t script_size);
+
   private:
-    bool InjectObject(std::string& name,
-                      const base::android::JavaRef<jobject>& object,
-                      const base::android::JavaRef<jclass>& annotation_clazz);
-    void loadJSFileTask(const std::string& jspath); //'const'
+    struct PendingObject {
+      std::string name;
+      base::android::ScopedJavaGlobalRef<jobject> object;
+      base::android::ScopedJavaGlobalRef<jclass> annotation_clazz;
+    };
+
+    // Every injection, to bind the objects again after a hibernation.
+    struct InjectedObject {
+      int context_id;
+      std::string name;
+      JavaObjectWeakGlobalRef object;
+      base::android::ScopedJavaGlobalRef<jclass> annotation_clazz;
+    };
+
+    // A script load waiting in its lane. Every one has a RunNextScriptTask()
+    // on JSTask, which runs whatever script is first in line by then. It
+    // may overtake scripts, not the other tasks queued before it.
+    struct QueuedScript {
+      int64_t id;
+      std::string replace_key;
+      base::TimeTicks queued;
+      // Non-script tasks posted before it, see |barriers_posted_|.
+      int64_t barrier;
+      base::OnceClosure task;
+    };
+
+    // The result of a task a caller waits for. Shared, the caller may give
+    // up before the task runs.
+    struct SyncResult : public base::RefCountedThreadSafe<SyncResult> {
+      SyncResult();
+
+      // False when |timeout| passed first.
+      bool Wait(base::TimeDelta timeout, bool* value);
+      void Set(bool value);
+
+     private:
+      friend class base::RefCountedThreadSafe<SyncResult>;
+      ~SyncResult();
+
+      base::WaitableEvent done_;
+      bool value_;
+
+      DISALLOW_COPY_AND_ASSIGN(SyncResult);
+    };
+
+    // A caller on the lock-free path, see |running_|.
+    class ScopedCaller;
+
+    // What a hibernated instance keeps.
+    struct Hibernation {
+      ScriptEngine::Type type;
+      // Per context id, see ScriptEngine::SaveGlobals(). Written by JSTask
+      // while it hibernates, callers record their changes below instead.
+      std::map<int, std::string> globals;
+      // Contexts reset or disposed meanwhile, applied on resume.
+      std::set<int> reset_contexts;
+      std::set<int> disposed_contexts;
+    };
+
+    std::unique_ptr<ScriptEngine> CreateEngine(ScriptEngine::Type type);
+    void EnsureEngine(size_t script_size);
+    void EnsureEngineLocked(size_t script_size) EXCLUSIVE_LOCKS_REQUIRED(engine_lock_);
+    bool PostTaskFast(base::OnceClosure* task);
+    void PostTaskLocked(base::OnceClosure task) EXCLUSIVE_LOCKS_REQUIRED(engine_lock_);
+    void QueueTaskLocked(base::OnceClosure task, bool barrier) EXCLUSIVE_LOCKS_REQUIRED(engine_lock_);
+    void QueueTask(base::OnceClosure task, bool barrier);
+    void PushTaskLocked(base::OnceClosure task) EXCLUSIVE_LOCKS_REQUIRED(engine_lock_);
+    void PushTask(base::OnceClosure task);
+    void StartThreadLocked() EXCLUSIVE_LOCKS_REQUIRED(engine_lock_);
+    void StopFastCallersLocked() EXCLUSIVE_LOCKS_REQUIRED(engine_lock_);
+    scoped_refptr<SyncResult> MakeSyncResult(jlong wait_ms);
+    bool WaitForResult(scoped_refptr<SyncResult> result, jlong wait_ms, const char* what);
+    void DrainTasksTask();
+    void InitEngineTask(const std::vector<PendingObject>& objects);
+    void PostTaskOnJSTask(base::OnceClosure task);
+    jlong QueueScript(JNIEnv* env,
+                      jint priority,
+                      const base::android::JavaRef<jstring>& jreplace_key,
+                      size_t script_size,
+                      base::OnceClosure task);
+    int64_t AddScript(jint priority, const std::string& replace_key, base::OnceClosure task);
+    void RunNextScriptTask();
+    bool RunNextScript(bool* waiting);
+    void RunDeferredScripts();
+    void CreateContextTask(int context_id, scoped_refptr<SyncResult> result);
+    void DisposeContextTask(int context_id, scoped_refptr<SyncResult> result);
+    void OnIdleTimeout(uint64_t generation);
+    void RunQueuedTask(bool barrier, base::OnceClosure task);
+    void FinishQueuedTask();
+    void IdleGCTask(uint64_t generation);
+    void OnMemoryPressure(base::MemoryPressureListener::MemoryPressureLevel level);
+    void MemoryPressureTask(bool critical);
+    void Hibernate();
+    void HibernateTask(Hibernation* hibernation);
+    void ResumeTask(std::unique_ptr<Hibernation> hibernation,
+                    const std::vector<InjectedObject>& objects,
+                    base::TimeTicks start);
+    base::TimeDelta GetRunBudget(jlong timeout_ms) const;
+    void StartPendingProfile();
+    void OnRunFinished(ScriptEngine::RunStatus status, const std::string& resource_name, base::TimeDelta budget);
+    void InjectObjectTask(int context_id, const PendingObject& object, scoped_refptr<SyncResult> result);
+    void ResetContextTask(int context_id, scoped_refptr<SyncResult> result);
+    void PrepareContext(int context_id);
+    void RunTask(int context_id, const ScriptString& source, const std::string& resource_name, base::TimeDelta budget);
+    void RunModuleTask(int context_id, scoped_refptr<ModuleBundle> bundle, const std::string& entry, base::TimeDelta budget);
+    void loadJSFileTask(int context_id, const std::string& jspath, int64_t file_size, base::TimeDelta budget);
+    void FinishStreamingTask(uint64_t streaming_id);
+    void RunStreamedScript();
+    void StartProfilingTask(const std::string& title, base::TimeDelta interval);
+    void StopProfilingTask(const std::string& path);
+    bool QueueEvent(std::unique_ptr<ScriptEvent> event);
+    void DrainEventsTask();
+    void ShutdownTask();
     void Shutdown();
-    void doV8Test(const std::string& jsbuf);
 
-    static v8::Local<v8::Value> GetV8Version(gin::Arguments* args);
+    ScriptEngine::Type type_;
+    base::TimeDelta run_budget_;
+    bool fresh_context_per_run_;
+    base::TimeDelta idle_timeout_;
+    bool expose_wasm_;
+    base::FilePath wasm_cache_dir_;
+    size_t quickjs_memory_limit_;
+    size_t streaming_min_script_size_;
+    AndJSStats stats_;
+    EventChannel events_;
+    StructuredReceiver structured_receiver_;
+    std::atomic<int> next_context_id_;
+    // Contexts a script ran in since their last reset, JSTask thread only.
+    std::set<int> used_contexts_;
+    // Bumped by every non-script task, a script only runs once the ones
+    // posted before it did.
+    std::atomic<int64_t> barriers_posted_;
+    // Bumped by every task, an idle timer only fires for the latest one.
+    std::atomic<uint64_t> idle_generation_;
+    // Tasks posted by PostTaskLocked() that did not finish yet.
+    std::atomic<int> queued_tasks_;
+    // Only the idle GC task of the latest drain runs, JSTask thread only.
+    uint64_t idle_gc_generation_;
+    std::unique_ptr<base::MemoryPressureListener> memory_pressure_listener_;
 
-    typedef std::map<content::GinJavaBoundObject::ObjectID, scoped_refptr<content::GinJavaBoundObject>> ObjectMap;
-    ObjectMap objects_ GUARDED_BY(objects_lock_);
-    base::Lock objects_lock_;
-    content::GinJavaBoundObject::ObjectID next_object_id_;
+    // A profile requested before AUTO picked the engine, JSTask thread only.
+    std::string pending_profile_title_;
+    base::TimeDelta pending_profile_interval_;
+    // The script file the engine is streaming, see StartStreaming(). The
+    // queued tasks that came meanwhile are held back until it ran, so they
+    // run in the order they would without streaming. JSTask thread only.
+    bool streaming_;
+    uint64_t streaming_id_;
+    std::string streaming_name_;
+    base::TimeDelta streaming_budget_;
+    std::deque<base::OnceClosure> streaming_held_tasks_;
+    // Non-script tasks ran so far. A RunNextScriptTask() that only finds
+    // scripts queued behind one that did not run yet is deferred, the next
+    // barrier task runs it. JSTask thread only.
+    int64_t barriers_run_;
+    int deferred_scripts_;
+    // Created by the caller that picks the engine, set up by the first task
+    // on JSTask. |engine_ready_| tells JSTask whether it can be used, JSTask
+    // thread only.
+    std::unique_ptr<ScriptEngine> engine_;
+    bool engine_ready_;
+    std::vector<PendingObject> pending_objects_ GUARDED_BY(engine_lock_);
+    // Taken inside |engine_lock_| when both are needed.
+    std::vector<InjectedObject> injected_objects_ GUARDED_BY(injected_lock_);
+    base::Lock injected_lock_;
+    std::unique_ptr<Hibernation> hibernation_ GUARDED_BY(engine_lock_);
+    // Set while Hibernate() waits for JSTask to stop without the lock. The
+    // tasks posted meanwhile are held for the next thread, the engine comes
+    // back right after when one of them asked for it.
+    bool hibernating_ GUARDED_BY(engine_lock_);
+    bool resume_requested_ GUARDED_BY(engine_lock_);
+    std::vector<base::OnceClosure> held_tasks_ GUARDED_BY(engine_lock_);
+    bool shutdown_ GUARDED_BY(engine_lock_);
+    base::Lock engine_lock_;
+    // Signaled when |hibernating_| is cleared.
+    base::ConditionVariable hibernated_cv_;
+    // Set under |engine_lock_| while the engine and JSTask exist and no
+    // hibernation or shutdown is on the way. Callers that find it set queue
+    // their tasks without the lock, |active_callers_| of them at the moment.
+    // Whoever clears it waits for those, so their tasks come before the
+    // hibernation or the shutdown.
+    std::atomic<bool> running_;
+    std::atomic<int> active_callers_;
+    // For the callers that would wait for themselves.
+    std::atomic<base::PlatformThreadId> js_thread_id_;
+
+    // Script loads by Priority, oldest first.
+    std::deque<QueuedScript> lanes_[kPriorityCount] GUARDED_BY(lanes_lock_);
+    int64_t next_script_id_ GUARDED_BY(lanes_lock_);
+    base::Lock lanes_lock_;
 
-    bool InjectNativeObject();
-    std::unique_ptr<gin::IsolateHolder> instance_;
-    std::unique_ptr<gin::ContextHolder> context_holder_;
     std::unique_ptr<base::MessageLoop> message_loop_;
+    // Tasks for JSTask from other threads. Only the push that finds no drain
+    // scheduled posts one, a burst of calls costs a single PostTask().
+    MPSCQueue<base::OnceClosure> tasks_;
+    std::atomic<bool> drain_scheduled_;
+    // Null while hibernated.
     std::unique_ptr<base::Thread> thread_;
-    v8::Persistent<v8::External> v8_this_;
+
+    DISALLOW_COPY_AND_ASSIGN(AndJSCore);
 };
 
 }
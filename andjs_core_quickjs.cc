@@ -19,6 +19,7 @@
  * IN THE SOFTWARE.
  */
 #include "andjs/andjs_core_quickjs.h"
+#include <set>
 
 #include "base/threading/thread_task_runner_handle.h"
 #include "base/threading/thread_task_runner_handle.h"
@@ -27,14 +28,29 @@
 #include "base/android/jni_string.h"
 #include "base/android/jni_android.h"
 #include "base/android/scoped_java_ref.h"
+#include "base/auto_reset.h"
+#include "base/bind.h"
 #include "base/feature_list.h"
 #include "base/files/file_util.h"
-#include "crypto/aead.h"
-#include "crypto/sha2.h"
-#include "base/base64.h"
+#include "base/no_destructor.h"
+#include "base/pickle.h"
+#include "base/json/string_escape.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/utf_string_conversions.h"
+#include "base/trace_event/trace_event.h"
 #include "content/browser/android/java/gin_java_bound_object.h"
 #include "content/browser/android/java/jni_reflect.h"
 
+#include "andjs/andjs_cpu_profile.h"
+#include "andjs/andjs_events.h"
+#include "andjs/andjs_logger.h"
+#include "andjs/andjs_native_module_quickjs.h"
+#include "andjs/andjs_native_objects.h"
+#include "andjs/andjs_quickjs_arena.h"
+#include "andjs/andjs_structured.h"
+#include "andjs/andjs_worker.h"
+
 using base::android::JavaParamRef;
 using base::android::ScopedJavaLocalRef;
 using base::android::ConvertJavaStringToUTF8;
@@ -44,261 +60,398 @@ using base::android::JavaObjectArrayReader;
 
 namespace andjs {
 
-static JSClassID jsdata_class_id = 0;
-static JSClassID jscrypto_class_id = 0;
-class JSCrypto {
-  public:
-    JSCrypto(const std::string& key) {
-      aead_.reset(new crypto::Aead(crypto::Aead::AES_128_CTR_HMAC_SHA256));
-      std::string hash256_ = crypto::SHA256HashString(key);
-      aead_nonce_.assign(hash256_, 0, aead_->NonceLength());
-      aead_key_ = crypto::SHA256HashString(hash256_+aead_nonce_);
-      aead_key_.append(hash256_, 0, 16);
-      aead_->Init(&aead_key_);
-    }
-
-    bool Seal(const std::string& plaintext, std::string& output) {
-      std::string ciphertext;
-      if(aead_->Seal(plaintext, aead_nonce_, "jscrypto", &ciphertext)) {
-        base::Base64Encode(ciphertext, &output);
-        return true;
-      }
-      return false;
-    }
-
-    bool Open(const std::string& ciphertext, std::string& output) {
-      base::Base64Decode(ciphertext, &output);
-      if(aead_->Open(output, aead_nonce_, "jscrypto", &output)) {
-        return true;
-      }
-      return false;
-    }
-
-    ~JSCrypto() {}
+static JSClassID worker_class_id = 0;
 
-  private:
-    std::string aead_nonce_;
-    std::string aead_key_;
-	std::unique_ptr<crypto::Aead> aead_;
-    DISALLOW_COPY_AND_ASSIGN(JSCrypto);
+static JSClassDef worker_class = {
+    "Worker",
 };
 
-static JSValue get_jscrypto_object(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-  const char* str = JS_ToCString(ctx, argv[0]);
-  if(!str) return JS_EXCEPTION;
+static AndJSCoreQuickJS* GetEngine(JSContext* ctx) {
+  return static_cast<AndJSCoreQuickJS*>(JS_GetContextOpaque(ctx));
+}
 
-  JSValue obj = JS_NewObjectClass(ctx, jscrypto_class_id);
-  if(JS_IsException(obj)) return obj;
-  
-  JSCrypto* crypto = new JSCrypto(str);
-  if(crypto == NULL) return JS_EXCEPTION;
+static JSValue worker_constructor(JSContext *ctx, JSValueConst new_target, int argc, JSValueConst *argv) {
+  return GetEngine(ctx)->NewWorker(argc, argv);
+}
 
-  JS_SetOpaque(obj, crypto);
-  return obj;
+// The worker id is kept as the opaque pointer of the object.
+static JSValue worker_post_message(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+  void* opaque = JS_GetOpaque2(ctx, this_val, worker_class_id);
+  if(opaque == NULL) return JS_EXCEPTION;
+  return GetEngine(ctx)->PostWorkerMessage(static_cast<int>(reinterpret_cast<intptr_t>(opaque)), argc, argv);
 }
 
-static void jscrypto_finalizer(JSRuntime *rt, JSValue val) {
-    JSCrypto *crypto = (JSCrypto* )JS_GetOpaque(val, jscrypto_class_id);
-    if (crypto) {
-      delete crypto;
-    }
+static JSValue worker_terminate(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+  void* opaque = JS_GetOpaque2(ctx, this_val, worker_class_id);
+  if(opaque == NULL) return JS_EXCEPTION;
+  return GetEngine(ctx)->TerminateWorker(static_cast<int>(reinterpret_cast<intptr_t>(opaque)));
 }
 
-//static void jscrypto_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func) {
-//    JSCrypto *crypto = JS_GetOpaque(val, jscrypto_class_id);
-//    if (crypto) {
-//        JS_MarkValue(rt, th->func, mark_func);
-//    }
-//}
+static JSValue worker_global_post_message(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+  return GetEngine(ctx)->PostMessageToParent(argc, argv);
+}
 
-static JSClassDef jscrypto_class = {
-    "JSCrypto",
-    .finalizer = jscrypto_finalizer,
-    //.gc_mark = jscrypto_mark,
-};
+static JSValue add_event_listener(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+  return GetEngine(ctx)->AddEventListener(ctx, argc, argv);
+}
 
-static JSValue jscrypto_seal_open(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic) {
-  JSCrypto* crypto = (JSCrypto *)JS_GetOpaque2(ctx, this_val, jscrypto_class_id);
-  if(crypto == NULL) return JS_EXCEPTION;
-  const char* str = JS_ToCString(ctx, argv[0]);
-  std::string output;
-  if((magic == 0 && crypto->Seal(str, output)) ||
-     (magic == 1 && crypto->Open(str, output))) {
-    LOG(INFO) << "jscrypto_seal_open " << str << " ==> " << output;
-    return JS_NewString(ctx, output.c_str());
-  }
-  return JS_UNDEFINED;
+static JSValue post_to_java(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+  return GetEngine(ctx)->PostToJava(ctx, argc, argv);
 }
 
-static const JSCFunctionListEntry jscrypto_method_funcs[] = {
-    JS_CFUNC_MAGIC_DEF("seal", 1, jscrypto_seal_open, 0),
-    JS_CFUNC_MAGIC_DEF("open", 1, jscrypto_seal_open, 1),
+static JSValue remove_event_listener(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+  return GetEngine(ctx)->RemoveEventListener(ctx, argc, argv);
+}
+
+static const JSCFunctionListEntry worker_method_funcs[] = {
+    JS_CFUNC_DEF("postMessage", 2, worker_post_message),
+    JS_CFUNC_DEF("terminate", 0, worker_terminate),
 };
 
-AndJSCore::AndJSCore() : next_object_id_(1), message_loop_(new base::MessageLoopForIO()) {
+AndJSCoreQuickJS::AndJSCoreQuickJS(AndJSStats* stats, StructuredReceiver* structured_receiver)
+    : memory_limit_(0),
+      stats_(stats),
+      structured_receiver_(structured_receiver),
+      batched_calls_(stats),
+      run_terminated_(false),
+      error_ctor_(JS_UNDEFINED),
+      in_sample_(false),
+      worker_host_(nullptr),
+      terminate_requested_(false),
+      next_object_id_(1) {
 }
 
-void AndJSCore::Init() {
-  rt_ = JS_NewRuntime();
-  ctx_ = JS_NewContext(rt_);
+ScriptEngine::Type AndJSCoreQuickJS::GetType() const {
+  return kQuickJS;
+}
+
+void AndJSCoreQuickJS::Init() {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::Init");
+  arena_ = std::make_unique<QuickJSArena>(stats_);
+  rt_ = JS_NewRuntime2(&QuickJSArena::kMallocFunctions, arena_.get());
 
-  JS_SetMemoryLimit(rt_, 51200);
   JS_SetGCThreshold(rt_, 25600);
-  JS_SetModuleLoaderFunc(rt_, NULL, js_module_loader, NULL);
+  JS_SetModuleLoaderFunc(rt_, &AndJSCoreQuickJS::NormalizeModuleName,
+                         &AndJSCoreQuickJS::LoadModule, this);
+  JS_SetInterruptHandler(rt_, &AndJSCoreQuickJS::InterruptHandler, this);
+
+  /* classes belong to the runtime, their prototypes to each context */
+  QuickJSNativeClass<AdbLog>::Register(rt_);
+  QuickJSNativeClass<JSCrypto>::Register(rt_);
+  QuickJSNativeClass<AndJSControl>::Register(rt_);
+  QuickJSNativeClass<Encoding>::Register(rt_);
+  QuickJSNativeClass<JSHash>::Register(rt_);
+  QuickJSNativeClass<KV>::Register(rt_);
+  QuickJSNativeClass<KVStoreObject>::Register(rt_);
+  NewQuickJSClassID(&worker_class_id);
+  JS_NewClass(rt_, worker_class_id, &worker_class);
+
+  ctx_ = NewContext();
+  CHECK(ctx_);
+  contexts_[kMainContextId] = ctx_;
+  // After the main context, which alone takes a few hundred KB.
+  if(memory_limit_)
+    JS_SetMemoryLimit(rt_, memory_limit_);
+  LOG(INFO) << " InjectNativeObject DONE";
+}
+
+void AndJSCoreQuickJS::SetMemoryLimit(size_t memory_limit) {
+  memory_limit_ = memory_limit;
+}
+
+// Null once the runtime is over its memory limit.
+JSContext* AndJSCoreQuickJS::NewContext() {
+  JSContext* ctx = JS_NewContext(rt_);
+  if(!ctx) {
+    LOG(ERROR) << " AndJSCoreQuickJS out of memory for a new context, limit " << memory_limit_;
+    return nullptr;
+  }
+  JS_SetContextOpaque(ctx, this);
+  native_async_[ctx] = std::make_unique<QuickJSNativeAsync>(
+      ctx, base::BindRepeating(&AndJSCoreQuickJS::SettleNativeAsync, base::Unretained(this), ctx));
+  base::AutoReset<JSContext*> scoped_context(&ctx_, ctx);
   js_init_module_std(ctx_, "std");
   js_init_module_os(ctx_, "os");
-
   InjectNativeObject();
-  LOG(INFO) << " InjectNativeObject DONE";
+  return ctx;
+}
 
-  thread_.reset(new base::Thread("JSTask"));
-  thread_->Start();
+JSContext* AndJSCoreQuickJS::GetContext(int context_id) {
+  auto it = contexts_.find(context_id);
+  if(it == contexts_.end()) {
+    LOG(ERROR) << " AndJSCoreQuickJS unknown context " << context_id;
+    return nullptr;
+  }
+  return it->second;
 }
 
-void AndJSCore::Shutdown() {
-  JS_FreeContext(ctx_);
-  JS_FreeRuntime(rt_);
-  LOG(INFO) << " AndJSCore Shutdown instance " ;
+bool AndJSCoreQuickJS::CreateContext(int context_id) {
+  TRACE_EVENT1("andjs", "AndJSCoreQuickJS::CreateContext", "context_id", context_id);
+  ScopedStatsTimer timer(&stats_->context_create_time_us);
+  JSContext* ctx = NewContext();
+  if(!ctx)
+    return false;
+  AndJSStats::Add(&stats_->contexts_created, 1);
+  contexts_[context_id] = ctx;
+  return true;
 }
- 
-JavaObjectWeakGlobalRef AndJSCore::GetObjectWeakRef(content::GinJavaBoundObject::ObjectID object_id) {
-  LOG(INFO) << " *AndJSCore::GetObjectWeakRef* " << object_id;
-  return JavaObjectWeakGlobalRef();
+
+void AndJSCoreQuickJS::DisposeContext(int context_id) {
+  auto it = contexts_.find(context_id);
+  if(context_id == kMainContextId || it == contexts_.end())
+    return;
+  TerminateWorkers(it->second);
+  FreeContext(it->second);
+  contexts_.erase(it);
+  injected_objects_.erase(context_id);
 }
 
-static JSValue adb_info(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-  std::string output("");
+// A new JSContext in place of the old one. QuickJS cannot copy a context,
+// but a new one only pays for the intrinsics: injected objects are bound
+// again from the reflected classes and their per context prototypes are
+// built on first use.
+void AndJSCoreQuickJS::ResetContext(int context_id) {
+  auto it = contexts_.find(context_id);
+  if(it == contexts_.end())
+    return;
+  TRACE_EVENT1("andjs", "AndJSCoreQuickJS::ResetContext", "context_id", context_id);
+  ScopedStatsTimer timer(&stats_->context_reset_time_us);
+  // Out of memory the old scope stays.
+  JSContext* fresh = NewContext();
+  if(!fresh)
+    return;
+  AndJSStats::Add(&stats_->context_resets, 1);
 
-  for(int i = 0; i < argc; i++) {
-    const char* str = JS_ToCString(ctx, argv[i]);
-    if(!str) return JS_EXCEPTION;
-    output.append(str);
-    JS_FreeCString(ctx, str);
+  TerminateWorkers(it->second);
+  JSContext* old_context = it->second;
+  it->second = fresh;
+  base::AutoReset<JSContext*> scoped_context(&ctx_, it->second);
+  if(profile_ && context_id == kMainContextId) {
+    // The sampler builds its errors with the Error of the main context.
+    JS_FreeValue(ctx_, error_ctor_);
+    JSValue global = JS_GetGlobalObject(ctx_);
+    error_ctor_ = JS_GetPropertyStr(ctx_, global, "Error");
+    JS_FreeValue(ctx_, global);
   }
-  LOG(INFO) << " " << output;
-  return JS_UNDEFINED;
-}
+  FreeContext(old_context);
 
-static JSValue adb_error(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-  std::string output("");
-  for(int i = 0; i < argc; i++) {
-    const char* str = JS_ToCString(ctx, argv[i]);
-    if(!str) return JS_EXCEPTION;
-    output.append(str);
-    JS_FreeCString(ctx, str);
+  JSValue global = JS_GetGlobalObject(ctx_);
+  for(const InjectedObject& injected : injected_objects_[context_id]) {
+    JS_SetPropertyStr(ctx_, global, injected.name.c_str(),
+                      NewJavaObject(injected.object_id, *injected.java_class));
   }
-  LOG(ERROR) << " " << output;
-  return JS_UNDEFINED;
+  JS_FreeValue(ctx_, global);
 }
 
-static JSValue jscrypto_constructor(JSContext *ctx, JSValueConst new_target, int argc, JSValueConst *argv) {
-  if(argc == 1) {
-    const char* str = JS_ToCString(ctx, argv[0]);
-    if(str) {
-      JSValue obj = JS_NewObjectClass(ctx, jscrypto_class_id);
-      if(JS_IsException(obj)) return obj;
-
-      JSCrypto* crypto = new JSCrypto(str);
-      if(crypto == NULL) return JS_EXCEPTION;
-
-      JS_SetOpaque(obj, crypto);
-      return obj;
+void AndJSCoreQuickJS::TerminateWorkers(JSContext* ctx) {
+  for(auto worker = worker_objects_.begin(); worker != worker_objects_.end();) {
+    if(worker->second.ctx == ctx) {
+      workers_->Terminate(worker->first);
+      JS_FreeValue(worker->second.ctx, worker->second.object);
+      worker = worker_objects_.erase(worker);
+    } else {
+      ++worker;
     }
   }
-  return JS_EXCEPTION;
 }
 
-static JSValue js_Crypto_key(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-  if(argc == 1) {
-    const char* str = JS_ToCString(ctx, argv[0]);
-    if(str) {
-      JSValue obj = JS_NewObjectClass(ctx, jscrypto_class_id);
-      if(JS_IsException(obj)) return obj;
-
-      JSCrypto* crypto = new JSCrypto(str);
-      if(crypto == NULL) return JS_EXCEPTION;
-
-      JS_SetOpaque(obj, crypto);
-      return obj;
+// The enumerable string keyed globals of |ctx| that are not in |skipped|.
+static std::vector<std::string> GetScriptGlobals(JSContext* ctx, const std::set<std::string>& skipped) {
+  std::vector<std::string> names;
+  JSValue global = JS_GetGlobalObject(ctx);
+  JSPropertyEnum* props;
+  uint32_t length;
+  if(JS_GetOwnPropertyNames(ctx, &props, &length, global, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) == 0) {
+    for(uint32_t i = 0; i < length; i++) {
+      const char* name = JS_AtomToCString(ctx, props[i].atom);
+      if(name && !skipped.count(name))
+        names.push_back(name);
+      JS_FreeCString(ctx, name);
+      JS_FreeAtom(ctx, props[i].atom);
     }
+    js_free(ctx, props);
   }
-  return JS_EXCEPTION;
+  JS_FreeValue(ctx, global);
+  return names;
 }
 
-static const JSCFunctionListEntry jscrypto_funcs[] = {
-  JS_CFUNC_DEF("key", 1, js_Crypto_key ),
-};
-
-bool AndJSCore::InjectNativeObject() {
-  JSValue global, adb, jscrypto;
-  global = JS_GetGlobalObject(ctx_);
+void AndJSCoreQuickJS::SaveGlobals(std::map<int, std::string>* globals) {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::SaveGlobals");
+  std::set<std::string> builtins;
+  {
+    JSContext* fresh = NewContext();
+    if(fresh) {
+      for(const std::string& name : GetScriptGlobals(fresh, builtins))
+        builtins.insert(name);
+      FreeContext(fresh);
+    }
+  }
 
-  adb = JS_NewObject(ctx_);
-  JS_SetPropertyStr(ctx_, adb, "info", JS_NewCFunction(ctx_, adb_info, "info", 1));
-  JS_SetPropertyStr(ctx_, adb, "error", JS_NewCFunction(ctx_, adb_error, "error", 1));
-  JS_SetPropertyStr(ctx_, global, "adb", adb);
+  for(auto& context : contexts_) {
+    JSContext* ctx = context.second;
+    std::set<std::string> skipped(builtins);
+    for(const InjectedObject& injected : injected_objects_[context.first])
+      skipped.insert(injected.name);
 
-  /* JSData class */
-  JS_NewClassID(&jsdata_class_id);
+    base::Pickle pickle;
+    JSValue global = JS_GetGlobalObject(ctx);
+    for(const std::string& name : GetScriptGlobals(ctx, skipped)) {
+      JSValue value = JS_GetPropertyStr(ctx, global, name.c_str());
+      size_t size;
+      uint8_t* buf = JS_WriteObject(ctx, &size, value, 0);
+      JS_FreeValue(ctx, value);
+      if(!buf) {
+        ANDJS_LOG(Debug) << " SaveGlobals skips " << name;
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        continue;
+      }
+      pickle.WriteString(name);
+      pickle.WriteData(reinterpret_cast<const char*>(buf), static_cast<int>(size));
+      js_free(ctx, buf);
+    }
+    JS_FreeValue(ctx, global);
+    (*globals)[context.first].assign(static_cast<const char*>(pickle.data()), pickle.size());
+  }
+}
 
-  /* JSCrypto class */
-  JSValue proto;
-  JS_NewClassID(&jscrypto_class_id);
-  JS_NewClass(JS_GetRuntime(ctx_), jscrypto_class_id, &jscrypto_class);
-  proto = JS_NewObject(ctx_);
-  JS_SetPropertyFunctionList(ctx_, proto, jscrypto_method_funcs, countof(jscrypto_method_funcs));
-  JS_SetClassProto(ctx_, jscrypto_class_id, proto);
+void AndJSCoreQuickJS::RestoreGlobals(const std::map<int, std::string>& globals) {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::RestoreGlobals");
+  for(const auto& entry : globals) {
+    if(!contexts_.count(entry.first) && !CreateContext(entry.first))
+      continue;
+    if(entry.second.empty())
+      continue;
 
-  JS_SetPropertyStr(ctx_, global, "getJSCrypto", JS_NewCFunction(ctx_, get_jscrypto_object, "getJSCrypto", 1));
+    JSContext* ctx = contexts_[entry.first];
+    JSValue global = JS_GetGlobalObject(ctx);
+    base::Pickle pickle(entry.second.data(), static_cast<int>(entry.second.size()));
+    base::PickleIterator iter(pickle);
+    std::string name;
+    const char* data;
+    int length;
+    while(iter.ReadString(&name) && iter.ReadData(&data, &length)) {
+      JSValue value = JS_ReadObject(ctx, reinterpret_cast<const uint8_t*>(data), length, 0);
+      if(JS_IsException(value)) {
+        LOG(ERROR) << " RestoreGlobals failed on " << name;
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        continue;
+      }
+      JS_SetPropertyStr(ctx, global, name.c_str(), value);
+    }
+    JS_FreeValue(ctx, global);
+  }
+}
 
-  JSValueConst jscrypto_obj;
-  jscrypto_obj = JS_NewGlobalCConstructor(ctx_, "JSCrypto", jscrypto_constructor, 1, proto);
-  JS_SetPropertyFunctionList(ctx_, jscrypto_obj, jscrypto_funcs, 1);
+// What the arena holds, freed blocks waiting for reuse included.
+size_t AndJSCoreQuickJS::GetHeapSize() {
+  return arena_->reserved_bytes();
+}
 
-  JS_FreeValue(ctx_, global);
+// QuickJS frees by reference counting, JS_RunGC() only collects cycles and
+// has no incremental mode, so one full pass per idle period. Small heaps
+// keep it short.
+bool AndJSCoreQuickJS::CollectIdleGarbage(base::TimeDelta budget) {
+  RunGC();
   return true;
 }
 
-bool AndJSCore::InjectObject(JNIEnv* env,
-                             const base::android::JavaParamRef<jobject>& jcaller,
-                             const base::android::JavaParamRef<jobject>& jobject,
-                             const base::android::JavaParamRef<jstring>& jname,
-                             const base::android::JavaParamRef<jclass>&  annotation_clazz) {
-  std::string name(ConvertJavaStringToUTF8(env, jname));
-  return InjectObject(name, jobject, annotation_clazz);
+void AndJSCoreQuickJS::OnMemoryPressure(bool critical) {
+  AndJSStats::Add(&stats_->memory_pressure_gcs, 1);
+  RunGC();
 }
 
-void AndJSCore::LoadJSBuf(JNIEnv* env,
-                          const base::android::JavaParamRef<jobject>& jcaller,
-                          const base::android::JavaParamRef<jstring>& jsbuf) {
-  std::string buf(ConvertJavaStringToUTF8(env, jsbuf));
-  thread_->task_runner()->PostTask(FROM_HERE, base::BindRepeating(&AndJSCore::Run, base::Unretained(this), buf, "_membuf.js_"));
+void AndJSCoreQuickJS::RunGC() {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::RunGC");
+  base::TimeTicks start = base::TimeTicks::Now();
+  JS_RunGC(rt_);
+  stats_->AddGCPause(base::TimeTicks::Now() - start);
 }
 
-void AndJSCore::LoadJSFile(JNIEnv* env,
-                           const base::android::JavaParamRef<jobject>& jcaller,
-                           const base::android::JavaParamRef<jstring>& jsfile) {
-  std::string jspath (ConvertJavaStringToUTF8(env, jsfile));
-  std::string buf;
-  base::FilePath filepath(jspath);
-  if(base::ReadFileToString(filepath, &buf)) {
-    thread_->task_runner()->PostTask(FROM_HERE, base::BindRepeating(&AndJSCore::Run, base::Unretained(this), buf, filepath.BaseName().value()));
-  }
+void AndJSCoreQuickJS::FlushBatchedCalls() {
+  batched_calls_.Flush();
 }
 
-void AndJSCore::Shutdown(JNIEnv* env,
-                          const base::android::JavaParamRef<jobject>& jcaller) {
-  Shutdown();
+void AndJSCoreQuickJS::Shutdown() {
+  batched_calls_.Flush();
+  StopProfiling();
+  workers_.reset();
+  for(auto& worker : worker_objects_)
+    JS_FreeValue(worker.second.ctx, worker.second.object);
+  worker_objects_.clear();
+  for(auto& context : contexts_)
+    FreeContext(context.second);
+  contexts_.clear();
+  ctx_ = nullptr;
+  JS_FreeRuntime(rt_);
+  arena_.reset();
+  LOG(INFO) << " AndJSCoreQuickJS Shutdown instance " ;
 }
+ 
+JavaObjectWeakGlobalRef AndJSCoreQuickJS::GetObjectWeakRef(content::GinJavaBoundObject::ObjectID object_id) {
+  ANDJS_LOG(Debug) << " *AndJSCoreQuickJS::GetObjectWeakRef* " << object_id;
+  return JavaObjectWeakGlobalRef();
+}
+
+bool AndJSCoreQuickJS::InjectNativeObject() {
+  JSValue global = JS_GetGlobalObject(ctx_);
+
+  QuickJSNativeClass<AdbLog>::InitPrototype(ctx_);
+  JS_SetPropertyStr(ctx_, global, "adb", QuickJSNativeClass<AdbLog>::Wrap(ctx_, std::make_unique<AdbLog>()));
+
+  QuickJSNativeClass<AndJSControl>::InitPrototype(ctx_);
+  JS_SetPropertyStr(ctx_, global, "andjs",
+                    QuickJSNativeClass<AndJSControl>::Wrap(ctx_, std::make_unique<AndJSControl>(&batched_calls_)));
+
+  QuickJSNativeClass<JSCrypto>::InitPrototype(ctx_);
+  QuickJSNativeClass<JSHash>::InitPrototype(ctx_);
+  JS_SetPropertyStr(ctx_, global, "jscrypto", QuickJSNativeClass<JSCrypto>::Wrap(ctx_, std::make_unique<JSCrypto>()));
+  JSValue jscrypto_class = QuickJSNativeClass<JSCrypto>::NewConstructor(ctx_);
+  JS_SetPropertyStr(ctx_, jscrypto_class, "key", JS_DupValue(ctx_, jscrypto_class));
+  JS_SetPropertyStr(ctx_, global, "getJSCrypto", JS_DupValue(ctx_, jscrypto_class));
+  JS_SetPropertyStr(ctx_, global, JSCrypto::kClassName, jscrypto_class);
+
+  QuickJSNativeClass<KV>::InitPrototype(ctx_);
+  QuickJSNativeClass<KVStoreObject>::InitPrototype(ctx_);
+  JS_SetPropertyStr(ctx_, global, "kv", QuickJSNativeClass<KV>::Wrap(ctx_, std::make_unique<KV>()));
+
+  QuickJSNativeClass<Encoding>::InitPrototype(ctx_);
+  JSValue encoding = QuickJSNativeClass<Encoding>::Wrap(ctx_, std::make_unique<Encoding>());
+  JS_SetPropertyStr(ctx_, global, "encoding", JS_DupValue(ctx_, encoding));
+  /* TextEncoder, TextDecoder, atob() and btoa() */
+  JSValue prelude = JS_Eval(ctx_, Encoding::kPrelude, strlen(Encoding::kPrelude), "<encoding>", JS_EVAL_TYPE_GLOBAL);
+  if(!JS_IsException(prelude)) {
+    JSValue prelude_args[] = { global, encoding };
+    JSValue prelude_result = JS_Call(ctx_, prelude, JS_UNDEFINED, 2, prelude_args);
+    if(JS_IsException(prelude_result))
+      JS_FreeValue(ctx_, JS_GetException(ctx_));
+    JS_FreeValue(ctx_, prelude_result);
+  } else {
+    JS_FreeValue(ctx_, JS_GetException(ctx_));
+  }
+  JS_FreeValue(ctx_, prelude);
+  JS_FreeValue(ctx_, encoding);
+
+  /* Worker class */
+  JSValue proto = JS_NewObject(ctx_);
+  JS_SetPropertyFunctionList(ctx_, proto, worker_method_funcs, countof(worker_method_funcs));
+  JS_SetClassProto(ctx_, worker_class_id, proto);
+  JS_NewGlobalCConstructor(ctx_, "Worker", worker_constructor, 1, proto);
+  JS_SetPropertyStr(ctx_, global, "addEventListener",
+                    JS_NewCFunction(ctx_, add_event_listener, "addEventListener", 2));
+  JS_SetPropertyStr(ctx_, global, "removeEventListener",
+                    JS_NewCFunction(ctx_, remove_event_listener, "removeEventListener", 2));
+  if(structured_receiver_)
+    JS_SetPropertyStr(ctx_, global, "postToJava", JS_NewCFunction(ctx_, post_to_java, "postToJava", 2));
+  if(worker_host_) {
+    JS_SetPropertyStr(ctx_, global, "postMessage",
+                      JS_NewCFunction(ctx_, worker_global_post_message, "postMessage", 2));
+  }
 
-//static void jscrypto_finalizer(JSRuntime *rt, JSValue val) {
-//    JSCrypto *crypto = (JSCrypto* )JS_GetOpaque(val, jscrypto_class_id);
-//    if (crypto) {
-//      delete crypto;
-//    }
-//}
+  JS_FreeValue(ctx_, global);
+  return true;
+}
 
-std::unique_ptr<base::Value> AndJSCore::FromJSValue(JSValue val) {
+std::unique_ptr<base::Value> AndJSCoreQuickJS::FromJSValue(JSValue val) {
   uint32_t tag = JS_VALUE_GET_TAG(val);
   //LOG(INFO) << " FromJSValue jsvalue.type=" << tag;
   switch(tag) {
@@ -343,8 +496,8 @@ std::unique_ptr<base::Value> AndJSCore::FromJSValue(JSValue val) {
   return std::make_unique<base::Value>();
 }
 
-JSValue AndJSCore::ToJSValue(const base::Value* value) {
-  LOG(INFO) << " ToJSValue value.type = " << value->type();
+JSValue AndJSCoreQuickJS::ToJSValue(const base::Value* value) {
+  ANDJS_LOG(Debug) << " ToJSValue value.type = " << value->type();
   switch(value->type()) {
     case base::Value::Type::NONE:
       return JS_NULL;
@@ -368,10 +521,19 @@ JSValue AndJSCore::ToJSValue(const base::Value* value) {
       value->GetAsString(&val);
       return JS_NewString(ctx_, val.c_str());
     }
-    case base::Value::Type::LIST:
-    break;
-    case base::Value::Type::DICTIONARY:
-    break;
+    case base::Value::Type::LIST: {
+      JSValue array = JS_NewArray(ctx_);
+      uint32_t index = 0;
+      for(const base::Value& item : value->GetList())
+        JS_SetPropertyUint32(ctx_, array, index++, ToJSValue(&item));
+      return array;
+    }
+    case base::Value::Type::DICTIONARY: {
+      JSValue object = JS_NewObject(ctx_);
+      for(const auto& item : value->DictItems())
+        JS_SetPropertyStr(ctx_, object, item.first.c_str(), ToJSValue(&item.second));
+      return object;
+    }
     case base::Value::Type::BINARY: {
       return JS_NewArrayBufferCopy(ctx_, value->GetBlob().data(), value->GetBlob().size());
     }
@@ -382,15 +544,50 @@ JSValue AndJSCore::ToJSValue(const base::Value* value) {
   return JS_UNDEFINED;
 }
 
+// A method of a java class prototype, |magic| is the class id and the
+// object id is the opaque pointer of |this_val|.
 static JSValue java_object_invoke(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue* data) {
-  content::GinJavaBoundObject::ObjectID object_id = magic;
-  AndJSCore* thiz = (AndJSCore* )JS_GetOpaque(data[0], jsdata_class_id);
-  const char* method_name = JS_ToCString(ctx, data[1]);
+  void* opaque = JS_GetOpaque2(ctx, this_val, static_cast<JSClassID>(magic));
+  if(opaque == NULL) return JS_EXCEPTION;
+  content::GinJavaBoundObject::ObjectID object_id = static_cast<int32_t>(reinterpret_cast<intptr_t>(opaque));
+  AndJSCoreQuickJS* thiz = GetEngine(ctx);
+  const char* method_cstr = JS_ToCString(ctx, data[0]);
+  if(!method_cstr) return JS_EXCEPTION;
+  std::string method_name(method_cstr);
+  JS_FreeCString(ctx, method_cstr);
   scoped_refptr<content::GinJavaBoundObject> bound_object = thiz->GetObject(object_id);
-  LOG(INFO) << " java_object_invoke " << " object_id " << object_id << " method_name " << method_name;
+  if(!bound_object)
+    return JS_ThrowTypeError(ctx, "%s", kJavaObjectGone);
+  JNIEnv* env = base::android::AttachCurrentThread();
+  base::android::ScopedJavaLocalRef<jobject> object = bound_object->GetLocalRef(env);
+  if(object.is_null())
+    return JS_ThrowTypeError(ctx, "%s", kJavaObjectGone);
+  AndJSStats* stats = thiz->stats();
+  TRACE_EVENT2("andjs", "java_object_invoke",
+               "class", content::GetClassName(env, bound_object->GetLocalClassRef(env)),
+               "method", method_name);
+  AndJSStats::Add(&stats->bridge_calls, 1);
+  ANDJS_LOG(Debug) << " java_object_invoke " << " object_id " << object_id << " method_name " << method_name;
+
+  const ClassBinding* binding = thiz->GetClassBinding(static_cast<JSClassID>(magic));
+  const MethodBinding* method = binding ? binding->Find(method_name, argc) : nullptr;
+  if(method && method->batched)
+    return thiz->InvokeBatched(*binding, *method, object_id, object, argc, argv);
+  // Any other call runs after the batched calls made before it.
+  thiz->FlushBatchedCalls();
+  if(method && method->direct) {
+    AndJSStats::Add(&stats->bridge_direct_calls, 1);
+    return thiz->InvokeDirect(*binding, *method, object, argc, argv);
+  }
+
   base::ListValue arguments;
-  for(int i = 0; i < argc; i++) {
-    arguments.Append(thiz->FromJSValue(argv[i]));
+  {
+    TRACE_EVENT0("andjs", "AndJSCoreQuickJS::FromJSValue");
+    for(int i = 0; i < argc; i++) {
+      std::unique_ptr<base::Value> arg = thiz->FromJSValue(argv[i]);
+      AndJSStats::Add(&stats->bytes_converted, AndJSStats::EstimateValueSize(*arg));
+      arguments.Append(std::move(arg));
+    }
   }
 
   content::GinJavaBridgeError error;
@@ -401,15 +598,15 @@ static JSValue java_object_invoke(JSContext *ctx, JSValueConst this_val, int arg
   result->Invoke();
   error = result->GetInvocationError();
 
-  JS_FreeCString(ctx, method_name);
   if (result->HoldsPrimitiveResult()) {
     base::Value* v8_result;
     std::unique_ptr<base::ListValue> result_copy(result->GetPrimitiveResult().DeepCopy());
     if(result_copy->Get(0, &v8_result)) {
+      TRACE_EVENT0("andjs", "AndJSCoreQuickJS::ToJSValue");
+      AndJSStats::Add(&stats->bytes_converted, AndJSStats::EstimateValueSize(*v8_result));
       return thiz->ToJSValue(v8_result);
     }
   } else if (!result->GetObjectResult().is_null()) {
-    JNIEnv* env = base::android::AttachCurrentThread();
     JavaObjectWeakGlobalRef ref(env, result->GetObjectResult().obj());
     //scoped_refptr<content::GinJavaBoundObject> bound_object = content::GinJavaBoundObject::CreateNamed(ref, result->GetSafeAnnotationClass());
     return thiz->ToJSObject(result->GetObjectResult(), result->GetSafeAnnotationClass());
@@ -418,96 +615,1217 @@ static JSValue java_object_invoke(JSContext *ctx, JSValueConst this_val, int arg
   return JS_UNDEFINED;
 }
 
-scoped_refptr<content::GinJavaBoundObject> AndJSCore::GetObject(content::GinJavaBoundObject::ObjectID object_id) {
+// Return values of generated bindings, one specialization per JNI type.
+template <BindingType R>
+struct QuickJSResult;
+
+template <>
+struct QuickJSResult<BindingType::kBoolean> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding, jboolean value) {
+    return JS_NewBool(ctx, value);
+  }
+};
+
+template <>
+struct QuickJSResult<BindingType::kInt> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding, jint value) {
+    return JS_NewInt32(ctx, value);
+  }
+};
+
+template <>
+struct QuickJSResult<BindingType::kLong> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding, jlong value) {
+    return JS_NewInt64(ctx, value);
+  }
+};
+
+template <>
+struct QuickJSResult<BindingType::kFloat> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding, jfloat value) {
+    return JS_NewFloat64(ctx, value);
+  }
+};
+
+template <>
+struct QuickJSResult<BindingType::kDouble> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding, jdouble value) {
+    return JS_NewFloat64(ctx, value);
+  }
+};
+
+template <>
+struct QuickJSResult<BindingType::kString> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding,
+                      const ScopedJavaLocalRef<jstring>& value) {
+    if(value.is_null())
+      return JS_NULL;
+    JNIEnv* env = base::android::AttachCurrentThread();
+    ScriptString str = ScriptString::FromJavaString(env, value.obj());
+    if(str.IsUTF8())
+      return JS_NewStringLen(ctx, str.bytes().data(), str.bytes().size());
+    std::string utf8 = str.ToUTF8();
+    return JS_NewStringLen(ctx, utf8.data(), utf8.size());
+  }
+};
+
+template <>
+struct QuickJSResult<BindingType::kObject> {
+  static JSValue ToJS(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding,
+                      const ScopedJavaLocalRef<jobject>& value) {
+    if(value.is_null())
+      return JS_NULL;
+    return thiz->ToJSObject(value, binding.annotation_clazz());
+  }
+};
+
+// The thunk of a return type: calls the method and converts its result,
+// no base::Value and no overload resolution in between.
+template <BindingType R>
+static JSValue CallThunk(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding,
+                         const MethodBinding& method, JNIEnv* env, jobject object, const jvalue* args) {
+  typename JavaMethod<R>::Type result = JavaMethod<R>::Call(env, object, method.method_id, args);
+  if(base::android::HasException(env))
+    return JS_EXCEPTION;
+  return QuickJSResult<R>::ToJS(thiz, ctx, binding, result);
+}
+
+template <>
+JSValue CallThunk<BindingType::kVoid>(AndJSCoreQuickJS* thiz, JSContext* ctx, const ClassBinding& binding,
+                                      const MethodBinding& method, JNIEnv* env, jobject object, const jvalue* args) {
+  JavaMethod<BindingType::kVoid>::Call(env, object, method.method_id, args);
+  if(base::android::HasException(env))
+    return JS_EXCEPTION;
+  return JS_UNDEFINED;
+}
+
+typedef JSValue (*Thunk)(AndJSCoreQuickJS*, JSContext*, const ClassBinding&,
+                         const MethodBinding&, JNIEnv*, jobject, const jvalue*);
+
+// Indexed by BindingType.
+static const Thunk kThunks[] = {
+  nullptr,
+  &CallThunk<BindingType::kVoid>,
+  &CallThunk<BindingType::kBoolean>,
+  &CallThunk<BindingType::kInt>,
+  &CallThunk<BindingType::kLong>,
+  &CallThunk<BindingType::kFloat>,
+  &CallThunk<BindingType::kDouble>,
+  &CallThunk<BindingType::kString>,
+  &CallThunk<BindingType::kObject>,
+};
+
+const ClassBinding* AndJSCoreQuickJS::GetClassBinding(JSClassID class_id) {
+  auto it = class_bindings_.find(class_id);
+  return it == class_bindings_.end() ? nullptr : it->second;
+}
+
+JSValue AndJSCoreQuickJS::InvokeDirect(const ClassBinding& binding, const MethodBinding& method,
+                                       const base::android::JavaRef<jobject>& object,
+                                       int argc, JSValueConst* argv) {
+  if(object.is_null())
+    return JS_UNDEFINED;
+  JNIEnv* env = base::android::AttachCurrentThread();
+  std::vector<jvalue> values(method.parameter_types.size());
+  std::vector<ScopedJavaLocalRef<jstring>> locals;
+  for(size_t i = 0; i < values.size(); i++) {
+    JSValueConst arg = argv[i];
+    jvalue& value = values[i];
+    switch(method.parameter_types[i]) {
+      case BindingType::kBoolean: {
+        int b = JS_ToBool(ctx_, arg);
+        if(b < 0) return JS_EXCEPTION;
+        value.z = b;
+        break;
+      }
+      case BindingType::kInt:
+        if(JS_ToInt32(ctx_, &value.i, arg)) return JS_EXCEPTION;
+        break;
+      case BindingType::kLong: {
+        int64_t j;
+        if(JS_ToInt64(ctx_, &j, arg)) return JS_EXCEPTION;
+        value.j = j;
+        break;
+      }
+      case BindingType::kFloat:
+      case BindingType::kDouble: {
+        double d;
+        if(JS_ToFloat64(ctx_, &d, arg)) return JS_EXCEPTION;
+        if(method.parameter_types[i] == BindingType::kFloat)
+          value.f = static_cast<jfloat>(d);
+        else
+          value.d = d;
+        break;
+      }
+      case BindingType::kString: {
+        if(JS_IsNull(arg) || JS_IsUndefined(arg)) {
+          value.l = nullptr;
+          break;
+        }
+        size_t len;
+        const char* str = JS_ToCStringLen(ctx_, &len, arg);
+        if(!str) return JS_EXCEPTION;
+        locals.push_back(NewJavaStringFromUTF8(env, str, len));
+        JS_FreeCString(ctx_, str);
+        value.l = locals.back().obj();
+        break;
+      }
+      default:
+        return JS_UNDEFINED;
+    }
+  }
+
+  JSValue result = kThunks[static_cast<int>(method.return_type)](this, ctx_, binding, method,
+                                                                 env, object.obj(), values.data());
+  if(JS_IsException(result)) {
+    base::android::ClearException(env);
+    return JS_ThrowInternalError(ctx_, "%s", kJavaExceptionRaised);
+  }
+  return result;
+}
+
+// Packs the call into the batch of the engine, see BatchedCalls.
+JSValue AndJSCoreQuickJS::InvokeBatched(const ClassBinding& binding, const MethodBinding& method,
+                                        content::GinJavaBoundObject::ObjectID object_id,
+                                        const base::android::JavaRef<jobject>& object,
+                                        int argc, JSValueConst* argv) {
+  if(object.is_null())
+    return JS_UNDEFINED;
+  batched_calls_.BeginCall(binding, method, object_id, object);
+  for(size_t i = 0; i < method.parameter_types.size(); i++) {
+    JSValueConst arg = argv[i];
+    switch(method.parameter_types[i]) {
+      case BindingType::kBoolean: {
+        int b = JS_ToBool(ctx_, arg);
+        if(b < 0) break;
+        batched_calls_.WriteBoolean(b);
+        continue;
+      }
+      case BindingType::kInt: {
+        int32_t value;
+        if(JS_ToInt32(ctx_, &value, arg)) break;
+        batched_calls_.WriteInt(value);
+        continue;
+      }
+      case BindingType::kLong: {
+        int64_t value;
+        if(JS_ToInt64(ctx_, &value, arg)) break;
+        batched_calls_.WriteLong(value);
+        continue;
+      }
+      case BindingType::kFloat:
+      case BindingType::kDouble: {
+        double value;
+        if(JS_ToFloat64(ctx_, &value, arg)) break;
+        if(method.parameter_types[i] == BindingType::kFloat)
+          batched_calls_.WriteFloat(static_cast<float>(value));
+        else
+          batched_calls_.WriteDouble(value);
+        continue;
+      }
+      case BindingType::kString: {
+        if(JS_IsNull(arg) || JS_IsUndefined(arg)) {
+          batched_calls_.WriteNullString();
+          continue;
+        }
+        size_t len;
+        const char* str = JS_ToCStringLen(ctx_, &len, arg);
+        if(!str) break;
+        base::string16 chars;
+        base::UTF8ToUTF16(str, len, &chars);
+        JS_FreeCString(ctx_, str);
+        memcpy(batched_calls_.WriteString(chars.size()), chars.data(), chars.size() * sizeof(base::char16));
+        continue;
+      }
+      default:
+        batched_calls_.CancelCall();
+        return JS_UNDEFINED;
+    }
+    // A conversion threw.
+    batched_calls_.CancelCall();
+    return JS_EXCEPTION;
+  }
+  batched_calls_.EndCall();
+  return JS_UNDEFINED;
+}
+
+scoped_refptr<content::GinJavaBoundObject> AndJSCoreQuickJS::GetObject(content::GinJavaBoundObject::ObjectID object_id) {
   // Can be called on any thread.
   base::AutoLock locker(objects_lock_);
   auto iter = objects_.find(object_id);
   if (iter != objects_.end())
     return iter->second;
-  LOG(ERROR) << "AndJSCore: Unknown object: " << object_id;
+  LOG(ERROR) << "AndJSCoreQuickJS: Unknown object: " << object_id;
   return nullptr;
 }
 
-JSValue AndJSCore::ToJSObject(const base::android::JavaRef<jobject>& java_object, const base::android::JavaRef<jclass>&  annotation_clazz) {
-  JSValue jsobj = JS_NULL;
+// QuickJS allocates class ids from one unguarded process wide counter.
+static base::Lock& GetClassIDLock() {
+  static base::NoDestructor<base::Lock> lock;
+  return *lock;
+}
+
+void NewQuickJSClassID(JSClassID* class_id) {
+  base::AutoLock locker(GetClassIDLock());
+  JS_NewClassID(class_id);
+}
+
+// QuickJS class ids are process wide and size the class table of every
+// runtime, so each java class gets one id shared by all engines.
+static JSClassID GetJavaClassID(const std::string& class_name) {
+  static base::NoDestructor<std::map<std::string, JSClassID>> class_ids;
+  base::AutoLock locker(GetClassIDLock());
+  JSClassID& class_id = (*class_ids)[class_name];
+  JS_NewClassID(&class_id);
+  return class_id;
+}
 
+// Reflects the methods of |clazz| once per engine.
+const AndJSCoreQuickJS::JavaClass& AndJSCoreQuickJS::GetJavaClass(const base::android::JavaRef<jclass>& clazz,
+                                                                  const base::android::JavaRef<jclass>& annotation_clazz) {
   JNIEnv* env = base::android::AttachCurrentThread();
-  if(java_object.obj()) {
-    jsobj = JS_NewObject(ctx_);
-    JavaObjectWeakGlobalRef ref(env, java_object.obj());
-    //content::GinJavaBoundObject* bound_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
-    scoped_refptr<content::GinJavaBoundObject> new_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
-    ScopedJavaLocalRef<jclass> clazz = new_object->GetLocalClassRef(env);
-    content::GinJavaBoundObject::ObjectID object_id;
-    {
-      base::AutoLock locker(objects_lock_);
-      object_id = next_object_id_++;
-      objects_[object_id] = new_object;
-    }
-    std::string class_name = content::GetClassName(env, clazz);
-    JSValue jsdata = JS_NewObjectClass(ctx_, jsdata_class_id);
-    JS_SetOpaque(jsdata, (void *)this);
-    LOG(INFO) << " java_object class_name " << class_name << " object_id " << object_id;
-
-    JavaObjectArrayReader<jobject> methods(content::GetClassMethods(env, clazz));
-    for (auto java_method : methods) {
-      if (!annotation_clazz.is_null() && !content::IsAnnotationPresent(env, java_method, annotation_clazz)) {
-        continue;
-      }
-      std::string method_name = content::GetMethodName(env, java_method);
-      ScopedJavaLocalRef<jobjectArray> parameters(content::GetMethodParameterTypes(env, java_method));
-      int num_parameters = env->GetArrayLength(parameters.obj());
-      bool is_static = content::IsMethodStatic(env, java_method);
-      JSValueConst method_data[2];
+  std::string class_name = content::GetClassName(env, clazz);
+  auto it = java_classes_.find(class_name);
+  if(it != java_classes_.end())
+    return it->second;
+
+  JavaClass& java_class = java_classes_[class_name];
+  java_class.class_id = GetJavaClassID(class_name);
+  if(!JS_IsRegisteredClass(rt_, java_class.class_id)) {
+    JSClassDef class_def = { class_name.c_str() };
+    JS_NewClass(rt_, java_class.class_id, &class_def);
+  }
+
+  java_class.binding = BindingRegistry::GetInstance()->Find(class_name);
+  if(java_class.binding) {
+    for(const MethodBinding& method : java_class.binding->methods())
+      java_class.methods.emplace_back(method.name, static_cast<int>(method.parameter_types.size()));
+    class_bindings_[java_class.class_id] = java_class.binding;
+    ANDJS_LOG(Debug) << " java_object class_name " << class_name << " bound methods " << java_class.methods.size();
+    return java_class;
+  }
+
+  TRACE_EVENT1("andjs", "AndJSCoreQuickJS::ReflectClass", "class", class_name);
+
+  JavaObjectArrayReader<jobject> methods(content::GetClassMethods(env, clazz));
+  for (auto java_method : methods) {
+    if (!annotation_clazz.is_null() && !content::IsAnnotationPresent(env, java_method, annotation_clazz)) {
+      continue;
+    }
+    ScopedJavaLocalRef<jobjectArray> parameters(content::GetMethodParameterTypes(env, java_method));
+    java_class.methods.emplace_back(content::GetMethodName(env, java_method),
+                                    env->GetArrayLength(parameters.obj()));
+  }
+  ANDJS_LOG(Debug) << " java_object class_name " << class_name << " methods " << java_class.methods.size();
+  return java_class;
+}
 
-      method_data[0] = jsdata;
-      method_data[1] = JS_NewString(ctx_, method_name.c_str());
-      JS_SetPropertyStr(ctx_, jsobj, method_name.c_str(), JS_NewCFunctionData(ctx_, java_object_invoke, num_parameters, object_id, 2, method_data));
-      //LOG(INFO) << " method : " << method_name << " is_static " << is_static << " num_parameters " << num_parameters;
+// Instances share one prototype per class and context, built on first use.
+JSValue AndJSCoreQuickJS::NewJavaObject(content::GinJavaBoundObject::ObjectID object_id, const JavaClass& java_class) {
+  JSValue proto = JS_GetClassProto(ctx_, java_class.class_id);
+  if(JS_IsNull(proto)) {
+    proto = JS_NewObject(ctx_);
+    for(const auto& method : java_class.methods) {
+      JSValue method_name = JS_NewString(ctx_, method.first.c_str());
+      JS_SetPropertyStr(ctx_, proto, method.first.c_str(),
+                        JS_NewCFunctionData(ctx_, java_object_invoke, method.second,
+                                            static_cast<int>(java_class.class_id), 1, &method_name));
+      JS_FreeValue(ctx_, method_name);
     }
+    JS_SetClassProto(ctx_, java_class.class_id, JS_DupValue(ctx_, proto));
   }
+  JS_FreeValue(ctx_, proto);
+
+  JSValue jsobj = JS_NewObjectClass(ctx_, java_class.class_id);
+  if(!JS_IsException(jsobj))
+    JS_SetOpaque(jsobj, reinterpret_cast<void*>(static_cast<intptr_t>(object_id)));
   return jsobj;
 }
 
-bool AndJSCore::InjectObject(std::string& objname,
-                             const base::android::JavaRef<jobject>& java_object,
-                             const base::android::JavaRef<jclass>&  annotation_clazz) {
-  bool ret = false;
+JSValue AndJSCoreQuickJS::ToJSObject(const base::android::JavaRef<jobject>& java_object, const base::android::JavaRef<jclass>&  annotation_clazz) {
+  content::GinJavaBoundObject::ObjectID object_id;
+  const JavaClass* java_class = BindJavaObject(java_object, annotation_clazz, &object_id);
+  if(!java_class)
+    return JS_NULL;
+  return NewJavaObject(object_id, *java_class);
+}
 
-  JSValue global = JS_GetGlobalObject(ctx_);
-  JSValue jsobj = ToJSObject(java_object, annotation_clazz);
+const AndJSCoreQuickJS::JavaClass* AndJSCoreQuickJS::BindJavaObject(const base::android::JavaRef<jobject>& java_object,
+                                                                    const base::android::JavaRef<jclass>& annotation_clazz,
+                                                                    content::GinJavaBoundObject::ObjectID* object_id) {
+  if(!java_object.obj())
+    return nullptr;
+  JNIEnv* env = base::android::AttachCurrentThread();
+  JavaObjectWeakGlobalRef ref(env, java_object.obj());
+  scoped_refptr<content::GinJavaBoundObject> new_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
+  {
+    base::AutoLock locker(objects_lock_);
+    *object_id = next_object_id_++;
+    objects_[*object_id] = new_object;
+  }
+  return &GetJavaClass(new_object->GetLocalClassRef(env), annotation_clazz);
+}
+
+bool AndJSCoreQuickJS::InjectObject(int context_id,
+                                    const std::string& objname,
+                                    const base::android::JavaRef<jobject>& java_object,
+                                    const base::android::JavaRef<jclass>&  annotation_clazz) {
+  bool ret = false;
+  JSContext* context = GetContext(context_id);
+  if(!context)
+    return false;
+  base::AutoReset<JSContext*> scoped_context(&ctx_, context);
 
-  if(!JS_IsNull(jsobj)) {
-    JS_SetPropertyStr(ctx_, global, objname.c_str(), jsobj);
+  content::GinJavaBoundObject::ObjectID object_id;
+  const JavaClass* java_class = BindJavaObject(java_object, annotation_clazz, &object_id);
+  if(java_class) {
+    JSValue global = JS_GetGlobalObject(ctx_);
+    JS_SetPropertyStr(ctx_, global, objname.c_str(), NewJavaObject(object_id, *java_class));
     JS_FreeValue(ctx_, global);
+    injected_objects_[context_id].push_back(InjectedObject{objname, object_id, java_class});
     ret = true;
   }
   return ret;
 }
 
-void AndJSCore::Run(const std::string& jsbuf, const std::string& resource_name) {
+// static
+int AndJSCoreQuickJS::InterruptHandler(JSRuntime* rt, void* opaque) {
+  AndJSCoreQuickJS* thiz = static_cast<AndJSCoreQuickJS*>(opaque);
+  if(thiz->terminate_requested_.load(std::memory_order_relaxed))
+    return 1;
+  if(thiz->profile_ && !thiz->in_sample_) {
+    base::TimeTicks now = base::TimeTicks::Now();
+    if(now >= thiz->next_sample_) {
+      thiz->SampleStack(now);
+      thiz->next_sample_ = now + thiz->profile_interval_;
+    }
+  }
+  if(thiz->run_deadline_.is_null() || base::ThreadTicks::Now() < thiz->run_deadline_)
+    return 0;
+  thiz->run_terminated_ = true;
+  return 1;
+}
+
+void AndJSCoreQuickJS::LogException() {
+  JSValue exception_val = JS_GetException(ctx_);
+  BOOL is_error = JS_IsError(ctx_, exception_val);
+  const char* str = JS_ToCString(ctx_, exception_val);
+  LOG(ERROR) << " is_error " << is_error << ": " << str;
+  JS_FreeCString(ctx_, str);
+  if (is_error) {
+      JSValue stack = JS_GetPropertyStr(ctx_, exception_val, "stack");
+      if (!JS_IsUndefined(stack)) {
+        str = JS_ToCString(ctx_, stack);
+        LOG(INFO) << "*" << str;
+        JS_FreeCString(ctx_, str);
+      }
+      JS_FreeValue(ctx_, stack);
+  }
+  JS_FreeValue(ctx_, exception_val);
+}
+
+// Drains the promise job queue, the QuickJS equivalent of V8 microtasks.
+bool AndJSCoreQuickJS::ExecutePendingJobs() {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::ExecutePendingJobs");
+  ScopedStatsTimer timer(&stats_->run_time_us);
+  bool ok = true;
+  JSContext* job_ctx;
+  int ret;
+  while((ret = JS_ExecutePendingJob(rt_, &job_ctx)) != 0) {
+    if(ret < 0) {
+      LogException();
+      ok = false;
+      if(run_terminated_)
+        break;
+    }
+  }
+  return ok;
+}
+
+// Parses one "    at func (file.js:12)" line of an Error stack.
+static void ParseStackFrame(base::StringPiece frame, std::string* function_name,
+                            std::string* url, int* line_number) {
+  *line_number = -1;
+  url->clear();
+  if(frame.starts_with("at "))
+    frame.remove_prefix(3);
+
+  size_t paren = frame.rfind(" (");
+  if(paren == base::StringPiece::npos || !frame.ends_with(")")) {
+    *function_name = frame.as_string();
+    return;
+  }
+  *function_name = frame.substr(0, paren).as_string();
+  base::StringPiece location = frame.substr(paren + 2, frame.size() - paren - 3);
+  size_t colon = location.rfind(':');
+  int line;
+  if(colon != base::StringPiece::npos && base::StringToInt(location.substr(colon + 1), &line)) {
+    *url = location.substr(0, colon).as_string();
+    *line_number = line - 1;
+  } else {
+    *url = location.as_string();
+  }
+}
+
+// QuickJS has no public stack walking API, so a sample builds an Error (its
+// constructor records the backtrace of the running code) and parses the
+// stack string. Time spent outside the interpreter, e.g. in java bridge
+// calls, is not sampled.
+void AndJSCoreQuickJS::SampleStack(base::TimeTicks now) {
+  in_sample_ = true;
+  JSValue error = JS_CallConstructor(ctx_, error_ctor_, 0, NULL);
+  if(JS_IsException(error)) {
+    JS_FreeValue(ctx_, JS_GetException(ctx_));
+    in_sample_ = false;
+    return;
+  }
+
+  JSValue stack = JS_GetPropertyStr(ctx_, error, "stack");
+  const char* str = JS_IsString(stack) ? JS_ToCString(ctx_, stack) : NULL;
+  if(str) {
+    std::vector<base::StringPiece> frames = base::SplitStringPiece(
+      str, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    int node = CpuProfile::kRootNodeId;
+    std::string function_name, url;
+    int line_number;
+    for(auto it = frames.rbegin(); it != frames.rend(); ++it) {
+      ParseStackFrame(*it, &function_name, &url, &line_number);
+      node = profile_->GetOrAddChild(node, function_name, url, line_number, -1);
+    }
+    profile_->AddHitCount(node, 1);
+    profile_->AddSample(node, (now - base::TimeTicks()).InMicroseconds());
+    JS_FreeCString(ctx_, str);
+  }
+  JS_FreeValue(ctx_, stack);
+  JS_FreeValue(ctx_, error);
+  in_sample_ = false;
+}
+
+bool AndJSCoreQuickJS::StartProfiling(const std::string& title, base::TimeDelta interval) {
+  if(profile_) {
+    LOG(ERROR) << " StartProfiling " << title << " while " << profile_->title() << " is running";
+    return false;
+  }
+  JSValue global = JS_GetGlobalObject(ctx_);
+  error_ctor_ = JS_GetPropertyStr(ctx_, global, "Error");
+  JS_FreeValue(ctx_, global);
+
+  base::TimeTicks now = base::TimeTicks::Now();
+  profile_.reset(new CpuProfile(title));
+  profile_->set_start_time((now - base::TimeTicks()).InMicroseconds());
+  profile_interval_ = interval;
+  next_sample_ = now + interval;
+  return true;
+}
+
+std::unique_ptr<CpuProfile> AndJSCoreQuickJS::StopProfiling() {
+  if(profile_) {
+    profile_->set_end_time((base::TimeTicks::Now() - base::TimeTicks()).InMicroseconds());
+    JS_FreeValue(ctx_, error_ctor_);
+    error_ctor_ = JS_UNDEFINED;
+  }
+  return std::move(profile_);
+}
+
+ScriptEngine::RunStatus AndJSCoreQuickJS::Run(int context_id,
+                                              const ScriptString& source,
+                                              const std::string& resource_name,
+                                              base::TimeDelta cpu_budget) {
   JSValue val;
+  RunStatus status = kOk;
+  JSContext* context = GetContext(context_id);
+  if(!context)
+    return kException;
+  base::AutoReset<JSContext*> scoped_context(&ctx_, context);
 
-  val = JS_Eval(ctx_, jsbuf.c_str(), jsbuf.length(), resource_name.c_str(), JS_EVAL_TYPE_MODULE);
+  StartRunBudget(cpu_budget);
+  {
+    TRACE_EVENT1("andjs", "AndJSCoreQuickJS::Compile", "resource_name", resource_name);
+    ScopedStatsTimer timer(&stats_->compile_time_us);
+    // JS_Eval only parses UTF-8, ASCII is used as is.
+    std::string transcoded;
+    const std::string& jsbuf = source.IsUTF8() ? source.bytes() : (transcoded = source.ToUTF8());
+    val = JS_Eval(ctx_, jsbuf.c_str(), jsbuf.length(), resource_name.c_str(),
+                  JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+  }
+  if(!JS_IsException(val)) {
+    TRACE_EVENT1("andjs", "AndJSCoreQuickJS::Run", "resource_name", resource_name);
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    val = JS_EvalFunction(ctx_, val);
+  }
   if(JS_IsException(val)) {
-    JSValue exception_val = JS_GetException(ctx_);
-    BOOL is_error = JS_IsError(ctx_, exception_val);
-    const char* str = JS_ToCString(ctx_, exception_val);
-    LOG(ERROR) << " is_error " << is_error << ": " << str;
-    JS_FreeCString(ctx_, str);
-    if (is_error) {
-        JSValue stack = JS_GetPropertyStr(ctx_, exception_val, "stack");
-        if (!JS_IsUndefined(stack)) {
-          str = JS_ToCString(ctx_, stack);
-          LOG(INFO) << "*" << str;
-          JS_FreeCString(ctx_, str);
-        }
-        JS_FreeValue(ctx_, stack);
+    status = kException;
+    LogException();
+  }
+  JS_FreeValue(ctx_, val);
+  if(!ExecutePendingJobs() && status == kOk)
+    status = kException;
+
+  if(StopRunBudget())
+    status = kTerminated;
+  return status;
+}
+
+// The interrupt handler stops the script once the deadline passed.
+void AndJSCoreQuickJS::StartRunBudget(base::TimeDelta cpu_budget) {
+  run_terminated_ = false;
+  if(cpu_budget > base::TimeDelta() && base::ThreadTicks::IsSupported())
+    run_deadline_ = base::ThreadTicks::Now() + cpu_budget;
+}
+
+// True when the script was stopped.
+bool AndJSCoreQuickJS::StopRunBudget() {
+  run_deadline_ = base::ThreadTicks();
+  bool terminated = run_terminated_;
+  run_terminated_ = false;
+  return terminated;
+}
+
+void AndJSCoreQuickJS::SetCallbackBudget(base::TimeDelta cpu_budget) {
+  callback_budget_ = cpu_budget;
+}
+
+// Listeners and settlements have no RunStatus for AndJSCore to count.
+void AndJSCoreQuickJS::OnCallbackTerminated(const std::string& what) {
+  int64_t count = ++stats_->terminated_runs;
+  LOG(WARNING) << " AndJSCoreQuickJS " << what << " terminated after " << callback_budget_.InMilliseconds()
+               << "ms cpu time, terminated runs " << count;
+}
+
+// static
+char* AndJSCoreQuickJS::NormalizeModuleName(JSContext* ctx, const char* base,
+                                            const char* name, void* opaque) {
+  std::string resolved = ModuleBundle::ResolveSpecifier(base, name);
+  char* result = static_cast<char*>(js_malloc(ctx, resolved.size() + 1));
+  if(!result)
+    return NULL;
+  memcpy(result, resolved.c_str(), resolved.size() + 1);
+  return result;
+}
+
+// static
+JSModuleDef* AndJSCoreQuickJS::LoadModule(JSContext* ctx, const char* name, void* opaque) {
+  AndJSCoreQuickJS* self = static_cast<AndJSCoreQuickJS*>(opaque);
+  ModuleBundle::Module module;
+  if(self->bundle_ && self->bundle_->Find(name, &module))
+    return self->LoadBundleModule(module);
+  return js_module_loader(ctx, name, NULL);
+}
+
+// QuickJS keeps loaded modules per context, so this runs once per module and
+// instance. The parse is shared: bytecode shipped in the bundle or written by
+// the first instance that compiled the source is read back instead.
+JSModuleDef* AndJSCoreQuickJS::LoadBundleModule(const ModuleBundle::Module& module) {
+  TRACE_EVENT1("andjs", "AndJSCoreQuickJS::LoadModule", "name", module.name.as_string());
+  AndJSStats::Add(&stats_->modules_loaded, 1);
+
+  scoped_refptr<base::RefCountedBytes> code;
+  base::StringPiece bytecode = module.bytecode;
+  if(bytecode.empty()) {
+    code = bundle_->GetCompiledCode(kQuickJS, module.index);
+    if(code)
+      bytecode = base::StringPiece(reinterpret_cast<const char*>(code->front()), code->size());
+  }
+
+  JSValue val;
+  if(!bytecode.empty()) {
+    AndJSStats::Add(&stats_->module_cache_hits, 1);
+    val = JS_ReadObject(ctx_, reinterpret_cast<const uint8_t*>(bytecode.data()),
+                        bytecode.size(), JS_READ_OBJ_BYTECODE);
+  } else {
+    ScopedStatsTimer timer(&stats_->compile_time_us);
+    // The parser wants a nul terminated buffer, the mapping has none.
+    std::string source = module.source.as_string();
+    std::string name = module.name.as_string();
+    val = JS_Eval(ctx_, source.c_str(), source.length(), name.c_str(),
+                  JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    if(!JS_IsException(val)) {
+      size_t size;
+      uint8_t* buf = JS_WriteObject(ctx_, &size, val, JS_WRITE_OBJ_BYTECODE);
+      if(buf) {
+        bundle_->SetCompiledCode(kQuickJS, module.index,
+                                 base::MakeRefCounted<base::RefCountedBytes>(buf, size));
+        js_free(ctx_, buf);
+      }
     }
-    JS_FreeValue(ctx_, exception_val);
   }
+  if(JS_IsException(val))
+    return NULL;
+
+  js_module_set_import_meta(ctx_, val, FALSE, FALSE);
+  JSModuleDef* m = static_cast<JSModuleDef*>(JS_VALUE_GET_PTR(val));
   JS_FreeValue(ctx_, val);
+  return m;
+}
+
+void AndJSCoreQuickJS::SetModuleBundle(scoped_refptr<ModuleBundle> bundle) {
+  bundle_ = std::move(bundle);
+}
+
+ScriptEngine::RunStatus AndJSCoreQuickJS::RunModule(int context_id,
+                                                    const std::string& name,
+                                                    base::TimeDelta cpu_budget) {
+  // A one line entry module lets JS_Eval resolve and link the import graph.
+  std::string entry = "import " + base::GetQuotedJSONString(name) + ";";
+  return Run(context_id, ScriptString(std::move(entry)), "_bundle_entry_.js", cpu_budget);
+}
+
+// QuickJS compiles and runs in one JS_Eval() on the runtime's thread.
+bool AndJSCoreQuickJS::StartStreaming(int context_id,
+                                      const base::FilePath& path,
+                                      const std::string& resource_name,
+                                      base::OnceClosure done) {
+  return false;
+}
+
+ScriptEngine::RunStatus AndJSCoreQuickJS::FinishStreaming(base::TimeDelta cpu_budget) {
+  NOTREACHED();
+  return kException;
+}
+
+// static
+std::unique_ptr<ScriptEngine> AndJSCoreQuickJS::CreateWorkerEngine(size_t memory_limit, AndJSStats* stats,
+                                                                   WorkerHost* host) {
+  std::unique_ptr<AndJSCoreQuickJS> engine = std::make_unique<AndJSCoreQuickJS>(stats, nullptr);
+  engine->SetMemoryLimit(memory_limit);
+  engine->worker_host_ = host;
+  return engine;
+}
+
+// `new Worker(src)`, |src| is a module of the bundle or a script file.
+JSValue AndJSCoreQuickJS::NewWorker(int argc, JSValueConst* argv) {
+  const char* str = argc > 0 ? JS_ToCString(ctx_, argv[0]) : NULL;
+  if(!str)
+    return JS_ThrowTypeError(ctx_, "Worker needs a module name or script path");
+  std::string src(str);
+  JS_FreeCString(ctx_, str);
+
+  JSValue obj = JS_NewObjectClass(ctx_, worker_class_id);
+  if(JS_IsException(obj))
+    return obj;
+  if(!workers_)
+    workers_ = std::make_unique<WorkerList>(this, stats_);
+  int worker_id = workers_->Start(base::BindOnce(&AndJSCoreQuickJS::CreateWorkerEngine, memory_limit_), src, bundle_,
+                                  callback_budget_);
+  JS_SetOpaque(obj, reinterpret_cast<void*>(static_cast<intptr_t>(worker_id)));
+  worker_objects_[worker_id] = WorkerObject{ctx_, JS_DupValue(ctx_, obj)};
+  return obj;
+}
+
+// postMessage(message[, transfer]). ArrayBuffer memory belongs to the
+// allocator of its runtime, so transferred buffers are copied once into the
+// message by JS_WriteObject() and then detached here.
+bool AndJSCoreQuickJS::SerializeMessage(int argc, JSValueConst* argv, WorkerMessage* message) {
+  size_t size;
+  uint8_t* buf = JS_WriteObject(ctx_, &size, argc > 0 ? argv[0] : JS_UNDEFINED, 0);
+  if(!buf)
+    return false;
+  message->data.assign(buf, buf + size);
+  js_free(ctx_, buf);
+
+  if(argc > 1 && JS_IsArray(ctx_, argv[1]) > 0) {
+    JSValue length_val = JS_GetPropertyStr(ctx_, argv[1], "length");
+    uint32_t length = 0;
+    JS_ToUint32(ctx_, &length, length_val);
+    JS_FreeValue(ctx_, length_val);
+    for(uint32_t i = 0; i < length; i++) {
+      JSValue item = JS_GetPropertyUint32(ctx_, argv[1], i);
+      size_t byte_length;
+      if(JS_GetArrayBuffer(ctx_, &byte_length, item))
+        JS_DetachArrayBuffer(ctx_, item);
+      else
+        JS_FreeValue(ctx_, JS_GetException(ctx_));
+      JS_FreeValue(ctx_, item);
+    }
+  }
+  return true;
+}
+
+JSValue AndJSCoreQuickJS::PostWorkerMessage(int worker_id, int argc, JSValueConst* argv) {
+  if(!workers_ || !worker_objects_.count(worker_id))
+    return JS_UNDEFINED;
+  std::unique_ptr<WorkerMessage> message = std::make_unique<WorkerMessage>();
+  if(!SerializeMessage(argc, argv, message.get()))
+    return JS_EXCEPTION;
+  workers_->PostMessage(worker_id, std::move(message));
+  return JS_UNDEFINED;
+}
+
+JSValue AndJSCoreQuickJS::TerminateWorker(int worker_id) {
+  auto it = worker_objects_.find(worker_id);
+  if(it == worker_objects_.end())
+    return JS_UNDEFINED;
+  workers_->Terminate(worker_id);
+  JSValue object = it->second.object;
+  worker_objects_.erase(it);
+  JS_FreeValue(ctx_, object);
+  return JS_UNDEFINED;
+}
+
+JSValue AndJSCoreQuickJS::PostMessageToParent(int argc, JSValueConst* argv) {
+  std::unique_ptr<WorkerMessage> message = std::make_unique<WorkerMessage>();
+  if(!SerializeMessage(argc, argv, message.get()))
+    return JS_EXCEPTION;
+  worker_host_->PostMessageToParent(std::move(message));
+  return JS_UNDEFINED;
+}
+
+// Calls target.onmessage({data}) in |ctx_|.
+void AndJSCoreQuickJS::DispatchMessageEvent(JSValueConst target, std::unique_ptr<WorkerMessage> message) {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::DispatchMessage");
+  JSValue data = JS_ReadObject(ctx_, message->data.data(), message->data.size(), 0);
+  if(JS_IsException(data)) {
+    LogException();
+    return;
+  }
+  JSValue handler = JS_GetPropertyStr(ctx_, target, "onmessage");
+  StartRunBudget(callback_budget_);
+  if(JS_IsFunction(ctx_, handler)) {
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    JSValue event = JS_NewObject(ctx_);
+    JS_SetPropertyStr(ctx_, event, "data", data);
+    JSValue ret = JS_Call(ctx_, handler, target, 1, &event);
+    if(JS_IsException(ret))
+      LogException();
+    JS_FreeValue(ctx_, ret);
+    JS_FreeValue(ctx_, event);
+  } else {
+    JS_FreeValue(ctx_, data);
+  }
+  JS_FreeValue(ctx_, handler);
+  ExecutePendingJobs();
+  if(StopRunBudget())
+    OnCallbackTerminated("message");
+}
+
+void AndJSCoreQuickJS::DispatchWorkerMessage(int worker_id, std::unique_ptr<WorkerMessage> message) {
+  auto it = worker_objects_.find(worker_id);
+  if(it == worker_objects_.end())
+    return;
+  base::AutoReset<JSContext*> scoped_context(&ctx_, it->second.ctx);
+  // The handler may terminate the worker and drop the map's reference.
+  JSValue target = JS_DupValue(ctx_, it->second.object);
+  DispatchMessageEvent(target, std::move(message));
+  JS_FreeValue(ctx_, target);
+}
+
+void AndJSCoreQuickJS::DispatchMessage(std::unique_ptr<WorkerMessage> message) {
+  JSContext* context = GetContext(kMainContextId);
+  if(!context)
+    return;
+  base::AutoReset<JSContext*> scoped_context(&ctx_, context);
+  JSValue global = JS_GetGlobalObject(ctx_);
+  DispatchMessageEvent(global, std::move(message));
+  JS_FreeValue(ctx_, global);
+}
+
+// The constructors WriteStructured() tells binary data apart by, looked up
+// once per postToJava().
+struct BinaryClasses {
+  explicit BinaryClasses(JSContext* ctx) : ctx(ctx) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    array_buffer = JS_GetPropertyStr(ctx, global, "ArrayBuffer");
+    data_view = JS_GetPropertyStr(ctx, global, "DataView");
+    JSValue uint8_array = JS_GetPropertyStr(ctx, global, "Uint8Array");
+    // %TypedArray%, what all typed array constructors inherit from.
+    typed_array = JS_GetPropertyStr(ctx, uint8_array, "__proto__");
+    JS_FreeValue(ctx, uint8_array);
+    JS_FreeValue(ctx, global);
+  }
+  ~BinaryClasses() {
+    JS_FreeValue(ctx, array_buffer);
+    JS_FreeValue(ctx, data_view);
+    JS_FreeValue(ctx, typed_array);
+  }
+
+  JSContext* ctx;
+  JSValue array_buffer;
+  JSValue data_view;
+  JSValue typed_array;
+};
+
+static bool WriteStructuredBytes(JSContext* ctx, JSValueConst view, StructuredWriter* writer) {
+  JSValue buffer = JS_GetPropertyStr(ctx, view, "buffer");
+  JSValue offset_val = JS_GetPropertyStr(ctx, view, "byteOffset");
+  JSValue length_val = JS_GetPropertyStr(ctx, view, "byteLength");
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  size_t size = 0;
+  uint8_t* data = NULL;
+  if(!JS_ToUint32(ctx, &offset, offset_val) && !JS_ToUint32(ctx, &length, length_val))
+    data = JS_GetArrayBuffer(ctx, &size, buffer);
+  JS_FreeValue(ctx, buffer);
+  JS_FreeValue(ctx, offset_val);
+  JS_FreeValue(ctx, length_val);
+  // A detached buffer throws.
+  if(!data || static_cast<size_t>(offset) + length > size)
+    return false;
+  memcpy(writer->WriteData(StructuredTag::kBytes, length, 1), data + offset, length);
+  return true;
+}
+
+// postToJava() values in the StructuredWriter format, straight from the
+// JSValues. Throws a TypeError into the script for what can't be written.
+static bool WriteStructured(JSContext* ctx, JSValueConst value, const BinaryClasses& classes,
+                            StructuredWriter* writer, int depth) {
+  switch(JS_VALUE_GET_TAG(value)) {
+    case JS_TAG_NULL:
+      writer->WriteTag(StructuredTag::kNull);
+      return true;
+    case JS_TAG_UNDEFINED:
+      writer->WriteTag(StructuredTag::kUndefined);
+      return true;
+    case JS_TAG_BOOL:
+      writer->WriteTag(JS_VALUE_GET_BOOL(value) ? StructuredTag::kTrue : StructuredTag::kFalse);
+      return true;
+    case JS_TAG_INT:
+      writer->WriteInt32(JS_VALUE_GET_INT(value));
+      return true;
+    case JS_TAG_FLOAT64:
+      writer->WriteDouble(JS_VALUE_GET_FLOAT64(value));
+      return true;
+    case JS_TAG_STRING: {
+      size_t length;
+      const char* str = JS_ToCStringLen(ctx, &length, value);
+      if(!str)
+        return false;
+      writer->WriteUtf8(str, length);
+      JS_FreeCString(ctx, str);
+      return true;
+    }
+    case JS_TAG_OBJECT:
+      break;
+    default:
+      JS_ThrowTypeError(ctx, "postToJava can't send this value");
+      return false;
+  }
+
+  if(JS_IsFunction(ctx, value)) {
+    JS_ThrowTypeError(ctx, "postToJava can't send functions");
+    return false;
+  }
+  if(JS_IsInstanceOf(ctx, value, classes.array_buffer) > 0) {
+    size_t size;
+    uint8_t* data = JS_GetArrayBuffer(ctx, &size, value);
+    if(!data)
+      return false;
+    memcpy(writer->WriteData(StructuredTag::kBytes, size, 1), data, size);
+    return true;
+  }
+  if(JS_IsInstanceOf(ctx, value, classes.typed_array) > 0 || JS_IsInstanceOf(ctx, value, classes.data_view) > 0)
+    return WriteStructuredBytes(ctx, value, writer);
+  if(depth >= StructuredWriter::kMaxDepth) {
+    JS_ThrowTypeError(ctx, "postToJava value is nested too deeply");
+    return false;
+  }
+
+  if(JS_IsArray(ctx, value) > 0) {
+    JSValue length_val = JS_GetPropertyStr(ctx, value, "length");
+    uint32_t length = 0;
+    int failed = JS_ToUint32(ctx, &length, length_val);
+    JS_FreeValue(ctx, length_val);
+    if(failed)
+      return false;
+    size_t offset = writer->BeginContainer(StructuredTag::kArray);
+    for(uint32_t i = 0; i < length; i++) {
+      JSValue item = JS_GetPropertyUint32(ctx, value, i);
+      bool written = !JS_IsException(item) && WriteStructured(ctx, item, classes, writer, depth + 1);
+      JS_FreeValue(ctx, item);
+      if(!written)
+        return false;
+    }
+    writer->EndContainer(offset, length);
+    return true;
+  }
+
+  JSPropertyEnum* props;
+  uint32_t length;
+  if(JS_GetOwnPropertyNames(ctx, &props, &length, value, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+    return false;
+  bool written = true;
+  size_t offset = writer->BeginContainer(StructuredTag::kObject);
+  for(uint32_t i = 0; i < length; i++) {
+    if(written) {
+      const char* key = JS_AtomToCString(ctx, props[i].atom);
+      JSValue item = JS_GetProperty(ctx, value, props[i].atom);
+      written = key && !JS_IsException(item);
+      if(written) {
+        writer->WriteUtf8(key, strlen(key));
+        written = WriteStructured(ctx, item, classes, writer, depth + 1);
+      }
+      JS_FreeCString(ctx, key);
+      JS_FreeValue(ctx, item);
+    }
+    JS_FreeAtom(ctx, props[i].atom);
+  }
+  js_free(ctx, props);
+  writer->EndContainer(offset, length);
+  return written;
+}
+
+static JSValue ReadStructured(JSContext* ctx, StructuredReader* reader, int depth) {
+  StructuredTag tag;
+  if(depth > StructuredWriter::kMaxDepth || !reader->ReadTag(&tag))
+    return JS_ThrowTypeError(ctx, "invalid structured data");
+  uint32_t length = 0;
+  const uint8_t* data = NULL;
+  switch(tag) {
+    case StructuredTag::kNull:
+      return JS_NULL;
+    case StructuredTag::kUndefined:
+      return JS_UNDEFINED;
+    case StructuredTag::kFalse:
+      return JS_FALSE;
+    case StructuredTag::kTrue:
+      return JS_TRUE;
+    case StructuredTag::kInt32: {
+      int32_t value;
+      if(!reader->ReadInt32(&value))
+        break;
+      return JS_NewInt32(ctx, value);
+    }
+    case StructuredTag::kDouble: {
+      double value;
+      if(!reader->ReadDouble(&value))
+        break;
+      return JS_NewFloat64(ctx, value);
+    }
+    case StructuredTag::kUtf8String:
+      if(!reader->ReadLength(&length) || !reader->ReadData(length, 1, &data))
+        break;
+      return JS_NewStringLen(ctx, reinterpret_cast<const char*>(data), length);
+    case StructuredTag::kLatin1String: {
+      if(!reader->ReadLength(&length) || !reader->ReadData(length, 1, &data))
+        break;
+      // QuickJS only takes UTF-8, ASCII passes as is.
+      std::string utf8;
+      utf8.reserve(length);
+      for(uint32_t i = 0; i < length; i++) {
+        if(data[i] < 0x80) {
+          utf8.push_back(data[i]);
+        } else {
+          utf8.push_back(0xc0 | (data[i] >> 6));
+          utf8.push_back(0x80 | (data[i] & 0x3f));
+        }
+      }
+      return JS_NewStringLen(ctx, utf8.data(), utf8.size());
+    }
+    case StructuredTag::kTwoByteString: {
+      if(!reader->ReadLength(&length) || !reader->ReadData(length, sizeof(base::char16), &data))
+        break;
+      base::string16 chars(length, 0);
+      memcpy(&chars[0], data, length * sizeof(base::char16));
+      std::string utf8 = base::UTF16ToUTF8(chars);
+      return JS_NewStringLen(ctx, utf8.data(), utf8.size());
+    }
+    case StructuredTag::kBytes: {
+      if(!reader->ReadLength(&length) || !reader->ReadData(length, 1, &data))
+        break;
+      JSValue buffer = JS_NewArrayBufferCopy(ctx, data, length);
+      if(JS_IsException(buffer))
+        return buffer;
+      JSValue global = JS_GetGlobalObject(ctx);
+      JSValue uint8_array = JS_GetPropertyStr(ctx, global, "Uint8Array");
+      JSValue view = JS_CallConstructor(ctx, uint8_array, 1, &buffer);
+      JS_FreeValue(ctx, uint8_array);
+      JS_FreeValue(ctx, global);
+      JS_FreeValue(ctx, buffer);
+      return view;
+    }
+    case StructuredTag::kArray: {
+      if(!reader->ReadLength(&length))
+        break;
+      JSValue array = JS_NewArray(ctx);
+      for(uint32_t i = 0; i < length; i++) {
+        JSValue item = ReadStructured(ctx, reader, depth + 1);
+        if(JS_IsException(item)) {
+          JS_FreeValue(ctx, array);
+          return item;
+        }
+        JS_SetPropertyUint32(ctx, array, i, item);
+      }
+      return array;
+    }
+    case StructuredTag::kObject: {
+      if(!reader->ReadLength(&length))
+        break;
+      JSValue object = JS_NewObject(ctx);
+      for(uint32_t i = 0; i < length; i++) {
+        JSValue key = ReadStructured(ctx, reader, depth + 1);
+        if(JS_IsException(key)) {
+          JS_FreeValue(ctx, object);
+          return key;
+        }
+        const char* key_str = JS_IsString(key) ? JS_ToCString(ctx, key) : NULL;
+        JS_FreeValue(ctx, key);
+        if(!key_str) {
+          JS_FreeValue(ctx, object);
+          return JS_ThrowTypeError(ctx, "invalid structured data");
+        }
+        JSValue item = ReadStructured(ctx, reader, depth + 1);
+        if(JS_IsException(item)) {
+          JS_FreeCString(ctx, key_str);
+          JS_FreeValue(ctx, object);
+          return item;
+        }
+        JS_SetPropertyStr(ctx, object, key_str, item);
+        JS_FreeCString(ctx, key_str);
+      }
+      return object;
+    }
+  }
+  return JS_ThrowTypeError(ctx, "invalid structured data");
+}
+
+// postToJava(channel, value), false without a receiver. Batched calls
+// made before go first.
+JSValue AndJSCoreQuickJS::PostToJava(JSContext* ctx, int argc, JSValueConst* argv) {
+  const char* channel = JS_ToCString(ctx, argv[0]);
+  if(!channel)
+    return JS_EXCEPTION;
+  std::string channel_name(channel);
+  JS_FreeCString(ctx, channel);
+  StructuredWriter writer;
+  {
+    TRACE_EVENT0("andjs", "AndJSCoreQuickJS::WriteStructured");
+    BinaryClasses classes(ctx);
+    if(!WriteStructured(ctx, argv[1], classes, &writer, 0))
+      return JS_EXCEPTION;
+  }
+  batched_calls_.Flush();
+  return JS_NewBool(ctx, structured_receiver_->Deliver(channel_name, writer));
+}
+
+// A listener is added once per type, like on a DOM EventTarget.
+JSValue AndJSCoreQuickJS::AddEventListener(JSContext* ctx, int argc, JSValueConst* argv) {
+  const char* type = JS_ToCString(ctx, argv[0]);
+  if(!type)
+    return JS_EXCEPTION;
+  std::string type_name(type);
+  JS_FreeCString(ctx, type);
+  if(!JS_IsFunction(ctx, argv[1]))
+    return JS_ThrowTypeError(ctx, "addEventListener needs a listener function");
+  std::vector<JSValue>& listeners = event_listeners_[ctx][type_name];
+  for(JSValue added : listeners) {
+    if(JS_VALUE_GET_PTR(added) == JS_VALUE_GET_PTR(argv[1]))
+      return JS_UNDEFINED;
+  }
+  listeners.push_back(JS_DupValue(ctx, argv[1]));
+  return JS_UNDEFINED;
+}
+
+JSValue AndJSCoreQuickJS::RemoveEventListener(JSContext* ctx, int argc, JSValueConst* argv) {
+  const char* type = JS_ToCString(ctx, argv[0]);
+  if(!type)
+    return JS_EXCEPTION;
+  std::string type_name(type);
+  JS_FreeCString(ctx, type);
+  auto context_it = event_listeners_.find(ctx);
+  if(context_it == event_listeners_.end() || !JS_IsObject(argv[1]))
+    return JS_UNDEFINED;
+  auto it = context_it->second.find(type_name);
+  if(it == context_it->second.end())
+    return JS_UNDEFINED;
+  std::vector<JSValue>& listeners = it->second;
+  for(auto listener = listeners.begin(); listener != listeners.end(); ++listener) {
+    if(JS_VALUE_GET_PTR(*listener) == JS_VALUE_GET_PTR(argv[1])) {
+      JS_FreeValue(ctx, *listener);
+      listeners.erase(listener);
+      break;
+    }
+  }
+  return JS_UNDEFINED;
+}
+
+void AndJSCoreQuickJS::FreeContext(JSContext* ctx) {
+  FreeEventListeners(ctx);
+  native_async_.erase(ctx);
+  JS_FreeContext(ctx);
+}
+
+// A NativeAsync result back from its thread, settled in the context that
+// started it.
+void AndJSCoreQuickJS::SettleNativeAsync(JSContext* ctx, base::OnceClosure settle) {
+  TRACE_EVENT0("andjs", "AndJSCoreQuickJS::SettleNativeAsync");
+  base::AutoReset<JSContext*> scoped_context(&ctx_, ctx);
+  StartRunBudget(callback_budget_);
+  {
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    std::move(settle).Run();
+  }
+  ExecutePendingJobs();
+  if(StopRunBudget())
+    OnCallbackTerminated("NativeAsync settlement");
+}
+
+void AndJSCoreQuickJS::FreeEventListeners(JSContext* ctx) {
+  auto it = event_listeners_.find(ctx);
+  if(it == event_listeners_.end())
+    return;
+  for(auto& type : it->second) {
+    for(JSValue listener : type.second)
+      JS_FreeValue(ctx, listener);
+  }
+  event_listeners_.erase(it);
+}
+
+void AndJSCoreQuickJS::DispatchEvent(const ScriptEvent& event) {
+  JSContext* context = GetContext(kMainContextId);
+  auto context_it = event_listeners_.find(context);
+  if(context_it == event_listeners_.end())
+    return;
+  auto it = context_it->second.find(event.type);
+  if(it == context_it->second.end() || it->second.empty())
+    return;
+  TRACE_EVENT1("andjs", "AndJSCoreQuickJS::DispatchEvent", "type", event.type);
+  base::AutoReset<JSContext*> scoped_context(&ctx_, context);
+
+  // Listeners added or removed by a listener count from the next event on.
+  std::vector<JSValue> listeners;
+  for(JSValue listener : it->second)
+    listeners.push_back(JS_DupValue(ctx_, listener));
+  JSValue object = JS_NewObject(ctx_);
+  JS_SetPropertyStr(ctx_, object, "type", JS_NewStringLen(ctx_, event.type.data(), event.type.size()));
+  JSValue data;
+  if(event.data) {
+    data = ToJSValue(event.data.get());
+  } else {
+    StructuredReader reader(event.structured.data(), event.structured.size());
+    data = reader.ReadHeader() ? ReadStructured(ctx_, &reader, 0) : JS_ThrowTypeError(ctx_, "invalid structured data");
+  }
+  if(JS_IsException(data)) {
+    LogException();
+    JS_FreeValue(ctx_, object);
+    for(JSValue listener : listeners)
+      JS_FreeValue(ctx_, listener);
+    return;
+  }
+  JS_SetPropertyStr(ctx_, object, "data", data);
+  JSValue global = JS_GetGlobalObject(ctx_);
+  // One budget for all listeners, the ones after a terminated listener are
+  // interrupted right away.
+  StartRunBudget(callback_budget_);
+  {
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    for(JSValue listener : listeners) {
+      JSValue ret = JS_Call(ctx_, listener, global, 1, &object);
+      if(JS_IsException(ret))
+        LogException();
+      JS_FreeValue(ctx_, ret);
+      JS_FreeValue(ctx_, listener);
+    }
+  }
+  JS_FreeValue(ctx_, global);
+  JS_FreeValue(ctx_, object);
+  ExecutePendingJobs();
+  if(StopRunBudget())
+    OnCallbackTerminated("event " + event.type);
+}
+
+// Any thread, see ScriptEngine::Terminate().
+void AndJSCoreQuickJS::Terminate() {
+  terminate_requested_ = true;
 }
 
-AndJSCore::~AndJSCore() = default;
+AndJSCoreQuickJS::~AndJSCoreQuickJS() = default;
 }
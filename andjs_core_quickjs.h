@@ -21,8 +21,14 @@
 
 #ifndef __ANDJS_CORE_QUICKJS_H__
 #define __ANDJS_CORE_QUICKJS_H__
+#include <atomic>
+#include <map>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "base/callback.h"
 #include "base/compiler_specific.h"
 #include "base/macros.h"
 #include "base/android/jni_weak_ref.h"
@@ -31,10 +37,16 @@
 #include "base/files/file_path.h"
 #include "base/threading/thread.h"
 #include "base/synchronization/lock.h"
+#include "base/time/time.h"
 
 #include "content/browser/android/java/gin_java_bound_object_delegate.h"
 #include "content/browser/android/java/gin_java_bound_object.h"
 
+#include "andjs/andjs_bindings.h"
+#include "andjs/andjs_module_bundle.h"
+#include "andjs/andjs_stats.h"
+#include "andjs/script_engine.h"
+
 extern "C" {
 #include "quickjs-libc.h"
 #include "cutils.h"
@@ -42,31 +54,60 @@ extern "C" {
 
 namespace andjs {
 
-class AndJSCore : public content::GinJavaMethodInvocationHelper::DispatcherDelegate {
-  public:
-    AndJSCore();
-    ~AndJSCore() override;
-
-    void Init();
-
-    bool InjectObject(JNIEnv* env,
-                      const base::android::JavaParamRef<jobject>& jcaller,
-                      const base::android::JavaParamRef<jobject>& jobject,
-                      const base::android::JavaParamRef<jstring>& jname,
-                      const base::android::JavaParamRef<jclass>&  annotation_clazz);
-
-    void LoadJSBuf(JNIEnv* env,
-                   const base::android::JavaParamRef<jobject>& jcaller,
-                   const base::android::JavaParamRef<jstring>& jsbuf);
+class QuickJSArena;
+class QuickJSNativeAsync;
+class StructuredReceiver;
+class WorkerHost;
+class WorkerList;
 
-    void LoadJSFile(JNIEnv* env,
-                    const base::android::JavaParamRef<jobject>& jcaller,
-                    const base::android::JavaParamRef<jstring>& jsfile);
-
-    void Shutdown(JNIEnv* env,
-                  const base::android::JavaParamRef<jobject>& jcaller);
-
-    void Run(const std::string& jsbuf, const std::string& resource_name);
+class AndJSCoreQuickJS : public ScriptEngine,
+                         public content::GinJavaMethodInvocationHelper::DispatcherDelegate {
+  public:
+    // postToJava() is only defined with a |structured_receiver|.
+    AndJSCoreQuickJS(AndJSStats* stats, StructuredReceiver* structured_receiver);
+    ~AndJSCoreQuickJS() override;
+
+    // Before Init(), caps the JSRuntime heap once the main context exists.
+    // Zero is unlimited.
+    void SetMemoryLimit(size_t memory_limit);
+
+    // ScriptEngine
+    Type GetType() const override;
+    void Init() override;
+    bool CreateContext(int context_id) override;
+    void DisposeContext(int context_id) override;
+    void ResetContext(int context_id) override;
+    bool InjectObject(int context_id,
+                      const std::string& name,
+                      const base::android::JavaRef<jobject>& object,
+                      const base::android::JavaRef<jclass>& annotation_clazz) override;
+    RunStatus Run(int context_id,
+                  const ScriptString& source,
+                  const std::string& resource_name,
+                  base::TimeDelta cpu_budget) override;
+    void SetCallbackBudget(base::TimeDelta cpu_budget) override;
+    void SetModuleBundle(scoped_refptr<ModuleBundle> bundle) override;
+    RunStatus RunModule(int context_id,
+                        const std::string& name,
+                        base::TimeDelta cpu_budget) override;
+    bool StartStreaming(int context_id,
+                        const base::FilePath& path,
+                        const std::string& resource_name,
+                        base::OnceClosure done) override;
+    RunStatus FinishStreaming(base::TimeDelta cpu_budget) override;
+    bool StartProfiling(const std::string& title, base::TimeDelta interval) override;
+    std::unique_ptr<CpuProfile> StopProfiling() override;
+    void SaveGlobals(std::map<int, std::string>* globals) override;
+    void RestoreGlobals(const std::map<int, std::string>& globals) override;
+    size_t GetHeapSize() override;
+    bool CollectIdleGarbage(base::TimeDelta budget) override;
+    void OnMemoryPressure(bool critical) override;
+    void Terminate() override;
+    void DispatchWorkerMessage(int worker_id, std::unique_ptr<WorkerMessage> message) override;
+    void DispatchMessage(std::unique_ptr<WorkerMessage> message) override;
+    void DispatchEvent(const ScriptEvent& event) override;
+    void FlushBatchedCalls() override;
+    void Shutdown() override;
 
     scoped_refptr<content::GinJavaBoundObject> GetObject(content::GinJavaBoundObject::ObjectID object_id);
     std::unique_ptr<base::Value> FromJSValue(JSValue val);
@@ -74,18 +115,129 @@ class AndJSCore : public content::GinJavaMethodInvocationHelper::DispatcherDeleg
     JSValue ToJSObject(const base::android::JavaRef<jobject>& java_object,
                        const base::android::JavaRef<jclass>&  annotation_clazz);
 
+    AndJSStats* stats() { return stats_; }
+    BatchedCalls* batched_calls() { return &batched_calls_; }
+
+    // Worker bindings: the constructor, postMessage()/terminate() of a Worker
+    // object and the global postMessage() of a worker.
+    JSValue NewWorker(int argc, JSValueConst* argv);
+    JSValue PostWorkerMessage(int worker_id, int argc, JSValueConst* argv);
+    JSValue TerminateWorker(int worker_id);
+    JSValue PostMessageToParent(int argc, JSValueConst* argv);
+
+    JSValue PostToJava(JSContext* ctx, int argc, JSValueConst* argv);
+
+    // The global addEventListener()/removeEventListener() of |ctx|.
+    JSValue AddEventListener(JSContext* ctx, int argc, JSValueConst* argv);
+    JSValue RemoveEventListener(JSContext* ctx, int argc, JSValueConst* argv);
+
+    // Bridge calls of classes with a generated binding, see andjs_bindings.h.
+    const ClassBinding* GetClassBinding(JSClassID class_id);
+    JSValue InvokeDirect(const ClassBinding& binding, const MethodBinding& method,
+                         const base::android::JavaRef<jobject>& object,
+                         int argc, JSValueConst* argv);
+    JSValue InvokeBatched(const ClassBinding& binding, const MethodBinding& method,
+                          content::GinJavaBoundObject::ObjectID object_id,
+                          const base::android::JavaRef<jobject>& object,
+                          int argc, JSValueConst* argv);
+
     // GinJavaMethodInvocationHelper::DispatcherDelegate
     JavaObjectWeakGlobalRef GetObjectWeakRef(content::GinJavaBoundObject::ObjectID object_id) override;
 
   private:
-    bool InjectObject(std::string& name,
-                      const base::android::JavaRef<jobject>& object,
-                      const base::android::JavaRef<jclass>& annotation_clazz);
-    void Shutdown();
-    bool InjectNativeObject();
+    // The @CalledByJavascript methods of a java class, name and arity.
+    struct JavaClass {
+      JSClassID class_id;
+      std::vector<std::pair<std::string, int>> methods;
+      // The generated binding of the class, nullptr when it is reflected.
+      const ClassBinding* binding = nullptr;
+    };
+    // An object injected into a context, bound again by ResetContext().
+    struct InjectedObject {
+      std::string name;
+      content::GinJavaBoundObject::ObjectID object_id;
+      const JavaClass* java_class;
+    };
 
+    bool InjectNativeObject();
+    JSContext* NewContext();
+    JSContext* GetContext(int context_id);
+    void TerminateWorkers(JSContext* ctx);
+    const JavaClass& GetJavaClass(const base::android::JavaRef<jclass>& clazz,
+                                  const base::android::JavaRef<jclass>& annotation_clazz);
+    const JavaClass* BindJavaObject(const base::android::JavaRef<jobject>& java_object,
+                                    const base::android::JavaRef<jclass>& annotation_clazz,
+                                    content::GinJavaBoundObject::ObjectID* object_id);
+    JSValue NewJavaObject(content::GinJavaBoundObject::ObjectID object_id, const JavaClass& java_class);
+    static int InterruptHandler(JSRuntime* rt, void* opaque);
+    static char* NormalizeModuleName(JSContext* ctx, const char* base, const char* name, void* opaque);
+    static JSModuleDef* LoadModule(JSContext* ctx, const char* name, void* opaque);
+    JSModuleDef* LoadBundleModule(const ModuleBundle::Module& module);
+    bool ExecutePendingJobs();
+    void StartRunBudget(base::TimeDelta cpu_budget);
+    bool StopRunBudget();
+    void OnCallbackTerminated(const std::string& what);
+    void RunGC();
+    void SampleStack(base::TimeTicks now);
+    void LogException();
+    static std::unique_ptr<ScriptEngine> CreateWorkerEngine(size_t memory_limit, AndJSStats* stats, WorkerHost* host);
+    bool SerializeMessage(int argc, JSValueConst* argv, WorkerMessage* message);
+    void DispatchMessageEvent(JSValueConst target, std::unique_ptr<WorkerMessage> message);
+    // Before |ctx| is freed.
+    void FreeEventListeners(JSContext* ctx);
+    // Frees |ctx| with everything kept for it.
+    void FreeContext(JSContext* ctx);
+    void SettleNativeAsync(JSContext* ctx, base::OnceClosure settle);
+
+    // Outlives |rt_|, JS_FreeRuntime() frees the runtime itself through it.
+    std::unique_ptr<QuickJSArena> arena_;
     JSRuntime* rt_;
+    size_t memory_limit_;
+    // The context the current task works in, one of |contexts_|.
     JSContext* ctx_;
+    std::map<int, JSContext*> contexts_;
+    std::map<int, std::vector<InjectedObject>> injected_objects_;
+    // By class name, JSTask thread only.
+    std::map<std::string, JavaClass> java_classes_;
+    std::map<JSClassID, const ClassBinding*> class_bindings_;
+    AndJSStats* stats_;
+    StructuredReceiver* structured_receiver_;
+    BatchedCalls batched_calls_;
+
+    // Only touched on the JSTask thread, from Run(), the callbacks and the
+    // interrupt handler.
+    base::ThreadTicks run_deadline_;
+    bool run_terminated_;
+    base::TimeDelta callback_budget_;
+
+    // Sampling profiler, driven by the interrupt handler as well.
+    std::unique_ptr<CpuProfile> profile_;
+    base::TimeDelta profile_interval_;
+    base::TimeTicks next_sample_;
+    JSValue error_ctor_;
+    bool in_sample_;
+
+    scoped_refptr<ModuleBundle> bundle_;
+
+    // Set when this engine runs inside a worker, for the global postMessage().
+    WorkerHost* worker_host_;
+    // Set by Terminate() from any thread, seen by the interrupt handler.
+    std::atomic<bool> terminate_requested_;
+    // Workers started by `new Worker()`, their JS objects and the context
+    // each was created in.
+    struct WorkerObject {
+      JSContext* ctx;
+      JSValue object;
+    };
+    std::unique_ptr<WorkerList> workers_;
+    std::map<int, WorkerObject> worker_objects_;
+
+    // addEventListener() listeners of each context by event type, in the
+    // order added.
+    typedef std::map<std::string, std::vector<JSValue>> EventListeners;
+    std::map<JSContext*, EventListeners> event_listeners_;
+    // Pending promises of native methods, see QuickJSNativeAsync.
+    std::map<JSContext*, std::unique_ptr<QuickJSNativeAsync>> native_async_;
 
     typedef std::map<content::GinJavaBoundObject::ObjectID, scoped_refptr<content::GinJavaBoundObject>> ObjectMap;
     ObjectMap objects_ GUARDED_BY(objects_lock_);
@@ -93,8 +245,6 @@ class AndJSCore : public content::GinJavaMethodInvocationHelper::DispatcherDeleg
     content::GinJavaBoundObject::ObjectID next_object_id_;
 
     //base::IDMap<JSClassID, jclass> jsclass_id_map_;
-    std::unique_ptr<base::Thread> thread_;
-    std::unique_ptr<base::MessageLoop> message_loop_;
 };
 
 }
@@ -0,0 +1,1646 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_core_v8.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "base/auto_reset.h"
+#include "base/threading/thread_task_runner_handle.h"
+#include "base/strings/string_util.h"
+#include "base/android/jni_weak_ref.h"
+#include "base/android/jni_string.h"
+#include "base/feature_list.h"
+#include "base/files/file_util.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/no_destructor.h"
+#include "base/strings/stringprintf.h"
+#include "base/synchronization/lock.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/system/sys_info.h"
+#include "base/threading/thread.h"
+#include "base/i18n/icu_util.h"
+#include "gin/try_catch.h"
+#include "gin/v8_initializer.h"
+#include "gin/arguments.h"
+#include "gin/converter.h"
+#include "gin/object_template_builder.h"
+#include "gin/handle.h"
+#include "gin/wrappable.h"
+#include "gin/per_context_data.h"
+#include "gin/public/v8_platform.h"
+#include "base/pickle.h"
+#include "base/trace_event/trace_event.h"
+#include "v8/include/libplatform/libplatform.h"
+
+#include "andjs/andjs_array_buffer_pool.h"
+#include "andjs/andjs_cpu_profile.h"
+#include "andjs/andjs_encoding.h"
+#include "andjs/andjs_events.h"
+#include "andjs/andjs_logger.h"
+#include "andjs/andjs_native_module_v8.h"
+#include "andjs/andjs_native_objects.h"
+#include "andjs/andjs_structured.h"
+#include "andjs/andjs_wasm_cache.h"
+#include "andjs/andjs_worker.h"
+#include "andjs/gin_java_bridge_object.h"
+
+using v8::Context;
+using v8::Local;
+using v8::HandleScope;
+using v8::Isolate;
+
+using base::android::JavaParamRef;
+using base::android::ScopedJavaLocalRef;
+using base::android::ConvertJavaStringToUTF8;
+using base::android::ConvertJavaStringToUTF16;
+using base::android::ConvertUTF8ToJavaString;
+
+namespace andjs {
+
+static std::unique_ptr<content::V8ValueConverter> g_converter_ = content::V8ValueConverter::Create();
+
+namespace {
+
+// What `new Worker(src)` returns.
+class JSWorker: public gin::Wrappable<JSWorker> {
+  public:
+    static gin::WrapperInfo kWrapperInfo;
+
+    static gin::Handle<JSWorker> Create(v8::Isolate* isolate, AndJSCoreV8* engine, int worker_id) {
+      return CreateHandle(isolate, new JSWorker(engine, worker_id));
+    }
+
+    void PostMessage(gin::Arguments* args) {
+      engine_->PostWorkerMessage(worker_id_, args);
+    }
+
+    void Terminate() {
+      engine_->TerminateWorker(worker_id_);
+    }
+
+  protected:
+    JSWorker(AndJSCoreV8* engine, int worker_id) : engine_(engine), worker_id_(worker_id) {}
+    gin::ObjectTemplateBuilder GetObjectTemplateBuilder(v8::Isolate* isolate) final {
+      return gin::Wrappable<JSWorker>::GetObjectTemplateBuilder(isolate)
+             .SetMethod("postMessage", &JSWorker::PostMessage)
+             .SetMethod("terminate", &JSWorker::Terminate);
+    }
+    const char* GetTypeName() final { return "Worker"; }
+    ~JSWorker() override = default;
+
+  private:
+    AndJSCoreV8* engine_;
+    const int worker_id_;
+
+    DISALLOW_COPY_AND_ASSIGN(JSWorker);
+};
+gin::WrapperInfo JSWorker::kWrapperInfo = { gin::kEmbedderNativeGin };
+
+// postMessage(message[, transfer]). The ArrayBuffers listed in |transfer|
+// are detached and their memory moves with the message.
+bool SerializeMessage(gin::Arguments* args, WorkerMessage* message) {
+  v8::Isolate* isolate = args->isolate();
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+  v8::Local<v8::Value> value = v8::Undefined(isolate);
+  args->GetNext(&value);
+
+  std::vector<v8::Local<v8::ArrayBuffer>> transfer;
+  v8::Local<v8::Array> list;
+  if(args->GetNext(&list)) {
+    for(uint32_t i = 0; i < list->Length(); i++) {
+      v8::Local<v8::Value> item;
+      if(!list->Get(context, i).ToLocal(&item))
+        return false;
+      if(!item->IsArrayBuffer() || !item.As<v8::ArrayBuffer>()->IsDetachable()) {
+        args->ThrowTypeError("postMessage can only transfer ArrayBuffers");
+        return false;
+      }
+      transfer.push_back(item.As<v8::ArrayBuffer>());
+    }
+  }
+
+  v8::ValueSerializer serializer(isolate);
+  for(size_t i = 0; i < transfer.size(); i++)
+    serializer.TransferArrayBuffer(static_cast<uint32_t>(i), transfer[i]);
+  serializer.WriteHeader();
+  if(!serializer.WriteValue(context, value).FromMaybe(false))
+    return false;
+
+  for(v8::Local<v8::ArrayBuffer> buffer : transfer) {
+    size_t length = buffer->ByteLength();
+    uint8_t* data;
+    if(buffer->IsExternal()) {
+      // Memory owned by someone else, only that copy is made.
+      data = static_cast<uint8_t*>(ArrayBufferPool::GetInstance()->AllocateUninitialized(length));
+      memcpy(data, buffer->GetContents().Data(), length);
+    } else {
+      data = static_cast<uint8_t*>(buffer->Externalize().Data());
+    }
+    buffer->Detach();
+    message->buffers.push_back(TransferredBuffer(data, length));
+  }
+
+  std::pair<uint8_t*, size_t> data = serializer.Release();
+  message->data.assign(data.first, data.first + data.second);
+  free(data.first);
+  return true;
+}
+
+v8::MaybeLocal<v8::Value> DeserializeMessage(v8::Isolate* isolate,
+                                             v8::Local<v8::Context> context,
+                                             WorkerMessage* message) {
+  v8::ValueDeserializer deserializer(isolate, message->data.data(), message->data.size());
+  for(size_t i = 0; i < message->buffers.size(); i++) {
+    TransferredBuffer& buffer = message->buffers[i];
+    deserializer.TransferArrayBuffer(static_cast<uint32_t>(i),
+      v8::ArrayBuffer::New(isolate, buffer.Release(), buffer.length,
+                           v8::ArrayBufferCreationMode::kInternalized));
+  }
+  if(!deserializer.ReadHeader(context).FromMaybe(false))
+    return v8::MaybeLocal<v8::Value>();
+  return deserializer.ReadValue(context);
+}
+
+// postToJava() values in the StructuredWriter format, straight from the
+// handles. Throws a TypeError into the script for what can't be written.
+bool WriteStructured(v8::Isolate* isolate,
+                     v8::Local<v8::Context> context,
+                     v8::Local<v8::Value> value,
+                     StructuredWriter* writer,
+                     int depth) {
+  if(value->IsNull()) {
+    writer->WriteTag(StructuredTag::kNull);
+  } else if(value->IsUndefined()) {
+    writer->WriteTag(StructuredTag::kUndefined);
+  } else if(value->IsBoolean()) {
+    writer->WriteTag(value->IsTrue() ? StructuredTag::kTrue : StructuredTag::kFalse);
+  } else if(value->IsInt32()) {
+    writer->WriteInt32(value.As<v8::Int32>()->Value());
+  } else if(value->IsNumber()) {
+    writer->WriteDouble(value.As<v8::Number>()->Value());
+  } else if(value->IsString()) {
+    v8::Local<v8::String> str = value.As<v8::String>();
+    int length = str->Length();
+    if(str->IsOneByte()) {
+      str->WriteOneByte(isolate, writer->WriteData(StructuredTag::kLatin1String, length, 1),
+                        0, length, v8::String::NO_NULL_TERMINATION);
+    } else {
+      // The payload may be unaligned.
+      std::vector<uint16_t> chars(length);
+      str->Write(isolate, chars.data(), 0, length, v8::String::NO_NULL_TERMINATION);
+      memcpy(writer->WriteData(StructuredTag::kTwoByteString, length, sizeof(uint16_t)),
+             chars.data(), length * sizeof(uint16_t));
+    }
+  } else if(value->IsArrayBufferView()) {
+    v8::Local<v8::ArrayBufferView> view = value.As<v8::ArrayBufferView>();
+    size_t length = view->ByteLength();
+    view->CopyContents(writer->WriteData(StructuredTag::kBytes, length, 1), length);
+  } else if(value->IsArrayBuffer()) {
+    v8::ArrayBuffer::Contents contents = value.As<v8::ArrayBuffer>()->GetContents();
+    memcpy(writer->WriteData(StructuredTag::kBytes, contents.ByteLength(), 1),
+           contents.Data(), contents.ByteLength());
+  } else if(depth >= StructuredWriter::kMaxDepth) {
+    isolate->ThrowException(v8::Exception::TypeError(gin::StringToV8(isolate, "postToJava value is nested too deeply")));
+    return false;
+  } else if(value->IsArray()) {
+    v8::Local<v8::Array> array = value.As<v8::Array>();
+    uint32_t length = array->Length();
+    size_t offset = writer->BeginContainer(StructuredTag::kArray);
+    for(uint32_t i = 0; i < length; i++) {
+      v8::Local<v8::Value> item;
+      if(!array->Get(context, i).ToLocal(&item) ||
+         !WriteStructured(isolate, context, item, writer, depth + 1))
+        return false;
+    }
+    writer->EndContainer(offset, length);
+  } else if(value->IsObject() && !value->IsFunction()) {
+    v8::Local<v8::Object> object = value.As<v8::Object>();
+    v8::Local<v8::Array> keys;
+    if(!object->GetOwnPropertyNames(context).ToLocal(&keys))
+      return false;
+    uint32_t length = keys->Length();
+    size_t offset = writer->BeginContainer(StructuredTag::kObject);
+    for(uint32_t i = 0; i < length; i++) {
+      v8::Local<v8::Value> key;
+      v8::Local<v8::String> key_string;
+      v8::Local<v8::Value> item;
+      if(!keys->Get(context, i).ToLocal(&key) ||
+         !key->ToString(context).ToLocal(&key_string) ||
+         !object->Get(context, key).ToLocal(&item) ||
+         !WriteStructured(isolate, context, key_string, writer, depth + 1) ||
+         !WriteStructured(isolate, context, item, writer, depth + 1))
+        return false;
+    }
+    writer->EndContainer(offset, length);
+  } else {
+    isolate->ThrowException(v8::Exception::TypeError(gin::StringToV8(isolate, "postToJava can't send functions or symbols")));
+    return false;
+  }
+  return true;
+}
+
+v8::MaybeLocal<v8::Value> ReadStructured(v8::Isolate* isolate,
+                                         v8::Local<v8::Context> context,
+                                         StructuredReader* reader,
+                                         int depth) {
+  StructuredTag tag;
+  if(depth > StructuredWriter::kMaxDepth || !reader->ReadTag(&tag))
+    return v8::MaybeLocal<v8::Value>();
+  uint32_t length = 0;
+  const uint8_t* data = nullptr;
+  switch(tag) {
+    case StructuredTag::kNull:
+      return v8::Null(isolate);
+    case StructuredTag::kUndefined:
+      return v8::Undefined(isolate);
+    case StructuredTag::kFalse:
+      return v8::False(isolate);
+    case StructuredTag::kTrue:
+      return v8::True(isolate);
+    case StructuredTag::kInt32: {
+      int32_t value;
+      if(!reader->ReadInt32(&value))
+        return v8::MaybeLocal<v8::Value>();
+      return v8::Integer::New(isolate, value);
+    }
+    case StructuredTag::kDouble: {
+      double value;
+      if(!reader->ReadDouble(&value))
+        return v8::MaybeLocal<v8::Value>();
+      return v8::Number::New(isolate, value);
+    }
+    case StructuredTag::kLatin1String:
+      if(!reader->ReadLength(&length) || length > static_cast<uint32_t>(v8::String::kMaxLength) ||
+         !reader->ReadData(length, 1, &data))
+        return v8::MaybeLocal<v8::Value>();
+      return v8::String::NewFromOneByte(isolate, data, v8::NewStringType::kNormal, length);
+    case StructuredTag::kUtf8String:
+      if(!reader->ReadLength(&length) || length > static_cast<uint32_t>(v8::String::kMaxLength) ||
+         !reader->ReadData(length, 1, &data))
+        return v8::MaybeLocal<v8::Value>();
+      return v8::String::NewFromUtf8(isolate, reinterpret_cast<const char*>(data), v8::NewStringType::kNormal, length);
+    case StructuredTag::kTwoByteString: {
+      if(!reader->ReadLength(&length) || length > static_cast<uint32_t>(v8::String::kMaxLength) ||
+         !reader->ReadData(length, sizeof(uint16_t), &data))
+        return v8::MaybeLocal<v8::Value>();
+      if(reinterpret_cast<uintptr_t>(data) % alignof(uint16_t) == 0) {
+        return v8::String::NewFromTwoByte(isolate, reinterpret_cast<const uint16_t*>(data),
+                                          v8::NewStringType::kNormal, length);
+      }
+      std::vector<uint16_t> chars(length);
+      memcpy(chars.data(), data, length * sizeof(uint16_t));
+      return v8::String::NewFromTwoByte(isolate, chars.data(), v8::NewStringType::kNormal, length);
+    }
+    case StructuredTag::kBytes: {
+      if(!reader->ReadLength(&length) || !reader->ReadData(length, 1, &data))
+        return v8::MaybeLocal<v8::Value>();
+      v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, length);
+      memcpy(buffer->GetContents().Data(), data, length);
+      return v8::Uint8Array::New(buffer, 0, length);
+    }
+    case StructuredTag::kArray: {
+      if(!reader->ReadLength(&length))
+        return v8::MaybeLocal<v8::Value>();
+      // Not sized by |length|, a bogus count runs out of input instead of
+      // allocating.
+      v8::Local<v8::Array> array = v8::Array::New(isolate, 0);
+      for(uint32_t i = 0; i < length; i++) {
+        v8::Local<v8::Value> item;
+        if(!ReadStructured(isolate, context, reader, depth + 1).ToLocal(&item) ||
+           array->CreateDataProperty(context, i, item).IsNothing())
+          return v8::MaybeLocal<v8::Value>();
+      }
+      return array;
+    }
+    case StructuredTag::kObject: {
+      if(!reader->ReadLength(&length))
+        return v8::MaybeLocal<v8::Value>();
+      v8::Local<v8::Object> object = v8::Object::New(isolate);
+      for(uint32_t i = 0; i < length; i++) {
+        v8::Local<v8::Value> key;
+        v8::Local<v8::Value> item;
+        if(!ReadStructured(isolate, context, reader, depth + 1).ToLocal(&key) || !key->IsString() ||
+           !ReadStructured(isolate, context, reader, depth + 1).ToLocal(&item) ||
+           object->CreateDataProperty(context, key.As<v8::String>(), item).IsNothing())
+          return v8::MaybeLocal<v8::Value>();
+      }
+      return object;
+    }
+  }
+  return v8::MaybeLocal<v8::Value>();
+}
+
+// V8 copies every chunk into its own buffers anyway, a bigger one only
+// delays the start of the parse.
+constexpr size_t kStreamingChunkSize = 64 * 1024;
+
+// At most this many streaming threads, and no more than cores.
+constexpr size_t kMaxStreamingThreads = 4;
+
+// The streaming threads of all isolates. A parse goes to the thread with
+// the fewest parses queued, a new one is started while all are busy, so a
+// big file of one instance doesn't hold up the files of the others.
+class StreamingPool {
+  public:
+    static StreamingPool* GetInstance() {
+      static base::NoDestructor<StreamingPool> instance;
+      return instance.get();
+    }
+
+    // |reply| runs on the calling thread once |parse| ran.
+    void PostParse(base::OnceClosure parse, base::OnceClosure reply) {
+      base::AutoLock locker(lock_);
+      size_t index = 0;
+      for(size_t i = 1; i < threads_.size(); i++) {
+        if(pending_[i] < pending_[index])
+          index = i;
+      }
+      size_t max_threads = std::min(kMaxStreamingThreads,
+                                    static_cast<size_t>(base::SysInfo::NumberOfProcessors()));
+      if(threads_.empty() || (pending_[index] > 0 && threads_.size() < max_threads)) {
+        index = threads_.size();
+        threads_.push_back(std::make_unique<base::Thread>(base::StringPrintf("JSStreaming%zu", index)));
+        threads_.back()->Start();
+        pending_.push_back(0);
+      }
+      pending_[index]++;
+      threads_[index]->task_runner()->PostTaskAndReply(FROM_HERE,
+        base::BindOnce(&StreamingPool::RunParse, base::Unretained(this), index, std::move(parse)),
+        std::move(reply));
+    }
+
+  private:
+    friend class base::NoDestructor<StreamingPool>;
+    StreamingPool() = default;
+    ~StreamingPool() = default;
+
+    void RunParse(size_t index, base::OnceClosure parse) {
+      std::move(parse).Run();
+      base::AutoLock locker(lock_);
+      pending_[index]--;
+    }
+
+    std::vector<std::unique_ptr<base::Thread>> threads_;
+    std::vector<size_t> pending_;
+    base::Lock lock_;
+
+    DISALLOW_COPY_AND_ASSIGN(StreamingPool);
+};
+
+// Hands V8 the mapped file chunk by chunk, it owns and frees each one.
+class MappedSourceStream : public v8::ScriptCompiler::ExternalSourceStream {
+  public:
+    MappedSourceStream(const uint8_t* data, size_t length)
+        : data_(data), length_(length), offset_(0) {}
+
+    // Streaming thread.
+    size_t GetMoreData(const uint8_t** src) override {
+      size_t size = std::min(kStreamingChunkSize, length_ - offset_);
+      if(size == 0)
+        return 0;
+      uint8_t* chunk = new uint8_t[size];
+      memcpy(chunk, data_ + offset_, size);
+      offset_ += size;
+      *src = chunk;
+      return size;
+    }
+
+  private:
+    const uint8_t* data_;
+    size_t length_;
+    size_t offset_;
+
+    DISALLOW_COPY_AND_ASSIGN(MappedSourceStream);
+};
+
+// An ASCII file as the source string of its script, V8 reads the mapping
+// instead of a decoded copy. The string owns it and frees it with itself.
+class MappedOneByteResource : public v8::String::ExternalOneByteStringResource {
+  public:
+    explicit MappedOneByteResource(std::unique_ptr<base::MemoryMappedFile> file)
+        : file_(std::move(file)) {}
+
+    const char* data() const override { return reinterpret_cast<const char*>(file_->data()); }
+    size_t length() const override { return file_->length(); }
+
+  private:
+    std::unique_ptr<base::MemoryMappedFile> file_;
+
+    DISALLOW_COPY_AND_ASSIGN(MappedOneByteResource);
+};
+
+}  // namespace
+
+// A script file parsed and compiled on the streaming thread. The mapping
+// outlives the stream reading it and is the full source string V8 wants
+// for the finalization on JSTask.
+class StreamedScript {
+  public:
+    StreamedScript(std::unique_ptr<base::MemoryMappedFile> file,
+                   int context_id,
+                   const std::string& resource_name)
+        : file_(std::move(file)),
+          context_id_(context_id),
+          resource_name_(resource_name),
+          source_(std::make_unique<MappedSourceStream>(file_->data(), file_->length()),
+                  v8::ScriptCompiler::StreamedSource::UTF8),
+          ascii_(false),
+          parsed_(base::WaitableEvent::ResetPolicy::MANUAL,
+                  base::WaitableEvent::InitialState::NOT_SIGNALED) {}
+
+    bool Start(v8::Isolate* isolate) {
+      task_.reset(v8::ScriptCompiler::StartStreamingScript(isolate, &source_));
+      return !!task_;
+    }
+
+    // Streaming thread. Nothing touches |this| after |parsed_| is signaled,
+    // JSTask may free it right away.
+    void Parse(AndJSStats* stats) {
+      TRACE_EVENT1("andjs", "AndJSCoreV8::StreamScript", "resource_name", resource_name_);
+      base::TimeTicks start = base::TimeTicks::Now();
+      task_->Run();
+      // The pages are hot from the parse, JSTask skips the decode if so.
+      ascii_ = CountASCII(file_->data(), file_->length()) == file_->length();
+      AndJSStats::Add(&stats->stream_time_us, (base::TimeTicks::Now() - start).InMicroseconds());
+      parsed_.Signal();
+    }
+
+    bool IsParsed() { return parsed_.IsSignaled(); }
+    void WaitParsed() { parsed_.Wait(); }
+
+    // Once parsed. An ASCII file goes to the source string as is, anything
+    // else is decoded.
+    v8::MaybeLocal<v8::Script> Compile(v8::Local<v8::Context> context, const v8::ScriptOrigin& origin) {
+      v8::Local<v8::String> code;
+      v8::MaybeLocal<v8::String> maybe_code;
+      if(ascii_) {
+        maybe_code = v8::String::NewExternalOneByte(context->GetIsolate(), new MappedOneByteResource(std::move(file_)));
+      } else {
+        maybe_code = v8::String::NewFromUtf8(context->GetIsolate(), reinterpret_cast<const char*>(file_->data()),
+                                             v8::NewStringType::kNormal, static_cast<int>(file_->length()));
+      }
+      if(!maybe_code.ToLocal(&code))
+        return v8::MaybeLocal<v8::Script>();
+      return v8::ScriptCompiler::Compile(context, &source_, code, origin);
+    }
+
+    int context_id() const { return context_id_; }
+    const std::string& resource_name() const { return resource_name_; }
+
+  private:
+    std::unique_ptr<base::MemoryMappedFile> file_;
+    int context_id_;
+    std::string resource_name_;
+    v8::ScriptCompiler::StreamedSource source_;
+    std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task_;
+    // Written by Parse() before |parsed_| is signaled.
+    bool ascii_;
+    base::WaitableEvent parsed_;
+
+    DISALLOW_COPY_AND_ASSIGN(StreamedScript);
+};
+
+AndJSCoreV8::AndJSCoreV8(AndJSStats* stats, StructuredReceiver* structured_receiver)
+    : next_object_id_(1),
+      current_(nullptr),
+      stats_(stats),
+      structured_receiver_(structured_receiver),
+      batched_calls_(stats),
+      cpu_profiler_(nullptr),
+      worker_host_(nullptr),
+      run_id_(0),
+      run_active_(false),
+      run_terminated_(false) {
+  g_converter_->SetDateAllowed(false);
+  g_converter_->SetRegExpAllowed(false);
+  g_converter_->SetFunctionAllowed(true);
+}
+
+void AndJSCoreV8::EnableWasm(const base::FilePath& cache_dir) {
+  DCHECK(!instance_);
+  wasm_cache_.reset(new WasmModuleCache(cache_dir));
+}
+
+ScriptEngine::Type AndJSCoreV8::GetType() const {
+  return kV8;
+}
+
+v8::Local<v8::Value> AndJSCoreV8::GetV8Version(gin::Arguments* args) {
+  base::Value version(v8::V8::GetVersion());
+  return g_converter_->ToV8Value(&version, args->isolate()->GetCurrentContext());
+}
+
+void AndJSCoreV8::Init() {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::Init");
+  base::i18n::InitializeICU();
+#ifdef V8_USE_EXTERNAL_STARTUP_DATA
+  gin::V8Initializer::LoadV8Snapshot();
+  gin::V8Initializer::LoadV8Natives();
+#endif
+
+  static const char kOptimizeForSize[] = "--optimize_for_size";
+  v8::V8::SetFlagsFromString(kOptimizeForSize, strlen(kOptimizeForSize));
+  static const char kNoOpt[] = "--noopt";
+  v8::V8::SetFlagsFromString(kNoOpt, strlen(kNoOpt));
+
+  // --expose-wasm is process wide and instances opt in one by one, so it
+  // stays on and NewContext() takes WebAssembly away from the others.
+
+  gin::IsolateHolder::Initialize(gin::IsolateHolder::kStrictMode,
+                                 ArrayBufferPool::GetInstance());
+
+  // Init() runs on the engine thread like every other call, AndJSCore and
+  // WorkerHost marshal them there, so the isolate needs no v8::Locker.
+  instance_.reset(new gin::IsolateHolder(base::ThreadTaskRunnerHandle::Get(),
+    gin::IsolateHolder::AccessMode::kSingleThread,
+    gin::IsolateHolder::IsolateType::kUtility));
+  LOG(INFO) << " CreateIsolateHolder instance " << instance_;
+  Isolate* isolate_ = instance_->isolate();
+  ArrayBufferPool::GetInstance()->AddIsolate(isolate_, stats_);
+
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+  // Microtasks are drained by Run() once the script returns.
+  isolate_->SetMicrotasksPolicy(v8::MicrotasksPolicy::kExplicit);
+  isolate_->SetCaptureStackTraceForUncaughtExceptions(true);
+  isolate_->AddGCPrologueCallback(&AndJSCoreV8::OnGCPrologue, this);
+  isolate_->AddGCEpilogueCallback(&AndJSCoreV8::OnGCEpilogue, this);
+  if(!wasm_cache_)
+    isolate_->SetAllowWasmCodeGenerationCallback(&AndJSCoreV8::DisallowWasmCodeGeneration);
+
+  contexts_[kMainContextId] = NewContext();
+  current_ = contexts_[kMainContextId].get();
+  LOG(INFO) << " InjectNativeObject DONE ";
+}
+
+// Callers hold the isolate.
+std::unique_ptr<AndJSCoreV8::ContextState> AndJSCoreV8::NewContext() {
+  Isolate* isolate_ = instance_->isolate();
+  v8::HandleScope handle_scope(isolate_);
+
+  v8::Local<v8::ObjectTemplate> global_templ;
+  if(global_template_.IsEmpty()) {
+    v8::Local<v8::FunctionTemplate> get_v8_version_templ =
+      gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::GetV8Version));
+    global_templ = gin::ObjectTemplateBuilder(isolate_).Build();
+    global_templ->Set(gin::StringToSymbol(isolate_, "get_v8_version"), get_v8_version_templ);
+    global_templ->Set(gin::StringToSymbol(isolate_, "Worker"),
+      gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::NewWorker, base::Unretained(this))));
+    global_templ->Set(gin::StringToSymbol(isolate_, "addEventListener"),
+      gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::AddEventListener, base::Unretained(this))));
+    global_templ->Set(gin::StringToSymbol(isolate_, "removeEventListener"),
+      gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::RemoveEventListener, base::Unretained(this))));
+    if(structured_receiver_) {
+      global_templ->Set(gin::StringToSymbol(isolate_, "postToJava"),
+        gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::PostToJava, base::Unretained(this))));
+    }
+    if(wasm_cache_) {
+      global_templ->Set(gin::StringToSymbol(isolate_, "loadWasm"),
+        gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::LoadWasm, base::Unretained(this))));
+    }
+    if(worker_host_) {
+      global_templ->Set(gin::StringToSymbol(isolate_, "postMessage"),
+        gin::CreateFunctionTemplate(isolate_, base::BindRepeating(&AndJSCoreV8::PostMessageToParent, base::Unretained(this))));
+    }
+    global_template_.Reset(isolate_, global_templ);
+  } else {
+    global_templ = global_template_.Get(isolate_);
+  }
+
+  std::unique_ptr<ContextState> state = std::make_unique<ContextState>();
+  state->holder.reset(new gin::ContextHolder(isolate_));
+  state->holder->SetContext(v8::Context::New(isolate_, nullptr, global_templ));
+  gin::PerContextData::From(state->holder->context())->set_runner(this);
+  GinNativeAsync::Install(state->holder->context(),
+                          base::BindRepeating(&AndJSCoreV8::SettleNativeAsync, base::Unretained(this), state.get()));
+
+  base::AutoReset<ContextState*> scoped_context(&current_, state.get());
+  v8::Context::Scope scope(state->holder->context());
+  if(!wasm_cache_) {
+    // WebAssembly isn't encountered during resolution, so reduce the
+    // potential attack surface.
+    state->holder->context()->Global()->Delete(state->holder->context(),
+      gin::StringToSymbol(isolate_, "WebAssembly")).FromMaybe(false);
+  }
+  InjectNativeObject();
+  return state;
+}
+
+AndJSCoreV8::ContextState* AndJSCoreV8::GetContext(int context_id) {
+  auto it = contexts_.find(context_id);
+  if(it == contexts_.end()) {
+    LOG(ERROR) << " AndJSCoreV8 unknown context " << context_id;
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+bool AndJSCoreV8::CreateContext(int context_id) {
+  TRACE_EVENT1("andjs", "AndJSCoreV8::CreateContext", "context_id", context_id);
+  ScopedStatsTimer timer(&stats_->context_create_time_us);
+  AndJSStats::Add(&stats_->contexts_created, 1);
+  Isolate* isolate_ = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  contexts_[context_id] = NewContext();
+  return true;
+}
+
+void AndJSCoreV8::DisposeContext(int context_id) {
+  if(context_id == kMainContextId)
+    return;
+  ContextState* state = GetContext(context_id);
+  if(!state)
+    return;
+  TerminateWorkers(state);
+  contexts_.erase(context_id);
+}
+
+// Swaps in a context made from the cached global template. The bound java
+// objects keep their reflected methods, so only the wrappers are new.
+// v8::Context::FromSnapshot() would need a custom startup snapshot, which
+// the gin wrappers and FunctionTemplate callbacks here cannot go into.
+void AndJSCoreV8::ResetContext(int context_id) {
+  ContextState* old_state = GetContext(context_id);
+  if(!old_state)
+    return;
+  TRACE_EVENT1("andjs", "AndJSCoreV8::ResetContext", "context_id", context_id);
+  ScopedStatsTimer timer(&stats_->context_reset_time_us);
+  AndJSStats::Add(&stats_->context_resets, 1);
+  Isolate* isolate_ = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  TerminateWorkers(old_state);
+
+  std::unique_ptr<ContextState> state = NewContext();
+  state->injected.swap(old_state->injected);
+  {
+    base::AutoReset<ContextState*> scoped_context(&current_, state.get());
+    gin::Runner::Scope scope(this);
+    for(const auto& injected : state->injected)
+      BindObject(injected.first, injected.second);
+  }
+  contexts_[context_id] = std::move(state);
+}
+
+void AndJSCoreV8::TerminateWorkers(ContextState* state) {
+  for(auto it = worker_objects_.begin(); it != worker_objects_.end();) {
+    if(it->second.context == state) {
+      workers_->Terminate(it->first);
+      it = worker_objects_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// The enumerable string keyed globals of the current context that a new
+// context doesn't have.
+static std::vector<std::string> GetScriptGlobals(v8::Local<v8::Context> context,
+                                                 const std::set<std::string>& builtins) {
+  std::vector<std::string> names;
+  v8::Local<v8::Array> keys;
+  if(!context->Global()->GetOwnPropertyNames(context,
+        static_cast<v8::PropertyFilter>(v8::ONLY_ENUMERABLE | v8::SKIP_SYMBOLS)).ToLocal(&keys))
+    return names;
+  for(uint32_t i = 0; i < keys->Length(); i++) {
+    v8::Local<v8::Value> key;
+    std::string name;
+    if(keys->Get(context, i).ToLocal(&key) &&
+       gin::ConvertFromV8(context->GetIsolate(), key, &name) && !builtins.count(name))
+      names.push_back(name);
+  }
+  return names;
+}
+
+void AndJSCoreV8::SaveGlobals(std::map<int, std::string>* globals) {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::SaveGlobals");
+  Isolate* isolate_ = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  std::set<std::string> builtins;
+  {
+    std::unique_ptr<ContextState> fresh = NewContext();
+    v8::Local<v8::Context> context = fresh->holder->context();
+    v8::Context::Scope context_scope(context);
+    for(const std::string& name : GetScriptGlobals(context, builtins))
+      builtins.insert(name);
+  }
+
+  for(auto& entry : contexts_) {
+    ContextState* state = entry.second.get();
+    std::set<std::string> skipped(builtins);
+    for(const auto& injected : state->injected)
+      skipped.insert(injected.first);
+
+    v8::Local<v8::Context> context = state->holder->context();
+    v8::Context::Scope context_scope(context);
+    v8::TryCatch try_catch(isolate_);
+    base::Pickle pickle;
+    for(const std::string& name : GetScriptGlobals(context, skipped)) {
+      v8::Local<v8::Value> value;
+      if(!context->Global()->Get(context, gin::StringToV8(isolate_, name)).ToLocal(&value))
+        continue;
+      v8::ValueSerializer serializer(isolate_);
+      serializer.WriteHeader();
+      if(!serializer.WriteValue(context, value).FromMaybe(false)) {
+        ANDJS_LOG(Debug) << " SaveGlobals skips " << name;
+        try_catch.Reset();
+        continue;
+      }
+      std::pair<uint8_t*, size_t> buffer = serializer.Release();
+      pickle.WriteString(name);
+      pickle.WriteData(reinterpret_cast<const char*>(buffer.first), static_cast<int>(buffer.second));
+      free(buffer.first);
+    }
+    (*globals)[entry.first].assign(static_cast<const char*>(pickle.data()), pickle.size());
+  }
+}
+
+void AndJSCoreV8::RestoreGlobals(const std::map<int, std::string>& globals) {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::RestoreGlobals");
+  for(const auto& entry : globals) {
+    if(!contexts_.count(entry.first))
+      CreateContext(entry.first);
+  }
+
+  Isolate* isolate_ = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+  for(const auto& entry : globals) {
+    if(entry.second.empty())
+      continue;
+    v8::Local<v8::Context> context = contexts_[entry.first]->holder->context();
+    v8::Context::Scope context_scope(context);
+    v8::TryCatch try_catch(isolate_);
+    base::Pickle pickle(entry.second.data(), static_cast<int>(entry.second.size()));
+    base::PickleIterator iter(pickle);
+    std::string name;
+    const char* data;
+    int length;
+    while(iter.ReadString(&name) && iter.ReadData(&data, &length)) {
+      v8::ValueDeserializer deserializer(isolate_, reinterpret_cast<const uint8_t*>(data), length);
+      v8::Local<v8::Value> value;
+      if(!deserializer.ReadHeader(context).FromMaybe(false) ||
+         !deserializer.ReadValue(context).ToLocal(&value) ||
+         context->Global()->Set(context, gin::StringToV8(isolate_, name), value).IsNothing()) {
+        LOG(ERROR) << " RestoreGlobals failed on " << name;
+        try_catch.Reset();
+      }
+    }
+  }
+}
+
+size_t AndJSCoreV8::GetHeapSize() {
+  v8::HeapStatistics heap_statistics;
+  instance_->isolate()->GetHeapStatistics(&heap_statistics);
+  return heap_statistics.total_heap_size();
+}
+
+// Runs V8's idle time GC tasks (incremental marking steps, finalization,
+// memory reducer) until the deadline.
+bool AndJSCoreV8::CollectIdleGarbage(base::TimeDelta budget) {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::CollectIdleGarbage");
+  Isolate* isolate_ = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  double deadline = gin::V8Platform::Get()->MonotonicallyIncreasingTime() + budget.InSecondsF();
+  return isolate_->IdleNotificationDeadline(deadline);
+}
+
+void AndJSCoreV8::OnMemoryPressure(bool critical) {
+  TRACE_EVENT1("andjs", "AndJSCoreV8::OnMemoryPressure", "critical", critical);
+  Isolate* isolate_ = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  AndJSStats::Add(&stats_->memory_pressure_gcs, 1);
+  if(critical) {
+    isolate_->MemoryPressureNotification(v8::MemoryPressureLevel::kCritical);
+    isolate_->LowMemoryNotification();
+  } else {
+    isolate_->MemoryPressureNotification(v8::MemoryPressureLevel::kModerate);
+  }
+  ArrayBufferPool::GetInstance()->Trim();
+}
+
+// static
+void AndJSCoreV8::OnGCPrologue(v8::Isolate* isolate, v8::GCType type,
+                               v8::GCCallbackFlags flags, void* data) {
+  static_cast<AndJSCoreV8*>(data)->gc_start_ = base::TimeTicks::Now();
+}
+
+// static
+void AndJSCoreV8::OnGCEpilogue(v8::Isolate* isolate, v8::GCType type,
+                               v8::GCCallbackFlags flags, void* data) {
+  AndJSCoreV8* self = static_cast<AndJSCoreV8*>(data);
+  self->stats_->AddGCPause(base::TimeTicks::Now() - self->gc_start_);
+}
+
+bool AndJSCoreV8::StartProfiling(const std::string& title, base::TimeDelta interval) {
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  if(!profile_title_.empty()) {
+    LOG(ERROR) << " StartProfiling " << title << " while " << profile_title_ << " is running";
+    return false;
+  }
+  if(!cpu_profiler_)
+    cpu_profiler_ = v8::CpuProfiler::New(isolate_);
+  cpu_profiler_->SetSamplingInterval(interval.InMicroseconds());
+  cpu_profiler_->StartProfiling(gin::StringToV8(isolate_, title), true);
+  profile_title_ = title;
+  return true;
+}
+
+static void CopyProfileNode(CpuProfile* profile,
+                            const v8::CpuProfileNode* v8_node,
+                            int parent,
+                            std::map<unsigned, int>* node_ids) {
+  int id;
+  if(parent == 0) {
+    id = CpuProfile::kRootNodeId;
+    profile->AddHitCount(id, v8_node->GetHitCount());
+  } else {
+    id = profile->AddChild(parent, v8_node->GetFunctionNameStr(),
+                           v8_node->GetScriptResourceNameStr(),
+                           v8_node->GetLineNumber() - 1,
+                           v8_node->GetColumnNumber() - 1,
+                           v8_node->GetHitCount());
+  }
+  (*node_ids)[v8_node->GetNodeId()] = id;
+
+  for(int i = 0; i < v8_node->GetChildrenCount(); i++)
+    CopyProfileNode(profile, v8_node->GetChild(i), id, node_ids);
+}
+
+std::unique_ptr<CpuProfile> AndJSCoreV8::StopProfiling() {
+  if(profile_title_.empty())
+    return nullptr;
+
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  v8::Isolate::Scope isolate_scope(isolate_);
+  v8::HandleScope handle_scope(isolate_);
+
+  std::unique_ptr<CpuProfile> profile = std::make_unique<CpuProfile>(profile_title_);
+  v8::CpuProfile* v8_profile = cpu_profiler_->StopProfiling(gin::StringToV8(isolate_, profile_title_));
+  profile_title_.clear();
+  if(!v8_profile)
+    return nullptr;
+
+  std::map<unsigned, int> node_ids;
+  CopyProfileNode(profile.get(), v8_profile->GetTopDownRoot(), 0, &node_ids);
+  for(int i = 0; i < v8_profile->GetSamplesCount(); i++) {
+    profile->AddSample(node_ids[v8_profile->GetSample(i)->GetNodeId()],
+                       v8_profile->GetSampleTimestamp(i));
+  }
+  profile->set_start_time(v8_profile->GetStartTime());
+  profile->set_end_time(v8_profile->GetEndTime());
+  v8_profile->Delete();
+  return profile;
+}
+
+void AndJSCoreV8::FlushBatchedCalls() {
+  batched_calls_.Flush();
+}
+
+void AndJSCoreV8::Shutdown() {
+  LOG(INFO) << " AndJSCoreV8 Shutdown instance " << instance_;
+  batched_calls_.Flush();
+  watchdog_.reset();
+  if(cpu_profiler_) {
+    cpu_profiler_->Dispose();
+    cpu_profiler_ = nullptr;
+  }
+  workers_.reset();
+  worker_objects_.clear();
+  // The streaming thread may still be parsing for the isolate.
+  if(streamed_) {
+    streamed_->WaitParsed();
+    streamed_.reset();
+  }
+  current_ = nullptr;
+  contexts_.clear();
+  global_template_.Reset();
+  if(instance_)
+    ArrayBufferPool::GetInstance()->RemoveIsolate(instance_->isolate());
+  instance_.reset();
+}
+
+bool AndJSCoreV8::InjectNativeObject() {
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  v8::HandleScope handle_scope(isolate_);
+  v8::Local<v8::Context> context = current_->holder->context();
+  v8::Local<v8::Function> jscrypto_class = GinNativeObject<JSCrypto>::GetConstructor(context);
+  v8::Local<v8::Value> adb = GinNativeObject<AdbLog>::Create(isolate_, std::make_unique<AdbLog>()).ToV8();
+  v8::Local<v8::Value> jscrypto = GinNativeObject<JSCrypto>::Create(isolate_, std::make_unique<JSCrypto>()).ToV8();
+  v8::Local<v8::Value> andjs = GinNativeObject<AndJSControl>::Create(
+      isolate_, std::make_unique<AndJSControl>(&batched_calls_)).ToV8();
+
+  bool result = global()->Set(context, gin::StringToV8(isolate_, "adb"), adb).FromMaybe(false);
+  result &= global()->Set(context, gin::StringToV8(isolate_, "andjs"), andjs).FromMaybe(false);
+  result &= global()->Set(context, gin::StringToV8(isolate_, "jscrypto"), jscrypto).FromMaybe(false);
+  result &= global()->Set(context, gin::StringToV8(isolate_, JSCrypto::kClassName), jscrypto_class).FromMaybe(false);
+  result &= global()->Set(context, gin::StringToV8(isolate_, "getJSCrypto"), jscrypto_class).FromMaybe(false);
+  result &= jscrypto_class->Set(context, gin::StringToV8(isolate_, "key"), jscrypto_class).FromMaybe(false);
+  v8::Local<v8::Value> kv = GinNativeObject<KV>::Create(isolate_, std::make_unique<KV>()).ToV8();
+  result &= global()->Set(context, gin::StringToV8(isolate_, "kv"), kv).FromMaybe(false);
+
+  v8::Local<v8::Value> encoding = GinNativeObject<Encoding>::Create(isolate_, std::make_unique<Encoding>()).ToV8();
+  result &= global()->Set(context, gin::StringToV8(isolate_, "encoding"), encoding).FromMaybe(false);
+  // TextEncoder, TextDecoder, atob() and btoa().
+  v8::TryCatch try_catch(isolate_);
+  v8::Local<v8::Script> prelude;
+  v8::Local<v8::Value> prelude_function;
+  v8::Local<v8::Value> prelude_args[] = { global(), encoding };
+  result &= v8::Script::Compile(context, gin::StringToV8(isolate_, Encoding::kPrelude)).ToLocal(&prelude) &&
+            prelude->Run(context).ToLocal(&prelude_function) && prelude_function->IsFunction() &&
+            !prelude_function.As<v8::Function>()->Call(context, v8::Undefined(isolate_), 2, prelude_args).IsEmpty();
+  return result;
+}
+
+scoped_refptr<content::GinJavaBoundObject> AndJSCoreV8::GetObject(content::GinJavaBoundObject::ObjectID object_id) {
+  // Can be called on any thread.
+  base::AutoLock locker(objects_lock_);
+  auto iter = objects_.find(object_id);
+  if (iter != objects_.end())
+    return iter->second;
+  LOG(ERROR) << "AndJSCoreV8: Unknown object: " << object_id;
+  return nullptr;
+}
+
+v8::Local<v8::Value> AndJSCoreV8::InjectObject(const base::android::JavaRef<jobject>& jobject,
+                                             const base::android::JavaRef<jclass>&  annotation_clazz) {
+
+  JNIEnv* env = base::android::AttachCurrentThread();
+  JavaObjectWeakGlobalRef ref(env, jobject.obj());
+
+  scoped_refptr<content::GinJavaBoundObject> bound_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
+  content::GinJavaBoundObject::ObjectID object_id;
+  {
+    base::AutoLock locker(objects_lock_);
+    object_id = next_object_id_++;
+    objects_[object_id] = bound_object;
+  }
+  GinJavaBridgeObject* object = new GinJavaBridgeObject(this, object_id);
+
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  v8::EscapableHandleScope handle_scope(isolate_);
+
+  ANDJS_LOG(Debug) << " Inject Anonymous Object " << object;
+  gin::Handle<GinJavaBridgeObject> bridge_object = gin::CreateHandle(isolate_, object);
+  ANDJS_LOG(Debug) << " Inject Anonymous Object " << "  bridge_object " << object;
+  if(!bridge_object.IsEmpty()) {
+    return handle_scope.Escape(bridge_object.ToV8());
+  }
+  return handle_scope.Escape(v8::Undefined(isolate_));
+}
+ 
+bool AndJSCoreV8::InjectObject(int context_id,
+                               const std::string& name,
+                               const base::android::JavaRef<jobject>& jobject,
+                               const base::android::JavaRef<jclass>&  annotation_clazz) {
+  ContextState* state = GetContext(context_id);
+  if(!state)
+    return false;
+  base::AutoReset<ContextState*> scoped_context(&current_, state);
+
+  JNIEnv* env = base::android::AttachCurrentThread();
+  JavaObjectWeakGlobalRef ref(env, jobject.obj());
+
+  scoped_refptr<content::GinJavaBoundObject> bound_object = content::GinJavaBoundObject::CreateNamed(ref, annotation_clazz);
+  content::GinJavaBoundObject::ObjectID object_id;
+  {
+    base::AutoLock locker(objects_lock_);
+    object_id = next_object_id_++;
+    objects_[object_id] = bound_object;
+  }
+
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  gin::Runner::Scope scope(this);
+  state->injected.emplace_back(name, object_id);
+  return BindObject(name, object_id);
+}
+
+// Exposes |object_id| as the global |name| of the current context.
+bool AndJSCoreV8::BindObject(const std::string& name, content::GinJavaBoundObject::ObjectID object_id) {
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  GinJavaBridgeObject* object = new GinJavaBridgeObject(this, object_id);
+  gin::Handle<GinJavaBridgeObject> bridge_object = gin::CreateHandle(isolate_, object);
+  ANDJS_LOG(Debug) << " InjectJavaObject " << name << "  bridge_object " << object;
+  if(!bridge_object.IsEmpty()) {
+    v8::Maybe<bool> result = global()->Set(current_->holder->context(), gin::StringToV8(isolate_, name), bridge_object.ToV8());
+    return !result.IsNothing() && result.FromJust();
+  }
+  return false;
+}
+
+static base::TimeDelta ThreadCPUTime(clockid_t clock) {
+  struct timespec ts;
+  if(clock_gettime(clock, &ts) != 0)
+    return base::TimeDelta();
+  return base::TimeDelta::FromTimeSpec(ts);
+}
+
+void AndJSCoreV8::StartWatchdog(base::TimeDelta cpu_budget) {
+  if(cpu_budget <= base::TimeDelta())
+    return;
+
+  clockid_t clock;
+  if(pthread_getcpuclockid(pthread_self(), &clock) != 0) {
+    LOG(ERROR) << " StartWatchdog no cpu clock for JSTask thread";
+    return;
+  }
+
+  if(!watchdog_) {
+    watchdog_.reset(new base::Thread("JSWatchdog"));
+    watchdog_->Start();
+  }
+
+  base::AutoLock locker(watchdog_lock_);
+  run_clock_ = clock;
+  run_start_ = ThreadCPUTime(clock);
+  run_active_ = true;
+  run_id_++;
+  watchdog_->task_runner()->PostDelayedTask(FROM_HERE,
+    base::BindOnce(&AndJSCoreV8::OnWatchdog, base::Unretained(this), run_id_, cpu_budget), cpu_budget);
+}
+
+// Runs on the watchdog thread. The run is only checked against its budget
+// in CPU time, so a script blocked in a java call is given more wall time.
+void AndJSCoreV8::OnWatchdog(uint64_t run_id, base::TimeDelta cpu_budget) {
+  base::AutoLock locker(watchdog_lock_);
+  if(!run_active_ || run_id != run_id_)
+    return;
+
+  base::TimeDelta used = ThreadCPUTime(run_clock_) - run_start_;
+  if(used < cpu_budget) {
+    watchdog_->task_runner()->PostDelayedTask(FROM_HERE,
+      base::BindOnce(&AndJSCoreV8::OnWatchdog, base::Unretained(this), run_id, cpu_budget), cpu_budget - used);
+    return;
+  }
+
+  run_terminated_ = true;
+  instance_->isolate()->TerminateExecution();
+}
+
+bool AndJSCoreV8::StopWatchdog() {
+  base::AutoLock locker(watchdog_lock_);
+  run_active_ = false;
+  bool terminated = run_terminated_;
+  run_terminated_ = false;
+  // The termination may still be pending if the script returned on its own,
+  // clear it so the next task starts clean.
+  if(terminated)
+    instance_->isolate()->CancelTerminateExecution();
+  return terminated;
+}
+
+void AndJSCoreV8::SetCallbackBudget(base::TimeDelta cpu_budget) {
+  callback_budget_ = cpu_budget;
+}
+
+// Listeners and settlements have no RunStatus for AndJSCore to count.
+void AndJSCoreV8::OnCallbackTerminated(const std::string& what) {
+  int64_t count = ++stats_->terminated_runs;
+  LOG(WARNING) << " AndJSCoreV8 " << what << " terminated after " << callback_budget_.InMilliseconds()
+               << "ms cpu time, terminated runs " << count;
+}
+
+void AndJSCoreV8::RunMicrotasks() {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::RunMicrotasks");
+  ScopedStatsTimer timer(&stats_->run_time_us);
+  current_->holder->isolate()->RunMicrotasks();
+}
+
+v8::MaybeLocal<v8::String> NewV8String(v8::Isolate* isolate, const ScriptString& str) {
+  if(str.length() > static_cast<size_t>(v8::String::kMaxLength))
+    return v8::MaybeLocal<v8::String>();
+  int length = static_cast<int>(str.length());
+  switch(str.encoding()) {
+    case ScriptString::kASCII:
+    case ScriptString::kLatin1:
+      return v8::String::NewFromOneByte(isolate, reinterpret_cast<const uint8_t*>(str.bytes().data()),
+                                        v8::NewStringType::kNormal, length);
+    case ScriptString::kUTF16:
+      return v8::String::NewFromTwoByte(isolate, reinterpret_cast<const uint16_t*>(str.chars().data()),
+                                        v8::NewStringType::kNormal, length);
+    case ScriptString::kUTF8:
+      return v8::String::NewFromUtf8(isolate, str.bytes().data(), v8::NewStringType::kNormal, length);
+  }
+  return v8::MaybeLocal<v8::String>();
+}
+
+ScriptEngine::RunStatus AndJSCoreV8::Run(int context_id,
+                                         const ScriptString& source,
+                                         const std::string& resource_name,
+                                         base::TimeDelta cpu_budget) {
+  return RunScript(context_id, &source, nullptr, resource_name, cpu_budget);
+}
+
+ScriptEngine::RunStatus AndJSCoreV8::RunScript(int context_id,
+                                               const ScriptString* source,
+                                               StreamedScript* streamed,
+                                               const std::string& resource_name,
+                                               base::TimeDelta cpu_budget) {
+  ContextState* state = GetContext(context_id);
+  if(!state)
+    return kException;
+  base::AutoReset<ContextState*> scoped_context(&current_, state);
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  gin::Runner::Scope scope(this);
+  gin::TryCatch try_catch(isolate_);
+  v8::ScriptOrigin origin(gin::StringToV8(isolate_, resource_name));
+  RunStatus status = kOk;
+
+  StartWatchdog(cpu_budget);
+  v8::MaybeLocal<v8::Script> maybe_script;
+  {
+    TRACE_EVENT1("andjs", "AndJSCoreV8::Compile", "resource_name", resource_name);
+    ScopedStatsTimer timer(&stats_->compile_time_us);
+    v8::Local<v8::String> code;
+    if(streamed)
+      maybe_script = streamed->Compile(current_->holder->context(), origin);
+    else if(NewV8String(isolate_, *source).ToLocal(&code))
+      maybe_script = v8::Script::Compile(current_->holder->context(), code, &origin);
+  }
+  v8::Local<v8::Script> script;
+  v8::MaybeLocal<v8::Value> maybe_result;
+  if (maybe_script.ToLocal(&script)) {
+    TRACE_EVENT1("andjs", "AndJSCoreV8::Run", "resource_name", resource_name);
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    maybe_result = script->Run(current_->holder->context());
+  }
+  v8::Local<v8::Value> result;
+  if (!maybe_result.ToLocal(&result)) {
+    LOG(ERROR) << try_catch.GetStackTrace();
+    status = kException;
+  } else {
+    v8::Local<v8::Function> func;
+    if(gin::ConvertFromV8(isolate_, result, &func)) {
+      ANDJS_LOG(Debug) << " result IsFunction() " << func->IsFunction();
+      if(func->IsFunction()) {
+        gin::TryCatch func_try_catch(isolate_);
+        v8::Local<v8::Value> ret;
+        TRACE_EVENT0("andjs", "AndJSCoreV8::CallResult");
+        ScopedStatsTimer timer(&stats_->run_time_us);
+        if(!v8::Function::Cast(*func)->Call(current_->holder->context(), global(), 0, nullptr).ToLocal(&ret)) {
+          LOG(ERROR) << func_try_catch.GetStackTrace();
+          status = kException;
+        }
+      }
+    }
+  }
+  RunMicrotasks();
+
+  if(StopWatchdog())
+    status = kTerminated;
+  return status;
+}
+
+// The file is mapped here and read by the streaming thread. Files V8 can't
+// take as one string go through Run(), which reports them.
+bool AndJSCoreV8::StartStreaming(int context_id,
+                                 const base::FilePath& path,
+                                 const std::string& resource_name,
+                                 base::OnceClosure done) {
+  DCHECK(!streamed_);
+  if(!GetContext(context_id))
+    return false;
+  std::unique_ptr<base::MemoryMappedFile> file = std::make_unique<base::MemoryMappedFile>();
+  if(!file->Initialize(path) || file->length() == 0 ||
+     file->length() > static_cast<size_t>(v8::String::kMaxLength))
+    return false;
+  v8::Isolate* isolate = instance_->isolate();
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  std::unique_ptr<StreamedScript> streamed = std::make_unique<StreamedScript>(std::move(file), context_id, resource_name);
+  if(!streamed->Start(isolate))
+    return false;
+  streamed_ = std::move(streamed);
+  AndJSStats::Add(&stats_->streamed_scripts, 1);
+  StreamingPool::GetInstance()->PostParse(
+    base::BindOnce(&StreamedScript::Parse, base::Unretained(streamed_.get()), stats_), std::move(done));
+  return true;
+}
+
+ScriptEngine::RunStatus AndJSCoreV8::FinishStreaming(base::TimeDelta cpu_budget) {
+  DCHECK(streamed_);
+  std::unique_ptr<StreamedScript> streamed = std::move(streamed_);
+  if(!streamed->IsParsed()) {
+    ScopedStatsTimer timer(&stats_->stream_wait_us);
+    streamed->WaitParsed();
+  }
+  return RunScript(streamed->context_id(), nullptr, streamed.get(), streamed->resource_name(), cpu_budget);
+}
+
+// The module records are of |bundle_|, another bundle or a changed file
+// may use the same names for other modules.
+void AndJSCoreV8::SetModuleBundle(scoped_refptr<ModuleBundle> bundle) {
+  if(bundle == bundle_)
+    return;
+  bundle_ = std::move(bundle);
+  for(auto& context : contexts_) {
+    context.second->modules.clear();
+    context.second->module_names.clear();
+  }
+}
+
+// Compiles a bundle module once per isolate. The code cache of the first
+// instance is kept in the bundle so the others skip parsing.
+v8::MaybeLocal<v8::Module> AndJSCoreV8::LoadModule(const std::string& name) {
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  auto it = current_->modules.find(name);
+  if(it != current_->modules.end())
+    return it->second.Get(isolate_);
+
+  ModuleBundle::Module module;
+  if(!bundle_ || !bundle_->Find(name, &module)) {
+    isolate_->ThrowException(v8::Exception::Error(
+      gin::StringToV8(isolate_, "Cannot find module '" + name + "'")));
+    return v8::MaybeLocal<v8::Module>();
+  }
+  TRACE_EVENT1("andjs", "AndJSCoreV8::LoadModule", "name", name);
+  AndJSStats::Add(&stats_->modules_loaded, 1);
+
+  v8::ScriptOrigin origin(gin::StringToV8(isolate_, name),
+                          v8::Local<v8::Integer>(), v8::Local<v8::Integer>(),
+                          v8::Local<v8::Boolean>(), v8::Local<v8::Integer>(),
+                          v8::Local<v8::Value>(), v8::Local<v8::Boolean>(),
+                          v8::Local<v8::Boolean>(), v8::True(isolate_));
+  scoped_refptr<base::RefCountedBytes> code = bundle_->GetCompiledCode(kV8, module.index);
+  v8::ScriptCompiler::CachedData* cached_data = nullptr;
+  if(code) {
+    cached_data = new v8::ScriptCompiler::CachedData(code->front(), code->size(),
+      v8::ScriptCompiler::CachedData::BufferNotOwned);
+  }
+  v8::ScriptCompiler::Source source(gin::StringToV8(isolate_, module.source), origin, cached_data);
+
+  v8::Local<v8::Module> result;
+  {
+    ScopedStatsTimer timer(&stats_->compile_time_us);
+    if(!v8::ScriptCompiler::CompileModule(isolate_, &source,
+         code ? v8::ScriptCompiler::kConsumeCodeCache : v8::ScriptCompiler::kNoCompileOptions).ToLocal(&result))
+      return v8::MaybeLocal<v8::Module>();
+  }
+  if(code && !source.GetCachedData()->rejected) {
+    AndJSStats::Add(&stats_->module_cache_hits, 1);
+  } else {
+    std::unique_ptr<v8::ScriptCompiler::CachedData> new_code(
+      v8::ScriptCompiler::CreateCodeCache(result->GetUnboundModuleScript()));
+    if(new_code) {
+      bundle_->SetCompiledCode(kV8, module.index,
+                               base::MakeRefCounted<base::RefCountedBytes>(new_code->data, new_code->length));
+    }
+  }
+
+  current_->modules[name].Reset(isolate_, result);
+  current_->module_names.emplace(result->GetIdentityHash(), name);
+  return result;
+}
+
+// static
+v8::MaybeLocal<v8::Module> AndJSCoreV8::ResolveModuleCallback(v8::Local<v8::Context> context,
+                                                              v8::Local<v8::String> specifier,
+                                                              v8::Local<v8::Module> referrer) {
+  AndJSCoreV8* self = static_cast<AndJSCoreV8*>(gin::PerContextData::From(context)->runner());
+  v8::Isolate* isolate = context->GetIsolate();
+  std::string referrer_name;
+  ContextState* state = self->current_;
+  auto range = state->module_names.equal_range(referrer->GetIdentityHash());
+  for(auto it = range.first; it != range.second; ++it) {
+    if(referrer == state->modules[it->second]) {
+      referrer_name = it->second;
+      break;
+    }
+  }
+  return self->LoadModule(ModuleBundle::ResolveSpecifier(referrer_name, gin::V8ToString(isolate, specifier)));
+}
+
+ScriptEngine::RunStatus AndJSCoreV8::RunModule(int context_id,
+                                               const std::string& name,
+                                               base::TimeDelta cpu_budget) {
+  ContextState* state = GetContext(context_id);
+  if(!state)
+    return kException;
+  base::AutoReset<ContextState*> scoped_context(&current_, state);
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  gin::Runner::Scope scope(this);
+  gin::TryCatch try_catch(isolate_);
+  v8::Local<v8::Context> context = current_->holder->context();
+  RunStatus status = kOk;
+
+  StartWatchdog(cpu_budget);
+  v8::Local<v8::Module> module;
+  v8::Local<v8::Value> result;
+  bool evaluated = false;
+  if(LoadModule(name).ToLocal(&module) &&
+     module->InstantiateModule(context, &AndJSCoreV8::ResolveModuleCallback).FromMaybe(false)) {
+    TRACE_EVENT1("andjs", "AndJSCoreV8::RunModule", "name", name);
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    evaluated = module->Evaluate(context).ToLocal(&result);
+  }
+  if(!evaluated) {
+    LOG(ERROR) << try_catch.GetStackTrace();
+    status = kException;
+  }
+  RunMicrotasks();
+
+  if(StopWatchdog())
+    status = kTerminated;
+  return status;
+}
+
+// static
+std::unique_ptr<ScriptEngine> AndJSCoreV8::CreateWorkerEngine(AndJSStats* stats, WorkerHost* host) {
+  std::unique_ptr<AndJSCoreV8> engine = std::make_unique<AndJSCoreV8>(stats, nullptr);
+  engine->worker_host_ = host;
+  return engine;
+}
+
+// `new Worker(src)`, |src| is a module of the bundle or a script file.
+v8::Local<v8::Value> AndJSCoreV8::NewWorker(gin::Arguments* args) {
+  std::string src;
+  if(!args->GetNext(&src)) {
+    args->ThrowTypeError("Worker needs a module name or script path");
+    return v8::Local<v8::Value>();
+  }
+  if(!workers_)
+    workers_ = std::make_unique<WorkerList>(this, stats_);
+  int worker_id = workers_->Start(base::BindOnce(&AndJSCoreV8::CreateWorkerEngine), src, bundle_,
+                                  callback_budget_);
+
+  v8::Local<v8::Object> object = JSWorker::Create(args->isolate(), this, worker_id).ToV8().As<v8::Object>();
+  WorkerObject& worker = worker_objects_[worker_id];
+  worker.context = current_;
+  worker.object.Reset(args->isolate(), object);
+  return object;
+}
+
+void AndJSCoreV8::PostWorkerMessage(int worker_id, gin::Arguments* args) {
+  if(!workers_ || !worker_objects_.count(worker_id))
+    return;
+  std::unique_ptr<WorkerMessage> message = std::make_unique<WorkerMessage>();
+  if(SerializeMessage(args, message.get()))
+    workers_->PostMessage(worker_id, std::move(message));
+}
+
+void AndJSCoreV8::TerminateWorker(int worker_id) {
+  if(!workers_)
+    return;
+  workers_->Terminate(worker_id);
+  worker_objects_.erase(worker_id);
+}
+
+void AndJSCoreV8::PostMessageToParent(gin::Arguments* args) {
+  std::unique_ptr<WorkerMessage> message = std::make_unique<WorkerMessage>();
+  if(SerializeMessage(args, message.get()))
+    worker_host_->PostMessageToParent(std::move(message));
+}
+
+// Calls target.onmessage({data}), callers enter the context.
+void AndJSCoreV8::DispatchMessageEvent(v8::Local<v8::Object> target, std::unique_ptr<WorkerMessage> message) {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::DispatchMessage");
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  v8::Local<v8::Context> context = current_->holder->context();
+  gin::TryCatch try_catch(isolate_);
+
+  v8::Local<v8::Value> data;
+  v8::Local<v8::Value> handler;
+  if(!DeserializeMessage(isolate_, context, message.get()).ToLocal(&data) ||
+     !target->Get(context, gin::StringToV8(isolate_, "onmessage")).ToLocal(&handler)) {
+    LOG(ERROR) << try_catch.GetStackTrace();
+    return;
+  }
+  StartWatchdog(callback_budget_);
+  if(handler->IsFunction()) {
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    v8::Local<v8::Object> event = v8::Object::New(isolate_);
+    v8::Local<v8::Value> argv[] = { event };
+    v8::Local<v8::Value> ret;
+    if(event->Set(context, gin::StringToV8(isolate_, "data"), data).IsNothing() ||
+       !handler.As<v8::Function>()->Call(context, target, 1, argv).ToLocal(&ret)) {
+      LOG(ERROR) << try_catch.GetStackTrace();
+    }
+  }
+  RunMicrotasks();
+  if(StopWatchdog())
+    OnCallbackTerminated("message");
+}
+
+void AndJSCoreV8::DispatchWorkerMessage(int worker_id, std::unique_ptr<WorkerMessage> message) {
+  auto it = worker_objects_.find(worker_id);
+  if(it == worker_objects_.end())
+    return;
+  base::AutoReset<ContextState*> scoped_context(&current_, it->second.context);
+  gin::Runner::Scope scope(this);
+  DispatchMessageEvent(it->second.object.Get(current_->holder->isolate()), std::move(message));
+}
+
+void AndJSCoreV8::DispatchMessage(std::unique_ptr<WorkerMessage> message) {
+  ContextState* state = GetContext(kMainContextId);
+  if(!state)
+    return;
+  base::AutoReset<ContextState*> scoped_context(&current_, state);
+  gin::Runner::Scope scope(this);
+  DispatchMessageEvent(global(), std::move(message));
+}
+
+// postToJava(channel, value), false without a receiver. Batched calls
+// made before go first.
+bool AndJSCoreV8::PostToJava(gin::Arguments* args) {
+  std::string channel;
+  v8::Local<v8::Value> value;
+  if(!args->GetNext(&channel) || !args->GetNext(&value)) {
+    args->ThrowError();
+    return false;
+  }
+  StructuredWriter writer;
+  {
+    TRACE_EVENT0("andjs", "AndJSCoreV8::WriteStructured");
+    if(!WriteStructured(args->isolate(), args->isolate()->GetCurrentContext(), value, &writer, 0))
+      return false;
+  }
+  batched_calls_.Flush();
+  return structured_receiver_->Deliver(channel, writer);
+}
+
+// static
+bool AndJSCoreV8::DisallowWasmCodeGeneration(v8::Local<v8::Context> context,
+                                             v8::Local<v8::String> source) {
+  return false;
+}
+
+// loadWasm(path) returns the WebAssembly.Module of the binary at |path|.
+// The file is mapped rather than read, V8 copies the wire bytes it keeps,
+// and the compiled module comes from the cache when V8 accepts the entry.
+v8::Local<v8::Value> AndJSCoreV8::LoadWasm(gin::Arguments* args) {
+  std::string path;
+  if(!args->GetNext(&path)) {
+    args->ThrowError();
+    return v8::Local<v8::Value>();
+  }
+  TRACE_EVENT1("andjs", "AndJSCoreV8::LoadWasm", "path", path);
+  base::MemoryMappedFile wire_bytes;
+  if(!wire_bytes.Initialize(base::FilePath(path)) || !wire_bytes.length()) {
+    args->ThrowTypeError("Cannot map '" + path + "'");
+    return v8::Local<v8::Value>();
+  }
+  AndJSStats::Add(&stats_->wasm_modules_loaded, 1);
+
+  std::string key = WasmModuleCache::Key(wire_bytes.data(), wire_bytes.length());
+  std::string serialized;
+  bool cached = wasm_cache_->Read(key, &serialized);
+  if(cached)
+    AndJSStats::Add(&stats_->wasm_cache_hits, 1);
+
+  // An empty or rejected entry falls back to compiling the wire bytes.
+  v8::Local<v8::WasmModuleObject> module;
+  {
+    ScopedStatsTimer timer(&stats_->wasm_compile_time_us);
+    if(!v8::WasmModuleObject::DeserializeOrCompile(args->isolate(),
+         v8::WasmModuleObject::BufferReference(reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size()),
+         v8::WasmModuleObject::BufferReference(wire_bytes.data(), wire_bytes.length())).ToLocal(&module))
+      return v8::Local<v8::Value>();
+  }
+  if(!cached) {
+    v8::WasmModuleObject::SerializedModule compiled = module->Serialize();
+    if(compiled.second && wasm_cache_->Write(key, compiled.first.get(), compiled.second))
+      AndJSStats::Add(&stats_->wasm_cache_bytes_written, compiled.second);
+  }
+  return module;
+}
+
+// A listener is added once per type, like on a DOM EventTarget.
+void AndJSCoreV8::AddEventListener(gin::Arguments* args) {
+  std::string type;
+  v8::Local<v8::Function> listener;
+  if(!args->GetNext(&type) || !args->GetNext(&listener)) {
+    args->ThrowError();
+    return;
+  }
+  std::vector<v8::Global<v8::Function>>& listeners = current_->event_listeners[type];
+  for(const v8::Global<v8::Function>& added : listeners) {
+    if(added == listener)
+      return;
+  }
+  listeners.emplace_back(args->isolate(), listener);
+}
+
+void AndJSCoreV8::RemoveEventListener(gin::Arguments* args) {
+  std::string type;
+  v8::Local<v8::Function> listener;
+  if(!args->GetNext(&type) || !args->GetNext(&listener)) {
+    args->ThrowError();
+    return;
+  }
+  auto it = current_->event_listeners.find(type);
+  if(it == current_->event_listeners.end())
+    return;
+  std::vector<v8::Global<v8::Function>>& listeners = it->second;
+  for(auto listener_it = listeners.begin(); listener_it != listeners.end(); ++listener_it) {
+    if(*listener_it == listener) {
+      listeners.erase(listener_it);
+      break;
+    }
+  }
+}
+
+void AndJSCoreV8::DispatchEvent(const ScriptEvent& event) {
+  ContextState* state = GetContext(kMainContextId);
+  if(!state)
+    return;
+  auto it = state->event_listeners.find(event.type);
+  if(it == state->event_listeners.end() || it->second.empty())
+    return;
+  TRACE_EVENT1("andjs", "AndJSCoreV8::DispatchEvent", "type", event.type);
+  base::AutoReset<ContextState*> scoped_context(&current_, state);
+  v8::Isolate* isolate_ = current_->holder->isolate();
+  gin::Runner::Scope scope(this);
+  v8::Local<v8::Context> context = current_->holder->context();
+
+  v8::Local<v8::Object> object = v8::Object::New(isolate_);
+  v8::Local<v8::Value> data;
+  if(event.data) {
+    data = g_converter_->ToV8Value(event.data.get(), context);
+  } else {
+    StructuredReader reader(event.structured.data(), event.structured.size());
+    if(!reader.ReadHeader() || !ReadStructured(isolate_, context, &reader, 0).ToLocal(&data)) {
+      LOG(ERROR) << " AndJSCoreV8 invalid structured event " << event.type;
+      return;
+    }
+  }
+  if(object->Set(context, gin::StringToV8(isolate_, "type"), gin::StringToV8(isolate_, event.type)).IsNothing() ||
+     object->Set(context, gin::StringToV8(isolate_, "data"), data).IsNothing()) {
+    return;
+  }
+  // Listeners added or removed by a listener count from the next event on.
+  std::vector<v8::Local<v8::Function>> listeners;
+  for(const v8::Global<v8::Function>& listener : it->second)
+    listeners.push_back(listener.Get(isolate_));
+
+  // One budget for all listeners, the ones after a terminated listener
+  // don't run.
+  StartWatchdog(callback_budget_);
+  {
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    v8::Local<v8::Value> argv[] = { object };
+    for(v8::Local<v8::Function> listener : listeners) {
+      gin::TryCatch try_catch(isolate_);
+      v8::Local<v8::Value> ret;
+      if(!listener->Call(context, global(), 1, argv).ToLocal(&ret))
+        LOG(ERROR) << try_catch.GetStackTrace();
+    }
+  }
+  RunMicrotasks();
+  if(StopWatchdog())
+    OnCallbackTerminated("event " + event.type);
+}
+
+// A NativeAsync result back from its thread, settled in the context that
+// started it. The GinNativeAsync goes with |state|.
+void AndJSCoreV8::SettleNativeAsync(ContextState* state, base::OnceClosure settle) {
+  TRACE_EVENT0("andjs", "AndJSCoreV8::SettleNativeAsync");
+  base::AutoReset<ContextState*> scoped_context(&current_, state);
+  gin::Runner::Scope scope(this);
+  StartWatchdog(callback_budget_);
+  {
+    ScopedStatsTimer timer(&stats_->run_time_us);
+    std::move(settle).Run();
+  }
+  RunMicrotasks();
+  if(StopWatchdog())
+    OnCallbackTerminated("NativeAsync settlement");
+}
+
+// Any thread, see ScriptEngine::Terminate().
+void AndJSCoreV8::Terminate() {
+  instance_->isolate()->TerminateExecution();
+}
+
+gin::ContextHolder* AndJSCoreV8::GetContextHolder() {
+  return current_->holder.get();
+}
+
+AndJSCoreV8::~AndJSCoreV8() = default;
+}
@@ -0,0 +1,227 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_CORE_V8_H__
+#define __ANDJS_CORE_V8_H__
+#include <time.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/compiler_specific.h"
+#include "base/macros.h"
+#include "base/android/jni_weak_ref.h"
+#include "base/android/jni_android.h"
+#include "base/message_loop/message_loop.h"
+#include "base/files/file_path.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/thread.h"
+#include "gin/public/isolate_holder.h"
+#include "gin/arguments.h"
+#include "gin/runner.h"
+#include "content/public/renderer/v8_value_converter.h"
+#include "gin/public/context_holder.h"
+#include "v8/include/v8-profiler.h"
+
+#include "content/browser/android/java/gin_java_bound_object_delegate.h"
+#include "content/browser/android/java/gin_java_bound_object.h"
+
+#include "andjs/andjs_bindings.h"
+#include "andjs/andjs_module_bundle.h"
+#include "andjs/andjs_stats.h"
+#include "andjs/script_engine.h"
+
+namespace andjs {
+
+class StreamedScript;
+class StructuredReceiver;
+class WasmModuleCache;
+class WorkerHost;
+class WorkerList;
+
+// One-byte and two-byte sources become V8 strings without transcoding.
+v8::MaybeLocal<v8::String> NewV8String(v8::Isolate* isolate, const ScriptString& str);
+
+class AndJSCoreV8 : public ScriptEngine,
+                    public gin::Runner {
+  public:
+    // postToJava() is only defined with a |structured_receiver|.
+    AndJSCoreV8(AndJSStats* stats, StructuredReceiver* structured_receiver);
+    ~AndJSCoreV8() override;
+
+    // ScriptEngine
+    Type GetType() const override;
+    void Init() override;
+    bool CreateContext(int context_id) override;
+    void DisposeContext(int context_id) override;
+    void ResetContext(int context_id) override;
+    bool InjectObject(int context_id,
+                      const std::string& name,
+                      const base::android::JavaRef<jobject>& object,
+                      const base::android::JavaRef<jclass>& annotation_clazz) override;
+    RunStatus Run(int context_id,
+                  const ScriptString& source,
+                  const std::string& resource_name,
+                  base::TimeDelta cpu_budget) override;
+    void SetCallbackBudget(base::TimeDelta cpu_budget) override;
+    void SetModuleBundle(scoped_refptr<ModuleBundle> bundle) override;
+    RunStatus RunModule(int context_id,
+                        const std::string& name,
+                        base::TimeDelta cpu_budget) override;
+    bool StartStreaming(int context_id,
+                        const base::FilePath& path,
+                        const std::string& resource_name,
+                        base::OnceClosure done) override;
+    RunStatus FinishStreaming(base::TimeDelta cpu_budget) override;
+    bool StartProfiling(const std::string& title, base::TimeDelta interval) override;
+    std::unique_ptr<CpuProfile> StopProfiling() override;
+    void SaveGlobals(std::map<int, std::string>* globals) override;
+    void RestoreGlobals(const std::map<int, std::string>& globals) override;
+    size_t GetHeapSize() override;
+    bool CollectIdleGarbage(base::TimeDelta budget) override;
+    void OnMemoryPressure(bool critical) override;
+    void Terminate() override;
+    void DispatchWorkerMessage(int worker_id, std::unique_ptr<WorkerMessage> message) override;
+    void DispatchMessage(std::unique_ptr<WorkerMessage> message) override;
+    void DispatchEvent(const ScriptEvent& event) override;
+    void FlushBatchedCalls() override;
+    void Shutdown() override;
+
+    scoped_refptr<content::GinJavaBoundObject> GetObject(content::GinJavaBoundObject::ObjectID object_id);
+    gin::ContextHolder* GetContextHolder() override;
+    AndJSStats* stats() { return stats_; }
+    // Before Init(). Keeps the WebAssembly global and adds loadWasm(),
+    // whose compiled modules are cached under |cache_dir|.
+    void EnableWasm(const base::FilePath& cache_dir);
+    BatchedCalls* batched_calls() { return &batched_calls_; }
+    v8::Local<v8::Value> InjectObject(const base::android::JavaRef<jobject>& jobject,
+                                      const base::android::JavaRef<jclass>&  annotation_clazz);
+
+    // Worker object methods.
+    void PostWorkerMessage(int worker_id, gin::Arguments* args);
+    void TerminateWorker(int worker_id);
+  private:
+    // One global scope of the isolate, see ScriptEngine::CreateContext().
+    struct ContextState {
+      std::unique_ptr<gin::ContextHolder> holder;
+      // Module records of the current bundle by name. V8 hands the resolve
+      // callback only the referrer, its name is found by identity hash.
+      std::map<std::string, v8::Global<v8::Module>> modules;
+      std::multimap<int, std::string> module_names;
+      // Injected java objects by global name, bound again by ResetContext().
+      std::vector<std::pair<std::string, content::GinJavaBoundObject::ObjectID>> injected;
+      // addEventListener() listeners by event type, in the order added.
+      std::map<std::string, std::vector<v8::Global<v8::Function>>> event_listeners;
+    };
+
+    std::unique_ptr<ContextState> NewContext();
+    ContextState* GetContext(int context_id);
+    void TerminateWorkers(ContextState* state);
+    bool BindObject(const std::string& name, content::GinJavaBoundObject::ObjectID object_id);
+    void StartWatchdog(base::TimeDelta cpu_budget);
+    void OnWatchdog(uint64_t run_id, base::TimeDelta cpu_budget);
+    bool StopWatchdog();
+    void OnCallbackTerminated(const std::string& what);
+    void RunMicrotasks();
+    // Run() and FinishStreaming(), a |streamed| script replaces |source|.
+    RunStatus RunScript(int context_id,
+                        const ScriptString* source,
+                        StreamedScript* streamed,
+                        const std::string& resource_name,
+                        base::TimeDelta cpu_budget);
+    v8::MaybeLocal<v8::Module> LoadModule(const std::string& name);
+    static v8::MaybeLocal<v8::Module> ResolveModuleCallback(v8::Local<v8::Context> context,
+                                                            v8::Local<v8::String> specifier,
+                                                            v8::Local<v8::Module> referrer);
+
+    static v8::Local<v8::Value> GetV8Version(gin::Arguments* args);
+    static void OnGCPrologue(v8::Isolate* isolate, v8::GCType type,
+                             v8::GCCallbackFlags flags, void* data);
+    static void OnGCEpilogue(v8::Isolate* isolate, v8::GCType type,
+                             v8::GCCallbackFlags flags, void* data);
+
+    static std::unique_ptr<ScriptEngine> CreateWorkerEngine(AndJSStats* stats, WorkerHost* host);
+    v8::Local<v8::Value> NewWorker(gin::Arguments* args);
+    void PostMessageToParent(gin::Arguments* args);
+    bool PostToJava(gin::Arguments* args);
+    v8::Local<v8::Value> LoadWasm(gin::Arguments* args);
+    static bool DisallowWasmCodeGeneration(v8::Local<v8::Context> context,
+                                           v8::Local<v8::String> source);
+    void AddEventListener(gin::Arguments* args);
+    void RemoveEventListener(gin::Arguments* args);
+    void DispatchMessageEvent(v8::Local<v8::Object> target, std::unique_ptr<WorkerMessage> message);
+    void SettleNativeAsync(ContextState* state, base::OnceClosure settle);
+
+    typedef std::map<content::GinJavaBoundObject::ObjectID, scoped_refptr<content::GinJavaBoundObject>> ObjectMap;
+    ObjectMap objects_ GUARDED_BY(objects_lock_);
+    base::Lock objects_lock_;
+    content::GinJavaBoundObject::ObjectID next_object_id_;
+
+    bool InjectNativeObject();
+    std::unique_ptr<gin::IsolateHolder> instance_;
+    // Built once, every context of the isolate starts from it.
+    v8::Global<v8::ObjectTemplate> global_template_;
+    std::map<int, std::unique_ptr<ContextState>> contexts_;
+    // The context the current task works in, what gin::Runner sees.
+    ContextState* current_;
+    v8::Persistent<v8::External> v8_this_;
+    AndJSStats* stats_;
+    StructuredReceiver* structured_receiver_;
+    BatchedCalls batched_calls_;
+    // Set by EnableWasm(), WebAssembly stays hidden without it.
+    std::unique_ptr<WasmModuleCache> wasm_cache_;
+
+    scoped_refptr<ModuleBundle> bundle_;
+    // The script StartStreaming() handed to the streaming thread.
+    std::unique_ptr<StreamedScript> streamed_;
+
+    // Start of the GC pause in progress.
+    base::TimeTicks gc_start_;
+
+    v8::CpuProfiler* cpu_profiler_;
+    std::string profile_title_;
+
+    // Set when this engine runs inside a worker, for the global postMessage().
+    WorkerHost* worker_host_;
+    // Workers started by `new Worker()`, their JS objects and the context
+    // each was created in.
+    struct WorkerObject {
+      ContextState* context;
+      v8::Global<v8::Object> object;
+    };
+    std::unique_ptr<WorkerList> workers_;
+    std::map<int, WorkerObject> worker_objects_;
+
+    base::TimeDelta callback_budget_;
+    std::unique_ptr<base::Thread> watchdog_;
+    base::Lock watchdog_lock_;
+    uint64_t run_id_ GUARDED_BY(watchdog_lock_);
+    bool run_active_ GUARDED_BY(watchdog_lock_);
+    bool run_terminated_ GUARDED_BY(watchdog_lock_);
+    clockid_t run_clock_ GUARDED_BY(watchdog_lock_);
+    base::TimeDelta run_start_ GUARDED_BY(watchdog_lock_);
+};
+
+}
+#endif
@@ -0,0 +1,133 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_cpu_profile.h"
+
+#include <memory>
+
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/json/json_writer.h"
+#include "base/values.h"
+
+namespace andjs {
+
+CpuProfile::CpuProfile(const std::string& title)
+    : title_(title), next_node_id_(kRootNodeId), start_time_us_(0), end_time_us_(0) {
+  AddChild(0, "(root)", "", -1, -1, 0);
+}
+
+CpuProfile::~CpuProfile() = default;
+
+int CpuProfile::AddChild(int parent, const std::string& function_name,
+                         const std::string& url, int line_number, int column_number,
+                         int64_t hit_count) {
+  int id = next_node_id_++;
+  Node& node = nodes_[id];
+  node.id = id;
+  node.parent = parent;
+  node.function_name = function_name;
+  node.url = url;
+  node.line_number = line_number;
+  node.column_number = column_number;
+  node.hit_count = hit_count;
+
+  auto iter = nodes_.find(parent);
+  if(iter != nodes_.end())
+    iter->second.children.push_back(id);
+  return id;
+}
+
+int CpuProfile::GetOrAddChild(int parent, const std::string& function_name,
+                              const std::string& url, int line_number, int column_number) {
+  ChildKey key(parent, function_name, url, line_number, column_number);
+  auto iter = child_index_.find(key);
+  if(iter != child_index_.end())
+    return iter->second;
+
+  int id = AddChild(parent, function_name, url, line_number, column_number, 0);
+  child_index_[key] = id;
+  return id;
+}
+
+void CpuProfile::AddSample(int node_id, int64_t timestamp_us) {
+  samples_.push_back(node_id);
+  timestamps_us_.push_back(timestamp_us);
+}
+
+void CpuProfile::AddHitCount(int node_id, int64_t hit_count) {
+  auto iter = nodes_.find(node_id);
+  if(iter != nodes_.end())
+    iter->second.hit_count += hit_count;
+}
+
+std::string CpuProfile::ToJSON() const {
+  base::DictionaryValue profile;
+
+  auto nodes = std::make_unique<base::ListValue>();
+  for(const auto& item : nodes_) {
+    const Node& node = item.second;
+    auto call_frame = std::make_unique<base::DictionaryValue>();
+    call_frame->SetString("functionName", node.function_name);
+    call_frame->SetString("scriptId", "0");
+    call_frame->SetString("url", node.url);
+    call_frame->SetInteger("lineNumber", node.line_number);
+    call_frame->SetInteger("columnNumber", node.column_number);
+
+    auto children = std::make_unique<base::ListValue>();
+    for(int child : node.children)
+      children->AppendInteger(child);
+
+    auto json_node = std::make_unique<base::DictionaryValue>();
+    json_node->SetInteger("id", node.id);
+    json_node->Set("callFrame", std::move(call_frame));
+    json_node->SetDouble("hitCount", node.hit_count);
+    json_node->Set("children", std::move(children));
+    nodes->Append(std::move(json_node));
+  }
+  profile.Set("nodes", std::move(nodes));
+  profile.SetDouble("startTime", start_time_us_);
+  profile.SetDouble("endTime", end_time_us_);
+
+  auto samples = std::make_unique<base::ListValue>();
+  auto time_deltas = std::make_unique<base::ListValue>();
+  int64_t last = start_time_us_;
+  for(size_t i = 0; i < samples_.size(); i++) {
+    samples->AppendInteger(samples_[i]);
+    time_deltas->AppendDouble(timestamps_us_[i] - last);
+    last = timestamps_us_[i];
+  }
+  profile.Set("samples", std::move(samples));
+  profile.Set("timeDeltas", std::move(time_deltas));
+
+  std::string json;
+  base::JSONWriter::Write(profile, &json);
+  return json;
+}
+
+bool CpuProfile::WriteToFile(const base::FilePath& path) const {
+  std::string json = ToJSON();
+  int written = base::WriteFile(path, json.data(), json.size());
+  LOG(INFO) << " CpuProfile " << title_ << " samples " << samples_.size()
+            << " written to " << path.value();
+  return written == static_cast<int>(json.size());
+}
+
+}
@@ -0,0 +1,95 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_CPU_PROFILE_H__
+#define __ANDJS_CPU_PROFILE_H__
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace base {
+class FilePath;
+}
+
+namespace andjs {
+
+// Engine independent call tree plus sample list, written in the Chrome
+// DevTools .cpuprofile format so both backends feed the same tooling.
+class CpuProfile {
+  public:
+    struct Node {
+      int id;
+      int parent;
+      std::string function_name;
+      std::string url;
+      int line_number;    // 0-based, -1 if unknown
+      int column_number;  // 0-based, -1 if unknown
+      int64_t hit_count;
+      std::vector<int> children;
+    };
+
+    static const int kRootNodeId = 1;
+
+    explicit CpuProfile(const std::string& title);
+    ~CpuProfile();
+
+    // Always adds a new node below |parent|, used when copying an engine tree.
+    int AddChild(int parent, const std::string& function_name,
+                 const std::string& url, int line_number, int column_number,
+                 int64_t hit_count);
+
+    // Returns the child of |parent| for the call frame, creating it on first
+    // use. Used by samplers that only see stacks.
+    int GetOrAddChild(int parent, const std::string& function_name,
+                      const std::string& url, int line_number, int column_number);
+
+    // |timestamp_us| is on the same clock as the start and end times.
+    void AddSample(int node_id, int64_t timestamp_us);
+    void AddHitCount(int node_id, int64_t hit_count);
+
+    void set_start_time(int64_t start_time_us) { start_time_us_ = start_time_us; }
+    void set_end_time(int64_t end_time_us) { end_time_us_ = end_time_us; }
+    const std::string& title() const { return title_; }
+
+    std::string ToJSON() const;
+    bool WriteToFile(const base::FilePath& path) const;
+
+  private:
+    typedef std::tuple<int, std::string, std::string, int, int> ChildKey;
+
+    std::string title_;
+    std::map<int, Node> nodes_;
+    std::map<ChildKey, int> child_index_;
+    int next_node_id_;
+    int64_t start_time_us_;
+    int64_t end_time_us_;
+    std::vector<int> samples_;
+    std::vector<int64_t> timestamps_us_;
+
+    DISALLOW_COPY_AND_ASSIGN(CpuProfile);
+};
+
+}
+#endif
@@ -0,0 +1,748 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_encoding.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ANDJS_ENCODING_NEON 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include "base/cpu.h"
+#define ANDJS_ENCODING_X86 1
+// The SSSE3 and AVX2 kernels are built for their instruction set alone
+// and only called once base::CPU found it.
+#define ANDJS_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace andjs {
+
+namespace {
+
+// Base64 decoding kernels store whole vectors, the output needs this much
+// room past the decoded bytes.
+const size_t kDecodeSlack = 32;
+
+const char kBase64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char kHexDigits[] = "0123456789abcdef";
+const char kReplacementCharacter[] = "\xef\xbf\xbd";
+
+// The vector loops of one instruction set. The block ones return how much
+// of the input they consumed, whole blocks only, and leave the rest to the
+// scalar code.
+struct EncodingKernels {
+  const char* name;
+  size_t (*count_ascii)(const uint8_t* data, size_t length);
+  size_t (*encode_base64)(const uint8_t* src, size_t length, char* dst);
+  size_t (*decode_base64)(const char* src, size_t length, uint8_t* dst);
+  size_t (*encode_hex)(const uint8_t* src, size_t length, char* dst);
+  size_t (*decode_hex)(const char* src, size_t length, uint8_t* dst);
+};
+
+size_t CountASCIIScalar(const uint8_t* data, size_t length) {
+  size_t i = 0;
+  for(; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    if(word & UINT64_C(0x8080808080808080))
+      break;
+  }
+  while(i < length && data[i] < 0x80)
+    i++;
+  return i;
+}
+
+size_t EncodeNone(const uint8_t* src, size_t length, char* dst) {
+  return 0;
+}
+
+size_t DecodeNone(const char* src, size_t length, uint8_t* dst) {
+  return 0;
+}
+
+#if defined(ANDJS_ENCODING_NEON)
+bool HasHighBit(uint8x16_t v) {
+#if defined(__aarch64__)
+  return vmaxvq_u8(v) >= 0x80;
+#else
+  uint8x8_t m = vpmax_u8(vget_low_u8(v), vget_high_u8(v));
+  m = vpmax_u8(m, m);
+  m = vpmax_u8(m, m);
+  m = vpmax_u8(m, m);
+  return vget_lane_u8(m, 0) >= 0x80;
+#endif
+}
+
+size_t CountASCIINEON(const uint8_t* data, size_t length) {
+  size_t i = 0;
+  for(; i + 64 <= length; i += 64) {
+    uint8x16_t v = vorrq_u8(vorrq_u8(vld1q_u8(data + i), vld1q_u8(data + i + 16)),
+                            vorrq_u8(vld1q_u8(data + i + 32), vld1q_u8(data + i + 48)));
+    if(HasHighBit(v))
+      break;
+  }
+  for(; i + 16 <= length; i += 16) {
+    if(HasHighBit(vld1q_u8(data + i)))
+      break;
+  }
+  return i + CountASCIIScalar(data + i, length - i);
+}
+
+#if defined(__aarch64__)
+// Values of the base64 characters below 0x80, 0xff for the others.
+const uint8_t kBase64Values[128] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,   62, 0xff, 0xff, 0xff,   63,
+    52,   53,   54,   55,   56,   57,   58,   59,   60,   61, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff,    0,    1,    2,    3,    4,    5,    6,    7,    8,    9,   10,   11,   12,   13,   14,
+    15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff,   26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+    41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+uint8x16x4_t LoadTable64(const uint8_t* table) {
+  uint8x16x4_t result;
+  result.val[0] = vld1q_u8(table);
+  result.val[1] = vld1q_u8(table + 16);
+  result.val[2] = vld1q_u8(table + 32);
+  result.val[3] = vld1q_u8(table + 48);
+  return result;
+}
+
+// 48 bytes to 64 characters, vld3q splits the byte triples.
+size_t EncodeBase64NEON(const uint8_t* src, size_t length, char* dst) {
+  const uint8x16x4_t chars = LoadTable64(reinterpret_cast<const uint8_t*>(kBase64Chars));
+  const uint8x16_t mask = vdupq_n_u8(0x3f);
+  size_t i = 0;
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+  for(; i + 48 <= length; i += 48, out += 64) {
+    uint8x16x3_t in = vld3q_u8(src + i);
+    uint8x16x4_t result;
+    result.val[0] = vshrq_n_u8(in.val[0], 2);
+    result.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+    result.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+    result.val[3] = vandq_u8(in.val[2], mask);
+    for(int k = 0; k < 4; k++)
+      result.val[k] = vqtbl4q_u8(chars, result.val[k]);
+    vst4q_u8(out, result);
+  }
+  return i;
+}
+
+// 64 characters to 48 bytes. Both halves of the ASCII table are looked up,
+// the second one with the index moved down by 64, so everything else is
+// left at 0xff or has its top bit set.
+size_t DecodeBase64NEON(const char* src, size_t length, uint8_t* dst) {
+  const uint8x16x4_t low = LoadTable64(kBase64Values);
+  const uint8x16x4_t high = LoadTable64(kBase64Values + 64);
+  const uint8x16_t offset = vdupq_n_u8(64);
+  const uint8_t* in_chars = reinterpret_cast<const uint8_t*>(src);
+  size_t i = 0;
+  for(; i + 64 <= length; i += 64, dst += 48) {
+    uint8x16x4_t in = vld4q_u8(in_chars + i);
+    uint8x16_t error = vdupq_n_u8(0);
+    uint8x16_t v[4];
+    for(int k = 0; k < 4; k++) {
+      v[k] = vqtbx4q_u8(vqtbl4q_u8(low, in.val[k]), high, vsubq_u8(in.val[k], offset));
+      error = vorrq_u8(error, vorrq_u8(v[k], in.val[k]));
+    }
+    if(vmaxvq_u8(error) >= 0x80)
+      break;
+    uint8x16x3_t result;
+    result.val[0] = vorrq_u8(vshlq_n_u8(v[0], 2), vshrq_n_u8(v[1], 4));
+    result.val[1] = vorrq_u8(vshlq_n_u8(v[1], 4), vshrq_n_u8(v[2], 2));
+    result.val[2] = vorrq_u8(vshlq_n_u8(v[2], 6), v[3]);
+    vst3q_u8(dst, result);
+  }
+  return i;
+}
+
+// 16 bytes to 32 digits, vst2q interleaves the high and low ones.
+size_t EncodeHexNEON(const uint8_t* src, size_t length, char* dst) {
+  const uint8x16_t digits = vld1q_u8(reinterpret_cast<const uint8_t*>(kHexDigits));
+  const uint8x16_t mask = vdupq_n_u8(0x0f);
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16, out += 32) {
+    uint8x16_t in = vld1q_u8(src + i);
+    uint8x16x2_t result;
+    result.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(in, 4));
+    result.val[1] = vqtbl1q_u8(digits, vandq_u8(in, mask));
+    vst2q_u8(out, result);
+  }
+  return i;
+}
+
+uint8x16_t HexNibblesNEON(uint8x16_t c, uint8x16_t* error) {
+  uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+  uint8x16_t letter = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  uint8x16_t is_digit = vcltq_u8(digit, vdupq_n_u8(10));
+  uint8x16_t is_letter = vcltq_u8(letter, vdupq_n_u8(6));
+  *error = vorrq_u8(*error, vmvnq_u8(vorrq_u8(is_digit, is_letter)));
+  return vbslq_u8(is_digit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+}
+
+size_t DecodeHexNEON(const char* src, size_t length, uint8_t* dst) {
+  const uint8_t* in_chars = reinterpret_cast<const uint8_t*>(src);
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32, dst += 16) {
+    uint8x16x2_t in = vld2q_u8(in_chars + i);
+    uint8x16_t error = vdupq_n_u8(0);
+    uint8x16_t high = HexNibblesNEON(in.val[0], &error);
+    uint8x16_t low = HexNibblesNEON(in.val[1], &error);
+    if(vmaxvq_u8(error))
+      break;
+    vst1q_u8(dst, vorrq_u8(vshlq_n_u8(high, 4), low));
+  }
+  return i;
+}
+#endif  // defined(__aarch64__)
+#endif  // defined(ANDJS_ENCODING_NEON)
+
+#if defined(ANDJS_ENCODING_X86)
+size_t CountASCIISSE2(const uint8_t* data, size_t length) {
+  size_t i = 0;
+  for(; i + 64 <= length; i += 64) {
+    const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+    __m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                             _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    if(_mm_movemask_epi8(v))
+      break;
+  }
+  for(; i + 16 <= length; i += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+    if(mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + CountASCIIScalar(data + i, length - i);
+}
+
+ANDJS_TARGET("avx2")
+size_t CountASCIIAVX2(const uint8_t* data, size_t length) {
+  size_t i = 0;
+  for(; i + 128 <= length; i += 128) {
+    const __m256i* p = reinterpret_cast<const __m256i*>(data + i);
+    __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+                                _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+    if(_mm256_movemask_epi8(v))
+      break;
+  }
+  for(; i + 32 <= length; i += 32) {
+    int mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+    if(mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + CountASCIISSE2(data + i, length - i);
+}
+
+// Base64 after Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding
+// and Decoding using AVX2 Instructions". A pshufb puts every 12 bit pair
+// of sextets in a 16 bit lane, two multiplies move them into bytes, and a
+// second pshufb adds the ASCII offset of each character range.
+ANDJS_TARGET("ssse3")
+__m128i EncodeBase64Block(__m128i in) {
+  in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  const __m128i indices = _mm_or_si128(t1, t3);
+
+  __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  const __m128i below_26 = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  reduced = _mm_or_si128(reduced, _mm_and_si128(below_26, _mm_set1_epi8(13)));
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                        '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(offsets, reduced), indices);
+}
+
+// 12 bytes to 16 characters, reading 16.
+ANDJS_TARGET("ssse3")
+size_t EncodeBase64SSSE3(const uint8_t* src, size_t length, char* dst) {
+  size_t i = 0;
+  for(; i + 16 <= length; i += 12, dst += 16) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), EncodeBase64Block(in));
+  }
+  return i;
+}
+
+ANDJS_TARGET("avx2")
+__m256i EncodeBase64Block(__m256i in) {
+  in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                                1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+  const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+  const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+  const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+  const __m256i indices = _mm256_or_si256(t1, t3);
+
+  __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+  const __m256i below_26 = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+  reduced = _mm256_or_si256(reduced, _mm256_and_si256(below_26, _mm256_set1_epi8(13)));
+  const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, reduced), indices);
+}
+
+// 24 bytes to 32 characters, each lane reads 16 of them.
+ANDJS_TARGET("avx2")
+size_t EncodeBase64AVX2(const uint8_t* src, size_t length, char* dst) {
+  size_t i = 0;
+  for(; i + 28 <= length; i += 24, dst += 32) {
+    __m256i in = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 12)), 1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), EncodeBase64Block(in));
+  }
+  return i + EncodeBase64SSSE3(src + i, length - i, dst);
+}
+
+// Decoding after Alfred Klomp's base64 library. Two pshufb on the nibbles
+// of a character give bit sets that only intersect for characters outside
+// the alphabet, a third one the offset from ASCII to the sextet. Multiply
+// adds pack four sextets into 24 bits.
+ANDJS_TARGET("ssse3")
+size_t DecodeBase64SSSE3(const char* src, size_t length, uint8_t* dst) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16, dst += 12) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    const __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) != 0xffff)
+      break;
+    const __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+    in = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), in);
+  }
+  return i;
+}
+
+ANDJS_TARGET("avx2")
+size_t DecodeBase64AVX2(const char* src, size_t length, uint8_t* dst) {
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                          0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32, dst += 24) {
+    __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+    const __m256i lo_nibbles = _mm256_and_si256(in, mask_2f);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if(!_mm256_testz_si256(lo, hi))
+      break;
+    const __m256i eq_2f = _mm256_cmpeq_epi8(in, mask_2f);
+    in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+    in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+    in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+    in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    // The twelve bytes of each lane next to each other.
+    in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), in);
+  }
+  return i + DecodeBase64SSSE3(src + i, length - i, dst);
+}
+
+// 16 bytes to 32 digits, a pshufb per nibble.
+ANDJS_TARGET("ssse3")
+size_t EncodeHexSSSE3(const uint8_t* src, size_t length, char* dst) {
+  const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kHexDigits));
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16, dst += 32) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+    __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(in, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi8(high, low));
+  }
+  return i;
+}
+
+// Nibble values of 16 digits, |error| collects the lanes that aren't one.
+__m128i HexNibblesSSE2(__m128i c, __m128i* error) {
+  const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  const __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  // Unsigned x <= n as min(x, n) == x.
+  const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  const __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  *error = _mm_or_si128(*error, _mm_cmpeq_epi8(_mm_or_si128(is_digit, is_letter), _mm_setzero_si128()));
+  return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                      _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+// 32 digits to 16 bytes, pmaddubsw joins the nibble pairs.
+ANDJS_TARGET("ssse3")
+size_t DecodeHexSSSE3(const char* src, size_t length, uint8_t* dst) {
+  const __m128i weights = _mm_set1_epi16(0x0110);
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32, dst += 16) {
+    __m128i error = _mm_setzero_si128();
+    __m128i first = HexNibblesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), &error);
+    __m128i second = HexNibblesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16)), &error);
+    if(_mm_movemask_epi8(error))
+      break;
+    __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(first, weights), _mm_maddubs_epi16(second, weights));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), bytes);
+  }
+  return i;
+}
+#endif  // defined(ANDJS_ENCODING_X86)
+
+EncodingKernels ScalarKernels() {
+  return {"scalar", &CountASCIIScalar, &EncodeNone, &DecodeNone, &EncodeNone, &DecodeNone};
+}
+
+EncodingKernels SelectKernels() {
+  EncodingKernels kernels = ScalarKernels();
+#if defined(ANDJS_ENCODING_NEON)
+  kernels.name = "neon";
+  kernels.count_ascii = &CountASCIINEON;
+#if defined(__aarch64__)
+  kernels.encode_base64 = &EncodeBase64NEON;
+  kernels.decode_base64 = &DecodeBase64NEON;
+  kernels.encode_hex = &EncodeHexNEON;
+  kernels.decode_hex = &DecodeHexNEON;
+#endif
+#elif defined(ANDJS_ENCODING_X86)
+  base::CPU cpu;
+  kernels.name = "sse2";
+  kernels.count_ascii = &CountASCIISSE2;
+  if(cpu.has_ssse3()) {
+    kernels.name = "ssse3";
+    kernels.encode_base64 = &EncodeBase64SSSE3;
+    kernels.decode_base64 = &DecodeBase64SSSE3;
+    kernels.encode_hex = &EncodeHexSSSE3;
+    kernels.decode_hex = &DecodeHexSSSE3;
+  }
+  if(cpu.has_avx2()) {
+    kernels.name = "avx2";
+    kernels.count_ascii = &CountASCIIAVX2;
+    kernels.encode_base64 = &EncodeBase64AVX2;
+    kernels.decode_base64 = &DecodeBase64AVX2;
+  }
+#endif
+  return kernels;
+}
+
+std::atomic<bool> g_scalar_for_testing(false);
+
+const EncodingKernels& GetKernels() {
+  static const EncodingKernels kernels = SelectKernels();
+  static const EncodingKernels scalar = ScalarKernels();
+  if(g_scalar_for_testing.load(std::memory_order_relaxed))
+    return scalar;
+  return kernels;
+}
+
+// Length of the UTF-8 sequence at |data|, by the Encoding Standard. An
+// invalid one is as long as its maximal subpart, at least one byte.
+size_t SequenceLength(const uint8_t* data, size_t length, bool* valid) {
+  uint8_t lead = data[0];
+  *valid = false;
+  size_t needed;
+  uint8_t lower = 0x80;
+  uint8_t upper = 0xbf;
+  if(lead < 0x80) {
+    *valid = true;
+    return 1;
+  } else if(lead >= 0xc2 && lead <= 0xdf) {
+    needed = 1;
+  } else if(lead >= 0xe0 && lead <= 0xef) {
+    needed = 2;
+    if(lead == 0xe0)
+      lower = 0xa0;
+    else if(lead == 0xed)
+      upper = 0x9f;
+  } else if(lead >= 0xf0 && lead <= 0xf4) {
+    needed = 3;
+    if(lead == 0xf0)
+      lower = 0x90;
+    else if(lead == 0xf4)
+      upper = 0x8f;
+  } else {
+    return 1;
+  }
+  for(size_t i = 1; i <= needed; i++) {
+    if(i >= length || data[i] < lower || data[i] > upper)
+      return i;
+    lower = 0x80;
+    upper = 0xbf;
+  }
+  *valid = true;
+  return needed + 1;
+}
+
+int Base64Value(uint8_t c) {
+  if(c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if(c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if(c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if(c == '+')
+    return 62;
+  if(c == '/')
+    return 63;
+  return -1;
+}
+
+int HexValue(uint8_t c) {
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  c |= 0x20;
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+bool IsASCIIWhitespace(uint8_t c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r';
+}
+
+}  // namespace
+
+const char* GetEncodingKernels() {
+  return GetKernels().name;
+}
+
+void SetScalarEncodingForTesting(bool scalar) {
+  g_scalar_for_testing.store(scalar, std::memory_order_relaxed);
+}
+
+size_t CountASCII(const uint8_t* data, size_t length) {
+  return GetKernels().count_ascii(data, length);
+}
+
+bool IsUTF8(const uint8_t* data, size_t length) {
+  const EncodingKernels& kernels = GetKernels();
+  size_t i = 0;
+  while(true) {
+    i += kernels.count_ascii(data + i, length - i);
+    if(i == length)
+      return true;
+    // Text that isn't ASCII tends to stay that way, so the vector loop
+    // only resumes at the next ASCII byte.
+    do {
+      bool valid;
+      i += SequenceLength(data + i, length - i, &valid);
+      if(!valid)
+        return false;
+    } while(i < length && data[i] >= 0x80);
+  }
+}
+
+bool DecodeUTF8(const uint8_t* data, size_t length, std::string* output) {
+  const char* chars = reinterpret_cast<const char*>(data);
+  if(IsUTF8(data, length)) {
+    output->assign(chars, length);
+    return true;
+  }
+  const EncodingKernels& kernels = GetKernels();
+  output->clear();
+  output->reserve(length + length / 2);
+  size_t copied = 0;
+  size_t i = 0;
+  while(true) {
+    i += kernels.count_ascii(data + i, length - i);
+    if(i == length)
+      break;
+    bool valid;
+    size_t n = SequenceLength(data + i, length - i, &valid);
+    if(!valid) {
+      output->append(chars + copied, i - copied);
+      output->append(kReplacementCharacter);
+      copied = i + n;
+    }
+    i += n;
+  }
+  output->append(chars + copied, length - copied);
+  return false;
+}
+
+bool ToWellFormedUTF8(const std::string& input, std::string* output) {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data());
+  size_t length = input.size();
+  if(IsUTF8(data, length))
+    return false;
+  output->clear();
+  output->reserve(length);
+  size_t copied = 0;
+  size_t i = 0;
+  while(i < length) {
+    if(data[i] < 0x80) {
+      i++;
+      continue;
+    }
+    bool valid;
+    size_t n = SequenceLength(data + i, length - i, &valid);
+    if(!valid) {
+      // A surrogate is one character, not the three subparts a decoder sees.
+      if(data[i] == 0xed && i + 2 < length && data[i + 1] >= 0xa0 && data[i + 1] <= 0xbf &&
+         data[i + 2] >= 0x80 && data[i + 2] <= 0xbf)
+        n = 3;
+      output->append(input, copied, i - copied);
+      output->append(kReplacementCharacter);
+      copied = i + n;
+    }
+    i += n;
+  }
+  output->append(input, copied, length - copied);
+  return true;
+}
+
+void EncodeBase64(const uint8_t* data, size_t length, std::string* output) {
+  output->resize((length + 2) / 3 * 4);
+  char* dst = &(*output)[0];
+  size_t i = GetKernels().encode_base64(data, length, dst);
+  dst += i / 3 * 4;
+  for(; i + 3 <= length; i += 3, dst += 4) {
+    uint32_t triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+    dst[0] = kBase64Chars[triple >> 18];
+    dst[1] = kBase64Chars[(triple >> 12) & 0x3f];
+    dst[2] = kBase64Chars[(triple >> 6) & 0x3f];
+    dst[3] = kBase64Chars[triple & 0x3f];
+  }
+  if(i < length) {
+    uint32_t triple = data[i] << 16;
+    if(i + 1 < length)
+      triple |= data[i + 1] << 8;
+    dst[0] = kBase64Chars[triple >> 18];
+    dst[1] = kBase64Chars[(triple >> 12) & 0x3f];
+    dst[2] = i + 1 < length ? kBase64Chars[(triple >> 6) & 0x3f] : '=';
+    dst[3] = '=';
+  }
+}
+
+bool DecodeBase64(const char* data, size_t length, std::vector<uint8_t>* output) {
+  output->resize(length / 4 * 3 + 3 + kDecodeSlack);
+  uint8_t* dst = output->data();
+  size_t i = GetKernels().decode_base64(data, length, dst);
+  dst += i / 4 * 3;
+
+  // The rest one character at a time: whitespace, padding and the tail.
+  uint32_t bits = 0;
+  size_t sextets = 0;
+  size_t padding = 0;
+  for(; i < length; i++) {
+    uint8_t c = static_cast<uint8_t>(data[i]);
+    if(IsASCIIWhitespace(c))
+      continue;
+    if(c == '=') {
+      padding++;
+      continue;
+    }
+    int value = Base64Value(c);
+    if(value < 0 || padding) {
+      output->clear();
+      return false;
+    }
+    bits = (bits << 6) | value;
+    if(++sextets == 4) {
+      dst[0] = static_cast<uint8_t>(bits >> 16);
+      dst[1] = static_cast<uint8_t>(bits >> 8);
+      dst[2] = static_cast<uint8_t>(bits);
+      dst += 3;
+      bits = 0;
+      sextets = 0;
+    }
+  }
+  // Padding only completes a last group of two or three characters.
+  if(sextets == 1 || (padding && (sextets < 2 || sextets + padding != 4))) {
+    output->clear();
+    return false;
+  }
+  if(sextets == 2) {
+    *dst++ = static_cast<uint8_t>(bits >> 4);
+  } else if(sextets == 3) {
+    *dst++ = static_cast<uint8_t>(bits >> 10);
+    *dst++ = static_cast<uint8_t>(bits >> 2);
+  }
+  output->resize(dst - output->data());
+  return true;
+}
+
+void EncodeHex(const uint8_t* data, size_t length, std::string* output) {
+  output->resize(length * 2);
+  char* dst = &(*output)[0];
+  size_t i = GetKernels().encode_hex(data, length, dst);
+  dst += i * 2;
+  for(; i < length; i++, dst += 2) {
+    dst[0] = kHexDigits[data[i] >> 4];
+    dst[1] = kHexDigits[data[i] & 0x0f];
+  }
+}
+
+bool DecodeHex(const char* data, size_t length, std::vector<uint8_t>* output) {
+  if(length % 2)
+    return false;
+  output->resize(length / 2);
+  uint8_t* dst = output->data();
+  size_t i = GetKernels().decode_hex(data, length, dst);
+  dst += i / 2;
+  for(; i < length; i += 2) {
+    int high = HexValue(static_cast<uint8_t>(data[i]));
+    int low = HexValue(static_cast<uint8_t>(data[i + 1]));
+    if(high < 0 || low < 0) {
+      output->clear();
+      return false;
+    }
+    *dst++ = static_cast<uint8_t>((high << 4) | low);
+  }
+  return true;
+}
+
+}  // namespace andjs
@@ -0,0 +1,71 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_ENCODING_H__
+#define __ANDJS_ENCODING_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace andjs {
+
+// Byte level text encodings behind the encoding global, TextEncoder,
+// TextDecoder, atob(), btoa() and JSCrypto. The vector kernels are picked
+// once per process: NEON on ARM, AVX2 or SSSE3 on x86 as base::CPU
+// reports, scalar loops elsewhere and for the tails.
+
+// "neon", "avx2", "ssse3", "sse2" or "scalar".
+const char* GetEncodingKernels();
+
+// Tests only. While set every function below runs the scalar loops alone,
+// to compare with the vector kernels.
+void SetScalarEncodingForTesting(bool scalar);
+
+// Bytes before the first one above 0x7f.
+size_t CountASCII(const uint8_t* data, size_t length);
+
+// Well-formed UTF-8: no overlong forms, surrogates or code points past
+// U+10FFFF.
+bool IsUTF8(const uint8_t* data, size_t length);
+
+// The UTF-8 decoder of the Encoding Standard, every maximal invalid
+// subpart becomes U+FFFD. Returns false if there was one.
+bool DecodeUTF8(const uint8_t* data, size_t length, std::string* output);
+
+// Engines write lone surrogates of a string in their three byte (CESU-8)
+// form. Returns false if |input| is well-formed already, otherwise
+// |output| gets it with U+FFFD in their place.
+bool ToWellFormedUTF8(const std::string& input, std::string* output);
+
+// RFC 4648 base64, padded.
+void EncodeBase64(const uint8_t* data, size_t length, std::string* output);
+// The forgiving-base64 decode of the HTML standard: ASCII whitespace is
+// skipped and padding is optional.
+bool DecodeBase64(const char* data, size_t length, std::vector<uint8_t>* output);
+
+// Two lower case digits per byte.
+void EncodeHex(const uint8_t* data, size_t length, std::string* output);
+// Digits of either case, an even number of them.
+bool DecodeHex(const char* data, size_t length, std::vector<uint8_t>* output);
+
+}
+#endif
@@ -0,0 +1,367 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_encoding.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace andjs {
+
+namespace {
+
+// Every length up to a few vector widths past the widest kernel, then some
+// long ones with odd tails.
+std::vector<size_t> TestLengths() {
+  std::vector<size_t> lengths;
+  for(size_t length = 0; length <= 130; length++)
+    lengths.push_back(length);
+  for(size_t length : {255, 256, 257, 1000, 4099})
+    lengths.push_back(length);
+  return lengths;
+}
+
+// The same bytes on every run, so a failure reproduces.
+std::string RandomBytes(size_t length, uint32_t seed) {
+  std::string bytes(length, '\0');
+  for(size_t i = 0; i < length; i++) {
+    seed = seed * 1103515245 + 12345;
+    bytes[i] = static_cast<char>(seed >> 16);
+  }
+  return bytes;
+}
+
+const uint8_t* Bytes(const std::string& s) {
+  return reinterpret_cast<const uint8_t*>(s.data());
+}
+
+std::string Base64(const std::string& s) {
+  std::string encoded;
+  EncodeBase64(Bytes(s), s.size(), &encoded);
+  return encoded;
+}
+
+std::string Hex(const std::string& s) {
+  std::string encoded;
+  EncodeHex(Bytes(s), s.size(), &encoded);
+  return encoded;
+}
+
+bool FromBase64(const std::string& s, std::string* decoded) {
+  std::vector<uint8_t> bytes;
+  if(!DecodeBase64(s.data(), s.size(), &bytes))
+    return false;
+  decoded->assign(bytes.begin(), bytes.end());
+  return true;
+}
+
+bool FromHex(const std::string& s, std::string* decoded) {
+  std::vector<uint8_t> bytes;
+  if(!DecodeHex(s.data(), s.size(), &bytes))
+    return false;
+  decoded->assign(bytes.begin(), bytes.end());
+  return true;
+}
+
+// What every function makes of one input.
+struct Results {
+  size_t ascii;
+  bool utf8;
+  bool decoded_valid;
+  std::string decoded;
+  bool well_formed;
+  std::string replaced;
+  std::string base64;
+  bool from_base64;
+  std::string base64_bytes;
+  std::string hex;
+  bool from_hex;
+  std::string hex_bytes;
+};
+
+Results Run(const std::string& input) {
+  Results results;
+  results.ascii = CountASCII(Bytes(input), input.size());
+  results.utf8 = IsUTF8(Bytes(input), input.size());
+  results.decoded_valid = DecodeUTF8(Bytes(input), input.size(), &results.decoded);
+  results.well_formed = !ToWellFormedUTF8(input, &results.replaced);
+  results.base64 = Base64(input);
+  results.from_base64 = FromBase64(input, &results.base64_bytes);
+  results.hex = Hex(input);
+  results.from_hex = FromHex(input, &results.hex_bytes);
+  return results;
+}
+
+// The vector kernels have to agree with the scalar loops on any input,
+// valid or not.
+void ExpectSameAsScalar(const std::string& input) {
+  Results vector = Run(input);
+  SetScalarEncodingForTesting(true);
+  Results scalar = Run(input);
+  SetScalarEncodingForTesting(false);
+  EXPECT_EQ(scalar.ascii, vector.ascii);
+  EXPECT_EQ(scalar.utf8, vector.utf8);
+  EXPECT_EQ(scalar.decoded_valid, vector.decoded_valid);
+  EXPECT_EQ(scalar.decoded, vector.decoded);
+  EXPECT_EQ(scalar.well_formed, vector.well_formed);
+  if(!scalar.well_formed) {
+    EXPECT_EQ(scalar.replaced, vector.replaced);
+  }
+  EXPECT_EQ(scalar.base64, vector.base64);
+  EXPECT_EQ(scalar.from_base64, vector.from_base64);
+  if(scalar.from_base64) {
+    EXPECT_EQ(scalar.base64_bytes, vector.base64_bytes);
+  }
+  EXPECT_EQ(scalar.hex, vector.hex);
+  EXPECT_EQ(scalar.from_hex, vector.from_hex);
+  if(scalar.from_hex) {
+    EXPECT_EQ(scalar.hex_bytes, vector.hex_bytes);
+  }
+}
+
+TEST(EncodingTest, ScalarSwitch) {
+  SetScalarEncodingForTesting(true);
+  EXPECT_STREQ("scalar", GetEncodingKernels());
+  SetScalarEncodingForTesting(false);
+  EXPECT_NE(nullptr, GetEncodingKernels());
+}
+
+TEST(EncodingTest, KnownVectors) {
+  // RFC 4648, section 10.
+  const char* const kVectors[][3] = {
+      {"", "", ""},
+      {"f", "Zg==", "66"},
+      {"fo", "Zm8=", "666f"},
+      {"foo", "Zm9v", "666f6f"},
+      {"foob", "Zm9vYg==", "666f6f62"},
+      {"fooba", "Zm9vYmE=", "666f6f6261"},
+      {"foobar", "Zm9vYmFy", "666f6f626172"},
+  };
+  for(bool scalar : {false, true}) {
+    SetScalarEncodingForTesting(scalar);
+    for(const auto& vector : kVectors) {
+      std::string decoded;
+      EXPECT_EQ(vector[1], Base64(vector[0]));
+      EXPECT_TRUE(FromBase64(vector[1], &decoded));
+      EXPECT_EQ(vector[0], decoded);
+      EXPECT_EQ(vector[2], Hex(vector[0]));
+      EXPECT_TRUE(FromHex(vector[2], &decoded));
+      EXPECT_EQ(vector[0], decoded);
+    }
+  }
+  SetScalarEncodingForTesting(false);
+}
+
+TEST(EncodingTest, KernelsMatchScalarOnEveryLength) {
+  for(size_t length : TestLengths()) {
+    SCOPED_TRACE(length);
+    std::string bytes = RandomBytes(length, static_cast<uint32_t>(length));
+    ExpectSameAsScalar(bytes);
+    ExpectSameAsScalar(Base64(bytes));
+    ExpectSameAsScalar(Hex(bytes));
+    ExpectSameAsScalar(std::string(length, 'a'));
+  }
+}
+
+TEST(EncodingTest, KernelsMatchScalarOnBadByteAnywhere) {
+  // A stray byte in each position of each length lands in every lane and
+  // in the scalar tail.
+  for(size_t length = 1; length <= 130; length++) {
+    std::string bytes = RandomBytes(length / 2 + 1, static_cast<uint32_t>(length));
+    std::string base64 = Base64(bytes).substr(0, length & ~3);
+    std::string hex = Hex(bytes).substr(0, length & ~1);
+    for(size_t i = 0; i < length; i++) {
+      SCOPED_TRACE(testing::Message() << length << " " << i);
+      std::string ascii(length, 'a');
+      ascii[i] = '\x80';
+      EXPECT_EQ(i, CountASCII(Bytes(ascii), ascii.size()));
+      ExpectSameAsScalar(ascii);
+      if(i < base64.size()) {
+        std::string bad = base64;
+        bad[i] = '*';
+        ExpectSameAsScalar(bad);
+        std::string decoded;
+        EXPECT_FALSE(FromBase64(bad, &decoded));
+        bad[i] = ' ';
+        ExpectSameAsScalar(bad);
+      }
+      if(i < hex.size()) {
+        std::string bad = hex;
+        bad[i] = 'g';
+        ExpectSameAsScalar(bad);
+        std::string decoded;
+        EXPECT_FALSE(FromHex(bad, &decoded));
+        bad[i] = "0123456789ABCDEF"[i % 16];
+        ExpectSameAsScalar(bad);
+      }
+    }
+  }
+}
+
+TEST(EncodingTest, KernelsMatchScalarOnUTF8Anywhere) {
+  const char* const kSequences[] = {
+      "\xc3\xa9",          // é
+      "\xe4\xb8\xad",      // 中
+      "\xf0\x9f\x98\x80",  // U+1F600
+      "\x80",              // lone continuation byte
+      "\xc0\xaf",          // overlong
+      "\xe4\xb8",          // truncated
+      "\xed\xa0\x80",      // surrogate
+      "\xf4\x90\x80\x80",  // past U+10FFFF
+      "\xff",
+  };
+  for(size_t length = 4; length <= 70; length++) {
+    for(size_t i = 0; i + 4 <= length; i++) {
+      for(const char* sequence : kSequences) {
+        SCOPED_TRACE(testing::Message() << length << " " << i << " " << Hex(sequence));
+        std::string text(length, 'a');
+        text.replace(i, strlen(sequence), sequence);
+        ExpectSameAsScalar(text);
+      }
+    }
+  }
+}
+
+TEST(EncodingTest, DecodesUTF8LikeTheEncodingStandard) {
+  const std::string kReplacement = "\xef\xbf\xbd";
+  struct {
+    const char* input;
+    const char* output;
+  } const kCases[] = {
+      {"a\xc3\xa9z", "a\xc3\xa9z"},
+      {"a\x80z", "a\xef\xbf\xbdz"},
+      {"a\xc0\xafz", "a\xef\xbf\xbd\xef\xbf\xbdz"},
+      {"a\xe4\xb8z", "a\xef\xbf\xbdz"},
+      {"a\xed\xa0\x80z", "a\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbdz"},
+      {"a\xf4\x90\x80\x80z", "a\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbdz"},
+      {"a\xf0\x9f\x98", "a\xef\xbf\xbd"},
+  };
+  for(bool scalar : {false, true}) {
+    SetScalarEncodingForTesting(scalar);
+    for(const auto& test : kCases) {
+      std::string input = test.input;
+      std::string output;
+      EXPECT_EQ(input == test.output, IsUTF8(Bytes(input), input.size()));
+      EXPECT_EQ(input == test.output, DecodeUTF8(Bytes(input), input.size(), &output));
+      EXPECT_EQ(test.output, output);
+    }
+
+    // A surrogate an engine wrote is one character.
+    std::string output;
+    EXPECT_TRUE(ToWellFormedUTF8("a\xed\xa0\x80z", &output));
+    EXPECT_EQ("a" + kReplacement + "z", output);
+    EXPECT_FALSE(ToWellFormedUTF8("a\xf0\x9f\x98\x80z", &output));
+  }
+  SetScalarEncodingForTesting(false);
+}
+
+TEST(EncodingTest, Base64RoundTrips) {
+  for(bool scalar : {false, true}) {
+    SetScalarEncodingForTesting(scalar);
+    for(size_t length : TestLengths()) {
+      SCOPED_TRACE(testing::Message() << scalar << " " << length);
+      std::string bytes = RandomBytes(length, static_cast<uint32_t>(length) + 7);
+      std::string encoded = Base64(bytes);
+      ASSERT_EQ((length + 2) / 3 * 4, encoded.size());
+      std::string decoded;
+      EXPECT_TRUE(FromBase64(encoded, &decoded));
+      EXPECT_EQ(bytes, decoded);
+
+      // Unpadded.
+      std::string unpadded = encoded.substr(0, encoded.find('='));
+      EXPECT_TRUE(FromBase64(unpadded, &decoded));
+      EXPECT_EQ(bytes, decoded);
+
+      // MIME lines.
+      std::string wrapped;
+      for(size_t i = 0; i < encoded.size(); i += 76)
+        wrapped += encoded.substr(i, 76) + "\r\n";
+      EXPECT_TRUE(FromBase64(wrapped, &decoded));
+      EXPECT_EQ(bytes, decoded);
+    }
+  }
+  SetScalarEncodingForTesting(false);
+}
+
+TEST(EncodingTest, Base64RejectsBadInput) {
+  const char* const kBad[] = {
+      "A", "AB=", "A===", "AB=A", "AB==AB==", "ABC==", "Zm9v*", "Zm9v-_", "Zm9v\x80",
+      "ABCD=", "ABCD====", "====", "=",
+  };
+  for(bool scalar : {false, true}) {
+    SetScalarEncodingForTesting(scalar);
+    std::string decoded;
+    for(const char* bad : kBad) {
+      std::vector<uint8_t> bytes;
+      EXPECT_FALSE(DecodeBase64(bad, strlen(bad), &bytes)) << bad;
+      EXPECT_TRUE(bytes.empty()) << bad;
+    }
+    EXPECT_TRUE(FromBase64(" Zm 9v\tYg =\n= ", &decoded));
+    EXPECT_EQ("foob", decoded);
+
+    // Padding after a complete group, past the vector loop.
+    EXPECT_FALSE(FromBase64(Base64(RandomBytes(99, 5)) + "==", &decoded));
+
+    // Padding before the last group.
+    std::string encoded = Base64(RandomBytes(200, 3));
+    for(size_t i = 0; i + 4 < encoded.size(); i++) {
+      std::string bad = encoded;
+      bad[i] = '=';
+      EXPECT_FALSE(FromBase64(bad, &decoded)) << scalar << " " << i;
+    }
+  }
+  SetScalarEncodingForTesting(false);
+}
+
+TEST(EncodingTest, HexRoundTripsAndRejectsBadInput) {
+  for(bool scalar : {false, true}) {
+    SetScalarEncodingForTesting(scalar);
+    for(size_t length : TestLengths()) {
+      SCOPED_TRACE(testing::Message() << scalar << " " << length);
+      std::string bytes = RandomBytes(length, static_cast<uint32_t>(length) + 11);
+      std::string encoded = Hex(bytes);
+      std::string decoded;
+      EXPECT_TRUE(FromHex(encoded, &decoded));
+      EXPECT_EQ(bytes, decoded);
+      for(char& c : encoded)
+        c = static_cast<char>(toupper(c));
+      EXPECT_TRUE(FromHex(encoded, &decoded));
+      EXPECT_EQ(bytes, decoded);
+      if(length) {
+        EXPECT_FALSE(FromHex(encoded.substr(1), &decoded));
+      }
+      std::vector<uint8_t> output;
+      encoded += "0g";
+      EXPECT_FALSE(DecodeHex(encoded.data(), encoded.size(), &output));
+      EXPECT_TRUE(output.empty());
+    }
+  }
+  SetScalarEncodingForTesting(false);
+}
+
+}  // namespace
+
+}  // namespace andjs
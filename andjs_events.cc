@@ -0,0 +1,216 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_events.h"
+
+#include "base/time/time.h"
+#include "base/trace_event/trace_event.h"
+#include "base/values.h"
+
+#include "andjs/andjs_stats.h"
+#include "andjs/andjs_structured.h"
+
+namespace andjs {
+
+namespace {
+
+// A blocked producer looks at the queue again after this long, in case it
+// missed the signal of a drain.
+const int kBlockedRecheckMs = 10;
+
+}  // namespace
+
+ScriptEvent::ScriptEvent() = default;
+
+ScriptEvent::ScriptEvent(const std::string& type, std::unique_ptr<base::Value> data)
+    : type(type),
+      data(std::move(data)) {
+}
+
+ScriptEvent::~ScriptEvent() = default;
+
+EventChannel::EventChannel(size_t capacity, Backpressure backpressure, AndJSStats* stats)
+    : queue_(capacity),
+      backpressure_(backpressure),
+      stats_(stats),
+      drain_scheduled_(false),
+      closed_(false),
+      consumer_thread_(base::kInvalidThreadId),
+      blocked_producers_(0),
+      space_available_(&space_lock_) {
+}
+
+EventChannel::~EventChannel() {
+  base::AutoLock locker(types_lock_);
+  for(auto& type : types_)
+    delete type.second->latest.exchange(nullptr);
+}
+
+void EventChannel::SetCoalesce(const std::string& type, Coalesce coalesce) {
+  base::AutoLock locker(types_lock_);
+  std::unique_ptr<TypeState>& state = types_[type];
+  if(!state) {
+    state = std::make_unique<TypeState>();
+    state->latest.store(nullptr);
+  }
+  state->coalesce.store(coalesce);
+}
+
+EventChannel::TypeState* EventChannel::FindType(const std::string& type) {
+  base::AutoLock locker(types_lock_);
+  auto it = types_.find(type);
+  return it == types_.end() ? nullptr : it->second.get();
+}
+
+bool EventChannel::Push(std::unique_ptr<ScriptEvent> event, bool* schedule_drain) {
+  *schedule_drain = false;
+  AndJSStats::Add(&stats_->events_dispatched, 1);
+  if(closed_.load()) {
+    AndJSStats::Add(&stats_->events_dropped, 1);
+    return false;
+  }
+
+  QueuedEvent entry;
+  TypeState* type = FindType(event->type);
+  if(type)
+    entry.coalesce = static_cast<Coalesce>(type->coalesce.load(std::memory_order_relaxed));
+  if(entry.coalesce != kLatest) {
+    entry.event = std::move(event);
+    if(PushEntry(std::move(entry), schedule_drain))
+      return true;
+    AndJSStats::Add(&stats_->events_dropped, 1);
+    return false;
+  }
+
+  // Whoever finds the slot empty queues the entry for it, the others only
+  // replace the event in it.
+  ScriptEvent* pending = event.get();
+  std::unique_ptr<ScriptEvent> replaced(type->latest.exchange(event.release()));
+  if(replaced) {
+    AndJSStats::Add(&stats_->events_coalesced, 1);
+    return true;
+  }
+  while(true) {
+    QueuedEvent latest_entry;
+    latest_entry.latest = type;
+    latest_entry.coalesce = kLatest;
+    if(PushEntry(std::move(latest_entry), schedule_drain))
+      return true;
+    // No entry would ever deliver the event in the slot, take it back. If a
+    // newer one replaced it meanwhile, its producer was told it is queued,
+    // so that one gets another try.
+    if(type->latest.compare_exchange_strong(pending, nullptr)) {
+      delete pending;
+      AndJSStats::Add(&stats_->events_dropped, 1);
+      return false;
+    }
+  }
+}
+
+bool EventChannel::PushEntry(QueuedEvent entry, bool* schedule_drain) {
+  // TryPush() only moves from |entry| when it succeeds.
+  while(!queue_.TryPush(std::move(entry))) {
+    if(backpressure_ == kDrop || closed_.load() ||
+       consumer_thread_.load() == base::PlatformThread::CurrentId())
+      return false;
+    TRACE_EVENT0("andjs", "EventChannel::WaitForSpace");
+    AndJSStats::Add(&stats_->events_blocked, 1);
+    base::AutoLock locker(space_lock_);
+    blocked_producers_++;
+    if(!closed_.load() && queue_.ApproximateSize() >= queue_.capacity())
+      space_available_.TimedWait(base::TimeDelta::FromMilliseconds(kBlockedRecheckMs));
+    blocked_producers_--;
+  }
+  *schedule_drain = !drain_scheduled_.exchange(true);
+  return true;
+}
+
+bool EventChannel::Drain(std::vector<std::unique_ptr<ScriptEvent>>* events) {
+  TRACE_EVENT0("andjs", "EventChannel::Drain");
+  consumer_thread_.store(base::PlatformThread::CurrentId());
+  // Pushes from here on either land in this drain or schedule the next.
+  drain_scheduled_.store(false);
+
+  // The data of the event delivered for each kAccumulate type.
+  std::map<std::string, base::ListValue*> accumulated;
+  // The same for structured events, the array is written as they come.
+  struct StructuredArray {
+    ScriptEvent* event;
+    StructuredWriter writer;
+    size_t offset;
+    uint32_t count;
+  };
+  std::map<std::string, std::unique_ptr<StructuredArray>> accumulated_structured;
+  QueuedEvent entry;
+  for(size_t i = 0; i < queue_.capacity() && queue_.TryPop(&entry); i++) {
+    std::unique_ptr<ScriptEvent> event = std::move(entry.event);
+    if(entry.latest)
+      event.reset(entry.latest->latest.exchange(nullptr));
+    if(!event)
+      continue;
+    if(entry.coalesce == kAccumulate && event->data) {
+      auto it = accumulated.find(event->type);
+      if(it != accumulated.end()) {
+        it->second->Append(std::move(event->data));
+        AndJSStats::Add(&stats_->events_coalesced, 1);
+        continue;
+      }
+      std::unique_ptr<base::ListValue> list = std::make_unique<base::ListValue>();
+      list->Append(std::move(event->data));
+      accumulated[event->type] = list.get();
+      event->data = std::move(list);
+    } else if(entry.coalesce == kAccumulate) {
+      std::unique_ptr<StructuredArray>& array = accumulated_structured[event->type];
+      if(array) {
+        array->writer.AppendValue(event->structured);
+        array->count++;
+        AndJSStats::Add(&stats_->events_coalesced, 1);
+        continue;
+      }
+      array = std::make_unique<StructuredArray>();
+      array->event = event.get();
+      array->offset = array->writer.BeginContainer(StructuredTag::kArray);
+      array->writer.AppendValue(event->structured);
+      array->count = 1;
+    }
+    events->push_back(std::move(event));
+  }
+  for(auto& merged : accumulated_structured) {
+    StructuredArray* array = merged.second.get();
+    array->writer.EndContainer(array->offset, array->count);
+    array->event->structured = array->writer.Take();
+  }
+
+  if(blocked_producers_.load() > 0) {
+    base::AutoLock locker(space_lock_);
+    space_available_.Broadcast();
+  }
+  // At most one drain is queued at a time.
+  return queue_.ApproximateSize() > 0 && !drain_scheduled_.exchange(true);
+}
+
+void EventChannel::Close() {
+  closed_.store(true);
+  base::AutoLock locker(space_lock_);
+  space_available_.Broadcast();
+}
+
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_EVENTS_H__
+#define __ANDJS_EVENTS_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/synchronization/condition_variable.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+#include "base/threading/platform_thread.h"
+
+#include "andjs/mpsc_ring_buffer.h"
+
+namespace base {
+class Value;
+}
+
+namespace andjs {
+
+struct AndJSStats;
+
+// An AndJS.dispatchEvent() on its way to the addEventListener() listeners
+// of the main context, as `{type, data}`.
+struct ScriptEvent {
+  ScriptEvent();
+  ScriptEvent(const std::string& type, std::unique_ptr<base::Value> data);
+  ~ScriptEvent();
+
+  std::string type;
+  std::unique_ptr<base::Value> data;
+  // Instead of |data| for AndJS.dispatchStructuredEvent(), a value in the
+  // StructuredWriter format.
+  std::vector<uint8_t> structured;
+};
+
+// The java to script event queue of one instance. Producers on any thread
+// push into a bounded MPSCRingBuffer, the JSTask thread drains it in
+// batches. Events of a type can be coalesced, see Coalesce, and a full
+// queue either drops the new event or blocks its producer.
+class EventChannel {
+  public:
+    // Keep in sync with AndJS.COALESCE_*.
+    enum Coalesce {
+      // Every event is delivered.
+      kNone = 0,
+      // Only the newest pending event of the type is delivered. It waits in
+      // a slot of its own and takes one queue entry however often it is
+      // replaced.
+      kLatest = 1,
+      // The pending events of the type found by one drain are delivered as
+      // one event whose data is the array of their data. JSON and structured
+      // events of a type are merged apart.
+      kAccumulate = 2,
+    };
+
+    // Keep in sync with AndJS.EventBackpressure.
+    enum Backpressure {
+      kDrop = 0,
+      kBlock = 1,
+    };
+
+    EventChannel(size_t capacity, Backpressure backpressure, AndJSStats* stats);
+    ~EventChannel();
+
+    // Any thread. Applies to events pushed afterwards.
+    void SetCoalesce(const std::string& type, Coalesce coalesce);
+
+    // Any thread. False when the event was dropped. Sets |schedule_drain|
+    // when the caller has to post a Drain() to JSTask. A blocked producer
+    // on the JSTask thread itself would never wake up, it drops instead.
+    bool Push(std::unique_ptr<ScriptEvent> event, bool* schedule_drain);
+
+    // JSTask thread. Appends up to capacity() queued events, coalesced, in
+    // the order they were pushed. Returns true when more are left and
+    // another Drain() has to be posted.
+    bool Drain(std::vector<std::unique_ptr<ScriptEvent>>* events);
+
+    // Any thread. Drops the events pushed from now on and wakes up blocked
+    // producers, the instance is shutting down.
+    void Close();
+
+    size_t capacity() const { return queue_.capacity(); }
+
+  private:
+    struct TypeState {
+      std::atomic<int> coalesce;
+      // kLatest only: the newest event, non-null while a queue entry for it
+      // is queued or about to be.
+      std::atomic<ScriptEvent*> latest;
+    };
+
+    // A queue entry, either an event or the slot of a kLatest type.
+    struct QueuedEvent {
+      std::unique_ptr<ScriptEvent> event;
+      TypeState* latest = nullptr;
+      // Looked up by the producer, Drain() takes no lock.
+      Coalesce coalesce = kNone;
+    };
+
+    TypeState* FindType(const std::string& type);
+    // False when there was no room, the caller counts the drop.
+    bool PushEntry(QueuedEvent entry, bool* schedule_drain);
+
+    MPSCRingBuffer<QueuedEvent> queue_;
+    const Backpressure backpressure_;
+    AndJSStats* stats_;
+    std::atomic<bool> drain_scheduled_;
+    std::atomic<bool> closed_;
+    // The thread that drains, producers on it never block.
+    std::atomic<base::PlatformThreadId> consumer_thread_;
+
+    // By event type. Never removed, queue entries point into them.
+    std::map<std::string, std::unique_ptr<TypeState>> types_ GUARDED_BY(types_lock_);
+    base::Lock types_lock_;
+
+    // Blocked producers wait here for a drain to make room.
+    std::atomic<int> blocked_producers_;
+    base::Lock space_lock_;
+    base::ConditionVariable space_available_;
+
+    DISALLOW_COPY_AND_ASSIGN(EventChannel);
+};
+
+}
+#endif
@@ -0,0 +1,286 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_events.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "base/values.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#include "andjs/andjs_stats.h"
+
+namespace andjs {
+
+namespace {
+
+const int kProducers = 4;
+const int kEventsPerProducer = 5000;
+
+std::unique_ptr<ScriptEvent> NewEvent(const std::string& type, int value) {
+  return std::make_unique<ScriptEvent>(type, std::make_unique<base::Value>(value));
+}
+
+bool Push(EventChannel* channel, const std::string& type, int value) {
+  bool schedule_drain;
+  return channel->Push(NewEvent(type, value), &schedule_drain);
+}
+
+std::vector<std::unique_ptr<ScriptEvent>> DrainAll(EventChannel* channel) {
+  std::vector<std::unique_ptr<ScriptEvent>> events;
+  while(channel->Drain(&events)) {}
+  return events;
+}
+
+void ExpectEvent(const ScriptEvent& event, const std::string& type, int value) {
+  EXPECT_EQ(type, event.type);
+  ASSERT_TRUE(event.data);
+  ASSERT_TRUE(event.data->is_int());
+  EXPECT_EQ(value, event.data->GetInt());
+}
+
+// Pushes one event and keeps what Push() returned.
+class EventProducer : public base::DelegateSimpleThread::Delegate {
+  public:
+    EventProducer(EventChannel* channel, int value) : channel_(channel), value_(value), pushed_(false) {}
+
+    void Run() override {
+      pushed_ = Push(channel_, "a", value_);
+    }
+
+    bool pushed() const { return pushed_; }
+
+  private:
+    EventChannel* channel_;
+    int value_;
+    bool pushed_;
+};
+
+// Pushes kLatest "pos" events between plain ones that keep the queue full.
+class LatestProducer : public base::DelegateSimpleThread::Delegate {
+  public:
+    LatestProducer(EventChannel* channel, std::atomic<int>* finished) : channel_(channel), finished_(finished) {}
+
+    void Run() override {
+      for(int i = 0; i < kEventsPerProducer; i++) {
+        Push(channel_, "pos", i);
+        Push(channel_, "a", i);
+      }
+      finished_->fetch_add(1);
+    }
+
+  private:
+    EventChannel* channel_;
+    std::atomic<int>* finished_;
+};
+
+// Waits until |count| producers wait for room.
+void WaitForBlocked(const AndJSStats& stats, int64_t count) {
+  while(stats.events_blocked.load() < count)
+    base::PlatformThread::YieldCurrentThread();
+}
+
+TEST(EventChannelTest, DeliversInOrder) {
+  AndJSStats stats;
+  EventChannel channel(8, EventChannel::kDrop, &stats);
+  bool schedule_drain;
+  EXPECT_TRUE(channel.Push(NewEvent("a", 1), &schedule_drain));
+  EXPECT_TRUE(schedule_drain);
+  // One drain is enough for both.
+  EXPECT_TRUE(channel.Push(NewEvent("b", 2), &schedule_drain));
+  EXPECT_FALSE(schedule_drain);
+
+  std::vector<std::unique_ptr<ScriptEvent>> events;
+  EXPECT_FALSE(channel.Drain(&events));
+  ASSERT_EQ(2u, events.size());
+  ExpectEvent(*events[0], "a", 1);
+  ExpectEvent(*events[1], "b", 2);
+
+  EXPECT_TRUE(channel.Push(NewEvent("a", 3), &schedule_drain));
+  EXPECT_TRUE(schedule_drain);
+  EXPECT_EQ(3, stats.events_dispatched.load());
+}
+
+TEST(EventChannelTest, LatestWins) {
+  AndJSStats stats;
+  EventChannel channel(8, EventChannel::kDrop, &stats);
+  channel.SetCoalesce("pos", EventChannel::kLatest);
+  EXPECT_TRUE(Push(&channel, "pos", 1));
+  EXPECT_TRUE(Push(&channel, "a", 10));
+  EXPECT_TRUE(Push(&channel, "pos", 2));
+  EXPECT_TRUE(Push(&channel, "pos", 3));
+
+  // The newest event, where the first one was queued.
+  std::vector<std::unique_ptr<ScriptEvent>> events = DrainAll(&channel);
+  ASSERT_EQ(2u, events.size());
+  ExpectEvent(*events[0], "pos", 3);
+  ExpectEvent(*events[1], "a", 10);
+  EXPECT_EQ(2, stats.events_coalesced.load());
+
+  // The slot is free again.
+  EXPECT_TRUE(Push(&channel, "pos", 4));
+  events = DrainAll(&channel);
+  ASSERT_EQ(1u, events.size());
+  ExpectEvent(*events[0], "pos", 4);
+}
+
+TEST(EventChannelTest, Accumulates) {
+  AndJSStats stats;
+  EventChannel channel(8, EventChannel::kDrop, &stats);
+  channel.SetCoalesce("log", EventChannel::kAccumulate);
+  EXPECT_TRUE(Push(&channel, "log", 1));
+  EXPECT_TRUE(Push(&channel, "a", 10));
+  EXPECT_TRUE(Push(&channel, "log", 2));
+  EXPECT_TRUE(Push(&channel, "log", 3));
+
+  std::vector<std::unique_ptr<ScriptEvent>> events = DrainAll(&channel);
+  ASSERT_EQ(2u, events.size());
+  EXPECT_EQ("log", events[0]->type);
+  ASSERT_TRUE(events[0]->data->is_list());
+  const auto& list = events[0]->data->GetList();
+  ASSERT_EQ(3u, list.size());
+  for(int i = 0; i < 3; i++)
+    EXPECT_EQ(i + 1, list[i].GetInt());
+  ExpectEvent(*events[1], "a", 10);
+  EXPECT_EQ(2, stats.events_coalesced.load());
+
+  // Each drain delivers its own array.
+  EXPECT_TRUE(Push(&channel, "log", 4));
+  events = DrainAll(&channel);
+  ASSERT_EQ(1u, events.size());
+  ASSERT_TRUE(events[0]->data->is_list());
+  ASSERT_EQ(1u, events[0]->data->GetList().size());
+  EXPECT_EQ(4, events[0]->data->GetList()[0].GetInt());
+}
+
+TEST(EventChannelTest, DropsWhenFull) {
+  AndJSStats stats;
+  EventChannel channel(2, EventChannel::kDrop, &stats);
+  ASSERT_EQ(2u, channel.capacity());
+  EXPECT_TRUE(Push(&channel, "a", 1));
+  EXPECT_TRUE(Push(&channel, "a", 2));
+  EXPECT_FALSE(Push(&channel, "a", 3));
+  EXPECT_EQ(1, stats.events_dropped.load());
+
+  std::vector<std::unique_ptr<ScriptEvent>> events = DrainAll(&channel);
+  ASSERT_EQ(2u, events.size());
+  ExpectEvent(*events[0], "a", 1);
+  ExpectEvent(*events[1], "a", 2);
+}
+
+TEST(EventChannelTest, DropsTheLatestWhenFull) {
+  AndJSStats stats;
+  EventChannel channel(2, EventChannel::kDrop, &stats);
+  channel.SetCoalesce("pos", EventChannel::kLatest);
+  EXPECT_TRUE(Push(&channel, "a", 1));
+  EXPECT_TRUE(Push(&channel, "a", 2));
+  EXPECT_FALSE(Push(&channel, "pos", 3));
+  EXPECT_EQ(1, stats.events_dropped.load());
+  EXPECT_EQ(0, stats.events_coalesced.load());
+  EXPECT_EQ(2u, DrainAll(&channel).size());
+
+  // The dropped event left the slot empty.
+  EXPECT_TRUE(Push(&channel, "pos", 4));
+  std::vector<std::unique_ptr<ScriptEvent>> events = DrainAll(&channel);
+  ASSERT_EQ(1u, events.size());
+  ExpectEvent(*events[0], "pos", 4);
+}
+
+TEST(EventChannelTest, BlocksUntilDrained) {
+  AndJSStats stats;
+  EventChannel channel(2, EventChannel::kBlock, &stats);
+  EXPECT_TRUE(Push(&channel, "a", 1));
+  EXPECT_TRUE(Push(&channel, "a", 2));
+  EventProducer producer(&channel, 3);
+  base::DelegateSimpleThread thread(&producer, "EventProducer");
+  thread.Start();
+  WaitForBlocked(stats, 1);
+
+  std::vector<std::unique_ptr<ScriptEvent>> events;
+  channel.Drain(&events);
+  thread.Join();
+  EXPECT_TRUE(producer.pushed());
+  events = DrainAll(&channel);
+  ASSERT_EQ(1u, events.size());
+  ExpectEvent(*events[0], "a", 3);
+  EXPECT_EQ(0, stats.events_dropped.load());
+}
+
+TEST(EventChannelTest, CloseWakesBlockedProducers) {
+  AndJSStats stats;
+  EventChannel channel(2, EventChannel::kBlock, &stats);
+  EXPECT_TRUE(Push(&channel, "a", 1));
+  EXPECT_TRUE(Push(&channel, "a", 2));
+  EventProducer producer(&channel, 3);
+  base::DelegateSimpleThread thread(&producer, "EventProducer");
+  thread.Start();
+  WaitForBlocked(stats, 1);
+
+  channel.Close();
+  thread.Join();
+  EXPECT_FALSE(producer.pushed());
+  EXPECT_EQ(1, stats.events_dropped.load());
+  EXPECT_FALSE(Push(&channel, "a", 4));
+}
+
+TEST(EventChannelTest, LatestRacesOnAFullQueue) {
+  // Every event is delivered, coalesced or dropped exactly once, and the
+  // slot is never left holding an event without a queue entry.
+  AndJSStats stats;
+  EventChannel channel(2, EventChannel::kDrop, &stats);
+  channel.SetCoalesce("pos", EventChannel::kLatest);
+  std::atomic<int> finished(0);
+  std::vector<std::unique_ptr<LatestProducer>> producers;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for(int i = 0; i < kProducers; i++) {
+    producers.push_back(std::make_unique<LatestProducer>(&channel, &finished));
+    threads.push_back(std::make_unique<base::DelegateSimpleThread>(producers.back().get(), "LatestProducer"));
+    threads.back()->Start();
+  }
+
+  int64_t delivered = 0;
+  while(finished.load() < kProducers) {
+    std::vector<std::unique_ptr<ScriptEvent>> events;
+    channel.Drain(&events);
+    delivered += events.size();
+    base::PlatformThread::YieldCurrentThread();
+  }
+  for(auto& thread : threads)
+    thread->Join();
+  delivered += DrainAll(&channel).size();
+
+  EXPECT_EQ(kProducers * kEventsPerProducer * 2, stats.events_dispatched.load());
+  EXPECT_EQ(stats.events_dispatched.load(),
+            delivered + stats.events_coalesced.load() + stats.events_dropped.load());
+  EXPECT_TRUE(Push(&channel, "pos", -1));
+  std::vector<std::unique_ptr<ScriptEvent>> events = DrainAll(&channel);
+  ASSERT_EQ(1u, events.size());
+  ExpectEvent(*events[0], "pos", -1);
+}
+
+}  // namespace
+
+}  // namespace andjs
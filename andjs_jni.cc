@@ -18,12 +18,15 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
  * IN THE SOFTWARE.
  */
+#include <algorithm>
 #include <memory>
+#include "base/memory/memory_pressure_listener.h"
 #include "base/memory/weak_ptr.h"
 #include "base/android/jni_weak_ref.h"
 #include "base/android/jni_android.h"
 #include "base/android/jni_utils.h"
 #include "base/android/jni_string.h"
+#include "base/files/file_path.h"
 #include "base/strings/string_split.h"
 #include "base/strings/utf_string_conversions.h"
 #include "base/task/post_task.h"
@@ -38,13 +41,10 @@
 #include "chrome/app/android/chrome_jni_onload.h"
 #include "base/android/library_loader/library_loader_hooks.h"
 
-#ifdef _ENABLE_QUICKJS_
-#include "andjs/andjs_core_quickjs.h"
-#include "andjs/android/andjs_quickjs_jni_registration.h"
-#else
 #include "andjs/andjs_core.h"
+#include "andjs/andjs_logger.h"
+#include "andjs/andjs_tracing.h"
 #include "andjs/android/andjs_jni_registration.h"
-#endif
 
 #include "jni/AndJS_jni.h"
 
@@ -52,15 +52,57 @@ namespace andjs {
 
 using base::android::JavaParamRef;
 
+static AndJSCore::Options OptionsFromJava(JNIEnv* env,
+                                          const base::android::JavaParamRef<jobject>& joptions) {
+  AndJSCore::Options options;
+  options.engine = static_cast<ScriptEngine::Type>(Java_Options_getEngine(env, joptions));
+  options.script_size_hint = std::max(0, Java_Options_getScriptSizeHint(env, joptions));
+  options.run_budget = base::TimeDelta::FromMilliseconds(std::max<jlong>(0, Java_Options_getRunTimeoutMs(env, joptions)));
+  options.fresh_context_per_run = Java_Options_getFreshContextPerRun(env, joptions);
+  options.idle_timeout = base::TimeDelta::FromMilliseconds(std::max<jlong>(0, Java_Options_getIdleHibernateMs(env, joptions)));
+  options.event_queue_capacity = std::max(1, Java_Options_getEventQueueCapacity(env, joptions));
+  options.event_backpressure = static_cast<EventChannel::Backpressure>(Java_Options_getEventBackpressure(env, joptions));
+  options.expose_wasm = Java_Options_getExposeWasm(env, joptions);
+  base::android::ScopedJavaLocalRef<jstring> jwasm_cache_dir = Java_Options_getWasmCacheDir(env, joptions);
+  if(!jwasm_cache_dir.is_null())
+    options.wasm_cache_dir = base::FilePath(base::android::ConvertJavaStringToUTF8(env, jwasm_cache_dir));
+  options.quickjs_memory_limit = static_cast<size_t>(std::max<jlong>(0, Java_Options_getQuickJSMemoryLimit(env, joptions)));
+  options.streaming_min_script_size = std::max(0, Java_Options_getStreamingMinScriptSize(env, joptions));
+  return options;
+}
+
 static jlong JNI_AndJS_InitAndJS(JNIEnv* env,
-                                 const base::android::JavaParamRef<jobject>& jcaller) {
+                                 const base::android::JavaParamRef<jobject>& jcaller,
+                                 const base::android::JavaParamRef<jobject>& joptions) {
   AndJSCore* jscore = NULL;
-  jscore = new AndJSCore();
+  jscore = new AndJSCore(OptionsFromJava(env, joptions));
   LOG(INFO) << "BuildInfo.device " << base::android::BuildInfo::GetInstance()->device();
   jscore->Init();
   return reinterpret_cast<intptr_t>(jscore);
 }
 
+static void JNI_AndJS_StartTracing(JNIEnv* env,
+                                   const base::android::JavaParamRef<jstring>& jcategories) {
+  StartTracing(base::android::ConvertJavaStringToUTF8(env, jcategories));
+}
+
+static jboolean JNI_AndJS_StopTracing(JNIEnv* env,
+                                      const base::android::JavaParamRef<jstring>& jpath) {
+  return StopTracing(base::FilePath(base::android::ConvertJavaStringToUTF8(env, jpath)));
+}
+
+static void JNI_AndJS_SetLogLevel(JNIEnv* env,
+                                  jint level) {
+  AsyncLogger::GetInstance()->SetMinLevel(static_cast<LogLevel>(std::min(std::max(level, 0), static_cast<jint>(kLogError))));
+}
+
+static void JNI_AndJS_OnMemoryPressure(JNIEnv* env,
+                                       jboolean critical) {
+  base::MemoryPressureListener::NotifyMemoryPressure(critical ?
+    base::MemoryPressureListener::MEMORY_PRESSURE_LEVEL_CRITICAL :
+    base::MemoryPressureListener::MEMORY_PRESSURE_LEVEL_MODERATE);
+}
+
 } //namespace andjs
 
 static bool NativeInit(base::android::LibraryProcessType) {
@@ -0,0 +1,385 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_kv_store.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <memory>
+
+#include "base/android/path_utils.h"
+#include "base/bind.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/no_destructor.h"
+#include "base/strings/string_util.h"
+#include "base/sys_byteorder.h"
+#include "base/trace_event/trace_event.h"
+#include "third_party/zlib/zlib.h"
+
+#include "andjs/andjs_native_module.h"
+
+namespace andjs {
+
+namespace {
+
+// A log starts with kMagic, then records of a header, the key and the
+// value. The header is the CRC32 of everything after it, the key size and
+// the value size, all little endian. A removal has no value and
+// kRemovedSize as its size.
+const char kMagic[8] = { 'A', 'J', 'K', 'V', 'L', 'O', 'G', '1' };
+const size_t kHeaderSize = 12;
+const uint32_t kRemovedSize = 0xffffffff;
+// Smaller logs are never compacted.
+const uint64_t kCompactMinBytes = 1024 * 1024;
+
+uint32_t ReadUint32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return base::ByteSwapToLE32(value);
+}
+
+void AppendUint32(std::string* out, uint32_t value) {
+  value = base::ByteSwapToLE32(value);
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint32_t RecordCRC(const uint8_t* data, size_t size) {
+  return static_cast<uint32_t>(crc32(crc32(0L, Z_NULL, 0), data, static_cast<uInt>(size)));
+}
+
+bool IsValidName(const std::string& name) {
+  if(name.empty() || name.size() > 64 || name[0] == '.')
+    return false;
+  for(char c : name) {
+    if(!base::IsAsciiAlpha(c) && !base::IsAsciiDigit(c) && c != '_' && c != '-' && c != '.')
+      return false;
+  }
+  return true;
+}
+
+struct Registry {
+  base::Lock lock;
+  std::map<base::FilePath, KVStore*> stores;
+};
+
+Registry* GetRegistry() {
+  static base::NoDestructor<Registry> registry;
+  return registry.get();
+}
+
+const uint8_t* MapFile(const base::File& file, uint64_t size) {
+  void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, file.GetPlatformFile(), 0);
+  return map == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(map);
+}
+
+}  // namespace
+
+const size_t KVStore::kMaxKeySize = 4096;
+const size_t KVStore::kMaxValueSize = 16 * 1024 * 1024;
+const base::TimeDelta KVStore::kFlushDelay = base::TimeDelta::FromMilliseconds(10);
+
+// static
+KVStore* KVStore::Open(const std::string& name) {
+  if(!IsValidName(name))
+    return nullptr;
+  base::FilePath dir;
+  if(!base::android::GetDataDirectory(&dir))
+    return nullptr;
+  base::FilePath path = dir.AppendASCII("andjs_kv").AppendASCII(name + ".kvlog");
+
+  Registry* registry = GetRegistry();
+  base::AutoLock locker(registry->lock);
+  auto it = registry->stores.find(path);
+  if(it != registry->stores.end())
+    return it->second;
+  std::unique_ptr<KVStore> store(new KVStore(path));
+  if(!store->Load())
+    return nullptr;
+  return registry->stores[path] = store.release();
+}
+
+KVStore::KVStore(const base::FilePath& path)
+    : path_(path),
+      map_(nullptr),
+      file_size_(0),
+      live_bytes_(0),
+      flush_scheduled_(false) {
+}
+
+KVStore::~KVStore() {
+  base::AutoLock locker(lock_);
+  Unmap();
+}
+
+// Replays the log into the index. Whatever follows the last good record is
+// cut off, so the next write starts at a clean end.
+bool KVStore::Load() {
+  TRACE_EVENT1("andjs", "KVStore::Load", "path", path_.value());
+  base::AutoLock io_locker(io_lock_);
+  base::AutoLock locker(lock_);
+  if(!base::CreateDirectory(path_.DirName())) {
+    LOG(ERROR) << " KVStore cannot create " << path_.DirName().value();
+    return false;
+  }
+  file_.Initialize(path_, base::File::FLAG_OPEN_ALWAYS | base::File::FLAG_READ | base::File::FLAG_WRITE);
+  if(!file_.IsValid()) {
+    LOG(ERROR) << " KVStore cannot open " << path_.value() << " " << base::File::ErrorToString(file_.error_details());
+    return false;
+  }
+  int64_t length = file_.GetLength();
+  if(length < static_cast<int64_t>(sizeof(kMagic))) {
+    if(!file_.SetLength(0) || file_.Write(0, kMagic, sizeof(kMagic)) != static_cast<int>(sizeof(kMagic)))
+      return false;
+    length = sizeof(kMagic);
+  }
+  if(!Map(static_cast<uint64_t>(length)))
+    return false;
+  if(memcmp(map_, kMagic, sizeof(kMagic)) != 0) {
+    LOG(ERROR) << " KVStore " << path_.value() << " is not a store";
+    return false;
+  }
+
+  uint64_t pos = sizeof(kMagic);
+  while(pos + kHeaderSize <= file_size_) {
+    const uint8_t* header = map_ + pos;
+    uint32_t key_size = ReadUint32(header + 4);
+    uint32_t value_size = ReadUint32(header + 8);
+    uint64_t body_size = key_size + (value_size == kRemovedSize ? 0 : static_cast<uint64_t>(value_size));
+    if(key_size == 0 || key_size > kMaxKeySize || body_size - key_size > kMaxValueSize ||
+       pos + kHeaderSize + body_size > file_size_ ||
+       RecordCRC(header + 4, kHeaderSize - 4 + body_size) != ReadUint32(header))
+      break;
+    std::string key(reinterpret_cast<const char*>(header + kHeaderSize), key_size);
+    auto it = index_.find(key);
+    if(it != index_.end()) {
+      live_bytes_ -= kHeaderSize + key_size + it->second.size;
+      index_.erase(it);
+    }
+    if(value_size != kRemovedSize) {
+      index_[key] = { pos + kHeaderSize + key_size, value_size };
+      live_bytes_ += kHeaderSize + body_size;
+    }
+    pos += kHeaderSize + body_size;
+  }
+  if(pos < file_size_) {
+    LOG(WARNING) << " KVStore " << path_.value() << " drops " << (file_size_ - pos) << " bytes of torn records";
+    Unmap();
+    if(!file_.SetLength(pos) || !file_.Flush() || !Map(pos))
+      return false;
+  }
+  return true;
+}
+
+// The old mapping stays until the new one is in place, readers never see
+// none.
+bool KVStore::Map(uint64_t size) {
+  const uint8_t* map = MapFile(file_, size);
+  if(!map) {
+    PLOG(ERROR) << " KVStore cannot map " << path_.value();
+    return false;
+  }
+  Unmap();
+  map_ = map;
+  file_size_ = size;
+  return true;
+}
+
+void KVStore::Unmap() {
+  if(map_)
+    munmap(const_cast<uint8_t*>(map_), file_size_);
+  map_ = nullptr;
+}
+
+const uint8_t* KVStore::ValueData(const Entry& entry) const {
+  if(entry.offset >= file_size_)
+    return reinterpret_cast<const uint8_t*>(pending_.data()) + (entry.offset - file_size_);
+  return map_ + entry.offset;
+}
+
+bool KVStore::Get(const std::string& key, std::string* value) {
+  base::AutoLock locker(lock_);
+  auto it = index_.find(key);
+  if(it == index_.end())
+    return false;
+  value->assign(reinterpret_cast<const char*>(ValueData(it->second)), it->second.size);
+  return true;
+}
+
+bool KVStore::GetBytes(const std::string& key, std::vector<uint8_t>* value) {
+  base::AutoLock locker(lock_);
+  auto it = index_.find(key);
+  if(it == index_.end())
+    return false;
+  const uint8_t* data = ValueData(it->second);
+  value->assign(data, data + it->second.size);
+  return true;
+}
+
+bool KVStore::Has(const std::string& key) {
+  base::AutoLock locker(lock_);
+  return index_.count(key) != 0;
+}
+
+size_t KVStore::Count() {
+  base::AutoLock locker(lock_);
+  return index_.size();
+}
+
+bool KVStore::Put(const std::string& key, const uint8_t* data, size_t size) {
+  if(key.empty() || key.size() > kMaxKeySize || size > kMaxValueSize)
+    return false;
+  base::AutoLock locker(lock_);
+  Append(key, data, size, false);
+  return true;
+}
+
+bool KVStore::Remove(const std::string& key) {
+  base::AutoLock locker(lock_);
+  if(!index_.count(key))
+    return false;
+  Append(key, nullptr, 0, true);
+  return true;
+}
+
+void KVStore::Append(const std::string& key, const uint8_t* data, size_t size, bool removed) {
+  auto it = index_.find(key);
+  if(it != index_.end()) {
+    live_bytes_ -= kHeaderSize + key.size() + it->second.size;
+    index_.erase(it);
+  }
+
+  size_t start = pending_.size();
+  pending_.append(4, '\0');
+  AppendUint32(&pending_, static_cast<uint32_t>(key.size()));
+  AppendUint32(&pending_, removed ? kRemovedSize : static_cast<uint32_t>(size));
+  pending_.append(key);
+  if(size)
+    pending_.append(reinterpret_cast<const char*>(data), size);
+  const uint8_t* record = reinterpret_cast<const uint8_t*>(pending_.data()) + start;
+  uint32_t crc = base::ByteSwapToLE32(RecordCRC(record + 4, pending_.size() - start - 4));
+  memcpy(&pending_[start], &crc, sizeof(crc));
+
+  if(!removed) {
+    index_[key] = { file_size_ + start + kHeaderSize + key.size(), static_cast<uint32_t>(size) };
+    live_bytes_ += kHeaderSize + key.size() + size;
+  }
+  ScheduleFlushLocked();
+}
+
+void KVStore::ScheduleFlushLocked() {
+  if(flush_scheduled_)
+    return;
+  flush_scheduled_ = true;
+  GetNativeAsyncTaskRunner()->PostDelayedTask(FROM_HERE,
+    base::BindOnce(&KVStore::FlushTask, base::Unretained(this)), kFlushDelay);
+}
+
+// Appends |pending_| to the file and maps the new end. Readers wait for
+// the page cache copy only, the sync comes after. On errors |pending_|
+// stays and is written again at the same offset by a later flush.
+bool KVStore::WriteLocked() {
+  flush_scheduled_ = false;
+  if(pending_.empty())
+    return true;
+  TRACE_EVENT1("andjs", "KVStore::Write", "bytes", pending_.size());
+  if(file_.Write(file_size_, pending_.data(), pending_.size()) != static_cast<int>(pending_.size())) {
+    PLOG(ERROR) << " KVStore cannot write " << path_.value();
+    ScheduleFlushLocked();
+    return false;
+  }
+  if(!Map(file_size_ + pending_.size())) {
+    ScheduleFlushLocked();
+    return false;
+  }
+  pending_.clear();
+  return true;
+}
+
+bool KVStore::NeedsCompaction() const {
+  uint64_t log_size = file_size_ + pending_.size();
+  return log_size >= kCompactMinBytes && live_bytes_ * 2 < log_size;
+}
+
+bool KVStore::Flush() {
+  TRACE_EVENT0("andjs", "KVStore::Flush");
+  bool compact;
+  {
+    base::AutoLock io_locker(io_lock_);
+    {
+      base::AutoLock locker(lock_);
+      if(!WriteLocked())
+        return false;
+      compact = NeedsCompaction();
+    }
+    if(!file_.Flush())
+      return false;
+  }
+  return !compact || Compact();
+}
+
+void KVStore::FlushTask() {
+  Flush();
+}
+
+// The live records in a new file, synced before it replaces the log. A
+// crash on the way leaves the old log in place.
+bool KVStore::Compact() {
+  TRACE_EVENT1("andjs", "KVStore::Compact", "path", path_.value());
+  base::AutoLock io_locker(io_lock_);
+  base::AutoLock locker(lock_);
+  if(!WriteLocked())
+    return false;
+
+  base::FilePath temp_path = path_.AddExtension("compact");
+  base::File temp(temp_path, base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_READ | base::File::FLAG_WRITE);
+  if(!temp.IsValid())
+    return false;
+  std::string log(kMagic, sizeof(kMagic));
+  log.reserve(sizeof(kMagic) + live_bytes_);
+  std::unordered_map<std::string, Entry> index;
+  for(const auto& entry : index_) {
+    const uint8_t* record = map_ + entry.second.offset - entry.first.size() - kHeaderSize;
+    size_t record_size = kHeaderSize + entry.first.size() + entry.second.size;
+    index[entry.first] = { log.size() + kHeaderSize + entry.first.size(), entry.second.size };
+    log.append(reinterpret_cast<const char*>(record), record_size);
+  }
+  const uint8_t* map = nullptr;
+  if(temp.Write(0, log.data(), log.size()) != static_cast<int>(log.size()) || !temp.Flush() ||
+     !(map = MapFile(temp, log.size())) || !base::ReplaceFile(temp_path, path_, nullptr)) {
+    LOG(ERROR) << " KVStore cannot compact " << path_.value();
+    if(map)
+      munmap(const_cast<uint8_t*>(map), log.size());
+    base::DeleteFile(temp_path, false);
+    return false;
+  }
+
+  Unmap();
+  file_ = std::move(temp);
+  map_ = map;
+  file_size_ = log.size();
+  index_.swap(index);
+  live_bytes_ = log.size() - sizeof(kMagic);
+  return true;
+}
+
+}
@@ -0,0 +1,122 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_KV_STORE_H__
+#define __ANDJS_KV_STORE_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+#include "base/time/time.h"
+
+namespace andjs {
+
+// A persistent key value store for script state: an append-only log file,
+// memory mapped for reads, and an in-memory hash index from each key to
+// where its value sits in the log.
+//
+// Puts land in the index and a pending batch right away. A task of the
+// NativeAsync thread writes the batch kFlushDelay later with one write()
+// and syncs it, Flush() does both before it returns. Every record carries a
+// CRC32, a torn or corrupt tail left by a crash is cut off when the store
+// is opened. Once dead records make up most of the log, it is rewritten
+// with the live ones and renamed over the old file.
+//
+// One object per store and process, shared by every engine and worker
+// that opens it, open until the process exits. Any thread.
+class KVStore {
+  public:
+    static const size_t kMaxKeySize;
+    static const size_t kMaxValueSize;
+    static const base::TimeDelta kFlushDelay;
+
+    // The store |name| under andjs_kv in the app data directory. Names are
+    // letters, digits, '_', '-' and '.', not leading. Null if the name is
+    // invalid or the file cannot be opened.
+    static KVStore* Open(const std::string& name);
+
+    ~KVStore();
+
+    bool Get(const std::string& key, std::string* value);
+    bool GetBytes(const std::string& key, std::vector<uint8_t>* value);
+    bool Has(const std::string& key);
+    // False when the key or value is too large.
+    bool Put(const std::string& key, const uint8_t* data, size_t size);
+    // False when there was nothing to remove.
+    bool Remove(const std::string& key);
+    size_t Count();
+
+    // Writes the pending batch and syncs the file. False on I/O errors.
+    bool Flush();
+    // Rewrites the log with only the live records.
+    bool Compact();
+
+  private:
+    // Where the value of a key is in the log, the file followed by
+    // |pending_|.
+    struct Entry {
+      uint64_t offset;
+      uint32_t size;
+    };
+
+    explicit KVStore(const base::FilePath& path);
+
+    bool Load();
+    const uint8_t* ValueData(const Entry& entry) const EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    void Append(const std::string& key, const uint8_t* data, size_t size, bool removed)
+        EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    void ScheduleFlushLocked() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    bool WriteLocked() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    bool Map(uint64_t size) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    void Unmap() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    bool NeedsCompaction() const EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    void FlushTask();
+
+    const base::FilePath path_;
+    // Orders the writes, syncs and compactions of the NativeAsync thread
+    // and of Flush() and Compact() callers. Taken before |lock_|.
+    base::Lock io_lock_;
+    base::File file_;
+
+    base::Lock lock_;
+    std::unordered_map<std::string, Entry> index_ GUARDED_BY(lock_);
+    // The first |file_size_| bytes of the log, mapped.
+    const uint8_t* map_ GUARDED_BY(lock_);
+    uint64_t file_size_ GUARDED_BY(lock_);
+    // Records not written yet.
+    std::string pending_ GUARDED_BY(lock_);
+    // Bytes of the records |index_| points into, the rest of the log is
+    // dead.
+    uint64_t live_bytes_ GUARDED_BY(lock_);
+    bool flush_scheduled_ GUARDED_BY(lock_);
+
+    DISALLOW_COPY_AND_ASSIGN(KVStore);
+};
+
+}
+#endif
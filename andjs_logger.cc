@@ -0,0 +1,122 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_logger.h"
+
+#include <android/log.h>
+
+#include "base/bind.h"
+#include "base/threading/thread.h"
+
+namespace andjs {
+
+namespace {
+
+const char kLogTag[] = "andjs";
+const size_t kBufferCapacity = 4096;
+// logd truncates entries at about 4KB, stay below when joining lines.
+const size_t kMaxBatchBytes = 3 * 1024;
+const int kDrainDelayMs = 10;
+
+int ToAndroidPriority(LogLevel level) {
+  switch(level) {
+    case kLogVerbose: return ANDROID_LOG_VERBOSE;
+    case kLogDebug: return ANDROID_LOG_DEBUG;
+    case kLogInfo: return ANDROID_LOG_INFO;
+    case kLogWarning: return ANDROID_LOG_WARN;
+    case kLogError: return ANDROID_LOG_ERROR;
+  }
+  return ANDROID_LOG_INFO;
+}
+
+}  // namespace
+
+// static
+AsyncLogger* AsyncLogger::GetInstance() {
+  static base::NoDestructor<AsyncLogger> instance;
+  return instance.get();
+}
+
+AsyncLogger::AsyncLogger()
+    : buffer_(kBufferCapacity),
+      min_level_(kLogInfo),
+      dropped_(0),
+      drain_scheduled_(false),
+      reported_dropped_(0),
+      thread_(new base::Thread("AndJSLogger")) {
+  thread_->Start();
+  task_runner_ = thread_->task_runner();
+}
+
+AsyncLogger::~AsyncLogger() = default;
+
+void AsyncLogger::SetMinLevel(LogLevel level) {
+  min_level_.store(level, std::memory_order_relaxed);
+}
+
+void AsyncLogger::Log(LogLevel level, std::string message) {
+  if(!IsEnabled(level))
+    return;
+  if(!buffer_.TryPush(Entry{level, std::move(message)})) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ScheduleDrain();
+}
+
+// Only the first message of a batch posts a task, the rest ride along.
+void AsyncLogger::ScheduleDrain() {
+  if(drain_scheduled_.exchange(true, std::memory_order_acq_rel))
+    return;
+  task_runner_->PostDelayedTask(FROM_HERE,
+    base::BindOnce(&AsyncLogger::Drain, base::Unretained(this)),
+    base::TimeDelta::FromMilliseconds(kDrainDelayMs));
+}
+
+void AsyncLogger::Drain() {
+  // Reset first, a message pushed while draining schedules the next batch.
+  drain_scheduled_.store(false, std::memory_order_release);
+
+  Entry entry;
+  std::string batch;
+  LogLevel batch_level = kLogInfo;
+  while(buffer_.TryPop(&entry)) {
+    if(!batch.empty() && (entry.level != batch_level ||
+                          batch.size() + entry.message.size() > kMaxBatchBytes)) {
+      __android_log_write(ToAndroidPriority(batch_level), kLogTag, batch.c_str());
+      batch.clear();
+    }
+    if(!batch.empty())
+      batch.push_back('\n');
+    batch_level = entry.level;
+    batch.append(entry.message);
+  }
+  if(!batch.empty())
+    __android_log_write(ToAndroidPriority(batch_level), kLogTag, batch.c_str());
+
+  int64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if(dropped != reported_dropped_) {
+    std::string msg = "AsyncLogger dropped " + std::to_string(dropped - reported_dropped_) + " messages";
+    __android_log_write(ANDROID_LOG_WARN, kLogTag, msg.c_str());
+    reported_dropped_ = dropped;
+  }
+}
+
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_LOGGER_H__
+#define __ANDJS_LOGGER_H__
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/no_destructor.h"
+
+#include "andjs/mpsc_ring_buffer.h"
+
+// Internal logs below this level are compiled out, see andjs_min_log_level
+// in BUILD.gn. 0 verbose, 1 debug, 2 info, 3 warning, 4 error.
+#ifndef ANDJS_MIN_LOG_LEVEL
+#define ANDJS_MIN_LOG_LEVEL 2
+#endif
+
+namespace base {
+class SingleThreadTaskRunner;
+class Thread;
+}
+
+namespace andjs {
+
+// Keep in sync with AndJS.LOG_* on the java side.
+enum LogLevel {
+  kLogVerbose = 0,
+  kLogDebug = 1,
+  kLogInfo = 2,
+  kLogWarning = 3,
+  kLogError = 4,
+};
+
+// Process wide logger behind adb.info/adb.error and ANDJS_LOG. Producers
+// never block: messages go into a lock-free ring buffer drained in batches
+// by the AndJSLogger thread, and a full ring drops the message and counts it.
+class AsyncLogger {
+  public:
+    static AsyncLogger* GetInstance();
+
+    // Check before formatting anything, filtered messages cost one load.
+    bool IsEnabled(LogLevel level) const {
+      return level >= min_level_.load(std::memory_order_relaxed);
+    }
+    void SetMinLevel(LogLevel level);
+
+    void Log(LogLevel level, std::string message);
+
+    int64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    struct Entry {
+      LogLevel level;
+      std::string message;
+    };
+
+    friend class base::NoDestructor<AsyncLogger>;
+    AsyncLogger();
+    ~AsyncLogger();
+
+    void ScheduleDrain();
+    void Drain();
+
+    MPSCRingBuffer<Entry> buffer_;
+    std::atomic<int> min_level_;
+    std::atomic<int64_t> dropped_;
+    std::atomic<bool> drain_scheduled_;
+    int64_t reported_dropped_;
+    std::unique_ptr<base::Thread> thread_;
+    scoped_refptr<base::SingleThreadTaskRunner> task_runner_;
+
+    DISALLOW_COPY_AND_ASSIGN(AsyncLogger);
+};
+
+// Collects one ANDJS_LOG statement and hands it to the AsyncLogger.
+class LogMessage {
+  public:
+    LogMessage(LogLevel level) : level_(level) {}
+    ~LogMessage() { AsyncLogger::GetInstance()->Log(level_, stream_.str()); }
+
+    std::ostream& stream() { return stream_; }
+
+  private:
+    LogLevel level_;
+    std::ostringstream stream_;
+
+    DISALLOW_COPY_AND_ASSIGN(LogMessage);
+};
+
+}
+
+#define ANDJS_LOG_IS_ON(level)                           \
+  (::andjs::kLog##level >= ANDJS_MIN_LOG_LEVEL &&        \
+   ::andjs::AsyncLogger::GetInstance()->IsEnabled(::andjs::kLog##level))
+
+// ANDJS_LOG(Debug) << ...; the stream is not evaluated when filtered.
+#define ANDJS_LOG(level) \
+  LAZY_STREAM(::andjs::LogMessage(::andjs::kLog##level).stream(), ANDJS_LOG_IS_ON(level))
+
+#endif
@@ -0,0 +1,191 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_module_bundle.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "base/files/file_util.h"
+#include "base/no_destructor.h"
+#include "base/strings/string_split.h"
+#include "base/strings/string_util.h"
+#include "base/trace_event/trace_event.h"
+
+namespace andjs {
+
+namespace {
+
+struct OpenBundle {
+  scoped_refptr<ModuleBundle> bundle;
+  base::Time last_modified;
+  int64_t size;
+};
+
+// Bundles stay mapped for the life of the process, an app ships a handful.
+base::Lock& RegistryLock() {
+  static base::NoDestructor<base::Lock> lock;
+  return *lock;
+}
+
+std::map<base::FilePath, OpenBundle>& Registry() {
+  static base::NoDestructor<std::map<base::FilePath, OpenBundle>> registry;
+  return *registry;
+}
+
+}  // namespace
+
+// static
+scoped_refptr<ModuleBundle> ModuleBundle::Open(const base::FilePath& path) {
+  base::File::Info info;
+  if(!base::GetFileInfo(path, &info)) {
+    LOG(ERROR) << " ModuleBundle unable to stat " << path.value();
+    return nullptr;
+  }
+
+  base::AutoLock locker(RegistryLock());
+  auto it = Registry().find(path);
+  if(it != Registry().end() && it->second.last_modified == info.last_modified &&
+     it->second.size == info.size)
+    return it->second.bundle;
+
+  TRACE_EVENT1("andjs", "ModuleBundle::Open", "path", path.value());
+  scoped_refptr<ModuleBundle> bundle(new ModuleBundle(path));
+  if(!bundle->Initialize()) {
+    LOG(ERROR) << " ModuleBundle " << path.value() << " is not a valid bundle";
+    return nullptr;
+  }
+  Registry()[path] = OpenBundle{bundle, info.last_modified, info.size};
+  return bundle;
+}
+
+// static
+uint64_t ModuleBundle::HashName(base::StringPiece name) {
+  uint64_t hash = 14695981039346656037ULL;
+  for(char c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// static
+std::string ModuleBundle::ResolveSpecifier(base::StringPiece referrer,
+                                           base::StringPiece specifier) {
+  if(!specifier.starts_with("./") && !specifier.starts_with("../"))
+    return specifier.as_string();
+
+  std::vector<base::StringPiece> parts;
+  size_t slash = referrer.rfind('/');
+  if(slash != base::StringPiece::npos) {
+    parts = base::SplitStringPiece(referrer.substr(0, slash), "/",
+                                   base::KEEP_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  }
+  for(base::StringPiece part : base::SplitStringPiece(specifier, "/", base::KEEP_WHITESPACE,
+                                                      base::SPLIT_WANT_NONEMPTY)) {
+    if(part == ".")
+      continue;
+    if(part == "..") {
+      if(!parts.empty())
+        parts.pop_back();
+      continue;
+    }
+    parts.push_back(part);
+  }
+  return base::JoinString(parts, "/");
+}
+
+ModuleBundle::ModuleBundle(const base::FilePath& path)
+    : path_(path),
+      entries_(nullptr),
+      module_count_(0) {
+}
+
+ModuleBundle::~ModuleBundle() = default;
+
+base::StringPiece ModuleBundle::Slice(uint32_t offset, uint32_t length) const {
+  return base::StringPiece(reinterpret_cast<const char*>(file_.data()) + offset, length);
+}
+
+bool ModuleBundle::Initialize() {
+  if(!file_.Initialize(path_))
+    return false;
+
+  const size_t file_length = file_.length();
+  if(file_length < sizeof(BundleHeader))
+    return false;
+  BundleHeader header;
+  memcpy(&header, file_.data(), sizeof(header));
+  if(header.magic != kMagic || header.version != kVersion)
+    return false;
+  if(header.module_count > (file_length - sizeof(BundleHeader)) / sizeof(BundleEntry))
+    return false;
+
+  entries_ = reinterpret_cast<const BundleEntry*>(file_.data() + sizeof(BundleHeader));
+  module_count_ = header.module_count;
+
+  // Validate once so Find() can hand out slices without checks.
+  auto in_bounds = [file_length](uint32_t offset, uint32_t length) {
+    return offset <= file_length && length <= file_length - offset;
+  };
+  for(size_t i = 0; i < module_count_; i++) {
+    const BundleEntry& entry = entries_[i];
+    if(!in_bounds(entry.name_offset, entry.name_length) ||
+       !in_bounds(entry.source_offset, entry.source_length) ||
+       !in_bounds(entry.bytecode_offset, entry.bytecode_length))
+      return false;
+    if(i > 0 && entries_[i - 1].name_hash > entry.name_hash)
+      return false;
+  }
+  return true;
+}
+
+bool ModuleBundle::Find(base::StringPiece name, Module* module) const {
+  uint64_t hash = HashName(name);
+  const BundleEntry* end = entries_ + module_count_;
+  const BundleEntry* it = std::lower_bound(entries_, end, hash,
+    [](const BundleEntry& entry, uint64_t hash) { return entry.name_hash < hash; });
+  for(; it != end && it->name_hash == hash; ++it) {
+    base::StringPiece entry_name = Slice(it->name_offset, it->name_length);
+    if(entry_name != name)
+      continue;
+    module->index = it - entries_;
+    module->name = entry_name;
+    module->source = Slice(it->source_offset, it->source_length);
+    module->bytecode = Slice(it->bytecode_offset, it->bytecode_length);
+    return true;
+  }
+  return false;
+}
+
+scoped_refptr<base::RefCountedBytes> ModuleBundle::GetCompiledCode(ScriptEngine::Type engine, size_t index) {
+  base::AutoLock locker(lock_);
+  auto it = compiled_code_.find(CodeKey(engine, index));
+  return it == compiled_code_.end() ? nullptr : it->second;
+}
+
+void ModuleBundle::SetCompiledCode(ScriptEngine::Type engine, size_t index,
+                                   scoped_refptr<base::RefCountedBytes> code) {
+  base::AutoLock locker(lock_);
+  compiled_code_[CodeKey(engine, index)] = std::move(code);
+}
+
+}
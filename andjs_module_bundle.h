@@ -0,0 +1,126 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_MODULE_BUNDLE_H__
+#define __ANDJS_MODULE_BUNDLE_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "base/files/file_path.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/memory/ref_counted_memory.h"
+#include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+
+#include "andjs/script_engine.h"
+
+namespace andjs {
+
+// Read-only archive of ES modules, mmapped once per process and shared by
+// every instance that runs from it. tools/make_bundle.py writes the format:
+//
+//   BundleHeader
+//   BundleEntry[module_count], sorted by name_hash
+//   names, sources and optional QuickJS bytecode, referenced by offset
+//
+// All integers are little endian, offsets are from the start of the file.
+// Engines keep their compiled form of a module (QuickJS bytecode, V8 code
+// cache) in the bundle, so only the first instance parses the source.
+class ModuleBundle : public base::RefCountedThreadSafe<ModuleBundle> {
+  public:
+    static const uint32_t kMagic = 0x42534a41;  // "AJSB"
+    static const uint32_t kVersion = 1;
+
+    struct BundleHeader {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t module_count;
+      uint32_t reserved;
+    };
+
+    struct BundleEntry {
+      uint64_t name_hash;
+      uint32_t name_offset;
+      uint32_t name_length;
+      uint32_t source_offset;
+      uint32_t source_length;
+      uint32_t bytecode_offset;
+      uint32_t bytecode_length;
+    };
+
+    struct Module {
+      size_t index;
+      base::StringPiece name;
+      base::StringPiece source;
+      base::StringPiece bytecode;
+    };
+
+    // Returns the process wide mapping of |path|, reopened when the file
+    // changed on disk, or null if it is missing or malformed.
+    static scoped_refptr<ModuleBundle> Open(const base::FilePath& path);
+
+    // 64 bit FNV-1a, the key of the index.
+    static uint64_t HashName(base::StringPiece name);
+
+    // Resolves |specifier| imported by the module |referrer|. "./" and "../"
+    // are relative to the referrer, anything else names a bundle entry.
+    static std::string ResolveSpecifier(base::StringPiece referrer,
+                                        base::StringPiece specifier);
+
+    bool Find(base::StringPiece name, Module* module) const;
+
+    const base::FilePath& path() const { return path_; }
+    size_t length() const { return file_.length(); }
+
+    // Compiled form of module |index| for |engine|, shared across instances.
+    scoped_refptr<base::RefCountedBytes> GetCompiledCode(ScriptEngine::Type engine, size_t index);
+    void SetCompiledCode(ScriptEngine::Type engine, size_t index,
+                         scoped_refptr<base::RefCountedBytes> code);
+
+  private:
+    friend class base::RefCountedThreadSafe<ModuleBundle>;
+
+    explicit ModuleBundle(const base::FilePath& path);
+    ~ModuleBundle();
+
+    bool Initialize();
+    base::StringPiece Slice(uint32_t offset, uint32_t length) const;
+
+    base::FilePath path_;
+    base::MemoryMappedFile file_;
+    const BundleEntry* entries_;
+    size_t module_count_;
+
+    typedef std::pair<ScriptEngine::Type, size_t> CodeKey;
+    std::map<CodeKey, scoped_refptr<base::RefCountedBytes>> compiled_code_ GUARDED_BY(lock_);
+    base::Lock lock_;
+
+    DISALLOW_COPY_AND_ASSIGN(ModuleBundle);
+};
+
+}
+#endif
@@ -0,0 +1,171 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_NATIVE_MODULE_H__
+#define __ANDJS_NATIVE_MODULE_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/memory/ref_counted.h"
+#include "base/single_thread_task_runner.h"
+
+namespace andjs {
+
+// Native objects such as adb and JSCrypto are plain C++ classes that list
+// their script visible methods once:
+//
+//   class Foo {
+//     public:
+//       static const char kClassName[];
+//       std::string Greet(const std::string& name);
+//       static auto Methods() {
+//         return std::make_tuple(ANDJS_NATIVE_METHOD("greet", &Foo::Greet));
+//       }
+//   };
+//
+// GinNativeObject<Foo> (andjs_native_module_v8.h) and QuickJSNativeClass<Foo>
+// (andjs_native_module_quickjs.h) turn that list into an ObjectTemplate and a
+// JSCFunctionListEntry table. Every method gets its own thunk, the argument
+// and return conversions are picked from its signature at compile time.
+//
+// Parameters are bool, int32_t, double, std::string, NativeBytes or a
+// trailing NativeRestArgs, returns bool, int32_t, double, std::string,
+// NativeBuffer or void or base::Optional<> of them, an empty optional is
+// undefined. A std::unique_ptr of another native class is returned as a new
+// object of that class, undefined when null, and NativeAsync<> of the
+// above as a Promise. A class that can be created from script
+// declares `using ConstructorArgs = std::tuple<...>;` with the parameters of
+// the constructor it wants called.
+
+// The remaining arguments of a variadic method. Nothing is converted before
+// the method asks, so adb.info() costs nothing while its level is filtered.
+class NativeRestArgs {
+  public:
+    virtual size_t size() const = 0;
+    // Appends the ToString() of argument |index|.
+    virtual bool AppendString(size_t index, std::string* output) const = 0;
+
+  protected:
+    virtual ~NativeRestArgs() = default;
+};
+
+// The memory of an ArrayBuffer, typed array or DataView argument, read in
+// place, or the UTF-8 of a string argument. Only valid during the call.
+struct NativeBytes {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Bytes returned to script as a new Uint8Array.
+struct NativeBuffer {
+  std::vector<uint8_t> bytes;
+};
+
+// A Promise settled after the method returns. |work| runs on the thread of
+// GetNativeAsyncTaskRunner() and must own everything it reads, NativeBytes
+// included. The promise is resolved with its result by a task of the engine
+// thread, unless the context is gone by then. Without |work| the promise is
+// resolved with |value| right away.
+template <typename R>
+struct NativeAsync {
+  base::OnceCallback<R()> work;
+  R value{};
+};
+
+// The one thread NativeAsync work of all engines runs on, started on first
+// use.
+scoped_refptr<base::SingleThreadTaskRunner> GetNativeAsyncTaskRunner();
+
+template <typename F>
+struct NativeMethodTraits;
+
+template <typename C, typename R, typename... A>
+struct NativeMethodTraits<R (C::*)(A...)> {
+  using Class = C;
+  using Return = R;
+  using Args = std::tuple<typename std::decay<A>::type...>;
+};
+
+template <typename C, typename R, typename... A>
+struct NativeMethodTraits<R (C::*)(A...) const> : NativeMethodTraits<R (C::*)(A...)> {};
+
+// Number of parameters before a trailing NativeRestArgs.
+template <typename... A>
+struct NativeArity;
+
+template <>
+struct NativeArity<> {
+  static constexpr int value = 0;
+};
+
+template <typename A, typename... Rest>
+struct NativeArity<A, Rest...> {
+  static constexpr int value =
+      std::is_same<A, NativeRestArgs>::value ? 0 : 1 + NativeArity<Rest...>::value;
+};
+
+template <typename Tuple>
+struct NativeTupleArity;
+
+template <typename... A>
+struct NativeTupleArity<std::tuple<A...>> : NativeArity<A...> {};
+
+// One entry of Methods(), see ANDJS_NATIVE_METHOD.
+template <typename F, F f>
+struct NativeMethod {
+  using Function = F;
+  using Traits = NativeMethodTraits<F>;
+  static constexpr F kFunction = f;
+  // The length property, a trailing NativeRestArgs is not counted.
+  static constexpr int kLength = NativeTupleArity<typename Traits::Args>::value;
+
+  const char* name;
+};
+
+template <typename F, F f>
+constexpr F NativeMethod<F, f>::kFunction;
+
+template <typename F, F f>
+constexpr int NativeMethod<F, f>::kLength;
+
+#define ANDJS_NATIVE_METHOD(name, method) \
+  ::andjs::NativeMethod<decltype(method), method>{name}
+
+// Calls |fn| with every element of |tuple| in order.
+template <typename Tuple, typename Fn, size_t... I>
+void ForEachNativeMethod(const Tuple& tuple, Fn&& fn, std::index_sequence<I...>) {
+  int unused[] = {0, (fn(std::get<I>(tuple)), 0)...};
+  (void)unused;
+}
+
+template <typename... M, typename Fn>
+void ForEachNativeMethod(const std::tuple<M...>& tuple, Fn&& fn) {
+  ForEachNativeMethod(tuple, std::forward<Fn>(fn), std::index_sequence_for<M...>());
+}
+
+}  // namespace andjs
+#endif
@@ -0,0 +1,535 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_NATIVE_MODULE_QUICKJS_H__
+#define __ANDJS_NATIVE_MODULE_QUICKJS_H__
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/macros.h"
+#include "base/memory/weak_ptr.h"
+#include "base/no_destructor.h"
+#include "base/optional.h"
+#include "base/synchronization/lock.h"
+#include "base/task_runner_util.h"
+
+#include "andjs/andjs_native_module.h"
+
+extern "C" {
+#include "quickjs.h"
+}
+
+namespace andjs {
+
+template <typename T>
+class QuickJSNativeClass;
+
+// JS_NewClassID() under the process wide lock of all class ids, runtimes
+// on different threads register their classes at the same time.
+void NewQuickJSClassID(JSClassID* class_id);
+
+namespace internal {
+
+// Mirrors the gin::Converter rules, see GetQuickJSArgs().
+template <typename A>
+class QuickJSArg;
+
+template <>
+class QuickJSArg<bool> {
+  public:
+    bool Get(JSContext* ctx, int argc, JSValueConst* argv, int index) {
+      int value = index < argc ? JS_ToBool(ctx, argv[index]) : -1;
+      value_ = value > 0;
+      return value >= 0;
+    }
+    bool value() const { return value_; }
+
+  private:
+    bool value_ = false;
+};
+
+template <>
+class QuickJSArg<int32_t> {
+  public:
+    bool Get(JSContext* ctx, int argc, JSValueConst* argv, int index) {
+      return index < argc && JS_IsNumber(argv[index]) && !JS_ToInt32(ctx, &value_, argv[index]);
+    }
+    int32_t value() const { return value_; }
+
+  private:
+    int32_t value_ = 0;
+};
+
+template <>
+class QuickJSArg<double> {
+  public:
+    bool Get(JSContext* ctx, int argc, JSValueConst* argv, int index) {
+      return index < argc && JS_IsNumber(argv[index]) && !JS_ToFloat64(ctx, &value_, argv[index]);
+    }
+    double value() const { return value_; }
+
+  private:
+    double value_ = 0;
+};
+
+template <>
+class QuickJSArg<std::string> {
+  public:
+    bool Get(JSContext* ctx, int argc, JSValueConst* argv, int index) {
+      if(index >= argc || !JS_IsString(argv[index]))
+        return false;
+      size_t len;
+      const char* str = JS_ToCStringLen(ctx, &len, argv[index]);
+      if(!str)
+        return false;
+      value_.assign(str, len);
+      JS_FreeCString(ctx, str);
+      return true;
+    }
+    const std::string& value() const { return value_; }
+
+  private:
+    std::string value_;
+};
+
+template <>
+class QuickJSArg<NativeRestArgs> : public NativeRestArgs {
+  public:
+    bool Get(JSContext* ctx, int argc, JSValueConst* argv, int index) {
+      ctx_ = ctx;
+      argv_ = argv + index;
+      argc_ = index < argc ? argc - index : 0;
+      return true;
+    }
+    const NativeRestArgs& value() const { return *this; }
+
+    size_t size() const override { return argc_; }
+
+    bool AppendString(size_t index, std::string* output) const override {
+      size_t len;
+      const char* str = JS_ToCStringLen(ctx_, &len, argv_[index]);
+      if(!str) {
+        JS_FreeValue(ctx_, JS_GetException(ctx_));
+        return false;
+      }
+      output->append(str, len);
+      JS_FreeCString(ctx_, str);
+      return true;
+    }
+
+  private:
+    JSContext* ctx_ = nullptr;
+    JSValueConst* argv_ = nullptr;
+    size_t argc_ = 0;
+};
+
+// An ArrayBuffer, or the buffer a typed array or DataView looks at, or the
+// UTF-8 of a string.
+template <>
+class QuickJSArg<NativeBytes> {
+  public:
+    bool Get(JSContext* ctx, int argc, JSValueConst* argv, int index) {
+      if(index < argc && JS_IsString(argv[index])) {
+        size_t len;
+        const char* str = JS_ToCStringLen(ctx, &len, argv[index]);
+        if(!str)
+          return false;
+        utf8_.assign(str, len);
+        JS_FreeCString(ctx, str);
+        value_.data = reinterpret_cast<const uint8_t*>(utf8_.data());
+        value_.size = utf8_.size();
+        return true;
+      }
+      if(index >= argc || !JS_IsObject(argv[index]))
+        return false;
+      size_t size;
+      uint8_t* data = JS_GetArrayBuffer(ctx, &size, argv[index]);
+      if(data) {
+        value_.data = data;
+        value_.size = size;
+        return true;
+      }
+      JS_FreeValue(ctx, JS_GetException(ctx));
+
+      JSValue buffer = JS_GetPropertyStr(ctx, argv[index], "buffer");
+      JSValue offset_val = JS_GetPropertyStr(ctx, argv[index], "byteOffset");
+      JSValue length_val = JS_GetPropertyStr(ctx, argv[index], "byteLength");
+      uint32_t offset = 0;
+      uint32_t length = 0;
+      if(JS_IsObject(buffer) && !JS_ToUint32(ctx, &offset, offset_val) && !JS_ToUint32(ctx, &length, length_val))
+        data = JS_GetArrayBuffer(ctx, &size, buffer);
+      JS_FreeValue(ctx, buffer);
+      JS_FreeValue(ctx, offset_val);
+      JS_FreeValue(ctx, length_val);
+      if(!data || static_cast<size_t>(offset) + length > size) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return false;
+      }
+      // The view keeps its buffer alive for the call.
+      value_.data = data + offset;
+      value_.size = length;
+      return true;
+    }
+    const NativeBytes& value() const { return value_; }
+
+  private:
+    NativeBytes value_;
+    std::string utf8_;
+};
+
+// Converts all parameters or throws the same TypeError as gin.
+template <typename... H, size_t... I>
+bool GetQuickJSArgs(JSContext* ctx, int argc, JSValueConst* argv,
+                    std::tuple<H...>* values, std::index_sequence<I...>) {
+  int failed = -1;
+  int unused[] = {0, (failed < 0 && !std::get<I>(*values).Get(ctx, argc, argv, I)
+                      ? failed = static_cast<int>(I) : 0)...};
+  (void)unused;
+  if(failed < 0)
+    return true;
+  if(failed >= argc)
+    JS_ThrowTypeError(ctx, "Insufficient number of arguments.");
+  else
+    JS_ThrowTypeError(ctx, "Error processing argument at index %d", failed);
+  return false;
+}
+
+inline JSValue ToQuickJS(JSContext* ctx, bool value) {
+  return JS_NewBool(ctx, value);
+}
+
+inline JSValue ToQuickJS(JSContext* ctx, int32_t value) {
+  return JS_NewInt32(ctx, value);
+}
+
+inline JSValue ToQuickJS(JSContext* ctx, double value) {
+  return JS_NewFloat64(ctx, value);
+}
+
+inline JSValue ToQuickJS(JSContext* ctx, const std::string& value) {
+  return JS_NewStringLen(ctx, value.data(), value.size());
+}
+
+inline JSValue ToQuickJS(JSContext* ctx, const NativeBuffer& value) {
+  JSValue buffer = JS_NewArrayBufferCopy(ctx, value.bytes.data(), value.bytes.size());
+  if(JS_IsException(buffer))
+    return buffer;
+  JSValue global = JS_GetGlobalObject(ctx);
+  JSValue uint8_array = JS_GetPropertyStr(ctx, global, "Uint8Array");
+  JSValue view = JS_CallConstructor(ctx, uint8_array, 1, &buffer);
+  JS_FreeValue(ctx, uint8_array);
+  JS_FreeValue(ctx, global);
+  JS_FreeValue(ctx, buffer);
+  return view;
+}
+
+template <typename R>
+JSValue ToQuickJS(JSContext* ctx, const base::Optional<R>& value) {
+  return value ? ToQuickJS(ctx, *value) : JS_UNDEFINED;
+}
+
+template <typename T>
+JSValue ToQuickJS(JSContext* ctx, std::unique_ptr<T> value) {
+  return value ? QuickJSNativeClass<T>::Wrap(ctx, std::move(value)) : JS_UNDEFINED;
+}
+
+}  // namespace internal
+
+// The pending promises of the NativeAsync methods called in one JSContext,
+// like GinNativeAsync on V8. The engine creates it with the context and
+// destroys it before JS_FreeContext(). Its callback runs a step with the
+// context current and the pending jobs after it.
+class QuickJSNativeAsync {
+  public:
+    typedef base::RepeatingCallback<void(base::OnceClosure)> EnterCallback;
+
+    QuickJSNativeAsync(JSContext* ctx, EnterCallback enter)
+        : ctx_(ctx), enter_(std::move(enter)), next_id_(0), weak_factory_(this) {
+      Registry* registry = GetRegistry();
+      base::AutoLock locker(registry->lock);
+      registry->contexts[ctx_] = this;
+    }
+
+    ~QuickJSNativeAsync() {
+      {
+        Registry* registry = GetRegistry();
+        base::AutoLock locker(registry->lock);
+        registry->contexts.erase(ctx_);
+      }
+      for(auto& it : pending_) {
+        JS_FreeValue(ctx_, it.second.resolve);
+        JS_FreeValue(ctx_, it.second.reject);
+      }
+    }
+
+    static QuickJSNativeAsync* From(JSContext* ctx) {
+      Registry* registry = GetRegistry();
+      base::AutoLock locker(registry->lock);
+      auto it = registry->contexts.find(ctx);
+      return it == registry->contexts.end() ? nullptr : it->second;
+    }
+
+    template <typename R>
+    JSValue Start(NativeAsync<R> async) {
+      JSValue functions[2];
+      JSValue promise = JS_NewPromiseCapability(ctx_, functions);
+      if(JS_IsException(promise))
+        return promise;
+      PendingPromise pending = { functions[0], functions[1] };
+      if(!async.work) {
+        Settle(pending, internal::ToQuickJS(ctx_, async.value));
+        return promise;
+      }
+      int id = next_id_++;
+      pending_[id] = pending;
+      base::PostTaskAndReplyWithResult(GetNativeAsyncTaskRunner().get(), FROM_HERE, std::move(async.work),
+                                       base::BindOnce(&QuickJSNativeAsync::OnDone<R>, weak_factory_.GetWeakPtr(), id));
+      return promise;
+    }
+
+  private:
+    struct PendingPromise {
+      JSValue resolve;
+      JSValue reject;
+    };
+
+    struct Registry {
+      base::Lock lock;
+      std::map<JSContext*, QuickJSNativeAsync*> contexts;
+    };
+
+    // Contexts of all runtimes, each engine looks up its own on its thread.
+    static Registry* GetRegistry() {
+      static base::NoDestructor<Registry> registry;
+      return registry.get();
+    }
+
+    // Engine thread, the work is done.
+    template <typename R>
+    void OnDone(int id, R result) {
+      enter_.Run(base::BindOnce(&QuickJSNativeAsync::Resolve<R>, base::Unretained(this), id, std::move(result)));
+    }
+
+    template <typename R>
+    void Resolve(int id, const R& result) {
+      auto it = pending_.find(id);
+      if(it == pending_.end())
+        return;
+      PendingPromise pending = it->second;
+      pending_.erase(it);
+      Settle(pending, internal::ToQuickJS(ctx_, result));
+    }
+
+    // Rejects when the conversion of the result threw.
+    void Settle(const PendingPromise& pending, JSValue value) {
+      JSValueConst function = pending.resolve;
+      if(JS_IsException(value)) {
+        value = JS_GetException(ctx_);
+        function = pending.reject;
+      }
+      JSValue ret = JS_Call(ctx_, function, JS_UNDEFINED, 1, &value);
+      if(JS_IsException(ret))
+        JS_FreeValue(ctx_, JS_GetException(ctx_));
+      JS_FreeValue(ctx_, ret);
+      JS_FreeValue(ctx_, value);
+      JS_FreeValue(ctx_, pending.resolve);
+      JS_FreeValue(ctx_, pending.reject);
+    }
+
+    JSContext* ctx_;
+    EnterCallback enter_;
+    std::map<int, PendingPromise> pending_;
+    int next_id_;
+
+    base::WeakPtrFactory<QuickJSNativeAsync> weak_factory_;
+
+    DISALLOW_COPY_AND_ASSIGN(QuickJSNativeAsync);
+};
+
+namespace internal {
+
+template <typename R>
+struct QuickJSReturn {
+  template <typename C, typename F, typename... A>
+  static JSValue Call(JSContext* ctx, C* impl, F f, const A&... a) {
+    return ToQuickJS(ctx, (impl->*f)(a...));
+  }
+};
+
+template <>
+struct QuickJSReturn<void> {
+  template <typename C, typename F, typename... A>
+  static JSValue Call(JSContext* ctx, C* impl, F f, const A&... a) {
+    (impl->*f)(a...);
+    return JS_UNDEFINED;
+  }
+};
+
+template <typename R>
+struct QuickJSReturn<NativeAsync<R>> {
+  template <typename C, typename F, typename... A>
+  static JSValue Call(JSContext* ctx, C* impl, F f, const A&... a) {
+    QuickJSNativeAsync* async = QuickJSNativeAsync::From(ctx);
+    if(!async)
+      return JS_ThrowTypeError(ctx, "Promises are not available in this context");
+    return async->Start((impl->*f)(a...));
+  }
+};
+
+template <typename Method, typename Args = typename Method::Traits::Args>
+struct QuickJSInvoker;
+
+template <typename Method, typename... A>
+struct QuickJSInvoker<Method, std::tuple<A...>> {
+  using Class = typename Method::Traits::Class;
+
+  static JSValue Invoke(Class* impl, JSContext* ctx, int argc, JSValueConst* argv) {
+    return Invoke(impl, ctx, argc, argv, std::index_sequence_for<A...>());
+  }
+
+  template <size_t... I>
+  static JSValue Invoke(Class* impl, JSContext* ctx, int argc, JSValueConst* argv,
+                        std::index_sequence<I...> indices) {
+    std::tuple<QuickJSArg<A>...> values;
+    if(!GetQuickJSArgs(ctx, argc, argv, &values, indices))
+      return JS_EXCEPTION;
+    return QuickJSReturn<typename Method::Traits::Return>::Call(
+        ctx, impl, Method::kFunction, std::get<I>(values).value()...);
+  }
+};
+
+template <typename T, typename Args = typename T::ConstructorArgs>
+struct QuickJSFactory;
+
+template <typename T, typename... A>
+struct QuickJSFactory<T, std::tuple<A...>> {
+  static std::unique_ptr<T> Create(JSContext* ctx, int argc, JSValueConst* argv) {
+    return Create(ctx, argc, argv, std::index_sequence_for<A...>());
+  }
+
+  template <size_t... I>
+  static std::unique_ptr<T> Create(JSContext* ctx, int argc, JSValueConst* argv,
+                                   std::index_sequence<I...> indices) {
+    std::tuple<QuickJSArg<A>...> values;
+    if(!GetQuickJSArgs(ctx, argc, argv, &values, indices))
+      return nullptr;
+    return std::make_unique<T>(std::get<I>(values).value()...);
+  }
+};
+
+}  // namespace internal
+
+// The QuickJS side of a native class T, see andjs_native_module.h. Objects
+// are of a JSClass of their own holding the T as opaque, the methods live
+// on the class prototype of each context.
+template <typename T>
+class QuickJSNativeClass {
+  public:
+    // Once per runtime, before a context uses the class.
+    static void Register(JSRuntime* rt) {
+      static JSClassDef class_def = { T::kClassName, &QuickJSNativeClass<T>::Finalize };
+      NewQuickJSClassID(&class_id_);
+      JS_NewClass(rt, class_id_, &class_def);
+    }
+
+    // Once per context.
+    static void InitPrototype(JSContext* ctx) {
+      JSValue proto = JS_NewObject(ctx);
+      const std::vector<JSCFunctionListEntry>& functions = GetFunctionList();
+      JS_SetPropertyFunctionList(ctx, proto, functions.data(), static_cast<int>(functions.size()));
+      JS_SetClassProto(ctx, class_id_, proto);
+    }
+
+    static JSValue Wrap(JSContext* ctx, std::unique_ptr<T> impl) {
+      JSValue obj = JS_NewObjectClass(ctx, class_id_);
+      if(!JS_IsException(obj))
+        JS_SetOpaque(obj, impl.release());
+      return obj;
+    }
+
+    // A function creating instances from T::ConstructorArgs, with or
+    // without new.
+    static JSValue NewConstructor(JSContext* ctx) {
+      JSValue constructor = JS_NewCFunction2(
+          ctx, &QuickJSNativeClass<T>::Construct, T::kClassName,
+          NativeTupleArity<typename T::ConstructorArgs>::value,
+          JS_CFUNC_constructor_or_func, 0);
+      JSValue proto = JS_GetClassProto(ctx, class_id_);
+      JS_SetConstructor(ctx, constructor, proto);
+      JS_FreeValue(ctx, proto);
+      return constructor;
+    }
+
+  private:
+    static const std::vector<JSCFunctionListEntry>& GetFunctionList() {
+      static const base::NoDestructor<std::vector<JSCFunctionListEntry>> functions(BuildFunctionList());
+      return *functions;
+    }
+
+    static std::vector<JSCFunctionListEntry> BuildFunctionList() {
+      std::vector<JSCFunctionListEntry> functions;
+      ForEachNativeMethod(T::Methods(), [&functions](auto method) {
+        using Method = decltype(method);
+        JSCFunctionListEntry entry = {};
+        entry.name = method.name;
+        entry.prop_flags = JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE;
+        entry.def_type = JS_DEF_CFUNC;
+        entry.u.func.length = Method::kLength;
+        entry.u.func.cproto = JS_CFUNC_generic;
+        entry.u.func.cfunc.generic = &QuickJSNativeClass<T>::template Invoke<Method>;
+        functions.push_back(entry);
+      });
+      return functions;
+    }
+
+    template <typename Method>
+    static JSValue Invoke(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) {
+      T* impl = static_cast<T*>(JS_GetOpaque2(ctx, this_val, class_id_));
+      if(!impl)
+        return JS_EXCEPTION;
+      return internal::QuickJSInvoker<Method>::Invoke(impl, ctx, argc, argv);
+    }
+
+    static JSValue Construct(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst* argv) {
+      std::unique_ptr<T> impl = internal::QuickJSFactory<T>::Create(ctx, argc, argv);
+      if(!impl)
+        return JS_EXCEPTION;
+      return Wrap(ctx, std::move(impl));
+    }
+
+    static void Finalize(JSRuntime* rt, JSValue val) {
+      delete static_cast<T*>(JS_GetOpaque(val, class_id_));
+    }
+
+    static JSClassID class_id_;
+};
+
+template <typename T>
+JSClassID QuickJSNativeClass<T>::class_id_ = 0;
+
+}  // namespace andjs
+#endif
@@ -0,0 +1,392 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_NATIVE_MODULE_V8_H__
+#define __ANDJS_NATIVE_MODULE_V8_H__
+#include <string.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/macros.h"
+#include "base/memory/ptr_util.h"
+#include "base/memory/weak_ptr.h"
+#include "base/optional.h"
+#include "base/supports_user_data.h"
+#include "base/task_runner_util.h"
+#include "gin/arguments.h"
+#include "gin/converter.h"
+#include "gin/function_template.h"
+#include "gin/handle.h"
+#include "gin/object_template_builder.h"
+#include "gin/per_context_data.h"
+#include "gin/per_isolate_data.h"
+#include "gin/wrappable.h"
+#include "v8/include/v8.h"
+
+#include "andjs/andjs_native_module.h"
+
+namespace gin {
+
+template <>
+struct Converter<andjs::NativeBuffer> {
+  static v8::Local<v8::Value> ToV8(v8::Isolate* isolate, const andjs::NativeBuffer& val) {
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, val.bytes.size());
+    if(!val.bytes.empty())
+      memcpy(buffer->GetContents().Data(), val.bytes.data(), val.bytes.size());
+    return v8::Uint8Array::New(buffer, 0, val.bytes.size());
+  }
+};
+
+}  // namespace gin
+
+namespace andjs {
+
+template <typename T>
+class GinNativeObject;
+
+namespace internal {
+
+// Converts one parameter with gin::Converter, see GetGinArgs().
+template <typename A>
+class GinArg {
+  public:
+    bool Get(gin::Arguments* args) { return args->GetNext(&value_); }
+    const A& value() const { return value_; }
+
+  private:
+    A value_{};
+};
+
+template <>
+class GinArg<NativeRestArgs> : public NativeRestArgs {
+  public:
+    bool Get(gin::Arguments* args) {
+      isolate_ = args->isolate();
+      v8::Local<v8::Value> value;
+      while(args->GetNext(&value))
+        values_.push_back(value);
+      return true;
+    }
+    const NativeRestArgs& value() const { return *this; }
+
+    size_t size() const override { return values_.size(); }
+
+    bool AppendString(size_t index, std::string* output) const override {
+      v8::String::Utf8Value utf8(isolate_, values_[index]);
+      if(!*utf8)
+        return false;
+      output->append(*utf8, utf8.length());
+      return true;
+    }
+
+  private:
+    v8::Isolate* isolate_ = nullptr;
+    std::vector<v8::Local<v8::Value>> values_;
+};
+
+template <>
+class GinArg<NativeBytes> {
+  public:
+    bool Get(gin::Arguments* args) {
+      v8::Local<v8::Value> value;
+      if(!args->GetNext(&value))
+        return false;
+      if(value->IsArrayBufferView()) {
+        v8::Local<v8::ArrayBufferView> view = value.As<v8::ArrayBufferView>();
+        value_.data = static_cast<const uint8_t*>(view->Buffer()->GetContents().Data()) + view->ByteOffset();
+        value_.size = view->ByteLength();
+        return true;
+      }
+      if(value->IsArrayBuffer()) {
+        v8::ArrayBuffer::Contents contents = value.As<v8::ArrayBuffer>()->GetContents();
+        value_.data = static_cast<const uint8_t*>(contents.Data());
+        value_.size = contents.ByteLength();
+        return true;
+      }
+      if(value->IsString() && gin::ConvertFromV8(args->isolate(), value, &utf8_)) {
+        value_.data = reinterpret_cast<const uint8_t*>(utf8_.data());
+        value_.size = utf8_.size();
+        return true;
+      }
+      return false;
+    }
+    const NativeBytes& value() const { return value_; }
+
+  private:
+    NativeBytes value_;
+    std::string utf8_;
+};
+
+// Converts all parameters or throws the usual gin conversion error.
+template <typename... H, size_t... I>
+bool GetGinArgs(gin::Arguments* args, std::tuple<H...>* values, std::index_sequence<I...>) {
+  bool ok = true;
+  int unused[] = {0, (ok = ok && std::get<I>(*values).Get(args), 0)...};
+  (void)unused;
+  if(!ok)
+    args->ThrowError();
+  return ok;
+}
+
+// What a promise is resolved with, see GinNativeAsync.
+template <typename R>
+v8::Local<v8::Value> ToGinValue(v8::Isolate* isolate, const R& value) {
+  return gin::ConvertToV8(isolate, value);
+}
+
+template <typename R>
+v8::Local<v8::Value> ToGinValue(v8::Isolate* isolate, const base::Optional<R>& value) {
+  return value ? ToGinValue(isolate, *value) : v8::Undefined(isolate).As<v8::Value>();
+}
+
+}  // namespace internal
+
+// The promises of the NativeAsync methods called in one context that are
+// still pending, user data of its gin::PerContextData. The engine installs
+// it with a callback that runs a step inside the scopes of that context and
+// the microtasks after it. It goes with the context and so do the results
+// that arrive later.
+class GinNativeAsync : public base::SupportsUserData::Data {
+  public:
+    typedef base::RepeatingCallback<void(base::OnceClosure)> EnterCallback;
+
+    static void Install(v8::Local<v8::Context> context, EnterCallback enter) {
+      gin::PerContextData::From(context)->SetUserData(
+          UserDataKey(), base::WrapUnique(new GinNativeAsync(context->GetIsolate(), std::move(enter))));
+    }
+
+    static GinNativeAsync* From(v8::Local<v8::Context> context) {
+      gin::PerContextData* data = gin::PerContextData::From(context);
+      return data ? static_cast<GinNativeAsync*>(data->GetUserData(UserDataKey())) : nullptr;
+    }
+
+    ~GinNativeAsync() override = default;
+
+    template <typename R>
+    v8::Local<v8::Promise> Start(v8::Local<v8::Context> context, NativeAsync<R> async) {
+      v8::Local<v8::Promise::Resolver> resolver = v8::Promise::Resolver::New(context).ToLocalChecked();
+      if(!async.work) {
+        resolver->Resolve(context, internal::ToGinValue(isolate_, async.value)).FromMaybe(false);
+        return resolver->GetPromise();
+      }
+      int id = next_id_++;
+      pending_[id].Reset(isolate_, resolver);
+      base::PostTaskAndReplyWithResult(GetNativeAsyncTaskRunner().get(), FROM_HERE, std::move(async.work),
+                                       base::BindOnce(&GinNativeAsync::Settle<R>, weak_factory_.GetWeakPtr(), id));
+      return resolver->GetPromise();
+    }
+
+  private:
+    GinNativeAsync(v8::Isolate* isolate, EnterCallback enter)
+        : isolate_(isolate), enter_(std::move(enter)), next_id_(0), weak_factory_(this) {}
+
+    static const void* UserDataKey() {
+      static const char kKey = 0;
+      return &kKey;
+    }
+
+    // Engine thread, the work is done.
+    template <typename R>
+    void Settle(int id, R result) {
+      enter_.Run(base::BindOnce(&GinNativeAsync::Resolve<R>, base::Unretained(this), id, std::move(result)));
+    }
+
+    template <typename R>
+    void Resolve(int id, const R& result) {
+      auto it = pending_.find(id);
+      if(it == pending_.end())
+        return;
+      v8::Local<v8::Promise::Resolver> resolver = it->second.Get(isolate_);
+      pending_.erase(it);
+      resolver->Resolve(resolver->CreationContext(), internal::ToGinValue(isolate_, result)).FromMaybe(false);
+    }
+
+    v8::Isolate* isolate_;
+    EnterCallback enter_;
+    std::map<int, v8::Global<v8::Promise::Resolver>> pending_;
+    int next_id_;
+
+    base::WeakPtrFactory<GinNativeAsync> weak_factory_;
+
+    DISALLOW_COPY_AND_ASSIGN(GinNativeAsync);
+};
+
+namespace internal {
+
+template <typename R>
+struct GinReturn {
+  template <typename C, typename F, typename... A>
+  static void Call(gin::Arguments* args, C* impl, F f, const A&... a) {
+    args->Return((impl->*f)(a...));
+  }
+};
+
+template <>
+struct GinReturn<void> {
+  template <typename C, typename F, typename... A>
+  static void Call(gin::Arguments* args, C* impl, F f, const A&... a) {
+    (impl->*f)(a...);
+  }
+};
+
+template <typename R>
+struct GinReturn<base::Optional<R>> {
+  template <typename C, typename F, typename... A>
+  static void Call(gin::Arguments* args, C* impl, F f, const A&... a) {
+    base::Optional<R> result = (impl->*f)(a...);
+    if(result)
+      args->Return(*result);
+  }
+};
+
+template <typename T>
+struct GinReturn<std::unique_ptr<T>> {
+  template <typename C, typename F, typename... A>
+  static void Call(gin::Arguments* args, C* impl, F f, const A&... a) {
+    std::unique_ptr<T> result = (impl->*f)(a...);
+    if(result)
+      args->Return(GinNativeObject<T>::Create(args->isolate(), std::move(result)).ToV8());
+  }
+};
+
+template <typename R>
+struct GinReturn<NativeAsync<R>> {
+  template <typename C, typename F, typename... A>
+  static void Call(gin::Arguments* args, C* impl, F f, const A&... a) {
+    v8::Local<v8::Context> context = args->isolate()->GetCurrentContext();
+    GinNativeAsync* async = GinNativeAsync::From(context);
+    if(!async) {
+      args->ThrowTypeError("Promises are not available in this context");
+      return;
+    }
+    args->Return(async->Start(context, (impl->*f)(a...)));
+  }
+};
+
+template <typename Method, typename Args = typename Method::Traits::Args>
+struct GinInvoker;
+
+template <typename Method, typename... A>
+struct GinInvoker<Method, std::tuple<A...>> {
+  using Class = typename Method::Traits::Class;
+
+  static void Invoke(Class* impl, gin::Arguments* args) {
+    Invoke(impl, args, std::index_sequence_for<A...>());
+  }
+
+  template <size_t... I>
+  static void Invoke(Class* impl, gin::Arguments* args, std::index_sequence<I...> indices) {
+    std::tuple<GinArg<A>...> values;
+    if(!GetGinArgs(args, &values, indices))
+      return;
+    GinReturn<typename Method::Traits::Return>::Call(
+        args, impl, Method::kFunction, std::get<I>(values).value()...);
+  }
+};
+
+template <typename T, typename Args = typename T::ConstructorArgs>
+struct GinFactory;
+
+template <typename T, typename... A>
+struct GinFactory<T, std::tuple<A...>> {
+  static std::unique_ptr<T> Create(gin::Arguments* args) {
+    return Create(args, std::index_sequence_for<A...>());
+  }
+
+  template <size_t... I>
+  static std::unique_ptr<T> Create(gin::Arguments* args, std::index_sequence<I...> indices) {
+    std::tuple<GinArg<A>...> values;
+    if(!GetGinArgs(args, &values, indices))
+      return nullptr;
+    return std::make_unique<T>(std::get<I>(values).value()...);
+  }
+};
+
+}  // namespace internal
+
+// The V8 side of a native class T, see andjs_native_module.h. The wrapper
+// owns its T and the ObjectTemplate is built once per isolate.
+template <typename T>
+class GinNativeObject : public gin::Wrappable<GinNativeObject<T>> {
+  public:
+    static gin::WrapperInfo kWrapperInfo;
+
+    static gin::Handle<GinNativeObject<T>> Create(v8::Isolate* isolate, std::unique_ptr<T> impl) {
+      return gin::CreateHandle(isolate, new GinNativeObject<T>(std::move(impl)));
+    }
+
+    // A function creating instances from T::ConstructorArgs, with or
+    // without new.
+    static v8::Local<v8::Function> GetConstructor(v8::Local<v8::Context> context) {
+      v8::Isolate* isolate = context->GetIsolate();
+      gin::PerIsolateData* data = gin::PerIsolateData::From(isolate);
+      v8::Local<v8::FunctionTemplate> tmpl = data->GetFunctionTemplate(&kWrapperInfo);
+      if(tmpl.IsEmpty()) {
+        tmpl = gin::CreateFunctionTemplate(isolate, base::BindRepeating(&GinNativeObject<T>::Construct));
+        tmpl->SetClassName(gin::StringToV8(isolate, T::kClassName));
+        data->SetFunctionTemplate(&kWrapperInfo, tmpl);
+      }
+      return tmpl->GetFunction(context).ToLocalChecked();
+    }
+
+    T* impl() const { return impl_.get(); }
+
+  protected:
+    gin::ObjectTemplateBuilder GetObjectTemplateBuilder(v8::Isolate* isolate) final {
+      gin::ObjectTemplateBuilder builder =
+          gin::Wrappable<GinNativeObject<T>>::GetObjectTemplateBuilder(isolate);
+      ForEachNativeMethod(T::Methods(), [&builder](auto method) {
+        builder.SetMethod(method.name, &GinNativeObject<T>::template Invoke<decltype(method)>);
+      });
+      return builder;
+    }
+    const char* GetTypeName() final { return T::kClassName; }
+    ~GinNativeObject() override = default;
+
+  private:
+    explicit GinNativeObject(std::unique_ptr<T> impl) : impl_(std::move(impl)) {}
+
+    template <typename Method>
+    void Invoke(gin::Arguments* args) {
+      internal::GinInvoker<Method>::Invoke(impl_.get(), args);
+    }
+
+    static void Construct(gin::Arguments* args) {
+      std::unique_ptr<T> impl = internal::GinFactory<T>::Create(args);
+      if(impl)
+        args->Return(Create(args->isolate(), std::move(impl)).ToV8());
+    }
+
+    std::unique_ptr<T> impl_;
+
+    DISALLOW_COPY_AND_ASSIGN(GinNativeObject);
+};
+
+template <typename T>
+gin::WrapperInfo GinNativeObject<T>::kWrapperInfo = { gin::kEmbedderNativeGin };
+
+}  // namespace andjs
+#endif
@@ -0,0 +1,530 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_native_objects.h"
+
+#include <utility>
+#include <vector>
+
+#include "base/bind.h"
+#include "base/memory/ptr_util.h"
+#include "base/strings/string_piece.h"
+#include "base/strings/string_util.h"
+#include "base/trace_event/trace_event.h"
+#include "crypto/aead.h"
+#include "crypto/hmac.h"
+#include "crypto/sha2.h"
+#include "third_party/boringssl/src/include/openssl/digest.h"
+
+#include "andjs/andjs_bindings.h"
+#include "andjs/andjs_encoding.h"
+#include "andjs/andjs_kv_store.h"
+
+namespace andjs {
+
+const char AndJSControl::kClassName[] = "AndJS";
+
+AndJSControl::AndJSControl(BatchedCalls* batched_calls)
+    : batched_calls_(batched_calls) {
+}
+
+AndJSControl::~AndJSControl() = default;
+
+void AndJSControl::Flush() {
+  batched_calls_->Flush();
+}
+
+const char AdbLog::kClassName[] = "AdbLog";
+
+AdbLog::AdbLog() = default;
+
+AdbLog::~AdbLog() = default;
+
+void AdbLog::Info(const NativeRestArgs& args) {
+  Write(kLogInfo, args);
+}
+
+void AdbLog::Error(const NativeRestArgs& args) {
+  Write(kLogError, args);
+}
+
+// Arguments are only converted when the level passes the filter.
+// static
+void AdbLog::Write(LogLevel level, const NativeRestArgs& args) {
+  AsyncLogger* logger = AsyncLogger::GetInstance();
+  if(!logger->IsEnabled(level))
+    return;
+
+  std::string output;
+  for(size_t i = 0; i < args.size(); i++)
+    args.AppendString(i, &output);
+  logger->Log(level, std::move(output));
+}
+
+const char Encoding::kClassName[] = "Encoding";
+
+const char Encoding::kPrelude[] = R"JS((function(global, encoding) {
+  'use strict';
+  function define(object, name, value) {
+    Object.defineProperty(object, name, {value: value, writable: true, configurable: true});
+  }
+  function bytesOf(input) {
+    if(input === undefined)
+      return new Uint8Array(0);
+    if(input instanceof ArrayBuffer)
+      return new Uint8Array(input);
+    if(ArrayBuffer.isView(input))
+      return new Uint8Array(input.buffer, input.byteOffset, input.byteLength);
+    throw new TypeError('The provided value is not an ArrayBuffer or ArrayBufferView');
+  }
+  // Bytes at the end that start a character still missing the rest.
+  function incompleteTail(bytes) {
+    for(var back = 1; back <= 3 && back <= bytes.length; back++) {
+      var b = bytes[bytes.length - back];
+      if((b & 0xc0) === 0x80)
+        continue;
+      var needed = b >= 0xf0 ? 4 : b >= 0xe0 ? 3 : b >= 0xc0 ? 2 : 1;
+      return needed > back ? back : 0;
+    }
+    return 0;
+  }
+  function invalidCharacter(message) {
+    var error = new Error(message);
+    error.name = 'InvalidCharacterError';
+    return error;
+  }
+
+  function TextEncoder() {}
+  Object.defineProperty(TextEncoder.prototype, 'encoding', {get: function() { return 'utf-8'; }});
+  define(TextEncoder.prototype, 'encode', function(input) {
+    return encoding.encodeUtf8(input === undefined ? '' : String(input));
+  });
+  define(TextEncoder.prototype, 'encodeInto', function(input, destination) {
+    var text = String(input);
+    var bytes = encoding.encodeUtf8(text);
+    var written = Math.min(bytes.length, destination.length);
+    while(written > 0 && written < bytes.length && (bytes[written] & 0xc0) === 0x80)
+      written--;
+    destination.set(written === bytes.length ? bytes : bytes.subarray(0, written));
+    var read = text.length;
+    if(written < bytes.length) {
+      read = 0;
+      for(var i = 0; i < written; i++) {
+        if((bytes[i] & 0xc0) !== 0x80)
+          read += bytes[i] >= 0xf0 ? 2 : 1;
+      }
+    }
+    return {read: read, written: written};
+  });
+
+  function TextDecoder(label, options) {
+    label = label === undefined ? 'utf-8' : String(label).trim().toLowerCase();
+    if(label !== 'utf-8' && label !== 'utf8' && label !== 'unicode-1-1-utf-8')
+      throw new RangeError('The encoding label provided ("' + label + '") is invalid.');
+    this.fatal = !!(options && options.fatal);
+    this.ignoreBOM = !!(options && options.ignoreBOM);
+    this.pending_ = null;
+    this.started_ = false;
+  }
+  Object.defineProperty(TextDecoder.prototype, 'encoding', {get: function() { return 'utf-8'; }});
+  define(TextDecoder.prototype, 'decode', function(input, options) {
+    var bytes = bytesOf(input);
+    var stream = !!(options && options.stream);
+    if(this.pending_) {
+      var joined = new Uint8Array(this.pending_.length + bytes.length);
+      joined.set(this.pending_);
+      joined.set(bytes, this.pending_.length);
+      bytes = joined;
+      this.pending_ = null;
+    }
+    if(stream) {
+      var tail = incompleteTail(bytes);
+      if(tail) {
+        this.pending_ = bytes.slice(bytes.length - tail);
+        bytes = bytes.subarray(0, bytes.length - tail);
+      }
+    }
+    if(!this.started_ && bytes.length) {
+      if(!this.ignoreBOM && bytes.length >= 3 && bytes[0] === 0xef && bytes[1] === 0xbb && bytes[2] === 0xbf)
+        bytes = bytes.subarray(3);
+      this.started_ = true;
+    }
+    if(!stream)
+      this.started_ = false;
+    var text = encoding.decodeUtf8(bytes, this.fatal);
+    if(text === undefined) {
+      this.pending_ = null;
+      this.started_ = false;
+      throw new TypeError('The encoded data was not valid.');
+    }
+    return text;
+  });
+
+  define(global, 'TextEncoder', TextEncoder);
+  define(global, 'TextDecoder', TextDecoder);
+  define(global, 'btoa', function btoa(data) {
+    var result = encoding.btoa(String(data));
+    if(result === undefined)
+      throw invalidCharacter('The string to be encoded contains characters outside of the Latin1 range.');
+    return result;
+  });
+  define(global, 'atob', function atob(data) {
+    var result = encoding.atob(String(data));
+    if(result === undefined)
+      throw invalidCharacter('The string to be decoded is not correctly encoded.');
+    return result;
+  });
+}))JS";
+
+Encoding::Encoding() = default;
+
+Encoding::~Encoding() = default;
+
+std::string Encoding::Kernels() {
+  return GetEncodingKernels();
+}
+
+bool Encoding::IsUTF8(const NativeBytes& bytes) {
+  return andjs::IsUTF8(bytes.data, bytes.size);
+}
+
+NativeBuffer Encoding::EncodeUTF8(const std::string& text) {
+  NativeBuffer result;
+  std::string well_formed;
+  const std::string& utf8 = ToWellFormedUTF8(text, &well_formed) ? well_formed : text;
+  result.bytes.assign(utf8.begin(), utf8.end());
+  return result;
+}
+
+base::Optional<std::string> Encoding::DecodeUTF8(const NativeBytes& bytes, bool fatal) {
+  TRACE_EVENT1("andjs", "Encoding::DecodeUTF8", "length", bytes.size);
+  std::string text;
+  if(!andjs::DecodeUTF8(bytes.data, bytes.size, &text) && fatal)
+    return base::nullopt;
+  return text;
+}
+
+std::string Encoding::EncodeBase64(const NativeBytes& bytes) {
+  std::string text;
+  andjs::EncodeBase64(bytes.data, bytes.size, &text);
+  return text;
+}
+
+base::Optional<NativeBuffer> Encoding::DecodeBase64(const std::string& text) {
+  NativeBuffer result;
+  if(!andjs::DecodeBase64(text.data(), text.size(), &result.bytes))
+    return base::nullopt;
+  return result;
+}
+
+std::string Encoding::EncodeHex(const NativeBytes& bytes) {
+  std::string text;
+  andjs::EncodeHex(bytes.data, bytes.size, &text);
+  return text;
+}
+
+base::Optional<NativeBuffer> Encoding::DecodeHex(const std::string& text) {
+  NativeBuffer result;
+  if(!andjs::DecodeHex(text.data(), text.size(), &result.bytes))
+    return base::nullopt;
+  return result;
+}
+
+// The engines hand strings over as UTF-8, U+0080 to U+00FF are the two
+// byte sequences with a C2 or C3 lead.
+base::Optional<std::string> Encoding::Btoa(const std::string& text) {
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+  size_t ascii = CountASCII(data, text.size());
+  std::string encoded;
+  if(ascii == text.size()) {
+    andjs::EncodeBase64(data, text.size(), &encoded);
+    return encoded;
+  }
+  std::vector<uint8_t> latin1(data, data + ascii);
+  for(size_t i = ascii; i < text.size(); i++) {
+    if(data[i] < 0x80) {
+      latin1.push_back(data[i]);
+    } else if((data[i] == 0xc2 || data[i] == 0xc3) && i + 1 < text.size() && (data[i + 1] & 0xc0) == 0x80) {
+      latin1.push_back(static_cast<uint8_t>(((data[i] & 0x03) << 6) | (data[i + 1] & 0x3f)));
+      i++;
+    } else {
+      return base::nullopt;
+    }
+  }
+  andjs::EncodeBase64(latin1.data(), latin1.size(), &encoded);
+  return encoded;
+}
+
+base::Optional<std::string> Encoding::Atob(const std::string& text) {
+  std::vector<uint8_t> bytes;
+  if(!andjs::DecodeBase64(text.data(), text.size(), &bytes))
+    return base::nullopt;
+  size_t ascii = CountASCII(bytes.data(), bytes.size());
+  std::string decoded(bytes.begin(), bytes.begin() + ascii);
+  if(ascii == bytes.size())
+    return decoded;
+  decoded.reserve(bytes.size() + (bytes.size() - ascii));
+  for(size_t i = ascii; i < bytes.size(); i++) {
+    if(bytes[i] < 0x80) {
+      decoded.push_back(static_cast<char>(bytes[i]));
+    } else {
+      decoded.push_back(static_cast<char>(0xc0 | (bytes[i] >> 6)));
+      decoded.push_back(static_cast<char>(0x80 | (bytes[i] & 0x3f)));
+    }
+  }
+  return decoded;
+}
+
+const char KVStoreObject::kClassName[] = "KVStore";
+
+KVStoreObject::KVStoreObject(KVStore* store) : store_(store) {
+}
+
+KVStoreObject::~KVStoreObject() = default;
+
+base::Optional<std::string> KVStoreObject::Get(const std::string& key) {
+  std::string value;
+  if(!store_->Get(key, &value))
+    return base::nullopt;
+  return value;
+}
+
+base::Optional<NativeBuffer> KVStoreObject::GetBytes(const std::string& key) {
+  NativeBuffer value;
+  if(!store_->GetBytes(key, &value.bytes))
+    return base::nullopt;
+  return value;
+}
+
+bool KVStoreObject::Has(const std::string& key) {
+  return store_->Has(key);
+}
+
+bool KVStoreObject::Put(const std::string& key, const NativeBytes& value) {
+  return store_->Put(key, value.data, value.size);
+}
+
+bool KVStoreObject::Remove(const std::string& key) {
+  return store_->Remove(key);
+}
+
+double KVStoreObject::Count() {
+  return static_cast<double>(store_->Count());
+}
+
+bool KVStoreObject::Flush() {
+  return store_->Flush();
+}
+
+bool KVStoreObject::Compact() {
+  return store_->Compact();
+}
+
+const char KV::kClassName[] = "KV";
+
+KV::KV() = default;
+
+KV::~KV() = default;
+
+std::unique_ptr<KVStoreObject> KV::Open(const std::string& name) {
+  TRACE_EVENT1("andjs", "KV::Open", "name", name);
+  KVStore* store = KVStore::Open(name);
+  if(!store)
+    return nullptr;
+  return std::make_unique<KVStoreObject>(store);
+}
+
+namespace {
+
+// WebCrypto names, "sha-256" and "sha256" work too.
+const EVP_MD* GetDigestAlgorithm(const std::string& algorithm) {
+  std::string name = base::ToLowerASCII(algorithm);
+  base::RemoveChars(name, "-", &name);
+  if(name == "sha1")
+    return EVP_sha1();
+  if(name == "sha256")
+    return EVP_sha256();
+  if(name == "sha384")
+    return EVP_sha384();
+  if(name == "sha512")
+    return EVP_sha512();
+  return nullptr;
+}
+
+base::Optional<NativeBuffer> DigestBytes(const EVP_MD* md, const uint8_t* data, size_t size) {
+  NativeBuffer digest;
+  digest.bytes.resize(EVP_MD_size(md));
+  if(!EVP_Digest(data, size, digest.bytes.data(), nullptr, md, nullptr))
+    return base::nullopt;
+  return digest;
+}
+
+base::Optional<NativeBuffer> HmacBytes(base::StringPiece key, base::StringPiece data) {
+  crypto::HMAC hmac(crypto::HMAC::SHA256);
+  NativeBuffer mac;
+  mac.bytes.resize(hmac.DigestLength());
+  if(!hmac.Init(key) || !hmac.Sign(data, mac.bytes.data(), mac.bytes.size()))
+    return base::nullopt;
+  return mac;
+}
+
+// The NativeAsync work, on copies of the input.
+base::Optional<NativeBuffer> DigestCopy(const EVP_MD* md, const std::vector<uint8_t>& data) {
+  TRACE_EVENT1("andjs", "JSCrypto::DigestAsync", "bytes", data.size());
+  return DigestBytes(md, data.data(), data.size());
+}
+
+base::Optional<NativeBuffer> HmacCopy(const std::string& key, const std::string& data) {
+  TRACE_EVENT1("andjs", "JSCrypto::HmacAsync", "bytes", data.size());
+  return HmacBytes(key, data);
+}
+
+base::StringPiece AsStringPiece(const NativeBytes& bytes) {
+  return base::StringPiece(reinterpret_cast<const char*>(bytes.data), bytes.size);
+}
+
+}  // namespace
+
+struct JSHash::State {
+  bssl::ScopedEVP_MD_CTX ctx;
+};
+
+const char JSHash::kClassName[] = "Hash";
+
+// static
+std::unique_ptr<JSHash> JSHash::Create(const std::string& algorithm) {
+  const EVP_MD* md = GetDigestAlgorithm(algorithm);
+  if(!md)
+    return nullptr;
+  std::unique_ptr<State> state = std::make_unique<State>();
+  if(!EVP_DigestInit_ex(state->ctx.get(), md, nullptr))
+    return nullptr;
+  return base::WrapUnique(new JSHash(std::move(state)));
+}
+
+JSHash::JSHash(std::unique_ptr<State> state) : state_(std::move(state)) {
+}
+
+JSHash::~JSHash() = default;
+
+bool JSHash::Update(const NativeBytes& data) {
+  TRACE_EVENT1("andjs", "JSHash::Update", "bytes", data.size);
+  return state_ && EVP_DigestUpdate(state_->ctx.get(), data.data, data.size);
+}
+
+base::Optional<NativeBuffer> JSHash::Digest() {
+  if(!state_)
+    return base::nullopt;
+  NativeBuffer digest;
+  digest.bytes.resize(EVP_MD_CTX_size(state_->ctx.get()));
+  bool ok = EVP_DigestFinal_ex(state_->ctx.get(), digest.bytes.data(), nullptr);
+  state_.reset();
+  if(!ok)
+    return base::nullopt;
+  return digest;
+}
+
+const char JSCrypto::kClassName[] = "JSCrypto";
+
+// Below it the copy and the thread hop cost more than the hash, about a
+// millisecond of SHA-256 on a phone.
+const size_t JSCrypto::kAsyncBytes = 256 * 1024;
+
+JSCrypto::JSCrypto() = default;
+
+JSCrypto::JSCrypto(const std::string& key) {
+  SetKey(key);
+}
+
+JSCrypto::~JSCrypto() = default;
+
+void JSCrypto::SetKey(const std::string& key) {
+  TRACE_EVENT0("andjs", "JSCrypto::SetKey");
+  // crypto::Aead keeps a pointer to its key and is initialized only once.
+  aead_.reset(new crypto::Aead(crypto::Aead::AES_128_CTR_HMAC_SHA256));
+  std::string hash256 = crypto::SHA256HashString(key);
+  aead_nonce_.assign(hash256, 0, aead_->NonceLength());
+  aead_key_ = crypto::SHA256HashString(hash256 + aead_nonce_);
+  aead_key_.append(hash256, 0, 16);
+  aead_->Init(&aead_key_);
+}
+
+base::Optional<std::string> JSCrypto::Seal(const std::string& plaintext) {
+  TRACE_EVENT0("andjs", "JSCrypto::Seal");
+  std::string ciphertext, output;
+  if(!aead_ || !aead_->Seal(plaintext, aead_nonce_, "jscrypto", &ciphertext))
+    return base::nullopt;
+  andjs::EncodeBase64(reinterpret_cast<const uint8_t*>(ciphertext.data()), ciphertext.size(), &output);
+  return output;
+}
+
+base::Optional<std::string> JSCrypto::Open(const std::string& ciphertext) {
+  TRACE_EVENT0("andjs", "JSCrypto::Open");
+  std::vector<uint8_t> sealed;
+  std::string plaintext;
+  if(!aead_ || !andjs::DecodeBase64(ciphertext.data(), ciphertext.size(), &sealed) ||
+     !aead_->Open(base::StringPiece(reinterpret_cast<const char*>(sealed.data()), sealed.size()),
+                  aead_nonce_, "jscrypto", &plaintext))
+    return base::nullopt;
+  return plaintext;
+}
+
+base::Optional<NativeBuffer> JSCrypto::Digest(const std::string& algorithm, const NativeBytes& data) {
+  TRACE_EVENT1("andjs", "JSCrypto::Digest", "bytes", data.size);
+  const EVP_MD* md = GetDigestAlgorithm(algorithm);
+  if(!md)
+    return base::nullopt;
+  return DigestBytes(md, data.data, data.size);
+}
+
+NativeAsync<base::Optional<NativeBuffer>> JSCrypto::DigestAsync(const std::string& algorithm, const NativeBytes& data) {
+  NativeAsync<base::Optional<NativeBuffer>> async;
+  const EVP_MD* md = GetDigestAlgorithm(algorithm);
+  if(!md)
+    return async;
+  if(data.size < kAsyncBytes) {
+    async.value = DigestBytes(md, data.data, data.size);
+    return async;
+  }
+  async.work = base::BindOnce(&DigestCopy, md, std::vector<uint8_t>(data.data, data.data + data.size));
+  return async;
+}
+
+base::Optional<NativeBuffer> JSCrypto::Hmac(const NativeBytes& key, const NativeBytes& data) {
+  TRACE_EVENT1("andjs", "JSCrypto::Hmac", "bytes", data.size);
+  return HmacBytes(AsStringPiece(key), AsStringPiece(data));
+}
+
+NativeAsync<base::Optional<NativeBuffer>> JSCrypto::HmacAsync(const NativeBytes& key, const NativeBytes& data) {
+  NativeAsync<base::Optional<NativeBuffer>> async;
+  if(data.size < kAsyncBytes) {
+    async.value = HmacBytes(AsStringPiece(key), AsStringPiece(data));
+    return async;
+  }
+  async.work = base::BindOnce(&HmacCopy, AsStringPiece(key).as_string(), AsStringPiece(data).as_string());
+  return async;
+}
+
+std::unique_ptr<JSHash> JSCrypto::CreateHash(const std::string& algorithm) {
+  return JSHash::Create(algorithm);
+}
+
+}  // namespace andjs
@@ -0,0 +1,272 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_NATIVE_OBJECTS_H__
+#define __ANDJS_NATIVE_OBJECTS_H__
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "base/macros.h"
+#include "base/optional.h"
+
+#include "andjs/andjs_logger.h"
+#include "andjs/andjs_native_module.h"
+
+namespace crypto {
+class Aead;
+}
+
+namespace andjs {
+
+class BatchedCalls;
+
+// The global andjs. andjs.flush() replays the batched bridge calls made so
+// far instead of at the end of the task.
+class AndJSControl {
+  public:
+    static const char kClassName[];
+
+    explicit AndJSControl(BatchedCalls* batched_calls);
+    ~AndJSControl();
+
+    void Flush();
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("flush", &AndJSControl::Flush));
+    }
+
+  private:
+    // Owned by the engine, which outlives its scripts.
+    BatchedCalls* batched_calls_;
+
+    DISALLOW_COPY_AND_ASSIGN(AndJSControl);
+};
+
+// The global adb: adb.info(...) and adb.error(...) log the ToString() of
+// their arguments.
+class AdbLog {
+  public:
+    static const char kClassName[];
+
+    AdbLog();
+    ~AdbLog();
+
+    void Info(const NativeRestArgs& args);
+    void Error(const NativeRestArgs& args);
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("info", &AdbLog::Info),
+                             ANDJS_NATIVE_METHOD("error", &AdbLog::Error));
+    }
+
+  private:
+    static void Write(LogLevel level, const NativeRestArgs& args);
+
+    DISALLOW_COPY_AND_ASSIGN(AdbLog);
+};
+
+// The global encoding: UTF-8, base64 and hex conversions that read
+// ArrayBuffer and typed array memory in place, see andjs_encoding.h.
+// kPrelude builds TextEncoder, TextDecoder, atob() and btoa() on it.
+class Encoding {
+  public:
+    static const char kClassName[];
+    // A function expression, called with the global object and encoding.
+    static const char kPrelude[];
+
+    Encoding();
+    ~Encoding();
+
+    std::string Kernels();
+    bool IsUTF8(const NativeBytes& bytes);
+    NativeBuffer EncodeUTF8(const std::string& text);
+    // Invalid input is undefined when |fatal|, U+FFFD otherwise.
+    base::Optional<std::string> DecodeUTF8(const NativeBytes& bytes, bool fatal);
+    std::string EncodeBase64(const NativeBytes& bytes);
+    base::Optional<NativeBuffer> DecodeBase64(const std::string& text);
+    std::string EncodeHex(const NativeBytes& bytes);
+    base::Optional<NativeBuffer> DecodeHex(const std::string& text);
+    // Binary strings of Latin-1 characters, undefined for a character past
+    // U+00FF or invalid base64.
+    base::Optional<std::string> Btoa(const std::string& text);
+    base::Optional<std::string> Atob(const std::string& text);
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("kernels", &Encoding::Kernels),
+                             ANDJS_NATIVE_METHOD("isUtf8", &Encoding::IsUTF8),
+                             ANDJS_NATIVE_METHOD("encodeUtf8", &Encoding::EncodeUTF8),
+                             ANDJS_NATIVE_METHOD("decodeUtf8", &Encoding::DecodeUTF8),
+                             ANDJS_NATIVE_METHOD("encodeBase64", &Encoding::EncodeBase64),
+                             ANDJS_NATIVE_METHOD("decodeBase64", &Encoding::DecodeBase64),
+                             ANDJS_NATIVE_METHOD("encodeHex", &Encoding::EncodeHex),
+                             ANDJS_NATIVE_METHOD("decodeHex", &Encoding::DecodeHex),
+                             ANDJS_NATIVE_METHOD("btoa", &Encoding::Btoa),
+                             ANDJS_NATIVE_METHOD("atob", &Encoding::Atob));
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Encoding);
+};
+
+class KVStore;
+
+// A store kv.open(name) returns: get(key) as a string, getBytes(key) as a
+// Uint8Array, both undefined for a missing key, put(key, value) of a
+// string or bytes, remove(key), has(key), count(), flush() and compact().
+// See KVStore.
+class KVStoreObject {
+  public:
+    static const char kClassName[];
+
+    explicit KVStoreObject(KVStore* store);
+    ~KVStoreObject();
+
+    base::Optional<std::string> Get(const std::string& key);
+    base::Optional<NativeBuffer> GetBytes(const std::string& key);
+    bool Has(const std::string& key);
+    bool Put(const std::string& key, const NativeBytes& value);
+    bool Remove(const std::string& key);
+    double Count();
+    bool Flush();
+    bool Compact();
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("get", &KVStoreObject::Get),
+                             ANDJS_NATIVE_METHOD("getBytes", &KVStoreObject::GetBytes),
+                             ANDJS_NATIVE_METHOD("has", &KVStoreObject::Has),
+                             ANDJS_NATIVE_METHOD("put", &KVStoreObject::Put),
+                             ANDJS_NATIVE_METHOD("remove", &KVStoreObject::Remove),
+                             ANDJS_NATIVE_METHOD("count", &KVStoreObject::Count),
+                             ANDJS_NATIVE_METHOD("flush", &KVStoreObject::Flush),
+                             ANDJS_NATIVE_METHOD("compact", &KVStoreObject::Compact));
+    }
+
+  private:
+    // Open until the process exits.
+    KVStore* store_;
+
+    DISALLOW_COPY_AND_ASSIGN(KVStoreObject);
+};
+
+// The global kv. kv.open(name) is undefined for an invalid name or a file
+// that cannot be opened.
+class KV {
+  public:
+    static const char kClassName[];
+
+    KV();
+    ~KV();
+
+    std::unique_ptr<KVStoreObject> Open(const std::string& name);
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("open", &KV::Open));
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(KV);
+};
+
+// What jscrypto.createHash(algorithm) returns: update(data) as often as
+// needed, then digest(). Both are false or undefined once digest() was
+// called.
+class JSHash {
+  public:
+    static const char kClassName[];
+
+    // Null for an algorithm digest() doesn't know.
+    static std::unique_ptr<JSHash> Create(const std::string& algorithm);
+    ~JSHash();
+
+    bool Update(const NativeBytes& data);
+    base::Optional<NativeBuffer> Digest();
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("update", &JSHash::Update),
+                             ANDJS_NATIVE_METHOD("digest", &JSHash::Digest));
+    }
+
+  private:
+    // The BoringSSL digest context.
+    struct State;
+
+    explicit JSHash(std::unique_ptr<State> state);
+
+    // Null once digested.
+    std::unique_ptr<State> state_;
+
+    DISALLOW_COPY_AND_ASSIGN(JSHash);
+};
+
+// The global jscrypto and the instances of new JSCrypto(key),
+// getJSCrypto(key) and JSCrypto.key(key). seal() and open() use AES-128-CTR
+// with HMAC-SHA256 and Base64 ciphertexts, both are undefined on failure or
+// before a key is set.
+//
+// digest() takes SHA-1, SHA-256, SHA-384 or SHA-512, case insensitive and
+// with or without the dash, and is undefined for others. hmac() is
+// HMAC-SHA256. Both read ArrayBuffer and typed array memory in place and
+// strings as their UTF-8. Their Async variants return a Promise, inputs of
+// kAsyncBytes or more are copied and hashed on the NativeAsync thread.
+class JSCrypto {
+  public:
+    static const char kClassName[];
+    using ConstructorArgs = std::tuple<std::string>;
+
+    static const size_t kAsyncBytes;
+
+    JSCrypto();
+    explicit JSCrypto(const std::string& key);
+    ~JSCrypto();
+
+    void SetKey(const std::string& key);
+    base::Optional<std::string> Seal(const std::string& plaintext);
+    base::Optional<std::string> Open(const std::string& ciphertext);
+
+    base::Optional<NativeBuffer> Digest(const std::string& algorithm, const NativeBytes& data);
+    NativeAsync<base::Optional<NativeBuffer>> DigestAsync(const std::string& algorithm, const NativeBytes& data);
+    base::Optional<NativeBuffer> Hmac(const NativeBytes& key, const NativeBytes& data);
+    NativeAsync<base::Optional<NativeBuffer>> HmacAsync(const NativeBytes& key, const NativeBytes& data);
+    std::unique_ptr<JSHash> CreateHash(const std::string& algorithm);
+
+    static auto Methods() {
+      return std::make_tuple(ANDJS_NATIVE_METHOD("setkey", &JSCrypto::SetKey),
+                             ANDJS_NATIVE_METHOD("seal", &JSCrypto::Seal),
+                             ANDJS_NATIVE_METHOD("open", &JSCrypto::Open),
+                             ANDJS_NATIVE_METHOD("digest", &JSCrypto::Digest),
+                             ANDJS_NATIVE_METHOD("digestAsync", &JSCrypto::DigestAsync),
+                             ANDJS_NATIVE_METHOD("hmac", &JSCrypto::Hmac),
+                             ANDJS_NATIVE_METHOD("hmacAsync", &JSCrypto::HmacAsync),
+                             ANDJS_NATIVE_METHOD("createHash", &JSCrypto::CreateHash));
+    }
+
+  private:
+    std::string aead_nonce_;
+    std::string aead_key_;
+    // Null until SetKey().
+    std::unique_ptr<crypto::Aead> aead_;
+
+    DISALLOW_COPY_AND_ASSIGN(JSCrypto);
+};
+
+}  // namespace andjs
+#endif
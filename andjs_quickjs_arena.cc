@@ -0,0 +1,206 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_quickjs_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "base/logging.h"
+
+#include "andjs/andjs_stats.h"
+
+namespace andjs {
+
+namespace {
+
+// Blocks start with their size, header included, and are multiples of
+// kGranule so a class is just block size / kGranule.
+const size_t kHeaderSize = sizeof(uint64_t);
+const size_t kGranule = 16;
+
+size_t BlockSize(size_t size) {
+  return (size + kHeaderSize + kGranule - 1) & ~(kGranule - 1);
+}
+
+uint64_t* HeaderOf(const void* ptr) {
+  return reinterpret_cast<uint64_t*>(const_cast<uint8_t*>(static_cast<const uint8_t*>(ptr)) - kHeaderSize);
+}
+
+}
+
+const size_t QuickJSArena::kChunkSize = 64 * 1024;
+const size_t QuickJSArena::kMaxSmallSize = 1024;
+
+const JSMallocFunctions QuickJSArena::kMallocFunctions = {
+  &QuickJSArena::Malloc,
+  &QuickJSArena::Free,
+  &QuickJSArena::Realloc,
+  &QuickJSArena::UsableSize,
+};
+
+QuickJSArena::QuickJSArena(AndJSStats* stats)
+    : stats_(stats),
+      chunk_pos_(nullptr),
+      chunk_end_(nullptr),
+      free_lists_(kMaxSmallSize / kGranule, nullptr),
+      reserved_bytes_(0) {
+}
+
+// The runtime is gone, whatever it did not free goes with the chunks.
+QuickJSArena::~QuickJSArena() {
+  for(void* chunk : chunks_)
+    free(chunk);
+  AndJSStats::Add(&stats_->heap_reserved_bytes, -static_cast<int64_t>(reserved_bytes_));
+}
+
+// static
+void* QuickJSArena::Malloc(JSMallocState* state, size_t size) {
+  DCHECK_NE(size, 0u);
+  if(state->malloc_size + size > state->malloc_limit)
+    return nullptr;
+  void* ptr = static_cast<QuickJSArena*>(state->opaque)->AllocateBlock(size);
+  if(!ptr)
+    return nullptr;
+  state->malloc_count++;
+  state->malloc_size += *HeaderOf(ptr);
+  return ptr;
+}
+
+// static
+void QuickJSArena::Free(JSMallocState* state, void* ptr) {
+  if(!ptr)
+    return;
+  state->malloc_count--;
+  state->malloc_size -= *HeaderOf(ptr);
+  static_cast<QuickJSArena*>(state->opaque)->FreeBlockAt(ptr);
+}
+
+// static
+void* QuickJSArena::Realloc(JSMallocState* state, void* ptr, size_t size) {
+  if(!ptr)
+    return size ? Malloc(state, size) : nullptr;
+  if(!size) {
+    Free(state, ptr);
+    return nullptr;
+  }
+  size_t old_block = *HeaderOf(ptr);
+  size_t old_size = old_block - kHeaderSize;
+  if(state->malloc_size + size - old_size > state->malloc_limit)
+    return nullptr;
+  size_t block = BlockSize(size);
+  if(block == old_block)
+    return ptr;
+
+  QuickJSArena* arena = static_cast<QuickJSArena*>(state->opaque);
+  if(old_block > kMaxSmallSize && block > kMaxSmallSize) {
+    // Strings and arrays that keep growing, the system can often do it in
+    // place.
+    void* moved = realloc(HeaderOf(ptr), block);
+    if(!moved)
+      return nullptr;
+    AndJSStats::Add(&arena->stats_->heap_allocs, 1);
+    AndJSStats::Add(&arena->stats_->heap_system_allocs, 1);
+    arena->AddReserved(static_cast<int64_t>(block) - static_cast<int64_t>(old_block));
+    *static_cast<uint64_t*>(moved) = block;
+    state->malloc_size = state->malloc_size - old_block + block;
+    return static_cast<uint8_t*>(moved) + kHeaderSize;
+  }
+
+  void* moved = arena->AllocateBlock(size);
+  if(!moved)
+    return nullptr;
+  memcpy(moved, ptr, std::min(size, old_size));
+  arena->FreeBlockAt(ptr);
+  state->malloc_size = state->malloc_size - old_block + *HeaderOf(moved);
+  return moved;
+}
+
+// static
+size_t QuickJSArena::UsableSize(const void* ptr) {
+  return ptr ? *HeaderOf(ptr) - kHeaderSize : 0;
+}
+
+void* QuickJSArena::AllocateBlock(size_t size) {
+  size_t block = BlockSize(size);
+  AndJSStats::Add(&stats_->heap_allocs, 1);
+  uint8_t* start;
+  if(block > kMaxSmallSize) {
+    start = static_cast<uint8_t*>(malloc(block));
+    if(!start)
+      return nullptr;
+    AndJSStats::Add(&stats_->heap_system_allocs, 1);
+    AddReserved(block);
+  } else {
+    FreeBlock*& head = free_lists_[block / kGranule - 1];
+    if(head) {
+      FreeBlock* reused = head;
+      head = reused->next;
+      return reused;
+    }
+    if(static_cast<size_t>(chunk_end_ - chunk_pos_) < block) {
+      // What is left of the chunk becomes a free block of its own size.
+      size_t tail = chunk_end_ - chunk_pos_;
+      if(tail) {
+        *reinterpret_cast<uint64_t*>(chunk_pos_) = tail;
+        FreeBlockAt(chunk_pos_ + kHeaderSize);
+      }
+      if(!AddChunk())
+        return nullptr;
+    }
+    start = chunk_pos_;
+    chunk_pos_ += block;
+  }
+  *reinterpret_cast<uint64_t*>(start) = block;
+  return start + kHeaderSize;
+}
+
+void QuickJSArena::FreeBlockAt(void* ptr) {
+  size_t block = *HeaderOf(ptr);
+  if(block > kMaxSmallSize) {
+    free(HeaderOf(ptr));
+    AddReserved(-static_cast<int64_t>(block));
+    return;
+  }
+  FreeBlock*& head = free_lists_[block / kGranule - 1];
+  FreeBlock* freed = static_cast<FreeBlock*>(ptr);
+  freed->next = head;
+  head = freed;
+}
+
+bool QuickJSArena::AddChunk() {
+  uint8_t* chunk = static_cast<uint8_t*>(malloc(kChunkSize));
+  if(!chunk)
+    return false;
+  chunks_.push_back(chunk);
+  chunk_pos_ = chunk;
+  chunk_end_ = chunk + kChunkSize;
+  AndJSStats::Add(&stats_->heap_system_allocs, 1);
+  AddReserved(kChunkSize);
+  return true;
+}
+
+void QuickJSArena::AddReserved(int64_t bytes) {
+  reserved_bytes_ += bytes;
+  AndJSStats::Add(&stats_->heap_reserved_bytes, bytes);
+}
+
+}
@@ -0,0 +1,90 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_QUICKJS_ARENA_H__
+#define __ANDJS_QUICKJS_ARENA_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "base/macros.h"
+
+extern "C" {
+#include "quickjs.h"
+}
+
+namespace andjs {
+
+struct AndJSStats;
+
+// The allocator of one JSRuntime, passed to JS_NewRuntime2() with the arena
+// as its opaque. Blocks of up to kMaxSmallSize bytes, size header included,
+// are carved from kChunkSize chunks in 16 byte size classes, a freed block goes on the free list of
+// its class for the next allocation of that size. Chunks are only given
+// back to the system, all at once, when the arena is destroyed after
+// JS_FreeRuntime(). Larger blocks are malloc()ed one by one.
+//
+// Every block starts with its size, so JS_FreeRuntime() and
+// js_malloc_usable_size() need nothing else. The JSMallocState counters and
+// malloc limit of the runtime are kept like the default allocator does.
+// Single threaded, like the runtime.
+class QuickJSArena {
+  public:
+    static const size_t kChunkSize;
+    static const size_t kMaxSmallSize;
+    static const JSMallocFunctions kMallocFunctions;
+
+    explicit QuickJSArena(AndJSStats* stats);
+    ~QuickJSArena();
+
+    // Chunks and large blocks held from the system right now.
+    size_t reserved_bytes() const { return reserved_bytes_; }
+
+  private:
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+
+    static void* Malloc(JSMallocState* state, size_t size);
+    static void Free(JSMallocState* state, void* ptr);
+    static void* Realloc(JSMallocState* state, void* ptr, size_t size);
+    static size_t UsableSize(const void* ptr);
+
+    // A block with room for |size| bytes after the header, without
+    // accounting. Returns the pointer handed to QuickJS.
+    void* AllocateBlock(size_t size);
+    void FreeBlockAt(void* ptr);
+    bool AddChunk();
+    void AddReserved(int64_t bytes);
+
+    AndJSStats* stats_;
+    std::vector<void*> chunks_;
+    // Unused tail of the newest chunk.
+    uint8_t* chunk_pos_;
+    uint8_t* chunk_end_;
+    std::vector<FreeBlock*> free_lists_;
+    size_t reserved_bytes_;
+
+    DISALLOW_COPY_AND_ASSIGN(QuickJSArena);
+};
+
+}
+#endif
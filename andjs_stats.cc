@@ -0,0 +1,193 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_stats.h"
+
+#include "base/values.h"
+
+namespace andjs {
+
+AndJSStats::AndJSStats()
+    : scripts_run(0),
+      compile_time_us(0),
+      run_time_us(0),
+      bridge_calls(0),
+      bridge_direct_calls(0),
+      bridge_batched_calls(0),
+      bridge_batch_flushes(0),
+      bytes_converted(0),
+      exceptions(0),
+      terminated_runs(0),
+      modules_loaded(0),
+      module_cache_hits(0),
+      init_time_us(0),
+      contexts_created(0),
+      context_create_time_us(0),
+      context_resets(0),
+      context_reset_time_us(0),
+      workers_started(0),
+      worker_messages(0),
+      hibernations(0),
+      hibernate_time_us(0),
+      hibernated_bytes(0),
+      released_heap_bytes(0),
+      resumes(0),
+      resume_time_us(0),
+      gc_count(0),
+      gc_pause_us(0),
+      gc_max_pause_us(0),
+      idle_gc_time_us(0),
+      memory_pressure_gcs(0),
+      events_dispatched(0),
+      events_delivered(0),
+      events_coalesced(0),
+      events_dropped(0),
+      events_blocked(0),
+      high_scripts(0),
+      high_queue_wait_us(0),
+      high_max_queue_wait_us(0),
+      normal_scripts(0),
+      normal_queue_wait_us(0),
+      normal_max_queue_wait_us(0),
+      idle_scripts(0),
+      idle_queue_wait_us(0),
+      idle_max_queue_wait_us(0),
+      scripts_cancelled(0),
+      scripts_replaced(0),
+      structured_messages(0),
+      structured_bytes(0),
+      wasm_modules_loaded(0),
+      wasm_cache_hits(0),
+      wasm_compile_time_us(0),
+      wasm_cache_bytes_written(0),
+      heap_allocs(0),
+      heap_system_allocs(0),
+      heap_reserved_bytes(0),
+      array_buffer_allocs(0),
+      array_buffer_pool_hits(0),
+      array_buffer_bytes(0),
+      caller_calls(0),
+      caller_block_us(0),
+      caller_max_block_us(0),
+      engine_tasks(0),
+      engine_task_drains(0),
+      streamed_scripts(0),
+      stream_time_us(0),
+      stream_wait_us(0) {}
+
+AndJSStats::~AndJSStats() = default;
+
+// static
+size_t AndJSStats::EstimateValueSize(const base::Value& value) {
+  switch(value.type()) {
+    case base::Value::Type::STRING:
+      return value.GetString().size();
+    case base::Value::Type::BINARY:
+      return value.GetBlob().size();
+    case base::Value::Type::LIST: {
+      size_t size = 0;
+      for(const auto& item : value.GetList())
+        size += EstimateValueSize(item);
+      return size;
+    }
+    case base::Value::Type::DICTIONARY: {
+      size_t size = 0;
+      for(const auto& item : value.DictItems())
+        size += item.first.size() + EstimateValueSize(item.second);
+      return size;
+    }
+    default:
+      return sizeof(double);
+  }
+}
+
+std::unique_ptr<base::DictionaryValue> AndJSStats::ToValue() const {
+  std::unique_ptr<base::DictionaryValue> dict(new base::DictionaryValue());
+  // base::Value has no 64 bit integer, doubles keep the counters exact up to 2^53.
+  dict->SetDouble("scriptsRun", scripts_run.load());
+  dict->SetDouble("compileTimeUs", compile_time_us.load());
+  dict->SetDouble("runTimeUs", run_time_us.load());
+  dict->SetDouble("bridgeCalls", bridge_calls.load());
+  dict->SetDouble("bridgeDirectCalls", bridge_direct_calls.load());
+  dict->SetDouble("bridgeBatchedCalls", bridge_batched_calls.load());
+  dict->SetDouble("bridgeBatchFlushes", bridge_batch_flushes.load());
+  dict->SetDouble("bytesConverted", bytes_converted.load());
+  dict->SetDouble("exceptions", exceptions.load());
+  dict->SetDouble("terminatedRuns", terminated_runs.load());
+  dict->SetDouble("modulesLoaded", modules_loaded.load());
+  dict->SetDouble("moduleCacheHits", module_cache_hits.load());
+  dict->SetDouble("initTimeUs", init_time_us.load());
+  dict->SetDouble("contextsCreated", contexts_created.load());
+  dict->SetDouble("contextCreateTimeUs", context_create_time_us.load());
+  dict->SetDouble("contextResets", context_resets.load());
+  dict->SetDouble("contextResetTimeUs", context_reset_time_us.load());
+  dict->SetDouble("workersStarted", workers_started.load());
+  dict->SetDouble("workerMessages", worker_messages.load());
+  dict->SetDouble("hibernations", hibernations.load());
+  dict->SetDouble("hibernateTimeUs", hibernate_time_us.load());
+  dict->SetDouble("hibernatedBytes", hibernated_bytes.load());
+  dict->SetDouble("releasedHeapBytes", released_heap_bytes.load());
+  dict->SetDouble("resumes", resumes.load());
+  dict->SetDouble("resumeTimeUs", resume_time_us.load());
+  dict->SetDouble("gcCount", gc_count.load());
+  dict->SetDouble("gcPauseUs", gc_pause_us.load());
+  dict->SetDouble("gcMaxPauseUs", gc_max_pause_us.load());
+  dict->SetDouble("idleGcTimeUs", idle_gc_time_us.load());
+  dict->SetDouble("memoryPressureGcs", memory_pressure_gcs.load());
+  dict->SetDouble("eventsDispatched", events_dispatched.load());
+  dict->SetDouble("eventsDelivered", events_delivered.load());
+  dict->SetDouble("eventsCoalesced", events_coalesced.load());
+  dict->SetDouble("eventsDropped", events_dropped.load());
+  dict->SetDouble("eventsBlocked", events_blocked.load());
+  dict->SetDouble("highScripts", high_scripts.load());
+  dict->SetDouble("highQueueWaitUs", high_queue_wait_us.load());
+  dict->SetDouble("highMaxQueueWaitUs", high_max_queue_wait_us.load());
+  dict->SetDouble("normalScripts", normal_scripts.load());
+  dict->SetDouble("normalQueueWaitUs", normal_queue_wait_us.load());
+  dict->SetDouble("normalMaxQueueWaitUs", normal_max_queue_wait_us.load());
+  dict->SetDouble("idleScripts", idle_scripts.load());
+  dict->SetDouble("idleQueueWaitUs", idle_queue_wait_us.load());
+  dict->SetDouble("idleMaxQueueWaitUs", idle_max_queue_wait_us.load());
+  dict->SetDouble("scriptsCancelled", scripts_cancelled.load());
+  dict->SetDouble("scriptsReplaced", scripts_replaced.load());
+  dict->SetDouble("structuredMessages", structured_messages.load());
+  dict->SetDouble("structuredBytes", structured_bytes.load());
+  dict->SetDouble("wasmModulesLoaded", wasm_modules_loaded.load());
+  dict->SetDouble("wasmCacheHits", wasm_cache_hits.load());
+  dict->SetDouble("wasmCompileTimeUs", wasm_compile_time_us.load());
+  dict->SetDouble("wasmCacheBytesWritten", wasm_cache_bytes_written.load());
+  dict->SetDouble("heapAllocs", heap_allocs.load());
+  dict->SetDouble("heapSystemAllocs", heap_system_allocs.load());
+  dict->SetDouble("heapReservedBytes", heap_reserved_bytes.load());
+  dict->SetDouble("arrayBufferAllocs", array_buffer_allocs.load());
+  dict->SetDouble("arrayBufferPoolHits", array_buffer_pool_hits.load());
+  dict->SetDouble("arrayBufferBytes", array_buffer_bytes.load());
+  dict->SetDouble("callerCalls", caller_calls.load());
+  dict->SetDouble("callerBlockUs", caller_block_us.load());
+  dict->SetDouble("callerMaxBlockUs", caller_max_block_us.load());
+  dict->SetDouble("engineTasks", engine_tasks.load());
+  dict->SetDouble("engineTaskDrains", engine_task_drains.load());
+  dict->SetDouble("streamedScripts", streamed_scripts.load());
+  dict->SetDouble("streamTimeUs", stream_time_us.load());
+  dict->SetDouble("streamWaitUs", stream_wait_us.load());
+  return dict;
+}
+
+}
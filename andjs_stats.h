@@ -0,0 +1,182 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_STATS_H__
+#define __ANDJS_STATS_H__
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include "base/macros.h"
+#include "base/time/time.h"
+
+namespace base {
+class DictionaryValue;
+class Value;
+}
+
+namespace andjs {
+
+// Cheap always-on counters of one AndJS instance. Written on the JSTask
+// thread, read from any thread by AndJS.getStats().
+struct AndJSStats {
+  AndJSStats();
+  ~AndJSStats();
+
+  std::atomic<int64_t> scripts_run;
+  std::atomic<int64_t> compile_time_us;
+  std::atomic<int64_t> run_time_us;
+  std::atomic<int64_t> bridge_calls;
+  // Bridge calls that went through a generated binding, no reflection.
+  std::atomic<int64_t> bridge_direct_calls;
+  // Calls of batched methods, and the upcalls that replayed them in java.
+  std::atomic<int64_t> bridge_batched_calls;
+  std::atomic<int64_t> bridge_batch_flushes;
+  std::atomic<int64_t> bytes_converted;
+  std::atomic<int64_t> exceptions;
+  std::atomic<int64_t> terminated_runs;
+  // Bundle modules instantiated, and how many of them skipped parsing.
+  std::atomic<int64_t> modules_loaded;
+  std::atomic<int64_t> module_cache_hits;
+  // Engine start up against extra global scopes on the same heap.
+  std::atomic<int64_t> init_time_us;
+  std::atomic<int64_t> contexts_created;
+  std::atomic<int64_t> context_create_time_us;
+  std::atomic<int64_t> context_resets;
+  std::atomic<int64_t> context_reset_time_us;
+  // Workers started by scripts, messages posted in either direction.
+  std::atomic<int64_t> workers_started;
+  std::atomic<int64_t> worker_messages;
+  // Hibernations and the resumes after them. hibernated_bytes is what the
+  // current hibernation keeps, released_heap_bytes the engine heap the last
+  // one gave back.
+  std::atomic<int64_t> hibernations;
+  std::atomic<int64_t> hibernate_time_us;
+  std::atomic<int64_t> hibernated_bytes;
+  std::atomic<int64_t> released_heap_bytes;
+  std::atomic<int64_t> resumes;
+  std::atomic<int64_t> resume_time_us;
+  // Garbage collection pauses on the engine thread. V8 counts every GC,
+  // QuickJS the collections AndJS asks for. idle_gc_time_us is the part
+  // done while JSTask was idle, memory_pressure_gcs the collections
+  // asked for by memory pressure.
+  std::atomic<int64_t> gc_count;
+  std::atomic<int64_t> gc_pause_us;
+  std::atomic<int64_t> gc_max_pause_us;
+  std::atomic<int64_t> idle_gc_time_us;
+  std::atomic<int64_t> memory_pressure_gcs;
+  // AndJS.dispatchEvent(): events pushed, events handed to the listeners,
+  // events merged into others by coalescing, events a full queue dropped
+  // and pushes that waited for room.
+  std::atomic<int64_t> events_dispatched;
+  std::atomic<int64_t> events_delivered;
+  std::atomic<int64_t> events_coalesced;
+  std::atomic<int64_t> events_dropped;
+  std::atomic<int64_t> events_blocked;
+  // Script loads by AndJS.Priority lane: scripts run, their total and
+  // longest time in the queue. Cancelled ones and the ones a load with the
+  // same replace key took the place of are counted apart.
+  std::atomic<int64_t> high_scripts;
+  std::atomic<int64_t> high_queue_wait_us;
+  std::atomic<int64_t> high_max_queue_wait_us;
+  std::atomic<int64_t> normal_scripts;
+  std::atomic<int64_t> normal_queue_wait_us;
+  std::atomic<int64_t> normal_max_queue_wait_us;
+  std::atomic<int64_t> idle_scripts;
+  std::atomic<int64_t> idle_queue_wait_us;
+  std::atomic<int64_t> idle_max_queue_wait_us;
+  std::atomic<int64_t> scripts_cancelled;
+  std::atomic<int64_t> scripts_replaced;
+  // postToJava() messages and AndJS.dispatchStructuredEvent() events, and
+  // their size in the binary format.
+  std::atomic<int64_t> structured_messages;
+  std::atomic<int64_t> structured_bytes;
+  // loadWasm(): modules loaded, the ones found in the cache, the time spent
+  // deserializing or compiling them and the bytes written to the cache.
+  std::atomic<int64_t> wasm_modules_loaded;
+  std::atomic<int64_t> wasm_cache_hits;
+  std::atomic<int64_t> wasm_compile_time_us;
+  std::atomic<int64_t> wasm_cache_bytes_written;
+  // QuickJS heap blocks handed out by the runtime's arena, the malloc()
+  // calls it made for them and the bytes it holds from the system. For V8,
+  // the ArrayBuffers allocated while its isolate was entered, the ones the
+  // pool had a free block for and their bytes.
+  std::atomic<int64_t> heap_allocs;
+  std::atomic<int64_t> heap_system_allocs;
+  std::atomic<int64_t> heap_reserved_bytes;
+  std::atomic<int64_t> array_buffer_allocs;
+  std::atomic<int64_t> array_buffer_pool_hits;
+  std::atomic<int64_t> array_buffer_bytes;
+  // JNI calls into the instance, the time they spent in it and the longest
+  // one. The engine work they queue on JSTask, and the drains running it.
+  std::atomic<int64_t> caller_calls;
+  std::atomic<int64_t> caller_block_us;
+  std::atomic<int64_t> caller_max_block_us;
+  std::atomic<int64_t> engine_tasks;
+  std::atomic<int64_t> engine_task_drains;
+  // Script files V8 parsed and compiled on the streaming thread, the time
+  // that took there and the time JSTask still waited for it.
+  std::atomic<int64_t> streamed_scripts;
+  std::atomic<int64_t> stream_time_us;
+  std::atomic<int64_t> stream_wait_us;
+
+  static void Add(std::atomic<int64_t>* counter, int64_t value) {
+    counter->fetch_add(value, std::memory_order_relaxed);
+  }
+
+  static void Max(std::atomic<int64_t>* counter, int64_t value) {
+    int64_t current = counter->load(std::memory_order_relaxed);
+    while(current < value && !counter->compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+  }
+
+  // Counts one GC pause of |pause|.
+  void AddGCPause(base::TimeDelta pause) {
+    Add(&gc_count, 1);
+    Add(&gc_pause_us, pause.InMicroseconds());
+    Max(&gc_max_pause_us, pause.InMicroseconds());
+  }
+
+  // Rough size in bytes of a value passed over the java bridge.
+  static size_t EstimateValueSize(const base::Value& value);
+
+  std::unique_ptr<base::DictionaryValue> ToValue() const;
+
+  DISALLOW_COPY_AND_ASSIGN(AndJSStats);
+};
+
+// Adds the lifetime of the scope to |counter| in microseconds.
+class ScopedStatsTimer {
+  public:
+    explicit ScopedStatsTimer(std::atomic<int64_t>* counter)
+        : counter_(counter), start_(base::TimeTicks::Now()) {}
+    ~ScopedStatsTimer() {
+      AndJSStats::Add(counter_, (base::TimeTicks::Now() - start_).InMicroseconds());
+    }
+
+  private:
+    std::atomic<int64_t>* counter_;
+    base::TimeTicks start_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedStatsTimer);
+};
+
+}
+#endif
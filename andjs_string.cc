@@ -0,0 +1,190 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_string.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ANDJS_STRING_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ANDJS_STRING_SSE2 1
+#endif
+
+#include "base/android/jni_string.h"
+#include "base/strings/string_piece.h"
+#include "base/strings/string_util.h"
+#include "base/strings/utf_string_conversions.h"
+
+namespace andjs {
+
+namespace {
+
+// Characters per early exit check of the vector loop.
+const size_t kScanBlock = 64;
+
+#if defined(ANDJS_STRING_NEON)
+// The classes are split at powers of two, so the widest lane of the OR of
+// all characters is as good as their OR.
+uint16_t MaxLane(uint16x8_t v) {
+#if defined(__aarch64__)
+  return vmaxvq_u16(v);
+#else
+  uint16x4_t m = vpmax_u16(vget_low_u16(v), vget_high_u16(v));
+  m = vpmax_u16(m, m);
+  m = vpmax_u16(m, m);
+  return vget_lane_u16(m, 0);
+#endif
+}
+#endif
+
+StringWidth WidthOf(uint16_t bits) {
+  if(bits < 0x80)
+    return StringWidth::kASCII;
+  return bits < 0x100 ? StringWidth::kLatin1 : StringWidth::kUTF16;
+}
+
+}  // namespace
+
+StringWidth ScanUTF16(const base::char16* chars, size_t length) {
+  const uint16_t* p = reinterpret_cast<const uint16_t*>(chars);
+  uint16_t bits = 0;
+  size_t i = 0;
+#if defined(ANDJS_STRING_NEON)
+  uint16x8_t acc = vdupq_n_u16(0);
+  while(i + kScanBlock <= length) {
+    for(size_t end = i + kScanBlock; i < end; i += 8)
+      acc = vorrq_u16(acc, vld1q_u16(p + i));
+    // Nothing wider than UTF-16 to find once a high byte is set.
+    if(MaxLane(acc) >= 0x100)
+      return StringWidth::kUTF16;
+  }
+  for(; i + 8 <= length; i += 8)
+    acc = vorrq_u16(acc, vld1q_u16(p + i));
+  bits = MaxLane(acc);
+#elif defined(ANDJS_STRING_SSE2)
+  const __m128i high = _mm_set1_epi16(static_cast<short>(0xff00));
+  __m128i acc = _mm_setzero_si128();
+  while(i + kScanBlock <= length) {
+    for(size_t end = i + kScanBlock; i < end; i += 8)
+      acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+    if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(acc, high), _mm_setzero_si128())) != 0xffff)
+      return StringWidth::kUTF16;
+  }
+  for(; i + 8 <= length; i += 8)
+    acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+  uint16_t lanes[8];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+  for(uint16_t lane : lanes)
+    bits |= lane;
+#endif
+  for(; i < length; i++)
+    bits |= p[i];
+  return WidthOf(bits);
+}
+
+ScriptString::ScriptString() : encoding_(kASCII) {}
+
+ScriptString::ScriptString(std::string utf8)
+    : encoding_(kUTF8), bytes_(std::move(utf8)) {}
+
+ScriptString::ScriptString(ScriptString&& other) = default;
+
+ScriptString& ScriptString::operator=(ScriptString&& other) = default;
+
+ScriptString::~ScriptString() = default;
+
+// static
+ScriptString ScriptString::FromJavaString(JNIEnv* env, jstring str) {
+  ScriptString result;
+  if(!str)
+    return result;
+  jsize length = env->GetStringLength(str);
+  const jchar* chars = env->GetStringCritical(str, nullptr);
+  if(!chars)
+    return result;
+
+  const base::char16* data = reinterpret_cast<const base::char16*>(chars);
+  switch(ScanUTF16(data, length)) {
+    case StringWidth::kASCII:
+      result.encoding_ = kASCII;
+      break;
+    case StringWidth::kLatin1:
+      result.encoding_ = kLatin1;
+      break;
+    case StringWidth::kUTF16:
+      result.encoding_ = kUTF16;
+      break;
+  }
+  if(result.encoding_ == kUTF16) {
+    result.chars_.assign(data, length);
+  } else {
+    // Clang vectorizes the narrowing loop.
+    result.bytes_.resize(length);
+    for(jsize i = 0; i < length; i++)
+      result.bytes_[i] = static_cast<char>(data[i]);
+  }
+  env->ReleaseStringCritical(str, chars);
+  return result;
+}
+
+size_t ScriptString::length() const {
+  return encoding_ == kUTF16 ? chars_.size() : bytes_.size();
+}
+
+std::string ScriptString::ToUTF8() const {
+  switch(encoding_) {
+    case kASCII:
+    case kUTF8:
+      return bytes_;
+    case kLatin1: {
+      std::string utf8;
+      utf8.reserve(bytes_.size() * 2);
+      for(char c : bytes_) {
+        uint8_t b = static_cast<uint8_t>(c);
+        if(b < 0x80) {
+          utf8.push_back(c);
+        } else {
+          utf8.push_back(static_cast<char>(0xc0 | (b >> 6)));
+          utf8.push_back(static_cast<char>(0x80 | (b & 0x3f)));
+        }
+      }
+      return utf8;
+    }
+    case kUTF16:
+      return base::UTF16ToUTF8(chars_);
+  }
+  return std::string();
+}
+
+base::android::ScopedJavaLocalRef<jstring> NewJavaStringFromUTF8(JNIEnv* env,
+                                                                 const char* utf8,
+                                                                 size_t length) {
+  base::StringPiece str(utf8, length);
+  // Modified UTF-8 only differs from UTF-8 in NUL and outside the BMP.
+  if(base::IsStringASCII(str) && !memchr(utf8, 0, length))
+    return base::android::ScopedJavaLocalRef<jstring>(env, env->NewStringUTF(utf8));
+  return base::android::ConvertUTF8ToJavaString(env, str);
+}
+
+}  // namespace andjs
@@ -0,0 +1,93 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_STRING_H__
+#define __ANDJS_STRING_H__
+#include <jni.h>
+#include <stddef.h>
+#include <string>
+
+#include "base/android/scoped_java_ref.h"
+#include "base/macros.h"
+#include "base/strings/string16.h"
+
+namespace andjs {
+
+// Widest character class of a string, what decides how an engine stores it.
+enum class StringWidth {
+  kASCII,
+  kLatin1,
+  kUTF16,
+};
+
+// Vectorized on ARM NEON and SSE2, scalar elsewhere.
+StringWidth ScanUTF16(const base::char16* chars, size_t length);
+
+// Script text or a bridge string on its way into an engine. Java strings
+// keep one byte per character when they are Latin-1 and stay UTF-16
+// otherwise, so V8 gets them without transcoding; files are UTF-8.
+class ScriptString {
+  public:
+    enum Encoding {
+      kASCII,
+      kLatin1,
+      kUTF16,
+      kUTF8,
+    };
+
+    ScriptString();
+    explicit ScriptString(std::string utf8);
+    ScriptString(ScriptString&& other);
+    ScriptString& operator=(ScriptString&& other);
+    ~ScriptString();
+
+    // Reads |str| with GetStringCritical, the critical region only covers
+    // the width scan and one copy.
+    static ScriptString FromJavaString(JNIEnv* env, jstring str);
+
+    Encoding encoding() const { return encoding_; }
+    // In characters, or bytes for kUTF8.
+    size_t length() const;
+    // kASCII, kLatin1 and kUTF8.
+    const std::string& bytes() const { return bytes_; }
+    // kUTF16.
+    const base::string16& chars() const { return chars_; }
+
+    // ASCII is UTF-8 as is, see ToUTF8().
+    bool IsUTF8() const { return encoding_ == kASCII || encoding_ == kUTF8; }
+    std::string ToUTF8() const;
+
+  private:
+    Encoding encoding_;
+    std::string bytes_;
+    base::string16 chars_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScriptString);
+};
+
+// NUL terminated |utf8| of |length| bytes to a java string. ASCII goes
+// straight to NewStringUTF, anything else through UTF-16.
+base::android::ScopedJavaLocalRef<jstring> NewJavaStringFromUTF8(JNIEnv* env,
+                                                                 const char* utf8,
+                                                                 size_t length);
+
+}  // namespace andjs
+#endif
@@ -0,0 +1,112 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_structured.h"
+
+#include "base/android/jni_android.h"
+#include "base/android/jni_string.h"
+#include "base/trace_event/trace_event.h"
+
+#include "andjs/andjs_stats.h"
+#include "jni/StructuredCodec_jni.h"
+
+using base::android::ScopedJavaLocalRef;
+
+namespace andjs {
+
+StructuredWriter::StructuredWriter() {
+  buffer_.reserve(256);
+  Write(kVersion);
+}
+
+StructuredWriter::~StructuredWriter() = default;
+
+uint8_t* StructuredWriter::WriteData(StructuredTag tag, uint32_t length, size_t unit_size) {
+  WriteTag(tag);
+  Write(length);
+  size_t size = buffer_.size();
+  buffer_.resize(size + length * unit_size);
+  return &buffer_[size];
+}
+
+size_t StructuredWriter::BeginContainer(StructuredTag tag) {
+  WriteTag(tag);
+  size_t offset = buffer_.size();
+  Write<uint32_t>(0);
+  return offset;
+}
+
+void StructuredWriter::EndContainer(size_t offset, uint32_t count) {
+  memcpy(&buffer_[offset], &count, sizeof(count));
+}
+
+StructuredReader::StructuredReader(const uint8_t* data, size_t size)
+    : data_(data), size_(size), position_(0) {}
+
+bool StructuredReader::ReadHeader() {
+  uint8_t version;
+  return Read(&version) && version == StructuredWriter::kVersion;
+}
+
+bool StructuredReader::ReadTag(StructuredTag* tag) {
+  uint8_t value;
+  if(!Read(&value) || value > static_cast<uint8_t>(StructuredTag::kBytes))
+    return false;
+  *tag = static_cast<StructuredTag>(value);
+  return true;
+}
+
+bool StructuredReader::ReadData(uint32_t length, size_t unit_size, const uint8_t** data) {
+  if((size_ - position_) / unit_size < length)
+    return false;
+  *data = data_ + position_;
+  position_ += length * unit_size;
+  return true;
+}
+
+StructuredReceiver::StructuredReceiver(AndJSStats* stats) : stats_(stats) {}
+
+StructuredReceiver::~StructuredReceiver() = default;
+
+void StructuredReceiver::Set(JNIEnv* env, const base::android::JavaRef<jobject>& receiver) {
+  base::AutoLock locker(lock_);
+  receiver_.Reset(env, receiver.obj());
+}
+
+bool StructuredReceiver::Deliver(const std::string& channel, const StructuredWriter& message) {
+  TRACE_EVENT2("andjs", "StructuredReceiver::Deliver", "channel", channel, "bytes", message.size());
+  JNIEnv* env = base::android::AttachCurrentThread();
+  ScopedJavaLocalRef<jobject> receiver;
+  {
+    base::AutoLock locker(lock_);
+    receiver.Reset(env, receiver_.obj());
+  }
+  if(receiver.is_null())
+    return false;
+  AndJSStats::Add(&stats_->structured_messages, 1);
+  AndJSStats::Add(&stats_->structured_bytes, message.size());
+  // Java decodes during the upcall and doesn't keep the buffer.
+  ScopedJavaLocalRef<jobject> data(env,
+    env->NewDirectByteBuffer(const_cast<uint8_t*>(message.data()), message.size()));
+  Java_StructuredCodec_deliver(env, receiver, base::android::ConvertUTF8ToJavaString(env, channel), data);
+  return true;
+}
+
+}
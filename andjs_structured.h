@@ -0,0 +1,173 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_STRUCTURED_H__
+#define __ANDJS_STRUCTURED_H__
+#include <jni.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "base/android/scoped_java_ref.h"
+#include "base/macros.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+
+namespace andjs {
+
+struct AndJSStats;
+
+// The binary format of postToJava() and AndJS.dispatchStructuredEvent(),
+// read and written without a base::Value tree in between. StructuredCodec
+// on the java side speaks it as well, so unlike the structured clones of
+// workers it is our own: a version byte, then one value. A value is a tag
+// byte and its payload, numbers little endian:
+//   kInt32 int32, kDouble float64,
+//   strings uint32 length in units, then the units,
+//   kBytes uint32 length, then the bytes,
+//   kArray uint32 count, then the items,
+//   kObject uint32 count, then key string and value pairs.
+// Keep the values in sync with StructuredCodec.java.
+enum class StructuredTag : uint8_t {
+  kNull = 0,
+  kUndefined = 1,
+  kFalse = 2,
+  kTrue = 3,
+  kInt32 = 4,
+  kDouble = 5,
+  kLatin1String = 6,
+  kTwoByteString = 7,
+  kUtf8String = 8,
+  kArray = 9,
+  kObject = 10,
+  kBytes = 11,
+};
+
+class StructuredWriter {
+  public:
+    static const uint8_t kVersion = 1;
+    // Deeper values are most likely cyclic, the engines throw instead.
+    static const int kMaxDepth = 128;
+
+    StructuredWriter();
+    ~StructuredWriter();
+
+    void WriteTag(StructuredTag tag) { Write(static_cast<uint8_t>(tag)); }
+    void WriteInt32(int32_t value) {
+      WriteTag(StructuredTag::kInt32);
+      Write(value);
+    }
+    void WriteDouble(double value) {
+      WriteTag(StructuredTag::kDouble);
+      Write(value);
+    }
+    // Room for a string, byte array or container payload of |length| units
+    // of |unit_size| bytes, valid until the next write.
+    uint8_t* WriteData(StructuredTag tag, uint32_t length, size_t unit_size);
+    void WriteUtf8(const char* str, size_t length) {
+      memcpy(WriteData(StructuredTag::kUtf8String, length, 1), str, length);
+    }
+    // kArray and kObject. The count is set by EndContainer() once the items
+    // are written.
+    size_t BeginContainer(StructuredTag tag);
+    void EndContainer(size_t offset, uint32_t count);
+    // Appends the value another writer wrote, without its version byte.
+    void AppendValue(const std::vector<uint8_t>& written) {
+      if(written.size() > 1)
+        buffer_.insert(buffer_.end(), written.begin() + 1, written.end());
+    }
+
+    const uint8_t* data() const { return buffer_.data(); }
+    size_t size() const { return buffer_.size(); }
+    std::vector<uint8_t> Take() { return std::move(buffer_); }
+
+  private:
+    template <typename T>
+    void Write(T value) {
+      size_t size = buffer_.size();
+      buffer_.resize(size + sizeof(T));
+      memcpy(&buffer_[size], &value, sizeof(T));
+    }
+
+    std::vector<uint8_t> buffer_;
+
+    DISALLOW_COPY_AND_ASSIGN(StructuredWriter);
+};
+
+// Reads what StructuredWriter or StructuredCodec wrote. Every method
+// returns false on truncated or malformed input.
+class StructuredReader {
+  public:
+    StructuredReader(const uint8_t* data, size_t size);
+
+    // Checks the version byte.
+    bool ReadHeader();
+    bool ReadTag(StructuredTag* tag);
+    bool ReadInt32(int32_t* value) { return Read(value); }
+    bool ReadDouble(double* value) { return Read(value); }
+    bool ReadLength(uint32_t* length) { return Read(length); }
+    // The payload of |length| units of |unit_size| bytes. Not aligned.
+    bool ReadData(uint32_t length, size_t unit_size, const uint8_t** data);
+    bool at_end() const { return position_ == size_; }
+
+  private:
+    template <typename T>
+    bool Read(T* value) {
+      if(size_ - position_ < sizeof(T))
+        return false;
+      memcpy(value, data_ + position_, sizeof(T));
+      position_ += sizeof(T);
+      return true;
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+
+    DISALLOW_COPY_AND_ASSIGN(StructuredReader);
+};
+
+// Where the postToJava() messages of an instance go, the
+// AndJS.StructuredReceiver set by AndJS.setStructuredReceiver().
+class StructuredReceiver {
+  public:
+    explicit StructuredReceiver(AndJSStats* stats);
+    ~StructuredReceiver();
+
+    // Any thread. A null |receiver| drops the messages from now on.
+    void Set(JNIEnv* env, const base::android::JavaRef<jobject>& receiver);
+
+    // JSTask thread. Hands |message| to java as a direct ByteBuffer that is
+    // only valid during the upcall. False without a receiver.
+    bool Deliver(const std::string& channel, const StructuredWriter& message);
+
+  private:
+    AndJSStats* stats_;
+    base::android::ScopedJavaGlobalRef<jobject> receiver_ GUARDED_BY(lock_);
+    base::Lock lock_;
+
+    DISALLOW_COPY_AND_ASSIGN(StructuredReceiver);
+};
+
+}
+#endif
@@ -0,0 +1,248 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/andjs_structured.h"
+
+#include <string.h>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace andjs {
+
+namespace {
+
+// Reads one value of any kind, the way the engines walk a message.
+bool SkipValue(StructuredReader* reader, int depth) {
+  StructuredTag tag;
+  if(depth > StructuredWriter::kMaxDepth || !reader->ReadTag(&tag))
+    return false;
+  uint32_t length;
+  const uint8_t* data;
+  switch(tag) {
+    case StructuredTag::kNull:
+    case StructuredTag::kUndefined:
+    case StructuredTag::kFalse:
+    case StructuredTag::kTrue:
+      return true;
+    case StructuredTag::kInt32: {
+      int32_t value;
+      return reader->ReadInt32(&value);
+    }
+    case StructuredTag::kDouble: {
+      double value;
+      return reader->ReadDouble(&value);
+    }
+    case StructuredTag::kLatin1String:
+    case StructuredTag::kUtf8String:
+    case StructuredTag::kBytes:
+      return reader->ReadLength(&length) && reader->ReadData(length, 1, &data);
+    case StructuredTag::kTwoByteString:
+      return reader->ReadLength(&length) && reader->ReadData(length, sizeof(uint16_t), &data);
+    case StructuredTag::kArray:
+      if(!reader->ReadLength(&length))
+        return false;
+      for(uint32_t i = 0; i < length; i++) {
+        if(!SkipValue(reader, depth + 1))
+          return false;
+      }
+      return true;
+    case StructuredTag::kObject:
+      if(!reader->ReadLength(&length))
+        return false;
+      for(uint32_t i = 0; i < length * 2; i++) {
+        if(!SkipValue(reader, depth + 1))
+          return false;
+      }
+      return true;
+  }
+  return false;
+}
+
+bool ReadMessage(const uint8_t* data, size_t size) {
+  StructuredReader reader(data, size);
+  return reader.ReadHeader() && SkipValue(&reader, 0) && reader.at_end();
+}
+
+void ExpectTag(StructuredReader* reader, StructuredTag expected) {
+  StructuredTag tag;
+  ASSERT_TRUE(reader->ReadTag(&tag));
+  EXPECT_EQ(static_cast<int>(expected), static_cast<int>(tag));
+}
+
+// {"list": [1, 2.5, "x"], "bytes": Uint8Array(3), "two": u"é中"}
+std::vector<uint8_t> WriteSample() {
+  StructuredWriter writer;
+  size_t object = writer.BeginContainer(StructuredTag::kObject);
+  writer.WriteUtf8("list", 4);
+  size_t array = writer.BeginContainer(StructuredTag::kArray);
+  writer.WriteInt32(1);
+  writer.WriteDouble(2.5);
+  writer.WriteUtf8("x", 1);
+  writer.EndContainer(array, 3);
+  writer.WriteUtf8("bytes", 5);
+  memcpy(writer.WriteData(StructuredTag::kBytes, 3, 1), "\x00\xff\x7f", 3);
+  writer.WriteUtf8("two", 3);
+  const uint16_t units[] = { 0xe9, 0x4e2d };
+  memcpy(writer.WriteData(StructuredTag::kTwoByteString, 2, sizeof(uint16_t)), units, sizeof(units));
+  writer.EndContainer(object, 3);
+  return writer.Take();
+}
+
+TEST(StructuredTest, RoundTripsScalars) {
+  StructuredWriter writer;
+  writer.WriteTag(StructuredTag::kNull);
+  writer.WriteTag(StructuredTag::kUndefined);
+  writer.WriteTag(StructuredTag::kFalse);
+  writer.WriteTag(StructuredTag::kTrue);
+  writer.WriteInt32(std::numeric_limits<int32_t>::min());
+  writer.WriteInt32(std::numeric_limits<int32_t>::max());
+  writer.WriteDouble(-0.0);
+  writer.WriteDouble(std::numeric_limits<double>::quiet_NaN());
+  writer.WriteDouble(std::numeric_limits<double>::infinity());
+
+  StructuredReader reader(writer.data(), writer.size());
+  ASSERT_TRUE(reader.ReadHeader());
+  ExpectTag(&reader, StructuredTag::kNull);
+  ExpectTag(&reader, StructuredTag::kUndefined);
+  ExpectTag(&reader, StructuredTag::kFalse);
+  ExpectTag(&reader, StructuredTag::kTrue);
+  int32_t int_value;
+  ExpectTag(&reader, StructuredTag::kInt32);
+  ASSERT_TRUE(reader.ReadInt32(&int_value));
+  EXPECT_EQ(std::numeric_limits<int32_t>::min(), int_value);
+  ExpectTag(&reader, StructuredTag::kInt32);
+  ASSERT_TRUE(reader.ReadInt32(&int_value));
+  EXPECT_EQ(std::numeric_limits<int32_t>::max(), int_value);
+  double double_value;
+  ExpectTag(&reader, StructuredTag::kDouble);
+  ASSERT_TRUE(reader.ReadDouble(&double_value));
+  EXPECT_EQ(0.0, double_value);
+  EXPECT_TRUE(std::signbit(double_value));
+  ExpectTag(&reader, StructuredTag::kDouble);
+  ASSERT_TRUE(reader.ReadDouble(&double_value));
+  EXPECT_TRUE(std::isnan(double_value));
+  ExpectTag(&reader, StructuredTag::kDouble);
+  ASSERT_TRUE(reader.ReadDouble(&double_value));
+  EXPECT_EQ(std::numeric_limits<double>::infinity(), double_value);
+  EXPECT_TRUE(reader.at_end());
+}
+
+TEST(StructuredTest, RoundTripsContainers) {
+  std::vector<uint8_t> message = WriteSample();
+  EXPECT_TRUE(ReadMessage(message.data(), message.size()));
+
+  StructuredReader reader(message.data(), message.size());
+  ASSERT_TRUE(reader.ReadHeader());
+  uint32_t length;
+  const uint8_t* data;
+  ExpectTag(&reader, StructuredTag::kObject);
+  ASSERT_TRUE(reader.ReadLength(&length));
+  EXPECT_EQ(3u, length);
+
+  ExpectTag(&reader, StructuredTag::kUtf8String);
+  ASSERT_TRUE(reader.ReadLength(&length));
+  ASSERT_TRUE(reader.ReadData(length, 1, &data));
+  EXPECT_EQ("list", std::string(reinterpret_cast<const char*>(data), length));
+  ExpectTag(&reader, StructuredTag::kArray);
+  ASSERT_TRUE(reader.ReadLength(&length));
+  EXPECT_EQ(3u, length);
+  for(uint32_t i = 0; i < length; i++)
+    ASSERT_TRUE(SkipValue(&reader, 1));
+
+  ASSERT_TRUE(SkipValue(&reader, 1));
+  ExpectTag(&reader, StructuredTag::kBytes);
+  ASSERT_TRUE(reader.ReadLength(&length));
+  ASSERT_TRUE(reader.ReadData(length, 1, &data));
+  EXPECT_EQ(std::vector<uint8_t>({ 0x00, 0xff, 0x7f }), std::vector<uint8_t>(data, data + length));
+
+  ASSERT_TRUE(SkipValue(&reader, 1));
+  ExpectTag(&reader, StructuredTag::kTwoByteString);
+  ASSERT_TRUE(reader.ReadLength(&length));
+  ASSERT_TRUE(reader.ReadData(length, sizeof(uint16_t), &data));
+  // Not aligned, read it the way the engines do.
+  uint16_t units[2];
+  ASSERT_EQ(2u, length);
+  memcpy(units, data, sizeof(units));
+  EXPECT_EQ(0xe9, units[0]);
+  EXPECT_EQ(0x4e2d, units[1]);
+  EXPECT_TRUE(reader.at_end());
+}
+
+TEST(StructuredTest, AppendsAnotherWritersValue) {
+  StructuredWriter inner;
+  inner.WriteInt32(42);
+  StructuredWriter writer;
+  size_t array = writer.BeginContainer(StructuredTag::kArray);
+  writer.AppendValue(inner.Take());
+  writer.AppendValue(WriteSample());
+  writer.EndContainer(array, 2);
+  EXPECT_TRUE(ReadMessage(writer.data(), writer.size()));
+}
+
+TEST(StructuredTest, RejectsBadHeaderAndTag) {
+  EXPECT_FALSE(ReadMessage(nullptr, 0));
+  const uint8_t wrong_version[] = { 2, static_cast<uint8_t>(StructuredTag::kNull) };
+  EXPECT_FALSE(ReadMessage(wrong_version, sizeof(wrong_version)));
+  const uint8_t unknown_tag[] = { StructuredWriter::kVersion, static_cast<uint8_t>(StructuredTag::kBytes) + 1 };
+  EXPECT_FALSE(ReadMessage(unknown_tag, sizeof(unknown_tag)));
+  const uint8_t trailing[] = { StructuredWriter::kVersion, static_cast<uint8_t>(StructuredTag::kNull), 0 };
+  EXPECT_FALSE(ReadMessage(trailing, sizeof(trailing)));
+}
+
+TEST(StructuredTest, RejectsEveryTruncation) {
+  std::vector<uint8_t> message = WriteSample();
+  for(size_t size = 0; size < message.size(); size++)
+    EXPECT_FALSE(ReadMessage(message.data(), size)) << size;
+}
+
+TEST(StructuredTest, RejectsLengthsPastTheEnd) {
+  StructuredWriter writer;
+  size_t offset = writer.BeginContainer(StructuredTag::kArray);
+  writer.EndContainer(offset, 0xffffffff);
+  EXPECT_FALSE(ReadMessage(writer.data(), writer.size()));
+
+  // A length whose byte size overflows 32 bits.
+  const uint8_t two_byte[] = { StructuredWriter::kVersion, static_cast<uint8_t>(StructuredTag::kTwoByteString),
+                               0x00, 0x00, 0x00, 0x80, 'a', 0 };
+  EXPECT_FALSE(ReadMessage(two_byte, sizeof(two_byte)));
+  const uint8_t bytes[] = { StructuredWriter::kVersion, static_cast<uint8_t>(StructuredTag::kBytes),
+                            0xff, 0xff, 0xff, 0xff, 1, 2, 3, 4 };
+  EXPECT_FALSE(ReadMessage(bytes, sizeof(bytes)));
+}
+
+TEST(StructuredTest, RejectsDeepNesting) {
+  StructuredWriter writer;
+  std::vector<size_t> offsets;
+  for(int i = 0; i <= StructuredWriter::kMaxDepth + 1; i++)
+    offsets.push_back(writer.BeginContainer(StructuredTag::kArray));
+  writer.EndContainer(offsets.back(), 0);
+  for(size_t i = 0; i + 1 < offsets.size(); i++)
+    writer.EndContainer(offsets[i], 1);
+  EXPECT_FALSE(ReadMessage(writer.data(), writer.size()));
+}
+
+}  // namespace
+
+}  // namespace andjs
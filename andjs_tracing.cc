@@ -0,0 +1,87 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_tracing.h"
+
+#include "base/bind.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/memory/ref_counted_memory.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/thread.h"
+#include "base/trace_event/trace_config.h"
+#include "base/trace_event/trace_log.h"
+
+namespace andjs {
+
+namespace {
+
+const char kDefaultCategories[] = "andjs,v8";
+
+void OnTraceDataCollected(std::string* json,
+                          base::WaitableEvent* done,
+                          const scoped_refptr<base::RefCountedString>& events,
+                          bool has_more_events) {
+  if(!json->empty() && !events->data().empty())
+    json->append(",");
+  json->append(events->data());
+  if(!has_more_events)
+    done->Signal();
+}
+
+void FlushTraceLog(std::string* json, base::WaitableEvent* done) {
+  base::trace_event::TraceLog::GetInstance()->Flush(
+    base::BindRepeating(&OnTraceDataCollected, json, done));
+}
+
+}  // namespace
+
+void StartTracing(const std::string& categories) {
+  base::trace_event::TraceConfig config(categories.empty() ? kDefaultCategories : categories,
+                                        base::trace_event::RECORD_CONTINUOUSLY);
+  base::trace_event::TraceLog::GetInstance()->SetEnabled(
+    config, base::trace_event::TraceLog::RECORDING_MODE);
+  LOG(INFO) << " StartTracing " << config.ToCategoryFilterString();
+}
+
+bool StopTracing(const base::FilePath& path) {
+  base::trace_event::TraceLog* trace_log = base::trace_event::TraceLog::GetInstance();
+  if(!trace_log->IsEnabled())
+    return false;
+  trace_log->SetDisabled();
+
+  // TraceLog::Flush() needs a thread with a message loop, the java caller
+  // thread may not have one.
+  std::string json;
+  base::WaitableEvent done(base::WaitableEvent::ResetPolicy::MANUAL,
+                           base::WaitableEvent::InitialState::NOT_SIGNALED);
+  base::Thread flush_thread("AndJSTraceFlush");
+  flush_thread.Start();
+  flush_thread.task_runner()->PostTask(FROM_HERE, base::BindOnce(&FlushTraceLog, &json, &done));
+  done.Wait();
+  flush_thread.Stop();
+
+  std::string output = "{\"traceEvents\":[" + json + "]}";
+  int written = base::WriteFile(path, output.data(), output.size());
+  LOG(INFO) << " StopTracing " << path.value() << " bytes " << written;
+  return written == static_cast<int>(output.size());
+}
+
+}
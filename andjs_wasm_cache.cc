@@ -0,0 +1,66 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_wasm_cache.h"
+
+#include "base/files/file_util.h"
+#include "base/files/important_file_writer.h"
+#include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_piece.h"
+#include "base/strings/string_util.h"
+#include "base/trace_event/trace_event.h"
+#include "crypto/sha2.h"
+#include "v8/include/v8.h"
+
+namespace andjs {
+
+WasmModuleCache::WasmModuleCache(const base::FilePath& dir)
+    : dir_(dir) {}
+
+WasmModuleCache::~WasmModuleCache() = default;
+
+// static
+std::string WasmModuleCache::Key(const uint8_t* wire_bytes, size_t length) {
+  std::string hash = crypto::SHA256HashString(
+    base::StringPiece(reinterpret_cast<const char*>(wire_bytes), length));
+  return base::ToLowerASCII(base::HexEncode(hash.data(), hash.size())) + "-" + v8::V8::GetVersion();
+}
+
+base::FilePath WasmModuleCache::GetPath(const std::string& key) const {
+  return dir_.AppendASCII(key + ".wasm-cache");
+}
+
+bool WasmModuleCache::Read(const std::string& key, std::string* data) const {
+  TRACE_EVENT0("andjs", "WasmModuleCache::Read");
+  return base::ReadFileToString(GetPath(key), data) && !data->empty();
+}
+
+bool WasmModuleCache::Write(const std::string& key, const uint8_t* data, size_t length) {
+  TRACE_EVENT1("andjs", "WasmModuleCache::Write", "length", length);
+  if(!base::CreateDirectory(dir_)) {
+    LOG(WARNING) << " WasmModuleCache cannot create " << dir_.value();
+    return false;
+  }
+  return base::ImportantFileWriter::WriteFileAtomically(
+    GetPath(key), base::StringPiece(reinterpret_cast<const char*>(data), length), "AndJSWasm");
+}
+
+}
@@ -0,0 +1,58 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_WASM_CACHE_H__
+#define __ANDJS_WASM_CACHE_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/files/file_path.h"
+#include "base/macros.h"
+
+namespace andjs {
+
+// Compiled WebAssembly modules of loadWasm(), one file per module under
+// |dir|. The key is the SHA-256 of the wire bytes and the V8 version, an
+// engine update never feeds an entry of another version to V8. Entries are
+// written atomically, readers see a whole file or none. JSTask thread only.
+class WasmModuleCache {
+  public:
+    explicit WasmModuleCache(const base::FilePath& dir);
+    ~WasmModuleCache();
+
+    static std::string Key(const uint8_t* wire_bytes, size_t length);
+
+    bool Read(const std::string& key, std::string* data) const;
+    bool Write(const std::string& key, const uint8_t* data, size_t length);
+
+    const base::FilePath& dir() const { return dir_; }
+
+  private:
+    base::FilePath GetPath(const std::string& key) const;
+
+    base::FilePath dir_;
+
+    DISALLOW_COPY_AND_ASSIGN(WasmModuleCache);
+};
+
+}
+#endif
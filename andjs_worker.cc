@@ -0,0 +1,229 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "andjs/andjs_worker.h"
+
+#include "base/bind.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/strings/stringprintf.h"
+#include "base/system/sys_info.h"
+#include "base/threading/thread.h"
+#include "base/threading/thread_task_runner_handle.h"
+#include "base/trace_event/trace_event.h"
+
+#include "andjs/andjs_array_buffer_pool.h"
+#include "andjs/script_engine.h"
+
+namespace andjs {
+
+TransferredBuffer::TransferredBuffer(uint8_t* data, size_t length)
+    : data(data), length(length) {
+}
+
+TransferredBuffer::TransferredBuffer(TransferredBuffer&& other)
+    : data(other.Release()), length(other.length) {
+}
+
+TransferredBuffer::~TransferredBuffer() {
+  ArrayBufferPool::GetInstance()->Free(data, length);
+}
+
+uint8_t* TransferredBuffer::Release() {
+  uint8_t* released = data;
+  data = nullptr;
+  return released;
+}
+
+WorkerMessage::WorkerMessage() = default;
+
+WorkerMessage::~WorkerMessage() = default;
+
+// static
+WorkerPool* WorkerPool::GetInstance() {
+  static base::NoDestructor<WorkerPool> instance;
+  return instance.get();
+}
+
+WorkerPool::WorkerPool() : next_(0) {
+}
+
+WorkerPool::~WorkerPool() = default;
+
+// Threads are started on first use, round robin over one per core.
+scoped_refptr<base::SingleThreadTaskRunner> WorkerPool::NextTaskRunner() {
+  base::AutoLock locker(lock_);
+  size_t size = static_cast<size_t>(base::SysInfo::NumberOfProcessors());
+  size_t index = next_++ % size;
+  if(index == threads_.size()) {
+    threads_.push_back(std::make_unique<base::Thread>(base::StringPrintf("JSWorker%zu", index)));
+    threads_.back()->Start();
+  }
+  return threads_[index]->task_runner();
+}
+
+WorkerHost::WorkerHost(int worker_id, base::WeakPtr<WorkerList> parent)
+    : worker_id_(worker_id),
+      parent_(std::move(parent)),
+      parent_task_runner_(base::ThreadTaskRunnerHandle::Get()),
+      worker_task_runner_(WorkerPool::GetInstance()->NextTaskRunner()),
+      terminated_(false) {
+}
+
+WorkerHost::~WorkerHost() = default;
+
+void WorkerHost::Start(EngineFactory factory, const std::string& src, scoped_refptr<ModuleBundle> bundle,
+                       base::TimeDelta cpu_budget) {
+  worker_task_runner_->PostTask(FROM_HERE, base::BindOnce(&WorkerHost::StartOnWorker, this,
+                                std::move(factory), src, std::move(bundle), cpu_budget));
+}
+
+void WorkerHost::StartOnWorker(EngineFactory factory, const std::string& src, scoped_refptr<ModuleBundle> bundle,
+                               base::TimeDelta cpu_budget) {
+  TRACE_EVENT1("andjs", "WorkerHost::Start", "src", src);
+  if(terminated_)
+    return;
+
+  std::unique_ptr<ScriptEngine> engine = std::move(factory).Run(&stats_, this);
+  engine->Init();
+  engine->SetCallbackBudget(cpu_budget);
+  {
+    base::AutoLock locker(engine_lock_);
+    engine_ = std::move(engine);
+    // A Terminate() during Init() saw no engine, ShutdownOnWorker() is
+    // already queued behind this task.
+    if(terminated_)
+      return;
+  }
+
+  ScriptEngine::RunStatus status;
+  ModuleBundle::Module module;
+  if(bundle && bundle->Find(src, &module)) {
+    engine_->SetModuleBundle(std::move(bundle));
+    status = engine_->RunModule(ScriptEngine::kMainContextId, src, cpu_budget);
+  } else {
+    std::string buf;
+    base::FilePath path(src);
+    if(!base::ReadFileToString(path, &buf)) {
+      LOG(ERROR) << " Worker unable to read " << src;
+      return;
+    }
+    status = engine_->Run(ScriptEngine::kMainContextId, ScriptString(std::move(buf)),
+                          path.BaseName().value(), cpu_budget);
+  }
+  if(status == ScriptEngine::kTerminated) {
+    int64_t count = ++stats_.terminated_runs;
+    LOG(WARNING) << " Worker " << src << " terminated after " << cpu_budget.InMilliseconds()
+                 << "ms cpu time, terminated runs " << count;
+  }
+  engine_->FlushBatchedCalls();
+}
+
+void WorkerHost::PostMessageToWorker(std::unique_ptr<WorkerMessage> message) {
+  worker_task_runner_->PostTask(FROM_HERE, base::BindOnce(&WorkerHost::DeliverToWorker, this,
+                                std::move(message)));
+}
+
+void WorkerHost::DeliverToWorker(std::unique_ptr<WorkerMessage> message) {
+  if(terminated_ || !engine_)
+    return;
+  engine_->DispatchMessage(std::move(message));
+  engine_->FlushBatchedCalls();
+}
+
+void WorkerHost::PostMessageToParent(std::unique_ptr<WorkerMessage> message) {
+  parent_task_runner_->PostTask(FROM_HERE, base::BindOnce(&WorkerHost::DeliverToParent, this,
+                                std::move(message)));
+}
+
+void WorkerHost::DeliverToParent(std::unique_ptr<WorkerMessage> message) {
+  if(terminated_ || !parent_)
+    return;
+  parent_->OnMessage(worker_id_, std::move(message));
+}
+
+// Interrupts a running script right away, the engine goes once its thread
+// gets to the shutdown task.
+void WorkerHost::Terminate() {
+  if(terminated_.exchange(true))
+    return;
+  {
+    base::AutoLock locker(engine_lock_);
+    if(engine_)
+      engine_->Terminate();
+  }
+  worker_task_runner_->PostTask(FROM_HERE, base::BindOnce(&WorkerHost::ShutdownOnWorker, this));
+}
+
+void WorkerHost::ShutdownOnWorker() {
+  std::unique_ptr<ScriptEngine> engine;
+  {
+    base::AutoLock locker(engine_lock_);
+    engine = std::move(engine_);
+  }
+  if(engine)
+    engine->Shutdown();
+}
+
+WorkerList::WorkerList(ScriptEngine* engine, AndJSStats* stats)
+    : engine_(engine),
+      stats_(stats),
+      next_worker_id_(1),
+      weak_factory_(this) {
+}
+
+WorkerList::~WorkerList() {
+  for(auto& worker : workers_)
+    worker.second->Terminate();
+}
+
+int WorkerList::Start(WorkerHost::EngineFactory factory, const std::string& src,
+                      scoped_refptr<ModuleBundle> bundle, base::TimeDelta cpu_budget) {
+  int worker_id = next_worker_id_++;
+  scoped_refptr<WorkerHost> host = base::MakeRefCounted<WorkerHost>(worker_id, weak_factory_.GetWeakPtr());
+  host->Start(std::move(factory), src, std::move(bundle), cpu_budget);
+  workers_[worker_id] = std::move(host);
+  AndJSStats::Add(&stats_->workers_started, 1);
+  return worker_id;
+}
+
+void WorkerList::PostMessage(int worker_id, std::unique_ptr<WorkerMessage> message) {
+  auto it = workers_.find(worker_id);
+  if(it == workers_.end())
+    return;
+  AndJSStats::Add(&stats_->worker_messages, 1);
+  it->second->PostMessageToWorker(std::move(message));
+}
+
+void WorkerList::Terminate(int worker_id) {
+  auto it = workers_.find(worker_id);
+  if(it == workers_.end())
+    return;
+  it->second->Terminate();
+  workers_.erase(it);
+}
+
+void WorkerList::OnMessage(int worker_id, std::unique_ptr<WorkerMessage> message) {
+  AndJSStats::Add(&stats_->worker_messages, 1);
+  engine_->DispatchWorkerMessage(worker_id, std::move(message));
+  engine_->FlushBatchedCalls();
+}
+
+}
@@ -0,0 +1,177 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_WORKER_H__
+#define __ANDJS_WORKER_H__
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/callback.h"
+#include "base/macros.h"
+#include "base/memory/ref_counted.h"
+#include "base/memory/weak_ptr.h"
+#include "base/no_destructor.h"
+#include "base/single_thread_task_runner.h"
+#include "base/synchronization/lock.h"
+#include "base/thread_annotations.h"
+#include "base/time/time.h"
+
+#include "andjs/andjs_module_bundle.h"
+#include "andjs/andjs_stats.h"
+
+namespace base {
+class Thread;
+}
+
+namespace andjs {
+
+class ScriptEngine;
+class WorkerList;
+
+// An ArrayBuffer handed over by postMessage(msg, [buffer]), the memory moves
+// with the message instead of being copied. It belongs to ArrayBufferPool,
+// and goes back there if the message is dropped.
+struct TransferredBuffer {
+  TransferredBuffer(uint8_t* data, size_t length);
+  TransferredBuffer(TransferredBuffer&& other);
+  ~TransferredBuffer();
+
+  // Hands the memory over to the receiving ArrayBuffer.
+  uint8_t* Release();
+
+  uint8_t* data;
+  size_t length;
+
+  DISALLOW_COPY_AND_ASSIGN(TransferredBuffer);
+};
+
+// One postMessage() call. |data| is the engine's own structured clone
+// format: v8::ValueSerializer output or QuickJS JS_WriteObject output. Both
+// ends of a channel always run the same engine.
+struct WorkerMessage {
+  WorkerMessage();
+  ~WorkerMessage();
+
+  std::vector<uint8_t> data;
+  std::vector<TransferredBuffer> buffers;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkerMessage);
+};
+
+// Process wide threads that run worker engines, one per core. A worker
+// stays on the thread it was given, engines are not free to move.
+class WorkerPool {
+  public:
+    static WorkerPool* GetInstance();
+
+    scoped_refptr<base::SingleThreadTaskRunner> NextTaskRunner();
+
+  private:
+    friend class base::NoDestructor<WorkerPool>;
+    WorkerPool();
+    ~WorkerPool();
+
+    std::vector<std::unique_ptr<base::Thread>> threads_ GUARDED_BY(lock_);
+    size_t next_ GUARDED_BY(lock_);
+    base::Lock lock_;
+
+    DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+// One `new Worker(src)`: a child engine of the parent's type on a pool
+// thread. Created and terminated on the parent's thread, the engine itself
+// is only touched on the worker thread.
+class WorkerHost : public base::RefCountedThreadSafe<WorkerHost> {
+  public:
+    typedef base::OnceCallback<std::unique_ptr<ScriptEngine>(AndJSStats*, WorkerHost*)> EngineFactory;
+
+    WorkerHost(int worker_id, base::WeakPtr<WorkerList> parent);
+
+    // Loads |src|, a module of |bundle| or else a script file, on a pool
+    // thread. The script and every message handler get |cpu_budget|, the
+    // parent's run budget.
+    void Start(EngineFactory factory, const std::string& src, scoped_refptr<ModuleBundle> bundle,
+               base::TimeDelta cpu_budget);
+
+    // Parent thread.
+    void PostMessageToWorker(std::unique_ptr<WorkerMessage> message);
+    void Terminate();
+
+    // Worker thread.
+    void PostMessageToParent(std::unique_ptr<WorkerMessage> message);
+
+  private:
+    friend class base::RefCountedThreadSafe<WorkerHost>;
+    ~WorkerHost();
+
+    void StartOnWorker(EngineFactory factory, const std::string& src, scoped_refptr<ModuleBundle> bundle,
+                       base::TimeDelta cpu_budget);
+    void DeliverToWorker(std::unique_ptr<WorkerMessage> message);
+    void DeliverToParent(std::unique_ptr<WorkerMessage> message);
+    void ShutdownOnWorker();
+
+    const int worker_id_;
+    base::WeakPtr<WorkerList> parent_;
+    scoped_refptr<base::SingleThreadTaskRunner> parent_task_runner_;
+    scoped_refptr<base::SingleThreadTaskRunner> worker_task_runner_;
+    std::atomic<bool> terminated_;
+
+    // Counters of the child engine, it can outlive the parent instance.
+    AndJSStats stats_;
+    // Set and reset on the worker thread, Terminate() reads it under the lock.
+    std::unique_ptr<ScriptEngine> engine_;
+    base::Lock engine_lock_;
+
+    DISALLOW_COPY_AND_ASSIGN(WorkerHost);
+};
+
+// The workers started by one engine, on that engine's thread. Messages of a
+// worker are dropped once its list is gone.
+class WorkerList {
+  public:
+    WorkerList(ScriptEngine* engine, AndJSStats* stats);
+    ~WorkerList();
+
+    int Start(WorkerHost::EngineFactory factory, const std::string& src,
+              scoped_refptr<ModuleBundle> bundle, base::TimeDelta cpu_budget);
+    void PostMessage(int worker_id, std::unique_ptr<WorkerMessage> message);
+    void Terminate(int worker_id);
+
+  private:
+    friend class WorkerHost;
+    void OnMessage(int worker_id, std::unique_ptr<WorkerMessage> message);
+
+    ScriptEngine* engine_;
+    AndJSStats* stats_;
+    std::map<int, scoped_refptr<WorkerHost>> workers_;
+    int next_worker_id_;
+
+    base::WeakPtrFactory<WorkerList> weak_factory_;
+
+    DISALLOW_COPY_AND_ASSIGN(WorkerList);
+};
+
+}
+#endif
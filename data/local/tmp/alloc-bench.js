@@ -0,0 +1,44 @@
+// Allocation churn for the QuickJS arena and the V8 ArrayBuffer pool:
+// short lived objects, strings and arrays, and ArrayBuffers of the sizes
+// encoding and crypto hand out. Read heapAllocs, heapSystemAllocs,
+// heapReservedBytes and the arrayBuffer counters of getStats() after it,
+// and the RSS from dumpsys meminfo.
+var ROUNDS = 20;
+var N = 20000;
+var SIZES = [32, 64, 256, 1024, 4096, 16384, 65536];
+
+function bench(name, fn) {
+  var t0 = Date.now();
+  for(var r = 0; r < ROUNDS; r++)
+    fn();
+  adb.info("alloc-bench ", name, " ms/round: ", ((Date.now() - t0) / ROUNDS).toFixed(2));
+}
+
+bench("objects", function() {
+  var list = [];
+  for(var i = 0; i < N; i++)
+    list.push({ id: i, name: "item" + i, tags: [i, i + 1] });
+  return list.length;
+});
+
+bench("strings", function() {
+  var s = "";
+  for(var i = 0; i < N; i++)
+    s += String.fromCharCode(97 + i % 26);
+  return s.split("a").length;
+});
+
+bench("buffers", function() {
+  var total = 0;
+  for(var i = 0; i < N / 10; i++) {
+    var buffer = new ArrayBuffer(SIZES[i % SIZES.length]);
+    total += new Uint8Array(buffer)[0];
+  }
+  return total;
+});
+
+bench("encoding", function() {
+  var text = "churn of the encoder output buffers";
+  for(var i = 0; i < N / 10; i++)
+    encoding.decodeUtf8(encoding.encodeUtf8(text + i));
+});
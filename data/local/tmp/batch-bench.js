@@ -0,0 +1,19 @@
+// Calls the void myobject.tick() of the sample app, batched, against its
+// direct twin tickDirect() and logs calls per second of both.
+var CALLS = 200000;
+
+function bench(name, call) {
+  var before = myobject.getTicks();
+  var t0 = Date.now();
+  for(var i = 0; i < CALLS; i++)
+    call(1);
+  andjs.flush();
+  var ms = Math.max(Date.now() - t0, 1);
+  // getTicks() flushes first as well, calls made before it are all in.
+  if(myobject.getTicks() - before != CALLS)
+    adb.error("batch-bench ", name, " lost calls");
+  adb.info("batch-bench ", name, " calls/s: ", Math.round(CALLS * 1000 / ms));
+}
+
+bench("direct", function(v) { myobject.tickDirect(v); });
+bench("batched", function(v) { myobject.tick(v); });
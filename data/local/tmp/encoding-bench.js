@@ -0,0 +1,121 @@
+// Compares the native TextEncoder, TextDecoder, btoa, atob and hex of the
+// encoding global with the usual JS polyfills, on 64K of mixed text and
+// 64K of random bytes, and logs the jscrypto seal/open rate that now goes
+// through the same base64 kernels.
+var LENGTH = 64 * 1024;
+var ROUNDS = 20;
+
+function polyfillEncode(str) {
+  var out = [];
+  for(var i = 0; i < str.length; i++) {
+    var c = str.charCodeAt(i);
+    if(c >= 0xd800 && c < 0xdc00 && i + 1 < str.length) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (str.charCodeAt(++i) - 0xdc00);
+    }
+    if(c < 0x80) {
+      out.push(c);
+    } else if(c < 0x800) {
+      out.push(0xc0 | (c >> 6), 0x80 | (c & 0x3f));
+    } else if(c < 0x10000) {
+      out.push(0xe0 | (c >> 12), 0x80 | ((c >> 6) & 0x3f), 0x80 | (c & 0x3f));
+    } else {
+      out.push(0xf0 | (c >> 18), 0x80 | ((c >> 12) & 0x3f), 0x80 | ((c >> 6) & 0x3f), 0x80 | (c & 0x3f));
+    }
+  }
+  return new Uint8Array(out);
+}
+
+function polyfillDecode(bytes) {
+  var out = "";
+  for(var i = 0; i < bytes.length;) {
+    var b = bytes[i++];
+    var c;
+    if(b < 0x80) {
+      c = b;
+    } else if(b < 0xe0) {
+      c = ((b & 0x1f) << 6) | (bytes[i++] & 0x3f);
+    } else if(b < 0xf0) {
+      c = ((b & 0x0f) << 12) | ((bytes[i++] & 0x3f) << 6) | (bytes[i++] & 0x3f);
+    } else {
+      c = ((b & 0x07) << 18) | ((bytes[i++] & 0x3f) << 12) | ((bytes[i++] & 0x3f) << 6) | (bytes[i++] & 0x3f);
+    }
+    out += String.fromCodePoint(c);
+  }
+  return out;
+}
+
+var CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+function polyfillBtoa(str) {
+  var out = "";
+  for(var i = 0; i < str.length; i += 3) {
+    var n = (str.charCodeAt(i) << 16) | ((str.charCodeAt(i + 1) || 0) << 8) | (str.charCodeAt(i + 2) || 0);
+    out += CHARS[n >> 18] + CHARS[(n >> 12) & 63] +
+           (i + 1 < str.length ? CHARS[(n >> 6) & 63] : "=") + (i + 2 < str.length ? CHARS[n & 63] : "=");
+  }
+  return out;
+}
+
+function polyfillAtob(str) {
+  var out = "";
+  str = str.replace(/=+$/, "");
+  for(var i = 0; i < str.length; i += 4) {
+    var n = (CHARS.indexOf(str[i]) << 18) | (CHARS.indexOf(str[i + 1]) << 12) |
+            ((CHARS.indexOf(str[i + 2]) & 63) << 6) | (CHARS.indexOf(str[i + 3]) & 63);
+    out += String.fromCharCode(n >> 16);
+    if(i + 2 < str.length)
+      out += String.fromCharCode((n >> 8) & 255);
+    if(i + 3 < str.length)
+      out += String.fromCharCode(n & 255);
+  }
+  return out;
+}
+
+function polyfillHex(bytes) {
+  var out = "";
+  for(var i = 0; i < bytes.length; i++)
+    out += (bytes[i] < 16 ? "0" : "") + bytes[i].toString(16);
+  return out;
+}
+
+function bench(name, fn, arg) {
+  var t0 = Date.now();
+  for(var i = 0; i < ROUNDS; i++)
+    fn(arg);
+  var ms = Math.max(Date.now() - t0, 1);
+  adb.info("encoding-bench ", name, " MB/s: ", (LENGTH * ROUNDS / ms / 1000).toFixed(1));
+}
+
+var text = "";
+while(text.length < LENGTH)
+  text += "The quick brown fox jumps over the lazy dog. Voix ambiguë d'un cœur. 天地玄黄宇宙洪荒 ";
+text = text.substring(0, LENGTH);
+var bytes = new Uint8Array(LENGTH);
+for(var i = 0; i < LENGTH; i++)
+  bytes[i] = (i * 7919) & 255;
+var binary = "";
+for(var i = 0; i < LENGTH; i++)
+  binary += String.fromCharCode(bytes[i]);
+
+adb.info("encoding-bench kernels ", encoding.kernels());
+var encoder = new TextEncoder();
+var decoder = new TextDecoder();
+var utf8 = encoder.encode(text);
+var b64 = btoa(binary);
+bench("TextEncoder.encode", function(s) { return encoder.encode(s); }, text);
+bench("polyfill encode", polyfillEncode, text);
+bench("TextDecoder.decode", function(b) { return decoder.decode(b); }, utf8);
+bench("polyfill decode", polyfillDecode, utf8);
+bench("btoa", btoa, binary);
+bench("polyfill btoa", polyfillBtoa, binary);
+bench("atob", atob, b64);
+bench("polyfill atob", polyfillAtob, b64);
+bench("encoding.encodeBase64", function(b) { return encoding.encodeBase64(b); }, bytes);
+bench("encoding.decodeBase64", function(s) { return encoding.decodeBase64(s); }, b64);
+bench("encoding.encodeHex", function(b) { return encoding.encodeHex(b); }, bytes);
+bench("polyfill hex", polyfillHex, bytes);
+
+var crypto = new JSCrypto("encoding-bench");
+var sealed = crypto.seal(binary);
+bench("jscrypto.seal", function(s) { return crypto.seal(s); }, binary);
+bench("jscrypto.open", function(s) { return crypto.open(s); }, sealed);
@@ -0,0 +1,18 @@
+// Load with AndJS.Options.engine = V8 and = QUICKJS and compare the logcat
+// output; it backs AndJSCore::kAutoQuickJSMaxScriptSize.
+var t0 = Date.now();
+
+function fib(n) {
+  return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+var small = 0;
+for(var i = 0; i < 1000; i++) {
+  small += i * i;
+}
+var t1 = Date.now();
+adb.info("engine-bench small loop ms: ", t1 - t0);
+
+var r = fib(27);
+var t2 = Date.now();
+adb.info("engine-bench fib(27) = ", r, " ms: ", t2 - t1);
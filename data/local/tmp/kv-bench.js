@@ -0,0 +1,36 @@
+// Get and put latency of the native kv store against SharedPreferences
+// through the java bridge (myactivity.getPref/putPref of the sample app),
+// for short strings and 4K values. Writes of both are batched: kv syncs its
+// log once per batch, SharedPreferences.apply() writes in the background.
+var N = 10000;
+var KEYS = 1000;
+
+function bench(name, fn) {
+  var t0 = Date.now();
+  for(var i = 0; i < N; i++)
+    fn(i);
+  adb.info("kv-bench ", name, " us/op: ", ((Date.now() - t0) * 1000 / N).toFixed(2));
+}
+
+var store = kv.open("kv-bench");
+var small = "value of a setting";
+var large = "";
+while(large.length < 4096)
+  large += "0123456789abcdef";
+
+bench("kv.put small", function(i) { store.put("k" + (i % KEYS), small); });
+bench("kv.get small", function(i) { return store.get("k" + (i % KEYS)); });
+bench("bridge put small", function(i) { myactivity.putPref("k" + (i % KEYS), small); });
+bench("bridge get small", function(i) { return myactivity.getPref("k" + (i % KEYS)); });
+bench("kv.put 4K", function(i) { store.put("l" + (i % KEYS), large); });
+bench("kv.get 4K", function(i) { return store.get("l" + (i % KEYS)); });
+bench("kv.getBytes 4K", function(i) { return store.getBytes("l" + (i % KEYS)); });
+bench("bridge put 4K", function(i) { myactivity.putPref("l" + (i % KEYS), large); });
+bench("bridge get 4K", function(i) { return myactivity.getPref("l" + (i % KEYS)); });
+
+var t0 = Date.now();
+store.flush();
+adb.info("kv-bench flush ms: ", Date.now() - t0, " keys: ", store.count());
+t0 = Date.now();
+store.compact();
+adb.info("kv-bench compact ms: ", Date.now() - t0);
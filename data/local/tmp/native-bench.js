@@ -0,0 +1,17 @@
+// Times calls into the native objects; run it on a build before and after
+// a change to their bindings, with AndJS.Options.engine = V8 and = QUICKJS.
+// Filtered adb.info calls only cost the binding itself.
+var N = 100000;
+
+function bench(name, fn) {
+  var t0 = Date.now();
+  for(var i = 0; i < N; i++)
+    fn(i);
+  adb.error("native-bench ", name, " ns/call: ", (Date.now() - t0) * 1e6 / N);
+}
+
+var c = new JSCrypto("bench-key");
+var sealed = c.seal("native-bench payload");
+bench("adb.info (filtered)", function(i) { adb.info("x", i); });
+bench("jscrypto.seal", function(i) { c.seal("native-bench payload"); });
+bench("jscrypto.open", function(i) { c.open(sealed); });
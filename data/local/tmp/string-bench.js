@@ -0,0 +1,25 @@
+// Round trips strings through the sample app's myobject.echo() and logs
+// the throughput for ASCII, Latin-1 and CJK text of 64K characters.
+var LENGTH = 64 * 1024;
+var ROUNDS = 50;
+
+function repeat(chars) {
+  var s = "";
+  while(s.length < LENGTH)
+    s += chars;
+  return s.substring(0, LENGTH);
+}
+
+function bench(name, text) {
+  var t0 = Date.now();
+  for(var i = 0; i < ROUNDS; i++) {
+    if(myobject.echo(text).length != text.length)
+      adb.error("string-bench ", name, " length mismatch");
+  }
+  var ms = Math.max(Date.now() - t0, 1);
+  adb.info("string-bench ", name, " Mchars/s: ", (LENGTH * ROUNDS * 2 / ms / 1000).toFixed(1));
+}
+
+bench("ascii", repeat("The quick brown fox jumps over the lazy dog. "));
+bench("latin1", repeat("Voix ambiguë d'un garçon qui préfère le zéphyr. "));
+bench("cjk", repeat("天地玄黄宇宙洪荒日月盈昃辰宿列张"));
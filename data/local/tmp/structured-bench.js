@@ -0,0 +1,65 @@
+// Round trips records of about 1KB, 100KB and 10MB of JSON to java and back
+// through the sample app: JSON.stringify() with myactivity.echoJSON(), the
+// JSON dispatchEvent() and the base::Value converter, against postToJava()
+// and dispatchStructuredEvent(). Logs the average round trip of each.
+var SIZES = [[1024, 200], [100 * 1024, 20], [10 * 1024 * 1024, 2]];
+
+function makeRecords(bytes) {
+  var records = [];
+  var size = 2;
+  for(var i = 0; size < bytes; i++) {
+    var record = {
+      id: i,
+      name: "record " + i,
+      score: i * 0.5,
+      active: i % 2 == 0,
+      tags: ["a", "bb", "ccc"],
+      position: { x: i, y: -i, label: "p" + i },
+    };
+    size += JSON.stringify(record).length + 1;
+    records.push(record);
+  }
+  return { records: records };
+}
+
+var runs = [];
+SIZES.forEach(function(size) {
+  runs.push({ mode: "json", bytes: size[0], count: size[1] });
+  runs.push({ mode: "structured", bytes: size[0], count: size[1] });
+});
+
+var run = null;
+var value = null;
+var left = 0;
+var t0 = 0;
+
+function send() {
+  if(run.mode == "json")
+    myactivity.echoJSON(JSON.stringify(value));
+  else
+    postToJava("bench-echo", value);
+}
+
+function next() {
+  run = runs.shift();
+  if(!run)
+    return;
+  value = makeRecords(run.bytes);
+  left = run.count;
+  t0 = Date.now();
+  send();
+}
+
+addEventListener("bench-echo", function(e) {
+  if(e.data.records.length != value.records.length)
+    adb.error("structured-bench ", run.mode, " lost records");
+  if(--left > 0) {
+    send();
+    return;
+  }
+  adb.info("structured-bench ", run.mode, " ", run.bytes, " bytes: ",
+           ((Date.now() - t0) / run.count).toFixed(2), " ms per round trip");
+  next();
+});
+
+next();
@@ -0,0 +1,29 @@
+// Splits fib(27) x 16 over 1, 2 and 4 workers and logs the wall time of
+// each round; worker-fib.js does the work. Needs both files in
+// /data/local/tmp.
+var JOBS = 16;
+
+function round(count, done) {
+  var t0 = Date.now();
+  var pending = JOBS;
+  var workers = [];
+  for(var i = 0; i < count; i++) {
+    var w = new Worker("/data/local/tmp/worker-fib.js");
+    w.onmessage = function(e) {
+      if(--pending == 0) {
+        adb.info("worker-bench workers: ", count, " ms: ", Date.now() - t0);
+        workers.forEach(function(w) { w.terminate(); });
+        done();
+      }
+    };
+    workers.push(w);
+  }
+  for(var j = 0; j < JOBS; j++)
+    workers[j % count].postMessage(27);
+}
+
+round(1, function() {
+  round(2, function() {
+    round(4, function() {});
+  });
+});
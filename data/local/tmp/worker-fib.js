@@ -0,0 +1,8 @@
+// Worker side of worker-bench.js.
+function fib(n) {
+  return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+var onmessage = function(e) {
+  postMessage(fib(e.data));
+};
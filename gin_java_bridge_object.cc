@@ -5,11 +5,17 @@
 
 #include "andjs/gin_java_bridge_object.h"
 
+#include <memory>
+
+#include "base/android/jni_android.h"
+#include "base/trace_event/trace_event.h"
 #include "base/values.h"
 #include "content/browser/android/java/gin_java_bound_object_delegate.h"
 #include "content/browser/android/java/gin_java_method_invocation_helper.h"
+#include "content/browser/android/java/jni_reflect.h"
 #include "gin/function_template.h"
-#include "andjs/andjs_core.h"
+#include "andjs/andjs_core_v8.h"
+#include "andjs/andjs_logger.h"
 
 namespace andjs {
 
@@ -20,9 +26,186 @@ const char kMethodInvocationAsConstructorDisallowed[] =
 const char kMethodInvocationOnNonInjectedObjectDisallowed[] =
     "Java bridge method can't be invoked on a non-injected object";
 
+// Strings up to this many characters are written to the stack.
+const int kStackStringLength = 256;
+
+// v8::String::Write() straight into the buffer handed to NewString(), no
+// UTF-8 in between.
+base::android::ScopedJavaLocalRef<jobject> ToJavaString(JNIEnv* env, v8::Isolate* isolate,
+                                                        v8::Local<v8::String> str) {
+  int length = str->Length();
+  uint16_t stack_buffer[kStackStringLength];
+  std::unique_ptr<uint16_t[]> heap_buffer;
+  uint16_t* buffer = stack_buffer;
+  if(length > kStackStringLength) {
+    heap_buffer.reset(new uint16_t[length]);
+    buffer = heap_buffer.get();
+  }
+  str->Write(isolate, buffer, 0, length, v8::String::NO_NULL_TERMINATION);
+  return base::android::ScopedJavaLocalRef<jobject>(
+      env, env->NewString(reinterpret_cast<const jchar*>(buffer), length));
+}
+
+// Script values to the JNI arguments of a generated binding. Strings are
+// kept alive by |locals|.
+bool ToJavaArguments(JNIEnv* env, gin::Arguments* args, const MethodBinding& method,
+                     std::vector<jvalue>* values,
+                     std::vector<base::android::ScopedJavaLocalRef<jobject>>* locals) {
+  v8::Isolate* isolate = args->isolate();
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+  for(BindingType type : method.parameter_types) {
+    v8::Local<v8::Value> arg;
+    if(!args->GetNext(&arg))
+      return false;
+    jvalue value;
+    switch(type) {
+      case BindingType::kBoolean:
+        value.z = arg->BooleanValue(isolate);
+        break;
+      case BindingType::kInt:
+        value.i = arg->Int32Value(context).FromMaybe(0);
+        break;
+      case BindingType::kLong:
+        value.j = arg->IntegerValue(context).FromMaybe(0);
+        break;
+      case BindingType::kFloat:
+        value.f = static_cast<jfloat>(arg->NumberValue(context).FromMaybe(0));
+        break;
+      case BindingType::kDouble:
+        value.d = arg->NumberValue(context).FromMaybe(0);
+        break;
+      case BindingType::kString: {
+        if(arg->IsNullOrUndefined()) {
+          value.l = nullptr;
+          break;
+        }
+        v8::Local<v8::String> str;
+        if(!arg->ToString(context).ToLocal(&str))
+          return false;
+        locals->push_back(ToJavaString(env, isolate, str));
+        value.l = locals->back().obj();
+        break;
+      }
+      default:
+        return false;
+    }
+    values->push_back(value);
+  }
+  return true;
+}
+
+// Return values of generated bindings, one specialization per JNI type.
+template <BindingType R>
+struct V8Result;
+
+template <>
+struct V8Result<BindingType::kBoolean> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate, jboolean value) {
+    return v8::Boolean::New(isolate, value);
+  }
+};
+
+template <>
+struct V8Result<BindingType::kInt> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate, jint value) {
+    return v8::Integer::New(isolate, value);
+  }
+};
+
+template <>
+struct V8Result<BindingType::kLong> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate, jlong value) {
+    return v8::Number::New(isolate, static_cast<double>(value));
+  }
+};
+
+template <>
+struct V8Result<BindingType::kFloat> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate, jfloat value) {
+    return v8::Number::New(isolate, value);
+  }
+};
+
+template <>
+struct V8Result<BindingType::kDouble> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate, jdouble value) {
+    return v8::Number::New(isolate, value);
+  }
+};
+
+template <>
+struct V8Result<BindingType::kString> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate,
+                                   const base::android::ScopedJavaLocalRef<jstring>& value) {
+    if(value.is_null())
+      return v8::Null(isolate);
+    JNIEnv* env = base::android::AttachCurrentThread();
+    v8::Local<v8::String> str;
+    if(!NewV8String(isolate, ScriptString::FromJavaString(env, value.obj())).ToLocal(&str))
+      return v8::Null(isolate);
+    return str;
+  }
+};
+
+template <>
+struct V8Result<BindingType::kObject> {
+  static v8::Local<v8::Value> ToV8(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                   v8::Isolate* isolate,
+                                   const base::android::ScopedJavaLocalRef<jobject>& value) {
+    if(value.is_null())
+      return v8::Null(isolate);
+    return jscore->InjectObject(value, binding.annotation_clazz());
+  }
+};
+
+// The thunk of a return type: calls the method and converts its result,
+// no base::Value and no overload resolution in between.
+template <BindingType R>
+v8::Local<v8::Value> CallThunk(AndJSCoreV8* jscore, const ClassBinding& binding,
+                               const MethodBinding& method, v8::Isolate* isolate,
+                               JNIEnv* env, jobject object, const jvalue* args) {
+  typename JavaMethod<R>::Type result = JavaMethod<R>::Call(env, object, method.method_id, args);
+  if(base::android::HasException(env))
+    return v8::Local<v8::Value>();
+  return V8Result<R>::ToV8(jscore, binding, isolate, result);
+}
+
+template <>
+v8::Local<v8::Value> CallThunk<BindingType::kVoid>(AndJSCoreV8* jscore, const ClassBinding& binding,
+                                                         const MethodBinding& method, v8::Isolate* isolate,
+                                                         JNIEnv* env, jobject object, const jvalue* args) {
+  JavaMethod<BindingType::kVoid>::Call(env, object, method.method_id, args);
+  if(base::android::HasException(env))
+    return v8::Local<v8::Value>();
+  return v8::Undefined(isolate);
+}
+
+typedef v8::Local<v8::Value> (*Thunk)(AndJSCoreV8*, const ClassBinding&,
+                                      const MethodBinding&, v8::Isolate*,
+                                      JNIEnv*, jobject, const jvalue*);
+
+// Indexed by BindingType.
+const Thunk kThunks[] = {
+  nullptr,
+  &CallThunk<BindingType::kVoid>,
+  &CallThunk<BindingType::kBoolean>,
+  &CallThunk<BindingType::kInt>,
+  &CallThunk<BindingType::kLong>,
+  &CallThunk<BindingType::kFloat>,
+  &CallThunk<BindingType::kDouble>,
+  &CallThunk<BindingType::kString>,
+  &CallThunk<BindingType::kObject>,
+};
+
 }  // namespace
 
-GinJavaBridgeObject::GinJavaBridgeObject(AndJSCore* jscore, content::GinJavaBoundObject::ObjectID object_id)
+GinJavaBridgeObject::GinJavaBridgeObject(AndJSCoreV8* jscore, content::GinJavaBoundObject::ObjectID object_id)
                                          : gin::NamedPropertyInterceptor(jscore->GetContextHolder()->isolate(), this),
                                            object_id_(object_id),
                                            converter_(content::V8ValueConverter::Create()),
@@ -31,6 +214,11 @@ GinJavaBridgeObject::GinJavaBridgeObject(AndJSCore* jscore, content::GinJavaBoun
   converter_->SetRegExpAllowed(false);
   converter_->SetFunctionAllowed(true);
   jscore_ = jscore;
+
+  JNIEnv* env = base::android::AttachCurrentThread();
+  scoped_refptr<content::GinJavaBoundObject> bound_object = jscore_->GetObject(object_id_);
+  binding_ = bound_object ? BindingRegistry::GetInstance()->Find(
+                              content::GetClassName(env, bound_object->GetLocalClassRef(env))) : nullptr;
 }
 
 GinJavaBridgeObject::~GinJavaBridgeObject() {}
@@ -42,9 +230,14 @@ gin::ObjectTemplateBuilder GinJavaBridgeObject::GetObjectTemplateBuilder(v8::Iso
 v8::Local<v8::Value> GinJavaBridgeObject::GetNamedProperty(
     v8::Isolate* isolate,
     const std::string& property) {
-  scoped_refptr<content::GinJavaBoundObject> bound_object = jscore_->GetObject(object_id_);
-  bool result = bound_object->HasMethod(property);
-  LOG(INFO) << "GetNamedProperty HasMethod(" << property << ") result " << result;
+  bool result;
+  if(binding_) {
+    result = binding_->HasMethod(property);
+  } else {
+    scoped_refptr<content::GinJavaBoundObject> bound_object = jscore_->GetObject(object_id_);
+    result = bound_object->HasMethod(property);
+  }
+  ANDJS_LOG(Debug) << "GetNamedProperty HasMethod(" << property << ") result " << result;
   if (result) {
     return GetFunctionTemplate(isolate, property)
         ->GetFunction(isolate->GetCurrentContext())
@@ -55,15 +248,18 @@ v8::Local<v8::Value> GinJavaBridgeObject::GetNamedProperty(
 }
 
 std::vector<std::string> GinJavaBridgeObject::EnumerateNamedProperties(v8::Isolate* isolate) {
-  scoped_refptr<content::GinJavaBoundObject> bound_object = jscore_->GetObject(object_id_);
-  std::set<std::string> method_names = bound_object->GetMethodNames();
-  LOG(INFO) << " EnumerateNamedProperties " << " method_names.size " << method_names.size();
+  std::set<std::string> method_names;
+  if(binding_)
+    method_names = binding_->GetMethodNames();
+  else
+    method_names = jscore_->GetObject(object_id_)->GetMethodNames();
+  ANDJS_LOG(Debug) << " EnumerateNamedProperties " << " method_names.size " << method_names.size();
 
   return std::vector<std::string> (method_names.begin(), method_names.end());
 }
 
 JavaObjectWeakGlobalRef GinJavaBridgeObject::GetObjectWeakRef(content::GinJavaBoundObject::ObjectID object_id) {
-  LOG(INFO) << " GinJavaBridgeObject GetObjectWeakRef " << object_id;
+  ANDJS_LOG(Debug) << " GinJavaBridgeObject GetObjectWeakRef " << object_id;
   return JavaObjectWeakGlobalRef();
 }
 
@@ -81,21 +277,45 @@ v8::Local<v8::Value> GinJavaBridgeObject::Invoke(const std::string& method_name,
     return v8::Undefined(args->isolate());
   }
 
+  scoped_refptr<content::GinJavaBoundObject> bound_object = jscore_->GetObject(object_id_);
+  if(!bound_object) {
+    args->ThrowTypeError(kJavaObjectGone);
+    return v8::Undefined(args->isolate());
+  }
+  JNIEnv* env = base::android::AttachCurrentThread();
+  AndJSStats* stats = jscore_->stats();
+  TRACE_EVENT2("andjs", "GinJavaBridgeObject::Invoke",
+               "class", content::GetClassName(env, bound_object->GetLocalClassRef(env)),
+               "method", method_name);
+  AndJSStats::Add(&stats->bridge_calls, 1);
+
+  const MethodBinding* method = binding_ ? binding_->Find(method_name, args->Length()) : nullptr;
+  if(method && method->batched)
+    return InvokeBatched(*method, args, bound_object->GetLocalRef(env));
+  // Any other call runs after the batched calls made before it.
+  jscore_->FlushBatchedCalls();
+  if(method && method->direct) {
+    AndJSStats::Add(&stats->bridge_direct_calls, 1);
+    return InvokeDirect(*method, args, bound_object->GetLocalRef(env));
+  }
+
   base::ListValue arguments;
   {
+    TRACE_EVENT0("andjs", "V8ValueConverter::FromV8Value");
     v8::HandleScope handle_scope(args->isolate());
     v8::Local<v8::Context> context = args->isolate()->GetCurrentContext();
     v8::Local<v8::Value> val;
     while (args->GetNext(&val)) {
       std::unique_ptr<base::Value> arg(converter_->FromV8Value(val, context));
-      if (arg.get())
+      if (arg.get()) {
+        AndJSStats::Add(&stats->bytes_converted, AndJSStats::EstimateValueSize(*arg));
         arguments.Append(std::move(arg));
-      else
+      } else {
         arguments.Append(std::make_unique<base::Value>());
+      }
     }
   }
 
-  scoped_refptr<content::GinJavaBoundObject> bound_object = jscore_->GetObject(object_id_);
   content::GinJavaBridgeError error;
   scoped_refptr<content::GinJavaMethodInvocationHelper> result =
     new content::GinJavaMethodInvocationHelper(
@@ -110,6 +330,8 @@ v8::Local<v8::Value> GinJavaBridgeObject::Invoke(const std::string& method_name,
     base::Value* v8_result;
     std::unique_ptr<base::ListValue> result_copy(result->GetPrimitiveResult().DeepCopy());
     if(result_copy->Get(0, &v8_result)) {
+      TRACE_EVENT0("andjs", "V8ValueConverter::ToV8Value");
+      AndJSStats::Add(&stats->bytes_converted, AndJSStats::EstimateValueSize(*v8_result));
       return converter_->ToV8Value(v8_result, args->isolate()->GetCurrentContext());
     }
   } else if (!result->GetObjectResult().is_null()) {
@@ -118,11 +340,87 @@ v8::Local<v8::Value> GinJavaBridgeObject::Invoke(const std::string& method_name,
   return v8::Undefined(args->isolate());
 }
 
+// A call through the generated binding of the class, see andjs_bindings.h.
+v8::Local<v8::Value> GinJavaBridgeObject::InvokeDirect(const MethodBinding& method, gin::Arguments* args,
+                                                       const base::android::JavaRef<jobject>& object) {
+  v8::Isolate* isolate = args->isolate();
+  if(object.is_null())
+    return v8::Undefined(isolate);
+  JNIEnv* env = base::android::AttachCurrentThread();
+  std::vector<jvalue> values;
+  std::vector<base::android::ScopedJavaLocalRef<jobject>> locals;
+  if(!ToJavaArguments(env, args, method, &values, &locals))
+    return v8::Undefined(isolate);
+
+  v8::Local<v8::Value> result = kThunks[static_cast<int>(method.return_type)](
+      jscore_, *binding_, method, isolate, env, object.obj(), values.data());
+  if(result.IsEmpty()) {
+    base::android::ClearException(env);
+    isolate->ThrowException(v8::Exception::Error(gin::StringToV8(isolate, kJavaExceptionRaised)));
+    return v8::Undefined(isolate);
+  }
+  return result;
+}
+
+// Packs the call into the batch of the engine, see BatchedCalls.
+v8::Local<v8::Value> GinJavaBridgeObject::InvokeBatched(const MethodBinding& method, gin::Arguments* args,
+                                                        const base::android::JavaRef<jobject>& object) {
+  v8::Isolate* isolate = args->isolate();
+  if(object.is_null())
+    return v8::Undefined(isolate);
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+  BatchedCalls* calls = jscore_->batched_calls();
+  calls->BeginCall(*binding_, method, object_id_, object);
+  for(BindingType type : method.parameter_types) {
+    v8::Local<v8::Value> arg;
+    if(!args->GetNext(&arg)) {
+      calls->CancelCall();
+      return v8::Undefined(isolate);
+    }
+    switch(type) {
+      case BindingType::kBoolean:
+        calls->WriteBoolean(arg->BooleanValue(isolate));
+        break;
+      case BindingType::kInt:
+        calls->WriteInt(arg->Int32Value(context).FromMaybe(0));
+        break;
+      case BindingType::kLong:
+        calls->WriteLong(arg->IntegerValue(context).FromMaybe(0));
+        break;
+      case BindingType::kFloat:
+        calls->WriteFloat(static_cast<float>(arg->NumberValue(context).FromMaybe(0)));
+        break;
+      case BindingType::kDouble:
+        calls->WriteDouble(arg->NumberValue(context).FromMaybe(0));
+        break;
+      case BindingType::kString: {
+        if(arg->IsNullOrUndefined()) {
+          calls->WriteNullString();
+          break;
+        }
+        v8::Local<v8::String> str;
+        if(!arg->ToString(context).ToLocal(&str)) {
+          calls->CancelCall();
+          return v8::Undefined(isolate);
+        }
+        int length = str->Length();
+        str->Write(isolate, calls->WriteString(length), 0, length, v8::String::NO_NULL_TERMINATION);
+        break;
+      }
+      default:
+        calls->CancelCall();
+        return v8::Undefined(isolate);
+    }
+  }
+  calls->EndCall();
+  return v8::Undefined(isolate);
+}
+
 v8::Local<v8::FunctionTemplate> GinJavaBridgeObject::GetFunctionTemplate(
     v8::Isolate* isolate,
     const std::string& name) {
   v8::Local<v8::FunctionTemplate> function_template = template_cache_.Get(name);
-  LOG(INFO) << " GetFunctionTemplate " << name << " function_template.IsEmpty " << function_template.IsEmpty();
+  ANDJS_LOG(Debug) << " GetFunctionTemplate " << name << " function_template.IsEmpty " << function_template.IsEmpty();
   if (!function_template.IsEmpty())
     return function_template;
   function_template = gin::CreateFunctionTemplate(
@@ -24,13 +24,15 @@
 #include "content/browser/android/java/gin_java_bound_object_delegate.h"
 #include "content/public/renderer/v8_value_converter.h"
 
+#include "andjs/andjs_bindings.h"
+
 namespace base {
 class Value;
 class ListValue;
 }
 
 namespace andjs {
-class AndJSCore;
+class AndJSCoreV8;
 class GinJavaBridgeObject : public gin::Wrappable<GinJavaBridgeObject>,
                             //public base::RefCountedThreadSafe<GinJavaBridgeObject>,
                             public content::GinJavaMethodInvocationHelper::DispatcherDelegate,
@@ -61,7 +63,7 @@ class GinJavaBridgeObject : public gin::Wrappable<GinJavaBridgeObject>,
   const base::android::JavaRef<jclass>& GetSafeAnnotationClass();
   base::android::ScopedJavaLocalRef<jclass> GetLocalClassRef(JNIEnv* env);
 
-  GinJavaBridgeObject(AndJSCore* jscore, content::GinJavaBoundObject::ObjectID object_id);
+  GinJavaBridgeObject(AndJSCoreV8* jscore, content::GinJavaBoundObject::ObjectID object_id);
 
  private:
   ~GinJavaBridgeObject() override;
@@ -70,7 +72,14 @@ class GinJavaBridgeObject : public gin::Wrappable<GinJavaBridgeObject>,
                                                       const std::string& name);
 
   v8::Local<v8::Value> Invoke(const std::string& method_name, gin::Arguments* args);
-  AndJSCore* jscore_;
+  v8::Local<v8::Value> InvokeDirect(const MethodBinding& method, gin::Arguments* args,
+                                    const base::android::JavaRef<jobject>& object);
+  v8::Local<v8::Value> InvokeBatched(const MethodBinding& method, gin::Arguments* args,
+                                     const base::android::JavaRef<jobject>& object);
+  AndJSCoreV8* jscore_;
+  // The generated binding of the object's class, nullptr for classes that
+  // are reflected.
+  const ClassBinding* binding_;
   JavaObjectWeakGlobalRef ref_;
   std::map<std::string, bool> known_methods_;
 
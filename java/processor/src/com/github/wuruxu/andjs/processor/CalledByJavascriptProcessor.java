@@ -0,0 +1,261 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+package com.github.wuruxu.andjs.processor;
+
+import java.io.IOException;
+import java.io.Writer;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.LinkedHashSet;
+import java.util.List;
+import java.util.Map;
+import java.util.Set;
+import javax.annotation.processing.AbstractProcessor;
+import javax.annotation.processing.RoundEnvironment;
+import javax.lang.model.SourceVersion;
+import javax.lang.model.element.AnnotationMirror;
+import javax.lang.model.element.AnnotationValue;
+import javax.lang.model.element.Element;
+import javax.lang.model.element.ElementKind;
+import javax.lang.model.element.ExecutableElement;
+import javax.lang.model.element.Modifier;
+import javax.lang.model.element.PackageElement;
+import javax.lang.model.element.TypeElement;
+import javax.lang.model.element.VariableElement;
+import javax.lang.model.type.ArrayType;
+import javax.lang.model.type.DeclaredType;
+import javax.lang.model.type.TypeKind;
+import javax.lang.model.type.TypeMirror;
+import javax.tools.Diagnostic;
+
+/* Writes <Class>_AndJSBindings next to every class with @CalledByJavascript
+ * methods: the names and JNI signatures of those methods, registered with
+ * native by AndJSBindings when the class is first injected. Objects of the
+ * annotated classes returned by them are registered as well. The generated
+ * class is also the AndJSBindings.Replayer of the batched methods, a switch
+ * that calls them without reflection. */
+public class CalledByJavascriptProcessor extends AbstractProcessor {
+	private static final String ANNOTATION = "com.github.wuruxu.andjs.CalledByJavascript";
+	private static final String BINDINGS = "com.github.wuruxu.andjs.AndJSBindings";
+	private static final String SUFFIX = "_AndJSBindings";
+
+	@Override
+	public Set<String> getSupportedAnnotationTypes() {
+		return Collections.singleton(ANNOTATION);
+	}
+
+	@Override
+	public SourceVersion getSupportedSourceVersion() {
+		return SourceVersion.latestSupported();
+	}
+
+	@Override
+	public boolean process(Set<? extends TypeElement> annotations, RoundEnvironment roundEnv) {
+		for(TypeElement annotation : annotations) {
+			Set<TypeElement> classes = new LinkedHashSet<TypeElement>();
+			for(Element element : roundEnv.getElementsAnnotatedWith(annotation))
+				classes.add((TypeElement) element.getEnclosingElement());
+			for(TypeElement clazz : classes)
+				generate(clazz);
+		}
+		return false;
+	}
+
+	private AnnotationMirror getAnnotation(Element element) {
+		for(AnnotationMirror mirror : element.getAnnotationMirrors()) {
+			TypeElement type = (TypeElement) mirror.getAnnotationType().asElement();
+			if(type.getQualifiedName().contentEquals(ANNOTATION))
+				return mirror;
+		}
+		return null;
+	}
+
+	private boolean isAnnotated(Element element) {
+		return getAnnotation(element) != null;
+	}
+
+	private boolean isBatched(ExecutableElement method) {
+		AnnotationMirror mirror = getAnnotation(method);
+		for(Map.Entry<? extends ExecutableElement, ? extends AnnotationValue> entry : mirror.getElementValues().entrySet()) {
+			if(entry.getKey().getSimpleName().contentEquals("batched"))
+				return Boolean.TRUE.equals(entry.getValue().getValue());
+		}
+		return false;
+	}
+
+	/* how replay() reads an argument of a batched call, null for types that
+	 * can't be batched */
+	private String reader(TypeMirror type) {
+		switch(type.getKind()) {
+			case BOOLEAN: return "args.get() != 0";
+			case INT: return "args.getInt()";
+			case LONG: return "args.getLong()";
+			case FLOAT: return "args.getFloat()";
+			case DOUBLE: return "args.getDouble()";
+			case DECLARED:
+				if(descriptor(type).equals("Ljava/lang/String;"))
+					return BINDINGS + ".readString(args)";
+				return null;
+			default:
+				return null;
+		}
+	}
+
+	private boolean canBatch(ExecutableElement method) {
+		if(method.getReturnType().getKind() != TypeKind.VOID)
+			return false;
+		for(VariableElement parameter : method.getParameters()) {
+			if(reader(parameter.asType()) == null)
+				return false;
+		}
+		return true;
+	}
+
+	/* public instance methods with the annotation, inherited ones included
+	 * like Class.getMethods() on the reflective path */
+	private List<ExecutableElement> getBoundMethods(TypeElement clazz) {
+		List<ExecutableElement> methods = new ArrayList<ExecutableElement>();
+		for(Element member : processingEnv.getElementUtils().getAllMembers(clazz)) {
+			if(member.getKind() != ElementKind.METHOD || !isAnnotated(member))
+				continue;
+			Set<Modifier> modifiers = member.getModifiers();
+			if(modifiers.contains(Modifier.PUBLIC) && !modifiers.contains(Modifier.STATIC))
+				methods.add((ExecutableElement) member);
+		}
+		return methods;
+	}
+
+	private String descriptor(TypeMirror type) {
+		switch(type.getKind()) {
+			case BOOLEAN: return "Z";
+			case BYTE: return "B";
+			case CHAR: return "C";
+			case SHORT: return "S";
+			case INT: return "I";
+			case LONG: return "J";
+			case FLOAT: return "F";
+			case DOUBLE: return "D";
+			case VOID: return "V";
+			case ARRAY: return "[" + descriptor(((ArrayType) type).getComponentType());
+			default:
+				break;
+		}
+		TypeMirror erasure = processingEnv.getTypeUtils().erasure(type);
+		TypeElement element = (TypeElement) processingEnv.getTypeUtils().asElement(erasure);
+		return "L" + processingEnv.getElementUtils().getBinaryName(element).toString().replace('.', '/') + ";";
+	}
+
+	private String signature(ExecutableElement method) {
+		StringBuilder signature = new StringBuilder("(");
+		for(VariableElement parameter : method.getParameters())
+			signature.append(descriptor(parameter.asType()));
+		signature.append(')').append(descriptor(method.getReturnType()));
+		return signature.toString();
+	}
+
+	private void generate(TypeElement clazz) {
+		/* the generated class names clazz from outside, the rest is reflected */
+		if(clazz.getModifiers().contains(Modifier.PRIVATE) || clazz.getQualifiedName().length() == 0)
+			return;
+		PackageElement pkg = processingEnv.getElementUtils().getPackageOf(clazz);
+		String packageName = pkg.getQualifiedName().toString();
+		String binaryName = processingEnv.getElementUtils().getBinaryName(clazz).toString();
+		String className = (packageName.isEmpty() ? binaryName : binaryName.substring(packageName.length() + 1)) + SUFFIX;
+
+		List<ExecutableElement> methods = getBoundMethods(clazz);
+		List<Boolean> batched = new ArrayList<Boolean>();
+		for(ExecutableElement method : methods) {
+			boolean batch = isBatched(method);
+			if(batch && !canBatch(method)) {
+				processingEnv.getMessager().printMessage(Diagnostic.Kind.ERROR,
+					"@CalledByJavascript(batched = true) needs a void method with boolean, int, long, float, double or String parameters", method);
+				batch = false;
+			}
+			batched.add(batch);
+		}
+		Set<String> returned = new LinkedHashSet<String>();
+		for(ExecutableElement method : methods) {
+			TypeMirror type = method.getReturnType();
+			if(type.getKind() != TypeKind.DECLARED)
+				continue;
+			TypeElement element = (TypeElement) ((DeclaredType) type).asElement();
+			if(!element.equals(clazz) && !getBoundMethods(element).isEmpty())
+				returned.add(element.getQualifiedName().toString());
+		}
+
+		StringBuilder out = new StringBuilder();
+		out.append("// Generated by CalledByJavascriptProcessor, do not edit.\n");
+		if(!packageName.isEmpty())
+			out.append("package ").append(packageName).append(";\n\n");
+		out.append("final class ").append(className).append(" implements ").append(BINDINGS).append(".Replayer {\n");
+		out.append("\tprivate static final String[] NAMES = {\n");
+		for(ExecutableElement method : methods)
+			out.append("\t\t\"").append(method.getSimpleName()).append("\",\n");
+		out.append("\t};\n");
+		out.append("\tprivate static final String[] SIGNATURES = {\n");
+		for(ExecutableElement method : methods)
+			out.append("\t\t\"").append(signature(method)).append("\",\n");
+		out.append("\t};\n");
+		out.append("\tprivate static final int[] FLAGS = {\n");
+		for(boolean batch : batched)
+			out.append("\t\t").append(batch ? BINDINGS + ".FLAG_BATCHED" : "0").append(",\n");
+		out.append("\t};\n\n");
+		out.append("\tstatic {\n");
+		out.append("\t\t").append(BINDINGS).append(".registerClass(")
+		   .append(clazz.getQualifiedName()).append(".class, NAMES, SIGNATURES, FLAGS, new ")
+		   .append(className).append("());\n");
+		for(String type : returned)
+			out.append("\t\t").append(BINDINGS).append(".ensureRegistered(").append(type).append(".class);\n");
+		out.append("\t}\n\n");
+		out.append("\tprivate ").append(className).append("() {\n\t}\n\n");
+		out.append("\t@Override\n");
+		out.append("\tpublic void replay(Object target, int method, java.nio.ByteBuffer args) throws Exception {\n");
+		out.append("\t\t").append(clazz.getQualifiedName()).append(" object = (")
+		   .append(clazz.getQualifiedName()).append(") target;\n");
+		out.append("\t\tswitch(method) {\n");
+		for(int i = 0; i < methods.size(); i++) {
+			if(!batched.get(i))
+				continue;
+			ExecutableElement method = methods.get(i);
+			/* java evaluates the arguments left to right, in buffer order */
+			out.append("\t\t\tcase ").append(i).append(":\n");
+			out.append("\t\t\t\tobject.").append(method.getSimpleName()).append("(");
+			List<? extends VariableElement> parameters = method.getParameters();
+			for(int j = 0; j < parameters.size(); j++)
+				out.append(j == 0 ? "" : ", ").append(reader(parameters.get(j).asType()));
+			out.append(");\n");
+			out.append("\t\t\t\tbreak;\n");
+		}
+		out.append("\t\t\tdefault:\n");
+		out.append("\t\t\t\tthrow new IllegalArgumentException(\"Not a batched method: \" + method);\n");
+		out.append("\t\t}\n");
+		out.append("\t}\n");
+		out.append("}\n");
+
+		String sourceName = packageName.isEmpty() ? className : packageName + "." + className;
+		try(Writer writer = processingEnv.getFiler().createSourceFile(sourceName, clazz).openWriter()) {
+			writer.write(out.toString());
+		} catch(IOException e) {
+			processingEnv.getMessager().printMessage(Diagnostic.Kind.ERROR,
+				"Unable to write " + sourceName + ": " + e.getMessage(), clazz);
+		}
+	}
+}
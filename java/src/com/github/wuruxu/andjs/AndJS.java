@@ -26,38 +26,430 @@ import org.chromium.base.library_loader.ProcessInitException;
 import org.chromium.base.library_loader.LibraryProcessType;
 import java.lang.annotation.Annotation;
 import java.lang.Object;
+import java.nio.ByteBuffer;
+import org.chromium.base.annotations.CalledByNative;
 import org.chromium.base.annotations.JNINamespace;
 import android.util.Log;
+import android.content.ComponentCallbacks2;
 import android.content.Context;
+import android.content.res.Configuration;
+import org.json.JSONException;
+import org.json.JSONObject;
 
 @JNINamespace("andjs")
 public class AndJS extends Object {
+	/* keep the order in sync with ScriptEngine::Type */
+	public enum Engine {
+		AUTO,
+		V8,
+		QUICKJS,
+	}
+
+	/* keep the order in sync with AndJSCore::Priority. Queued loads run from
+	 * the highest lane that has one, IDLE ones only while no other waits. */
+	public enum Priority {
+		HIGH,
+		NORMAL,
+		IDLE,
+	}
+
+	/* keep the values in sync with andjs::LogLevel */
+	public static final int LOG_VERBOSE = 0;
+	public static final int LOG_DEBUG = 1;
+	public static final int LOG_INFO = 2;
+	public static final int LOG_WARNING = 3;
+	public static final int LOG_ERROR = 4;
+
+	/* gets the postToJava(channel, value) calls of scripts on the JSTask
+	 * thread, data is in the StructuredCodec format and only valid during
+	 * the call */
+	public interface StructuredReceiver {
+		void onMessage(String channel, ByteBuffer data);
+	}
+
+	/* keep the values in sync with EventChannel::Coalesce */
+	public static final int COALESCE_NONE = 0;
+	/* only the newest pending event of the type is delivered */
+	public static final int COALESCE_LATEST = 1;
+	/* pending events of the type are delivered as one, data is their array */
+	public static final int COALESCE_ACCUMULATE = 2;
+
+	/* keep the order in sync with EventChannel::Backpressure */
+	public enum EventBackpressure {
+		DROP,
+		BLOCK,
+	}
+
+	public static class Options {
+		/* AUTO picks QuickJS for small scripts and V8 for large ones */
+		public Engine engine = Engine.AUTO;
+		/* expected script size in bytes, lets AUTO decide before the first load */
+		public int scriptSizeHint = 0;
+		/* CPU time budget of a single script run in ms, 0 means unlimited */
+		public long runTimeoutMs = 0;
+		/* every script run after the first one in a context starts from a
+		 * clean global scope, injected objects are kept */
+		public boolean freshContextPerRun = false;
+		/* hibernate() by itself after this many ms without work, 0 never does */
+		public long idleHibernateMs = 0;
+		/* events dispatched but not delivered yet, see dispatchEvent() */
+		public int eventQueueCapacity = 1024;
+		/* what dispatchEvent() does with a full queue */
+		public EventBackpressure eventBackpressure = EventBackpressure.DROP;
+		/* keeps the WebAssembly global and adds loadWasm(path), V8 only so
+		 * AUTO picks it */
+		public boolean exposeWasm = false;
+		/* where loadWasm() caches compiled modules, null is the app cache
+		 * directory */
+		public String wasmCacheDir = null;
+		/* heap limit in bytes of a QuickJS instance and of each of its
+		 * workers, 0 means unlimited */
+		public long quickjsMemoryLimit = 64L * 1024 * 1024;
+		/* loadJSFile() has V8 parse and compile files of at least this many
+		 * bytes on a background thread, 0 never does */
+		public int streamingMinScriptSize = 256 * 1024;
+
+		@CalledByNative("Options")
+		private int getEngine() {
+			return engine.ordinal();
+		}
+
+		@CalledByNative("Options")
+		private int getScriptSizeHint() {
+			return scriptSizeHint;
+		}
+
+		@CalledByNative("Options")
+		private long getRunTimeoutMs() {
+			return runTimeoutMs;
+		}
+
+		@CalledByNative("Options")
+		private boolean getFreshContextPerRun() {
+			return freshContextPerRun;
+		}
+
+		@CalledByNative("Options")
+		private long getIdleHibernateMs() {
+			return idleHibernateMs;
+		}
+
+		@CalledByNative("Options")
+		private int getEventQueueCapacity() {
+			return eventQueueCapacity;
+		}
+
+		@CalledByNative("Options")
+		private int getEventBackpressure() {
+			return eventBackpressure.ordinal();
+		}
+
+		@CalledByNative("Options")
+		private boolean getExposeWasm() {
+			return exposeWasm;
+		}
+
+		@CalledByNative("Options")
+		private String getWasmCacheDir() {
+			return wasmCacheDir;
+		}
+
+		@CalledByNative("Options")
+		private long getQuickJSMemoryLimit() {
+			return quickjsMemoryLimit;
+		}
+
+		@CalledByNative("Options")
+		private int getStreamingMinScriptSize() {
+			return streamingMinScriptSize;
+		}
+	}
+
+	/* keep in sync with ScriptEngine::kMainContextId */
+	static final int MAIN_CONTEXT_ID = 0;
+
 	private long mNativeJSCore;
-	private boolean mShutdown;
+	/* read without locker, the native calls after shutdown() are no-ops */
+	private volatile boolean mShutdown;
 	private Object locker;
+	private static boolean sTrimMemoryRegistered;
 
 	public AndJS(Context context) {
+		this(context, new Options());
+	}
+
+	public AndJS(Context context, Options options) {
 		ContextUtils.initApplicationContext(context);
 		try {
         	LibraryLoader.getInstance().ensureInitialized(LibraryProcessType.PROCESS_CHILD);
 		} catch( ProcessInitException pie) {
         	Log.e("AndJS" , "Unable to load native libraries.", pie);
 		}
-		mNativeJSCore = nativeInitAndJS();
+		mNativeJSCore = nativeInitAndJS(options);
 		mShutdown = false;
 		locker = new Object();
+		registerTrimMemory(context);
 	}
 
-	public void loadJSBuf(String jsbuf) {
-		nativeLoadJSBuf(mNativeJSCore, jsbuf);
+	/* onTrimMemory levels become base::MemoryPressureListener notifications,
+	 * every instance then runs a GC on its engine thread */
+	private static synchronized void registerTrimMemory(Context context) {
+		if(sTrimMemoryRegistered)
+			return;
+		sTrimMemoryRegistered = true;
+		context.getApplicationContext().registerComponentCallbacks(new ComponentCallbacks2() {
+			@Override
+			public void onTrimMemory(int level) {
+				if(level >= TRIM_MEMORY_COMPLETE || level == TRIM_MEMORY_RUNNING_CRITICAL)
+					nativeOnMemoryPressure(true);
+				else if(level >= TRIM_MEMORY_BACKGROUND || level == TRIM_MEMORY_RUNNING_LOW)
+					nativeOnMemoryPressure(false);
+			}
+
+			@Override
+			public void onLowMemory() {
+				nativeOnMemoryPressure(true);
+			}
+
+			@Override
+			public void onConfigurationChanged(Configuration config) {
+			}
+		});
 	}
 
-	public void loadJSFile(String jsfile) {
-		nativeLoadJSFile(mNativeJSCore, jsfile);
+	/* the engine in use, AUTO until the first script has been loaded */
+	public Engine getEngine() {
+		return Engine.values()[nativeGetEngineType(mNativeJSCore)];
+	}
+
+	public JSTaskHandle loadJSBuf(String jsbuf) {
+		return loadJSBuf(jsbuf, -1);
+	}
+
+	/* timeoutMs overrides Options.runTimeoutMs for this run, -1 keeps it */
+	public JSTaskHandle loadJSBuf(String jsbuf, long timeoutMs) {
+		return loadJSBuf(MAIN_CONTEXT_ID, jsbuf, timeoutMs, Priority.NORMAL, null);
+	}
+
+	public JSTaskHandle loadJSBuf(String jsbuf, Priority priority) {
+		return loadJSBuf(jsbuf, priority, null);
+	}
+
+	/* a queued load with the same replaceKey is dropped, this one takes its
+	 * place at the end of its lane */
+	public JSTaskHandle loadJSBuf(String jsbuf, Priority priority, String replaceKey) {
+		return loadJSBuf(MAIN_CONTEXT_ID, jsbuf, -1, priority, replaceKey);
+	}
+
+	JSTaskHandle loadJSBuf(int contextId, String jsbuf, long timeoutMs, Priority priority, String replaceKey) {
+		if(mShutdown)
+			return new JSTaskHandle(this, 0);
+		return new JSTaskHandle(this, nativeLoadJSBuf(mNativeJSCore, contextId, jsbuf, timeoutMs, priority.ordinal(), replaceKey));
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile) {
+		return loadJSFile(jsfile, -1);
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile, long timeoutMs) {
+		return loadJSFile(MAIN_CONTEXT_ID, jsfile, timeoutMs, Priority.NORMAL, null);
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile, Priority priority) {
+		return loadJSFile(jsfile, priority, null);
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile, Priority priority, String replaceKey) {
+		return loadJSFile(MAIN_CONTEXT_ID, jsfile, -1, priority, replaceKey);
+	}
+
+	JSTaskHandle loadJSFile(int contextId, String jsfile, long timeoutMs, Priority priority, String replaceKey) {
+		if(mShutdown)
+			return new JSTaskHandle(this, 0);
+		return new JSTaskHandle(this, nativeLoadJSFile(mNativeJSCore, contextId, jsfile, timeoutMs, priority.ordinal(), replaceKey));
+	}
+
+	/* runs the module entry of a bundle written by tools/make_bundle.py */
+	public JSTaskHandle loadJSBundle(String bundle, String entry) {
+		return loadJSBundle(bundle, entry, -1);
+	}
+
+	public JSTaskHandle loadJSBundle(String bundle, String entry, long timeoutMs) {
+		return loadJSBundle(MAIN_CONTEXT_ID, bundle, entry, timeoutMs, Priority.NORMAL, null);
+	}
+
+	public JSTaskHandle loadJSBundle(String bundle, String entry, Priority priority) {
+		return loadJSBundle(MAIN_CONTEXT_ID, bundle, entry, -1, priority, null);
+	}
+
+	JSTaskHandle loadJSBundle(int contextId, String bundle, String entry, long timeoutMs, Priority priority, String replaceKey) {
+		if(mShutdown)
+			return new JSTaskHandle(this, 0);
+		return new JSTaskHandle(this, nativeLoadJSBundle(mNativeJSCore, contextId, bundle, entry, timeoutMs, priority.ordinal(), replaceKey));
+	}
+
+	boolean cancelTask(long taskId) {
+		return nativeCancelTask(mNativeJSCore, taskId);
+	}
+
+	/* a separate global scope on this instance's heap and thread, much cheaper
+	 * than another AndJS. Creating one fixes an AUTO engine to QuickJS unless
+	 * a script has been loaded before. */
+	public AndJSContext createContext() {
+		return createContext(0);
+	}
+
+	/* waits up to waitMs for the context to exist on JSTask, called from a
+	 * script it doesn't wait */
+	public AndJSContext createContext(long waitMs) {
+		if(mShutdown)
+			throw new IllegalStateException("AndJS is shut down");
+		int contextId = nativeCreateContext(mNativeJSCore, waitMs);
+		/* 0 is the main context, it comes back when shut down meanwhile or
+		 * when the engine had no memory for the context */
+		if(contextId == 0)
+			throw new IllegalStateException("context not created");
+		return new AndJSContext(this, contextId);
+	}
+
+	boolean disposeContext(int contextId, long waitMs) {
+		if(mShutdown)
+			return false;
+		return nativeDisposeContext(mNativeJSCore, contextId, waitMs);
+	}
+
+	/* drop the globals of earlier scripts, injected objects stay bound */
+	public void resetContext() {
+		resetContext(MAIN_CONTEXT_ID, 0);
+	}
+
+	/* waits up to waitMs for the reset, false when it didn't happen in time */
+	public boolean resetContext(long waitMs) {
+		return resetContext(MAIN_CONTEXT_ID, waitMs);
+	}
+
+	boolean resetContext(int contextId, long waitMs) {
+		if(mShutdown)
+			return false;
+		return nativeResetContext(mNativeJSCore, contextId, waitMs);
+	}
+
+	/* number of runs stopped because they used up their CPU time budget */
+	public long getTerminatedRunCount() {
+		return nativeGetTerminatedRunCount(mNativeJSCore);
+	}
+
+	/* per instance counters such as scriptsRun, runTimeUs, bridgeCalls or
+	 * contextCreateTimeUs, see AndJSStats::ToValue() for all keys */
+	public JSONObject getStats() {
+		try {
+			return new JSONObject(nativeGetStats(mNativeJSCore));
+		} catch(JSONException e) {
+			Log.e("AndJS", "Invalid stats", e);
+			return new JSONObject();
+		}
+	}
+
+	/* sample the javascript stack of this instance every millisecond */
+	public void startProfiling(String name) {
+		startProfiling(name, 1000);
+	}
+
+	public void startProfiling(String name, int intervalUs) {
+		if(mShutdown)
+			return;
+		nativeStartProfiling(mNativeJSCore, name, intervalUs);
+	}
+
+	/* write the profile as a DevTools .cpuprofile file once queued scripts ran */
+	public void stopProfiling(String path) {
+		if(mShutdown)
+			return;
+		nativeStopProfiling(mNativeJSCore, path);
+	}
+
+	/* record trace events of all instances, null or "" records "andjs,v8" */
+	public static void startTracing(String categories) {
+		nativeStartTracing(categories == null ? "" : categories);
+	}
+
+	/* stop recording and write a chrome://tracing JSON file to path */
+	public static boolean stopTracing(String path) {
+		return nativeStopTracing(path);
+	}
+
+	/* minimum level of adb.info/adb.error and internal logs, process wide */
+	public static void setLogLevel(int level) {
+		nativeSetLogLevel(level);
 	}
 
 	public void injectObject(Object obj, String name) {
-		nativeInjectObject(mNativeJSCore, obj, name, CalledByJavascript.class);
+		injectObject(MAIN_CONTEXT_ID, obj, name, 0);
+	}
+
+	/* the object is bound on JSTask like everything the engine does, waits up
+	 * to waitMs for it. False when it couldn't be bound in time, called from
+	 * a script it doesn't wait. */
+	public boolean injectObject(Object obj, String name, long waitMs) {
+		return injectObject(MAIN_CONTEXT_ID, obj, name, waitMs);
+	}
+
+	boolean injectObject(int contextId, Object obj, String name, long waitMs) {
+		if(mShutdown)
+			return false;
+		AndJSBindings.ensureRegistered(obj.getClass());
+		return nativeInjectObject(mNativeJSCore, contextId, obj, name, CalledByJavascript.class, waitMs);
+	}
+
+	/* deliver {type, data} to the addEventListener(type) listeners of the main
+	 * context, from any thread. payload is null, a String, a Number, a Boolean,
+	 * a Map, a Collection, an array or a JSONObject/JSONArray. Returns false
+	 * when the queue was full or the payload can't be converted. */
+	public boolean dispatchEvent(String type, Object payload) {
+		String data;
+		if(payload == null)
+			data = "null";
+		else if(payload instanceof String)
+			data = JSONObject.quote((String) payload);
+		else {
+			Object wrapped = JSONObject.wrap(payload);
+			if(wrapped == null)
+				return false;
+			if(wrapped instanceof String || wrapped instanceof Character)
+				data = JSONObject.quote(wrapped.toString());
+			else
+				data = wrapped.toString();
+		}
+		return nativeDispatchEvent(mNativeJSCore, type, data);
+	}
+
+	/* like dispatchEvent() without JSON, payload is written in the binary
+	 * StructuredCodec format and read straight into script values. Takes what
+	 * StructuredCodec.encode() takes, byte[] and ByteBuffer become Uint8Arrays. */
+	public boolean dispatchStructuredEvent(String type, Object payload) {
+		ByteBuffer data = StructuredCodec.encode(payload);
+		return nativeDispatchStructuredEvent(mNativeJSCore, type, data, data.limit());
+	}
+
+	/* the receiver of the global postToJava(channel, value) of scripts, which
+	 * returns false while there is none */
+	public void setStructuredReceiver(StructuredReceiver receiver) {
+		nativeSetStructuredReceiver(mNativeJSCore, receiver);
+	}
+
+	/* COALESCE_NONE, COALESCE_LATEST or COALESCE_ACCUMULATE for the events of
+	 * type dispatched from now on */
+	public void setEventCoalescing(String type, int coalesce) {
+		nativeSetEventCoalesce(mNativeJSCore, type, coalesce);
+	}
+
+	/* release the engine heap and thread once queued scripts ran. Globals that
+	 * can be structured cloned and injected objects come back on the next
+	 * load, functions and workers do not */
+	public void hibernate() {
+		if(mShutdown)
+			return;
+		nativeHibernate(mNativeJSCore);
 	}
 
 	public void shutdown() {
@@ -74,9 +466,28 @@ public class AndJS extends Object {
 		shutdown();
 	}
 
-	private native long nativeInitAndJS();
-	private native boolean nativeInjectObject(long nativeAndJSCore, Object obj, String name, Class requiredAnnotation);
-	private native void nativeLoadJSBuf(long nativeAndJSCore, String jsbuf);
-	private native void nativeLoadJSFile(long nativeAndJSCore, String jsfile);
+	private native long nativeInitAndJS(Options options);
+	private native int nativeGetEngineType(long nativeAndJSCore);
+	private native long nativeGetTerminatedRunCount(long nativeAndJSCore);
+	private native String nativeGetStats(long nativeAndJSCore);
+	private native void nativeStartProfiling(long nativeAndJSCore, String name, int intervalUs);
+	private native void nativeStopProfiling(long nativeAndJSCore, String path);
+	private static native void nativeStartTracing(String categories);
+	private static native boolean nativeStopTracing(String path);
+	private static native void nativeSetLogLevel(int level);
+	private static native void nativeOnMemoryPressure(boolean critical);
+	private native int nativeCreateContext(long nativeAndJSCore, long waitMs);
+	private native boolean nativeDisposeContext(long nativeAndJSCore, int contextId, long waitMs);
+	private native boolean nativeResetContext(long nativeAndJSCore, int contextId, long waitMs);
+	private native boolean nativeInjectObject(long nativeAndJSCore, int contextId, Object obj, String name, Class requiredAnnotation, long waitMs);
+	private native long nativeLoadJSBuf(long nativeAndJSCore, int contextId, String jsbuf, long timeoutMs, int priority, String replaceKey);
+	private native long nativeLoadJSFile(long nativeAndJSCore, int contextId, String jsfile, long timeoutMs, int priority, String replaceKey);
+	private native long nativeLoadJSBundle(long nativeAndJSCore, int contextId, String bundle, String entry, long timeoutMs, int priority, String replaceKey);
+	private native boolean nativeCancelTask(long nativeAndJSCore, long taskId);
+	private native boolean nativeDispatchEvent(long nativeAndJSCore, String type, String data);
+	private native boolean nativeDispatchStructuredEvent(long nativeAndJSCore, String type, ByteBuffer data, int length);
+	private native void nativeSetStructuredReceiver(long nativeAndJSCore, StructuredReceiver receiver);
+	private native void nativeSetEventCoalesce(long nativeAndJSCore, String type, int coalesce);
+	private native void nativeHibernate(long nativeAndJSCore);
 	private native void nativeShutdown(long nativeAndJSCore);
 }
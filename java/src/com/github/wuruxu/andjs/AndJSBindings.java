@@ -0,0 +1,118 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+package com.github.wuruxu.andjs;
+
+import android.util.Log;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Set;
+import org.chromium.base.annotations.CalledByNative;
+import org.chromium.base.annotations.JNINamespace;
+
+/* Entry point of the <Class>_AndJSBindings classes CalledByJavascriptProcessor
+ * generates. A generated class hands its method table to native once, calls of
+ * those methods then skip reflection. Classes without one keep the reflective
+ * bridge. */
+@JNINamespace("andjs")
+public final class AndJSBindings {
+	static final String SUFFIX = "_AndJSBindings";
+
+	/* per method flags of a generated table, keep in sync with andjs_bindings.cc */
+	public static final int FLAG_BATCHED = 1 << 0;
+
+	/* runs the batched calls of one generated class, see replay() */
+	public interface Replayer {
+		/* calls method number method of the table on target with the
+		 * arguments read from args */
+		void replay(Object target, int method, ByteBuffer args) throws Exception;
+	}
+
+	private static final Set<Class<?>> sLoaded = new HashSet<Class<?>>();
+	private static final List<Replayer> sReplayers = new ArrayList<Replayer>();
+
+	private AndJSBindings() {
+	}
+
+	/* loads the generated bindings of clazz, at most once per class */
+	public static void ensureRegistered(Class<?> clazz) {
+		synchronized(sLoaded) {
+			if(!sLoaded.add(clazz))
+				return;
+		}
+		try {
+			Class.forName(clazz.getName() + SUFFIX, true, clazz.getClassLoader());
+		} catch(ClassNotFoundException e) {
+			/* not annotated at compile time, reflected on injection */
+		}
+	}
+
+	/* called from the static initializer of a generated class, names, JNI
+	 * signatures and FLAG_* of the @CalledByJavascript methods of clazz */
+	public static void registerClass(Class<?> clazz, String[] names, String[] signatures, int[] flags,
+	                                 Replayer replayer) {
+		int replayerId;
+		synchronized(sReplayers) {
+			replayerId = sReplayers.size();
+			sReplayers.add(replayer);
+		}
+		nativeRegisterClass(clazz, names, signatures, flags, replayerId, CalledByJavascript.class);
+	}
+
+	/* a String argument of a batched call */
+	public static String readString(ByteBuffer args) {
+		int length = args.getInt();
+		if(length < 0)
+			return null;
+		char[] chars = new char[length];
+		args.asCharBuffer().get(chars);
+		args.position(args.position() + length * 2);
+		return new String(chars);
+	}
+
+	/* the batched calls of one engine in the order scripts made them, see
+	 * BatchedCalls in andjs_bindings.h for the layout of calls */
+	@CalledByNative
+	private static void replay(Object[] targets, ByteBuffer calls) {
+		Replayer[] replayers;
+		synchronized(sReplayers) {
+			replayers = sReplayers.toArray(new Replayer[sReplayers.size()]);
+		}
+		calls.order(ByteOrder.nativeOrder());
+		while(calls.hasRemaining()) {
+			Replayer replayer = replayers[calls.getInt()];
+			int method = calls.getInt();
+			Object target = targets[calls.getInt()];
+			try {
+				replayer.replay(target, method, calls);
+			} catch(Throwable e) {
+				/* arguments are read before the method runs, the next call
+				 * starts where this one ended */
+				Log.e("AndJS", "Batched call of " + target.getClass().getName() + " threw", e);
+			}
+		}
+	}
+
+	private static native void nativeRegisterClass(Class clazz, String[] names, String[] signatures, int[] flags,
+	                                               int replayer, Class annotation);
+}
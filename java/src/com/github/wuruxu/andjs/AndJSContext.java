@@ -0,0 +1,101 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+package com.github.wuruxu.andjs;
+
+/* A global scope created by AndJS.createContext(). It has its own globals and
+ * injected objects but shares the heap, the thread and the engine of the AndJS
+ * it came from, scripts of all its contexts run one after another. */
+public class AndJSContext {
+	private final AndJS mOwner;
+	private final int mContextId;
+	private boolean mClosed;
+
+	AndJSContext(AndJS owner, int contextId) {
+		mOwner = owner;
+		mContextId = contextId;
+	}
+
+	public void injectObject(Object obj, String name) {
+		mOwner.injectObject(mContextId, obj, name, 0);
+	}
+
+	public boolean injectObject(Object obj, String name, long waitMs) {
+		return mOwner.injectObject(mContextId, obj, name, waitMs);
+	}
+
+	public JSTaskHandle loadJSBuf(String jsbuf) {
+		return loadJSBuf(jsbuf, -1);
+	}
+
+	public JSTaskHandle loadJSBuf(String jsbuf, long timeoutMs) {
+		return mOwner.loadJSBuf(mContextId, jsbuf, timeoutMs, AndJS.Priority.NORMAL, null);
+	}
+
+	public JSTaskHandle loadJSBuf(String jsbuf, AndJS.Priority priority, String replaceKey) {
+		return mOwner.loadJSBuf(mContextId, jsbuf, -1, priority, replaceKey);
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile) {
+		return loadJSFile(jsfile, -1);
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile, long timeoutMs) {
+		return mOwner.loadJSFile(mContextId, jsfile, timeoutMs, AndJS.Priority.NORMAL, null);
+	}
+
+	public JSTaskHandle loadJSFile(String jsfile, AndJS.Priority priority, String replaceKey) {
+		return mOwner.loadJSFile(mContextId, jsfile, -1, priority, replaceKey);
+	}
+
+	public JSTaskHandle loadJSBundle(String bundle, String entry) {
+		return loadJSBundle(bundle, entry, -1);
+	}
+
+	public JSTaskHandle loadJSBundle(String bundle, String entry, long timeoutMs) {
+		return mOwner.loadJSBundle(mContextId, bundle, entry, timeoutMs, AndJS.Priority.NORMAL, null);
+	}
+
+	/* a clean global scope once the queued scripts ran, injected objects stay */
+	public void reset() {
+		mOwner.resetContext(mContextId, 0);
+	}
+
+	/* waits up to waitMs for the reset, false when it didn't happen in time */
+	public boolean reset(long waitMs) {
+		return mOwner.resetContext(mContextId, waitMs);
+	}
+
+	/* drops the globals once the queued scripts ran */
+	public void close() {
+		close(0);
+	}
+
+	/* waits up to waitMs for the context to be gone, false when it wasn't in
+	 * time */
+	public boolean close(long waitMs) {
+		synchronized(this) {
+			if(mClosed)
+				return true;
+			mClosed = true;
+		}
+		return mOwner.disposeContext(mContextId, waitMs);
+	}
+}
@@ -31,4 +31,11 @@ import java.lang.annotation.Target;
  */
 @Retention(RetentionPolicy.RUNTIME)
 @Target({ElementType.METHOD})
-public @interface CalledByJavascript {}
+public @interface CalledByJavascript {
+	/* void methods with boolean, int, long, float, double or String
+	 * parameters only. Calls return undefined right away and run later in
+	 * the order they were made, in one upcall per batch: at the end of the
+	 * task, when the batch grows large, on andjs.flush() or before another
+	 * bridge call. Needs the generated bindings. */
+	boolean batched() default false;
+}
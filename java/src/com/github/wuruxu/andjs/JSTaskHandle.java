@@ -0,0 +1,39 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+package com.github.wuruxu.andjs;
+
+/* A script load waiting in its AndJS.Priority lane. */
+public final class JSTaskHandle {
+	private final AndJS mOwner;
+	/* 0 when nothing was queued, the file or bundle couldn't be opened */
+	private final long mTaskId;
+
+	JSTaskHandle(AndJS owner, long taskId) {
+		mOwner = owner;
+		mTaskId = taskId;
+	}
+
+	/* drop the script if it did not start yet, false once it started, ran,
+	 * was cancelled or replaced by a load with the same replace key */
+	public boolean cancel() {
+		return mTaskId != 0 && mOwner.cancelTask(mTaskId);
+	}
+}
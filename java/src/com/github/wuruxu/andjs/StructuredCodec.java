@@ -0,0 +1,263 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+package com.github.wuruxu.andjs;
+
+import android.util.Log;
+import java.lang.reflect.Array;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.Collection;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+import org.chromium.base.annotations.CalledByNative;
+import org.chromium.base.annotations.JNINamespace;
+import org.json.JSONArray;
+import org.json.JSONObject;
+
+/* The binary format of postToJava() and AndJS.dispatchStructuredEvent(), see
+ * StructuredWriter in andjs_structured.h. Script objects decode to
+ * LinkedHashMap, arrays to ArrayList, binary data to byte[], numbers to
+ * Integer or Double and undefined to null. */
+@JNINamespace("andjs")
+public final class StructuredCodec {
+	/* keep in sync with StructuredWriter::kVersion and StructuredTag */
+	private static final byte VERSION = 1;
+	private static final byte NULL = 0;
+	private static final byte UNDEFINED = 1;
+	private static final byte FALSE = 2;
+	private static final byte TRUE = 3;
+	private static final byte INT32 = 4;
+	private static final byte DOUBLE = 5;
+	private static final byte LATIN1_STRING = 6;
+	private static final byte TWO_BYTE_STRING = 7;
+	private static final byte UTF8_STRING = 8;
+	private static final byte ARRAY = 9;
+	private static final byte OBJECT = 10;
+	private static final byte BYTES = 11;
+	private static final int MAX_DEPTH = 128;
+
+	private ByteBuffer mBuffer;
+
+	private StructuredCodec() {
+		mBuffer = ByteBuffer.allocateDirect(256).order(ByteOrder.LITTLE_ENDIAN);
+	}
+
+	/* the value in data from its position on */
+	public static Object decode(ByteBuffer data) {
+		data.order(ByteOrder.LITTLE_ENDIAN);
+		if(data.get() != VERSION)
+			throw new IllegalArgumentException("Unknown structured data version");
+		return read(data, 0);
+	}
+
+	/* a direct buffer holding value, from position 0 to its limit. Takes
+	 * null, Boolean, Number, CharSequence, Character, byte[], ByteBuffer,
+	 * Map, Collection, arrays and JSONObject/JSONArray. */
+	public static ByteBuffer encode(Object value) {
+		StructuredCodec codec = new StructuredCodec();
+		codec.mBuffer.put(VERSION);
+		codec.write(value, 0);
+		codec.mBuffer.flip();
+		return codec.mBuffer;
+	}
+
+	private static Object read(ByteBuffer data, int depth) {
+		if(depth > MAX_DEPTH)
+			throw new IllegalArgumentException("Structured data nested too deeply");
+		byte tag = data.get();
+		switch(tag) {
+			case NULL:
+			case UNDEFINED:
+				return null;
+			case FALSE:
+				return Boolean.FALSE;
+			case TRUE:
+				return Boolean.TRUE;
+			case INT32:
+				return data.getInt();
+			case DOUBLE:
+				return data.getDouble();
+			case LATIN1_STRING:
+				return new String(readBytes(data), StandardCharsets.ISO_8859_1);
+			case UTF8_STRING:
+				return new String(readBytes(data), StandardCharsets.UTF_8);
+			case TWO_BYTE_STRING: {
+				char[] chars = new char[data.getInt()];
+				data.asCharBuffer().get(chars);
+				data.position(data.position() + chars.length * 2);
+				return new String(chars);
+			}
+			case BYTES:
+				return readBytes(data);
+			case ARRAY: {
+				int count = data.getInt();
+				/* not sized by count, a bogus one runs out of data first */
+				List<Object> list = new ArrayList<Object>();
+				for(int i = 0; i < count; i++)
+					list.add(read(data, depth + 1));
+				return list;
+			}
+			case OBJECT: {
+				int count = data.getInt();
+				Map<String, Object> map = new LinkedHashMap<String, Object>();
+				for(int i = 0; i < count; i++) {
+					Object key = read(data, depth + 1);
+					if(!(key instanceof String))
+						throw new IllegalArgumentException("Structured object key is not a string");
+					map.put((String) key, read(data, depth + 1));
+				}
+				return map;
+			}
+			default:
+				throw new IllegalArgumentException("Unknown structured data tag " + tag);
+		}
+	}
+
+	private static byte[] readBytes(ByteBuffer data) {
+		byte[] bytes = new byte[data.getInt()];
+		data.get(bytes);
+		return bytes;
+	}
+
+	private void ensureRoom(int bytes) {
+		if(mBuffer.remaining() >= bytes)
+			return;
+		int capacity = mBuffer.capacity();
+		while(capacity - mBuffer.position() < bytes)
+			capacity *= 2;
+		ByteBuffer grown = ByteBuffer.allocateDirect(capacity).order(ByteOrder.LITTLE_ENDIAN);
+		mBuffer.flip();
+		grown.put(mBuffer);
+		mBuffer = grown;
+	}
+
+	private void writeTag(byte tag) {
+		ensureRoom(1);
+		mBuffer.put(tag);
+	}
+
+	private void writeString(CharSequence value) {
+		int length = value.length();
+		ensureRoom(5 + length * 2);
+		mBuffer.put(TWO_BYTE_STRING).putInt(length);
+		for(int i = 0; i < length; i++)
+			mBuffer.putChar(value.charAt(i));
+	}
+
+	private void writeBytes(ByteBuffer value) {
+		ensureRoom(5 + value.remaining());
+		mBuffer.put(BYTES).putInt(value.remaining());
+		mBuffer.put(value.duplicate());
+	}
+
+	/* returns the position of the count, set by endContainer() */
+	private int beginContainer(byte tag) {
+		ensureRoom(5);
+		mBuffer.put(tag);
+		int position = mBuffer.position();
+		mBuffer.putInt(0);
+		return position;
+	}
+
+	private void endContainer(int position, int count) {
+		mBuffer.putInt(position, count);
+	}
+
+	private void write(Object value, int depth) {
+		if(value == null || value == JSONObject.NULL) {
+			writeTag(NULL);
+		} else if(value instanceof Boolean) {
+			writeTag((Boolean) value ? TRUE : FALSE);
+		} else if(value instanceof Integer || value instanceof Short || value instanceof Byte) {
+			ensureRoom(5);
+			mBuffer.put(INT32).putInt(((Number) value).intValue());
+		} else if(value instanceof Long && (Long) value == ((Long) value).intValue()) {
+			ensureRoom(5);
+			mBuffer.put(INT32).putInt(((Long) value).intValue());
+		} else if(value instanceof Number) {
+			ensureRoom(9);
+			mBuffer.put(DOUBLE).putDouble(((Number) value).doubleValue());
+		} else if(value instanceof CharSequence) {
+			writeString((CharSequence) value);
+		} else if(value instanceof Character) {
+			writeString(value.toString());
+		} else if(value instanceof byte[]) {
+			writeBytes(ByteBuffer.wrap((byte[]) value));
+		} else if(value instanceof ByteBuffer) {
+			writeBytes((ByteBuffer) value);
+		} else if(depth >= MAX_DEPTH) {
+			throw new IllegalArgumentException("Value nested too deeply, is it cyclic?");
+		} else if(value instanceof Map) {
+			Map<?, ?> map = (Map<?, ?>) value;
+			int position = beginContainer(OBJECT);
+			for(Map.Entry<?, ?> entry : map.entrySet()) {
+				writeString(String.valueOf(entry.getKey()));
+				write(entry.getValue(), depth + 1);
+			}
+			endContainer(position, map.size());
+		} else if(value instanceof JSONObject) {
+			JSONObject object = (JSONObject) value;
+			int position = beginContainer(OBJECT);
+			for(Iterator<String> keys = object.keys(); keys.hasNext();) {
+				String key = keys.next();
+				writeString(key);
+				write(object.opt(key), depth + 1);
+			}
+			endContainer(position, object.length());
+		} else if(value instanceof Collection) {
+			Collection<?> collection = (Collection<?>) value;
+			int position = beginContainer(ARRAY);
+			for(Object item : collection)
+				write(item, depth + 1);
+			endContainer(position, collection.size());
+		} else if(value instanceof JSONArray) {
+			JSONArray array = (JSONArray) value;
+			int position = beginContainer(ARRAY);
+			for(int i = 0; i < array.length(); i++)
+				write(array.opt(i), depth + 1);
+			endContainer(position, array.length());
+		} else if(value.getClass().isArray()) {
+			int length = Array.getLength(value);
+			int position = beginContainer(ARRAY);
+			for(int i = 0; i < length; i++)
+				write(Array.get(value, i), depth + 1);
+			endContainer(position, length);
+		} else {
+			throw new IllegalArgumentException("Can't encode " + value.getClass().getName());
+		}
+	}
+
+	/* a postToJava() of the instance receiver was set on, data is only valid
+	 * during the call */
+	@CalledByNative
+	private static void deliver(AndJS.StructuredReceiver receiver, String channel, ByteBuffer data) {
+		data.order(ByteOrder.LITTLE_ENDIAN);
+		try {
+			receiver.onMessage(channel, data);
+		} catch(Throwable e) {
+			Log.e("AndJS", "StructuredReceiver of " + channel + " threw", e);
+		}
+	}
+}
@@ -0,0 +1,102 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_MPSC_QUEUE_H__
+#define __ANDJS_MPSC_QUEUE_H__
+#include <atomic>
+#include <utility>
+
+#include "base/macros.h"
+
+namespace andjs {
+
+// Unbounded lock-free queue for many producers and a single consumer
+// (Dmitry Vyukov's intrusive node queue). Push is one atomic exchange and
+// never fails, for what can neither be dropped nor wait for room the way
+// MPSCRingBuffer entries can. TryPop may miss an element whose Push has not
+// returned yet, that producer sees it then.
+template <typename T>
+class MPSCQueue {
+  public:
+    MPSCQueue() : head_(&stub_), tail_(&stub_) {}
+
+    // No producer is left by then.
+    ~MPSCQueue() {
+      T value;
+      while(TryPop(&value)) {}
+    }
+
+    // Any thread.
+    void Push(T value) {
+      PushNode(new Node(std::move(value)));
+    }
+
+    // Consumer thread only.
+    bool TryPop(T* value) {
+      Node* tail = tail_;
+      Node* next = tail->next.load(std::memory_order_acquire);
+      if(tail == &stub_) {
+        if(!next)
+          return false;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+      if(!next) {
+        // |tail| is the last node, unless a push is between its exchange
+        // and linking the node.
+        if(tail != head_.load(std::memory_order_acquire))
+          return false;
+        PushNode(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if(!next)
+          return false;
+      }
+      tail_ = next;
+      *value = std::move(tail->value);
+      delete tail;
+      return true;
+    }
+
+  private:
+    struct Node {
+      Node() : next(nullptr) {}
+      explicit Node(T&& value) : next(nullptr), value(std::move(value)) {}
+
+      std::atomic<Node*> next;
+      T value;
+    };
+
+    void PushNode(Node* node) {
+      node->next.store(nullptr, std::memory_order_relaxed);
+      Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    alignas(64) std::atomic<Node*> head_;
+    alignas(64) Node* tail_;
+    Node stub_;
+
+    DISALLOW_COPY_AND_ASSIGN(MPSCQueue);
+};
+
+}
+#endif
@@ -0,0 +1,152 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/mpsc_queue.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace andjs {
+
+namespace {
+
+const int kProducers = 4;
+const int kItemsPerProducer = 20000;
+
+// Pushes (producer << 24 | sequence) for every sequence in order.
+class QueueProducer : public base::DelegateSimpleThread::Delegate {
+  public:
+    QueueProducer(MPSCQueue<int>* queue, int producer) : queue_(queue), producer_(producer) {}
+
+    void Run() override {
+      for(int i = 0; i < kItemsPerProducer; i++)
+        queue_->Push(producer_ << 24 | i);
+    }
+
+  private:
+    MPSCQueue<int>* queue_;
+    int producer_;
+};
+
+TEST(MPSCQueueTest, PopsNothingWhenEmpty) {
+  MPSCQueue<int> queue;
+  int value = -1;
+  EXPECT_FALSE(queue.TryPop(&value));
+  EXPECT_EQ(-1, value);
+}
+
+TEST(MPSCQueueTest, PopsInOrder) {
+  MPSCQueue<int> queue;
+  for(int i = 0; i < 100; i++)
+    queue.Push(i);
+  int value;
+  for(int i = 0; i < 100; i++) {
+    ASSERT_TRUE(queue.TryPop(&value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_FALSE(queue.TryPop(&value));
+}
+
+TEST(MPSCQueueTest, InterleavesPushAndPop) {
+  // Popping the last element puts the stub back behind it, every few
+  // rounds here.
+  MPSCQueue<int> queue;
+  int pushed = 0;
+  int popped = 0;
+  for(int round = 1; round <= 8; round++) {
+    for(int i = 0; i < round; i++)
+      queue.Push(pushed++);
+    int value;
+    for(int i = 0; i < round; i++) {
+      ASSERT_TRUE(queue.TryPop(&value));
+      EXPECT_EQ(popped++, value);
+    }
+    EXPECT_FALSE(queue.TryPop(&value));
+    queue.Push(pushed++);
+    ASSERT_TRUE(queue.TryPop(&value));
+    EXPECT_EQ(popped++, value);
+    EXPECT_FALSE(queue.TryPop(&value));
+  }
+}
+
+TEST(MPSCQueueTest, MovesValues) {
+  MPSCQueue<std::unique_ptr<int>> queue;
+  queue.Push(std::make_unique<int>(1));
+  queue.Push(std::make_unique<int>(2));
+  std::unique_ptr<int> value;
+  ASSERT_TRUE(queue.TryPop(&value));
+  EXPECT_EQ(1, *value);
+  ASSERT_TRUE(queue.TryPop(&value));
+  EXPECT_EQ(2, *value);
+  EXPECT_FALSE(queue.TryPop(&value));
+}
+
+TEST(MPSCQueueTest, DestructorDrains) {
+  std::shared_ptr<int> shared = std::make_shared<int>(0);
+  {
+    MPSCQueue<std::shared_ptr<int>> queue;
+    for(int i = 0; i < 10; i++)
+      queue.Push(shared);
+    std::shared_ptr<int> value;
+    ASSERT_TRUE(queue.TryPop(&value));
+    EXPECT_EQ(11, shared.use_count());
+  }
+  EXPECT_EQ(1, shared.use_count());
+}
+
+TEST(MPSCQueueTest, ManyProducers) {
+  MPSCQueue<int> queue;
+  std::vector<std::unique_ptr<QueueProducer>> producers;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for(int i = 0; i < kProducers; i++) {
+    producers.push_back(std::make_unique<QueueProducer>(&queue, i));
+    threads.push_back(std::make_unique<base::DelegateSimpleThread>(producers.back().get(), "QueueProducer"));
+    threads.back()->Start();
+  }
+
+  // Each producer's items arrive in the order it pushed them.
+  std::vector<int> next(kProducers, 0);
+  for(int received = 0; received < kProducers * kItemsPerProducer;) {
+    int value;
+    if(!queue.TryPop(&value)) {
+      base::PlatformThread::YieldCurrentThread();
+      continue;
+    }
+    int producer = value >> 24;
+    ASSERT_GE(producer, 0);
+    ASSERT_LT(producer, kProducers);
+    ASSERT_EQ(next[producer], value & 0xffffff);
+    next[producer]++;
+    received++;
+  }
+  for(auto& thread : threads)
+    thread->Join();
+  int value;
+  EXPECT_FALSE(queue.TryPop(&value));
+}
+
+}  // namespace
+
+}  // namespace andjs
@@ -0,0 +1,116 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_MPSC_RING_BUFFER_H__
+#define __ANDJS_MPSC_RING_BUFFER_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include "base/logging.h"
+#include "base/macros.h"
+
+namespace andjs {
+
+// Bounded lock-free queue for many producers and a single consumer (Dmitry
+// Vyukov's sequence-numbered ring). TryPush never blocks, it fails when the
+// ring is full and leaves the overflow policy to the caller.
+template <typename T>
+class MPSCRingBuffer {
+  public:
+    // |capacity| is rounded up to a power of two.
+    explicit MPSCRingBuffer(size_t capacity)
+        : mask_(RoundUpToPowerOfTwo(capacity) - 1),
+          cells_(new Cell[mask_ + 1]),
+          enqueue_pos_(0),
+          dequeue_pos_(0) {
+      for(size_t i = 0; i <= mask_; i++)
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Any thread.
+    bool TryPush(T&& value) {
+      Cell* cell;
+      size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+      for(;;) {
+        cell = &cells_[pos & mask_];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if(diff == 0) {
+          if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        } else if(diff < 0) {
+          return false;
+        } else {
+          pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+      }
+      cell->value = std::move(value);
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer thread only.
+    bool TryPop(T* value) {
+      size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+      Cell* cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0)
+        return false;
+      *value = std::move(cell->value);
+      cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+      dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    // Approximate, for statistics and backpressure decisions.
+    size_t ApproximateSize() const {
+      size_t head = enqueue_pos_.load(std::memory_order_relaxed);
+      size_t tail = dequeue_pos_.load(std::memory_order_relaxed);
+      return head > tail ? head - tail : 0;
+    }
+
+  private:
+    struct Cell {
+      std::atomic<size_t> sequence;
+      T value;
+    };
+
+    static size_t RoundUpToPowerOfTwo(size_t value) {
+      size_t result = 2;
+      while(result < value)
+        result <<= 1;
+      return result;
+    }
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> enqueue_pos_;
+    alignas(64) std::atomic<size_t> dequeue_pos_;
+
+    DISALLOW_COPY_AND_ASSIGN(MPSCRingBuffer);
+};
+
+}
+#endif
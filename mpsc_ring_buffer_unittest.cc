@@ -0,0 +1,140 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "andjs/mpsc_ring_buffer.h"
+
+#include <memory>
+#include <vector>
+
+#include "base/threading/platform_thread.h"
+#include "base/threading/simple_thread.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace andjs {
+
+namespace {
+
+const int kProducers = 4;
+const int kItemsPerProducer = 20000;
+
+// Pushes (producer << 24 | sequence) for every sequence in order, waiting
+// for room when the ring is full.
+class RingProducer : public base::DelegateSimpleThread::Delegate {
+  public:
+    RingProducer(MPSCRingBuffer<int>* ring, int producer) : ring_(ring), producer_(producer) {}
+
+    void Run() override {
+      for(int i = 0; i < kItemsPerProducer; i++) {
+        while(!ring_->TryPush(producer_ << 24 | i))
+          base::PlatformThread::YieldCurrentThread();
+      }
+    }
+
+  private:
+    MPSCRingBuffer<int>* ring_;
+    int producer_;
+};
+
+TEST(MPSCRingBufferTest, CapacityIsAPowerOfTwo) {
+  EXPECT_EQ(2u, MPSCRingBuffer<int>(1).capacity());
+  EXPECT_EQ(4u, MPSCRingBuffer<int>(3).capacity());
+  EXPECT_EQ(4u, MPSCRingBuffer<int>(4).capacity());
+  EXPECT_EQ(1024u, MPSCRingBuffer<int>(1000).capacity());
+}
+
+TEST(MPSCRingBufferTest, PushFailsWhenFull) {
+  MPSCRingBuffer<int> ring(4);
+  int value;
+  EXPECT_FALSE(ring.TryPop(&value));
+  for(int i = 0; i < 4; i++)
+    EXPECT_TRUE(ring.TryPush(int(i)));
+  EXPECT_FALSE(ring.TryPush(4));
+  EXPECT_EQ(4u, ring.ApproximateSize());
+
+  ASSERT_TRUE(ring.TryPop(&value));
+  EXPECT_EQ(0, value);
+  EXPECT_TRUE(ring.TryPush(4));
+  for(int i = 1; i <= 4; i++) {
+    ASSERT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_FALSE(ring.TryPop(&value));
+  EXPECT_EQ(0u, ring.ApproximateSize());
+}
+
+TEST(MPSCRingBufferTest, WrapsAroundInOrder) {
+  MPSCRingBuffer<int> ring(8);
+  int next_push = 0;
+  int next_pop = 0;
+  // Uneven batches move the ends across every cell many times.
+  for(int round = 0; round < 1000; round++) {
+    for(int i = 0; i < round % 7 + 1; i++)
+      ASSERT_TRUE(ring.TryPush(int(next_push++)));
+    int value;
+    while(ring.TryPop(&value))
+      ASSERT_EQ(next_pop++, value);
+  }
+  EXPECT_EQ(next_push, next_pop);
+}
+
+TEST(MPSCRingBufferTest, MovesValues) {
+  MPSCRingBuffer<std::unique_ptr<int>> ring(2);
+  EXPECT_TRUE(ring.TryPush(std::make_unique<int>(7)));
+  std::unique_ptr<int> value;
+  ASSERT_TRUE(ring.TryPop(&value));
+  ASSERT_TRUE(value);
+  EXPECT_EQ(7, *value);
+}
+
+TEST(MPSCRingBufferTest, ManyProducers) {
+  MPSCRingBuffer<int> ring(64);
+  std::vector<std::unique_ptr<RingProducer>> producers;
+  std::vector<std::unique_ptr<base::DelegateSimpleThread>> threads;
+  for(int i = 0; i < kProducers; i++) {
+    producers.push_back(std::make_unique<RingProducer>(&ring, i));
+    threads.push_back(std::make_unique<base::DelegateSimpleThread>(producers.back().get(), "RingProducer"));
+    threads.back()->Start();
+  }
+
+  // Each producer's items arrive in the order it pushed them.
+  std::vector<int> next(kProducers, 0);
+  for(int received = 0; received < kProducers * kItemsPerProducer;) {
+    int value;
+    if(!ring.TryPop(&value)) {
+      base::PlatformThread::YieldCurrentThread();
+      continue;
+    }
+    int producer = value >> 24;
+    ASSERT_GE(producer, 0);
+    ASSERT_LT(producer, kProducers);
+    ASSERT_EQ(next[producer], value & 0xffffff);
+    next[producer]++;
+    received++;
+  }
+  for(auto& thread : threads)
+    thread->Join();
+  int value;
+  EXPECT_FALSE(ring.TryPop(&value));
+}
+
+}  // namespace
+
+}  // namespace andjs
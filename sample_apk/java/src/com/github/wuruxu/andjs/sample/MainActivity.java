@@ -1,13 +1,18 @@
 package com.github.wuruxu.andjs.sample;
 
 import android.support.v7.app.AppCompatActivity;
+import android.content.SharedPreferences;
 import android.os.Bundle;
 import android.util.Log;
 import android.view.View;
 
 import java.io.File;
+import java.nio.ByteBuffer;
 import com.github.wuruxu.andjs.AndJS;
 import com.github.wuruxu.andjs.CalledByJavascript;
+import com.github.wuruxu.andjs.StructuredCodec;
+import org.json.JSONException;
+import org.json.JSONTokener;
 import com.google.firebase.FirebaseOptions;
 import com.google.firebase.FirebaseApp;
 import com.google.firebase.analytics.FirebaseAnalytics;
@@ -66,8 +71,41 @@ public class MainActivity extends AppCompatActivity {
 		mJSInstance = new AndJS(this);
 		mJSInstance.injectObject(obj, "myobject");
 		mJSInstance.injectObject(this, "myactivity");
+		/* data/local/tmp/structured-bench.js, postToJava() values come back
+		 * as a structured event */
+		mJSInstance.setStructuredReceiver(new AndJS.StructuredReceiver() {
+			@Override
+			public void onMessage(String channel, ByteBuffer data) {
+				Object value = StructuredCodec.decode(data);
+				if(channel.equals("bench-echo"))
+					mJSInstance.dispatchStructuredEvent(channel, value);
+			}
+		});
     }
 
+	/* the JSON twin of the structured receiver, through the base::Value converter */
+	@CalledByJavascript
+	public void echoJSON(String json) {
+		try {
+			mJSInstance.dispatchEvent("bench-echo", new JSONTokener(json).nextValue());
+		} catch(JSONException e) {
+			Log.e(TAG, "echoJSON", e);
+		}
+	}
+
+	/* data/local/tmp/kv-bench.js, the bridge way of keeping script state */
+	@CalledByJavascript
+	public String getPref(String key) {
+		return getSharedPreferences("kv-bench", MODE_PRIVATE).getString(key, null);
+	}
+
+	@CalledByJavascript
+	public void putPref(String key, String value) {
+		SharedPreferences.Editor editor = getSharedPreferences("kv-bench", MODE_PRIVATE).edit();
+		editor.putString(key, value);
+		editor.apply();
+	}
+
 	@Override
 	public void onDestroy() {
 		super.onDestroy();
@@ -6,6 +6,7 @@ import com.github.wuruxu.andjs.CalledByJavascript;
 public class MyObject extends Object {
 	private static final String TAG = "MyObject";
 	private MyHome home;
+	private long ticks;
 
 	public MyObject() {
 		home = new MyHome();
@@ -21,6 +22,28 @@ public class MyObject extends Object {
 		return "This is a java string";
 	}
 
+	/* data/local/tmp/string-bench.js */
+	@CalledByJavascript
+	public String echo(String text) {
+		return text;
+	}
+
+	/* data/local/tmp/batch-bench.js, the same void call batched and direct */
+	@CalledByJavascript(batched = true)
+	public void tick(int value) {
+		ticks += value;
+	}
+
+	@CalledByJavascript
+	public void tickDirect(int value) {
+		ticks += value;
+	}
+
+	@CalledByJavascript
+	public long getTicks() {
+		return ticks;
+	}
+
 	@CalledByJavascript
 	public MyHome getMyHome() {
 		return home;
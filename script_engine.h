@@ -0,0 +1,169 @@
+/* Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef __ANDJS_SCRIPT_ENGINE_H__
+#define __ANDJS_SCRIPT_ENGINE_H__
+#include <map>
+#include <memory>
+#include <string>
+
+#include "base/android/jni_android.h"
+#include "base/android/scoped_java_ref.h"
+#include "base/callback.h"
+#include "base/files/file_path.h"
+#include "base/memory/ref_counted.h"
+#include "base/time/time.h"
+
+#include "andjs/andjs_string.h"
+
+namespace andjs {
+
+class CpuProfile;
+class ModuleBundle;
+struct ScriptEvent;
+struct WorkerMessage;
+
+// Common interface of the javascript backends. An AndJSCore owns exactly one
+// ScriptEngine, picked at runtime. Everything but Terminate(), Init()
+// included, runs on the instance's JSTask thread.
+class ScriptEngine {
+  public:
+    // Keep in sync with AndJS.Engine on the java side.
+    enum Type {
+      kAuto = 0,
+      kV8 = 1,
+      kQuickJS = 2,
+    };
+
+    enum RunStatus {
+      kOk,
+      kException,
+      kTerminated,
+    };
+
+    // The global scope created by Init(). More are added by CreateContext().
+    static const int kMainContextId = 0;
+
+    virtual ~ScriptEngine() {}
+
+    virtual Type GetType() const = 0;
+
+    virtual void Init() = 0;
+
+    // Adds a global scope with its own globals and injected objects. It shares
+    // the heap and the thread of the engine, a v8::Context on the same
+    // isolate or a JSContext on the same JSRuntime. False when the engine is
+    // out of memory, runs in |context_id| then fail like in a disposed one.
+    virtual bool CreateContext(int context_id) = 0;
+    virtual void DisposeContext(int context_id) = 0;
+
+    // Replaces the global scope of |context_id| with a clean one holding the
+    // same injected objects, without reflecting their java classes again.
+    // Workers started from the old scope are terminated.
+    virtual void ResetContext(int context_id) = 0;
+
+    virtual bool InjectObject(int context_id,
+                              const std::string& name,
+                              const base::android::JavaRef<jobject>& object,
+                              const base::android::JavaRef<jclass>& annotation_clazz) = 0;
+
+    // A run that uses more than |cpu_budget| of JSTask thread CPU time is
+    // terminated and the engine is left ready for the next one. A zero budget
+    // means unlimited.
+    virtual RunStatus Run(int context_id,
+                          const ScriptString& source,
+                          const std::string& resource_name,
+                          base::TimeDelta cpu_budget) = 0;
+
+    // The CPU time budget of the script code that runs outside Run(): the
+    // listeners of one DispatchEvent() and each NativeAsync settlement.
+    // Terminated ones count as terminated runs. Zero means unlimited.
+    virtual void SetCallbackBudget(base::TimeDelta cpu_budget) = 0;
+
+    // Imports of later runs resolve against |bundle| first. QuickJS falls
+    // back to its file system loader for names the bundle doesn't have.
+    virtual void SetModuleBundle(scoped_refptr<ModuleBundle> bundle) = 0;
+
+    // Evaluates the bundle module |name| and everything it imports.
+    virtual RunStatus RunModule(int context_id,
+                                const std::string& name,
+                                base::TimeDelta cpu_budget) = 0;
+
+    // Large script files. Parses and compiles |path| on a background thread
+    // and posts |done| back once that is over, FinishStreaming() then
+    // finalizes the script on JSTask and runs it like Run(). Returns false
+    // when the engine can't, the file goes through Run() then. One script
+    // streams at a time.
+    virtual bool StartStreaming(int context_id,
+                                const base::FilePath& path,
+                                const std::string& resource_name,
+                                base::OnceClosure done) = 0;
+    // Waits for the background part when |done| didn't come yet.
+    virtual RunStatus FinishStreaming(base::TimeDelta cpu_budget) = 0;
+
+    // Any thread. Interrupts the running script for good, the engine is about
+    // to be shut down. Used to stop workers.
+    virtual void Terminate() = 0;
+
+    // A postMessage() of the worker |worker_id| this engine started, goes to
+    // the onmessage handler of its Worker object.
+    virtual void DispatchWorkerMessage(int worker_id, std::unique_ptr<WorkerMessage> message) = 0;
+
+    // Worker engines only: a postMessage() of the parent, goes to the global
+    // onmessage handler.
+    virtual void DispatchMessage(std::unique_ptr<WorkerMessage> message) = 0;
+
+    // An AndJS.dispatchEvent(), to the addEventListener() listeners of its
+    // type in the main context.
+    virtual void DispatchEvent(const ScriptEvent& event) = 0;
+
+    // Samples the javascript stack every |interval| until StopProfiling().
+    virtual bool StartProfiling(const std::string& title, base::TimeDelta interval) = 0;
+    virtual std::unique_ptr<CpuProfile> StopProfiling() = 0;
+
+    // Hibernation. Stores the globals scripts added to each context, by
+    // context id, as a base::Pickle of name and structured clone pairs.
+    // Values that cannot be cloned, functions first of all, are left out
+    // and so are injected objects.
+    virtual void SaveGlobals(std::map<int, std::string>* globals) = 0;
+    // Creates the contexts that are missing and sets the saved globals on
+    // them, before the injected objects are bound again.
+    virtual void RestoreGlobals(const std::map<int, std::string>& globals) = 0;
+    // Bytes the engine heap holds right now.
+    virtual size_t GetHeapSize() = 0;
+
+    // Garbage collection while JSTask has nothing queued. Does a slice of
+    // work that should end within |budget| and returns true once there is
+    // nothing left worth collecting.
+    virtual bool CollectIdleGarbage(base::TimeDelta budget) = 0;
+    // The device is low on memory. A critical one collects everything it
+    // can, whatever the pause.
+    virtual void OnMemoryPressure(bool critical) = 0;
+
+    // Replays the @CalledByJavascript(batched = true) calls made so far in
+    // one upcall, see BatchedCalls. Called at the end of every task.
+    virtual void FlushBatchedCalls() = 0;
+
+    virtual void Shutdown() = 0;
+};
+
+}
+#endif
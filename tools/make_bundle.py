@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+"""Packs the .js/.mjs files under a directory into an andjs module bundle.
+
+Module names are paths relative to the directory, e.g. "lib/util.js". A
+file next to a module named <module>.qbc is stored as its QuickJS bytecode
+(raw JS_WriteObject output of the same QuickJS version).
+
+Layout, see andjs_module_bundle.h:
+  header   magic "AJSB", version, module_count, reserved (4 x uint32)
+  entries  name_hash uint64, name/source/bytecode offset+length (6 x uint32)
+  data     names, sources and bytecode
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = 0x42534a41
+VERSION = 1
+HEADER = struct.Struct('<IIII')
+ENTRY = struct.Struct('<QIIIIII')
+
+
+def hash_name(name):
+  h = 14695981039346656037
+  for c in bytearray(name):
+    h ^= c
+    h = (h * 1099511628211) & 0xffffffffffffffff
+  return h
+
+
+def collect(root):
+  modules = []
+  for dirpath, _, filenames in os.walk(root):
+    for filename in sorted(filenames):
+      if not filename.endswith(('.js', '.mjs')):
+        continue
+      path = os.path.join(dirpath, filename)
+      name = os.path.relpath(path, root).replace(os.sep, '/')
+      with open(path, 'rb') as f:
+        source = f.read()
+      bytecode = b''
+      if os.path.exists(path + '.qbc'):
+        with open(path + '.qbc', 'rb') as f:
+          bytecode = f.read()
+      modules.append((name.encode('utf-8'), source, bytecode))
+  return modules
+
+
+def write_bundle(modules, output):
+  modules.sort(key=lambda m: hash_name(m[0]))
+  offset = HEADER.size + ENTRY.size * len(modules)
+  entries = []
+  blobs = []
+  for name, source, bytecode in modules:
+    fields = [hash_name(name)]
+    for blob in (name, source, bytecode):
+      fields += [offset, len(blob)]
+      blobs.append(blob)
+      offset += len(blob)
+    entries.append(ENTRY.pack(*fields))
+
+  with open(output, 'wb') as f:
+    f.write(HEADER.pack(MAGIC, VERSION, len(modules), 0))
+    for entry in entries:
+      f.write(entry)
+    for blob in blobs:
+      f.write(blob)
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument('root', help='directory holding the modules')
+  parser.add_argument('output', help='bundle file to write')
+  args = parser.parse_args()
+
+  modules = collect(args.root)
+  if not modules:
+    sys.stderr.write('no modules under %s\n' % args.root)
+    return 1
+  write_bundle(modules, args.output)
+  print('%s: %d modules' % (args.output, len(modules)))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+# Copyright (c) 2019 wuruxu <wrxzzj@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+"""Writes a synthetic script of a given size for the streaming compile bench.
+
+The script is mostly functions that are parsed but only partly called, like
+a large app bundle. Push it with adb and load it with loadJSFile() twice,
+with AndJS.Options.streamingMinScriptSize = 0 and with the default, then
+compare compileTimeUs, streamTimeUs and streamWaitUs in getStats():
+compileTimeUs is what JSTask spent compiling.
+"""
+
+import argparse
+import sys
+
+FUNCTION = '''function f%(i)d(a, b) {
+  var s = "%(i)d:" + a;
+  for(var j = 0; j < b; j++) {
+    s += String.fromCharCode(97 + (j + %(i)d) %% 26);
+  }
+  return { id: %(i)d, text: s, next: function() { return f%(i)d(a + 1, b); } };
+}
+'''
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument('size_mb', type=float, help='script size in MB, e.g. 1 or 10')
+  parser.add_argument('output', help='script file to write')
+  args = parser.parse_args()
+
+  target = int(args.size_mb * 1024 * 1024)
+  parts = ['var streamBenchStart = Date.now();\n']
+  size = len(parts[0])
+  count = 0
+  while size < target:
+    part = FUNCTION % {'i': count}
+    parts.append(part)
+    size += len(part)
+    count += 1
+  parts.append('var streamBenchSum = 0;\n'
+               'for(var i = 0; i < %d; i += 97) streamBenchSum += this["f" + i](i, 4).text.length;\n'
+               'adb.info("stream-bench %d functions, run ms: ", Date.now() - streamBenchStart, " sum ", streamBenchSum);\n'
+               % (count, count))
+  with open(args.output, 'w') as f:
+    f.write(''.join(parts))
+  print('%s: %d bytes, %d functions' % (args.output, size, count))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())